@@ -10,10 +10,12 @@ LOCAL_SRC_FILES:= \
 	debuggerd.c \
 	getevent.c \
 	tombstone.c \
+	tombstone_store.c \
 	utility.c \
 	$(TARGET_ARCH)/machine.c
 
 LOCAL_CFLAGS := -Wall -Wno-unused-parameter -std=gnu99
+LOCAL_C_INCLUDES := external/zlib
 LOCAL_MODULE := debuggerd
 
 ifeq ($(ARCH_ARM_HAVE_VFP),true)
@@ -28,7 +30,8 @@ LOCAL_SHARED_LIBRARIES := \
 	liblog \
 	libc \
 	libcorkscrew \
-	libselinux
+	libselinux \
+	libz
 
 include $(BUILD_EXECUTABLE)
 
@@ -42,7 +42,7 @@
 #endif
 #endif
 
-static void dump_memory(log_t* log, pid_t tid, uintptr_t addr, int scopeFlags) {
+static void dump_memory(log_t* log, const memory_t* memory, uintptr_t addr, int scopeFlags) {
     char code_buffer[64];       /* actual 8+1+((8+1)*4) + 1 == 45 */
     char ascii_buffer[32];      /* actual 16 + 1 == 17 */
     uintptr_t p, end;
@@ -72,15 +72,15 @@ static void dump_memory(log_t* log, pid_t tid, uintptr_t addr, int scopeFlags) {
         int i;
         for (i = 0; i < 4; i++) {
             /*
-             * If we see (data == -1 && errno != 0), we know that the ptrace
-             * call failed, probably because we're dumping memory in an
-             * unmapped or inaccessible page.  I don't know if there's
-             * value in making that explicit in the output -- it likely
-             * just complicates parsing and clarifies nothing for the
+             * If the read fails, data is -1, probably because we're dumping
+             * memory in an unmapped or inaccessible page.  I don't know if
+             * there's value in making that explicit in the output -- it
+             * likely just complicates parsing and clarifies nothing for the
              * enlightened reader.
              */
-            long data = ptrace(PTRACE_PEEKTEXT, tid, (void*)p, NULL);
-            sprintf(code_buffer + strlen(code_buffer), "%08lx ", data);
+            uint32_t data;
+            try_get_word(memory, p, &data);
+            sprintf(code_buffer + strlen(code_buffer), "%08x ", data);
 
             /* Enable the following code blob to dump ASCII values */
 #if 0
@@ -110,7 +110,7 @@ static void dump_memory(log_t* log, pid_t tid, uintptr_t addr, int scopeFlags) {
  * If configured to do so, dump memory around *all* registers
  * for the crashing thread.
  */
-void dump_memory_and_code(const ptrace_context_t* context __attribute((unused)),
+void dump_memory_and_code(const ptrace_context_t* context,
         log_t* log, pid_t tid, bool at_fault) {
     struct pt_regs regs;
     if(ptrace(PTRACE_GETREGS, tid, 0, &regs)) {
@@ -118,6 +118,8 @@ void dump_memory_and_code(const ptrace_context_t* context __attribute((unused)),
     }
 
     int scopeFlags = at_fault ? SCOPE_AT_FAULT : 0;
+    memory_t memory;
+    init_memory_ptrace_context(&memory, tid, context);
 
     if (at_fault && DUMP_MEMORY_FOR_ALL_REGISTERS) {
         static const char REG_NAMES[] = "r0r1r2r3r4r5r6r7r8r9slfpipsp";
@@ -135,17 +137,17 @@ void dump_memory_and_code(const ptrace_context_t* context __attribute((unused)),
             }
 
             _LOG(log, scopeFlags | SCOPE_SENSITIVE, "\nmemory near %.2s:\n", &REG_NAMES[reg * 2]);
-            dump_memory(log, tid, addr, scopeFlags | SCOPE_SENSITIVE);
+            dump_memory(log, &memory, addr, scopeFlags | SCOPE_SENSITIVE);
         }
     }
 
     /* explicitly allow upload of code dump logging */
     _LOG(log, scopeFlags, "\ncode around pc:\n");
-    dump_memory(log, tid, (uintptr_t)regs.ARM_pc, scopeFlags);
+    dump_memory(log, &memory, (uintptr_t)regs.ARM_pc, scopeFlags);
 
     if (regs.ARM_pc != regs.ARM_lr) {
         _LOG(log, scopeFlags, "\ncode around lr:\n");
-        dump_memory(log, tid, (uintptr_t)regs.ARM_lr, scopeFlags);
+        dump_memory(log, &memory, (uintptr_t)regs.ARM_lr, scopeFlags);
     }
 }
 
@@ -91,6 +91,11 @@ static void dump_thread(log_t* log, pid_t tid, ptrace_context_t* context, bool a
 
     wait_for_stop(tid, total_sleep_time_usec);
 
+    /* Until it stopped, the thread may have written to memory we have cached */
+    if (!attached && context->memory_cache) {
+        flush_memory_cache(context->memory_cache);
+    }
+
     backtrace_frame_t backtrace[STACK_DEPTH];
     ssize_t frames = unwind_backtrace_ptrace(tid, context, backtrace, 0, STACK_DEPTH);
     if (frames <= 0) {
@@ -117,6 +122,8 @@ void dump_backtrace(int fd, int amfd, pid_t pid, pid_t tid, bool* detach_failed,
         int* total_sleep_time_usec) {
     log_t log;
     log.tfd = fd;
+    log.tgz = NULL;
+    log.buffer = NULL;
     log.amfd = amfd;
     log.quiet = true;
 
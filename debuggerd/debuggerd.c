@@ -39,6 +39,7 @@
 #include <cutils/debugger.h>
 
 #include <corkscrew/backtrace.h>
+#include <corkscrew/symbol_table.h>
 
 #include <linux/input.h>
 
@@ -49,6 +50,9 @@
 #include "tombstone.h"
 #include "utility.h"
 
+/* Where the sorted symbol tables are kept, with persist.debuggerd.symindex=1 */
+#define SYMBOL_INDEX_DIR "/data/misc/debuggerd"
+
 typedef struct {
     debugger_action_t action;
     pid_t pid, tid;
@@ -464,6 +468,20 @@ static int do_server() {
 
     LOG("debuggerd: " __DATE__ " " __TIME__ "\n");
 
+    /*
+     * The symbol tables are cached for the lifetime of the daemon anyway,
+     * the index also saves parsing the libraries again after a restart.
+     */
+    char value[PROPERTY_VALUE_MAX];
+    property_get("persist.debuggerd.symindex", value, "0");
+    if (value[0] == '1') {
+        if (mkdir(SYMBOL_INDEX_DIR, 0700) == 0 || errno == EEXIST) {
+            set_symbol_table_index_dir(SYMBOL_INDEX_DIR);
+        } else {
+            LOG("cannot create %s: %s\n", SYMBOL_INDEX_DIR, strerror(errno));
+        }
+    }
+
     for(;;) {
         struct sockaddr addr;
         socklen_t alen;
@@ -36,7 +36,7 @@
 
 #define R(x) ((unsigned int)(x))
 
-static void dump_memory(log_t* log, pid_t tid, uintptr_t addr, int scopeFlags) {
+static void dump_memory(log_t* log, const memory_t* memory, uintptr_t addr, int scopeFlags) {
     char code_buffer[64];       /* actual 8+1+((8+1)*4) + 1 == 45 */
     char ascii_buffer[32];      /* actual 16 + 1 == 17 */
     uintptr_t p, end;
@@ -65,15 +65,15 @@ static void dump_memory(log_t* log, pid_t tid, uintptr_t addr, int scopeFlags) {
         int i;
         for (i = 0; i < 4; i++) {
             /*
-             * If we see (data == -1 && errno != 0), we know that the ptrace
-             * call failed, probably because we're dumping memory in an
-             * unmapped or inaccessible page.  I don't know if there's
-             * value in making that explicit in the output -- it likely
-             * just complicates parsing and clarifies nothing for the
+             * If the read fails, data is -1, probably because we're dumping
+             * memory in an unmapped or inaccessible page.  I don't know if
+             * there's value in making that explicit in the output -- it
+             * likely just complicates parsing and clarifies nothing for the
              * enlightened reader.
              */
-            long data = ptrace(PTRACE_PEEKTEXT, tid, (void*)p, NULL);
-            sprintf(code_buffer + strlen(code_buffer), "%08lx ", data);
+            uint32_t data;
+            try_get_word(memory, p, &data);
+            sprintf(code_buffer + strlen(code_buffer), "%08x ", data);
 
             int j;
             for (j = 0; j < 4; j++) {
@@ -100,7 +100,7 @@ static void dump_memory(log_t* log, pid_t tid, uintptr_t addr, int scopeFlags) {
  * If configured to do so, dump memory around *all* registers
  * for the crashing thread.
  */
-void dump_memory_and_code(const ptrace_context_t* context __attribute((unused)),
+void dump_memory_and_code(const ptrace_context_t* context,
         log_t* log, pid_t tid, bool at_fault) {
     pt_regs_mips_t r;
     if(ptrace(PTRACE_GETREGS, tid, 0, &r)) {
@@ -108,6 +108,9 @@ void dump_memory_and_code(const ptrace_context_t* context __attribute((unused)),
     }
 
     int scopeFlags = at_fault ? SCOPE_AT_FAULT : 0;
+    memory_t memory;
+    init_memory_ptrace_context(&memory, tid, context);
+
     if (at_fault && DUMP_MEMORY_FOR_ALL_REGISTERS) {
         static const char REG_NAMES[] = "$0atv0v1a0a1a2a3t0t1t2t3t4t5t6t7s0s1s2s3s4s5s6s7t8t9k0k1gpsps8ra";
 
@@ -131,7 +134,7 @@ void dump_memory_and_code(const ptrace_context_t* context __attribute((unused)),
             }
 
             _LOG(log, scopeFlags | SCOPE_SENSITIVE, "\nmemory near %.2s:\n", &REG_NAMES[reg * 2]);
-            dump_memory(log, tid, addr, scopeFlags | SCOPE_SENSITIVE);
+            dump_memory(log, &memory, addr, scopeFlags | SCOPE_SENSITIVE);
         }
     }
 
@@ -139,11 +142,11 @@ void dump_memory_and_code(const ptrace_context_t* context __attribute((unused)),
     unsigned int ra = R(r.regs[31]);
 
     _LOG(log, scopeFlags, "\ncode around pc:\n");
-    dump_memory(log, tid, (uintptr_t)pc, scopeFlags);
+    dump_memory(log, &memory, (uintptr_t)pc, scopeFlags);
 
     if (pc != ra) {
         _LOG(log, scopeFlags, "\ncode around ra:\n");
-        dump_memory(log, tid, (uintptr_t)ra, scopeFlags);
+        dump_memory(log, &memory, (uintptr_t)ra, scopeFlags);
     }
 }
 
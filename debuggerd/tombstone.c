@@ -23,7 +23,9 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <dirent.h>
+#include <pthread.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/ptrace.h>
 #include <sys/stat.h>
 
@@ -42,6 +44,7 @@
 
 #include "machine.h"
 #include "tombstone.h"
+#include "tombstone_store.h"
 #include "utility.h"
 
 #define STACK_DEPTH 32
@@ -50,6 +53,9 @@
 #define MAX_TOMBSTONES  10
 #define TOMBSTONE_DIR   "/data/tombstones"
 
+/* Most threads dumping the sibling threads, see persist.debuggerd.dump_threads */
+#define MAX_DUMP_WORKERS 4
+
 /* Must match the path defined in NativeCrashListener.java */
 #define NCRASH_SOCKET_PATH "/data/system/ndebugsocket"
 
@@ -249,9 +255,11 @@ static void dump_backtrace(const ptrace_context_t* context __attribute((unused))
 
 static void dump_stack_segment(const ptrace_context_t* context, log_t* log, pid_t tid,
         int scopeFlags, uintptr_t* sp, size_t words, int label) {
+    memory_t memory;
+    init_memory_ptrace_context(&memory, tid, context);
     for (size_t i = 0; i < words; i++) {
         uint32_t stack_content;
-        if (!try_get_word_ptrace(tid, *sp, &stack_content)) {
+        if (!try_get_word(&memory, *sp, &stack_content)) {
             break;
         }
 
@@ -422,8 +430,13 @@ static void dump_nearby_maps(const ptrace_context_t* context, log_t* log, pid_t
 }
 
 static void dump_thread(const ptrace_context_t* context, log_t* log, pid_t tid, bool at_fault,
-        int* total_sleep_time_usec) {
-    wait_for_stop(tid, total_sleep_time_usec);
+        int* total_sleep_time_usec, pthread_mutex_t* sleep_lock) {
+    wait_for_stop_locked(tid, total_sleep_time_usec, sleep_lock);
+
+    /* Until it stopped, the thread may have written to memory we have cached */
+    if (!at_fault && context->memory_cache) {
+        flush_memory_cache(context->memory_cache);
+    }
 
     dump_registers(context, log, tid, at_fault);
     dump_backtrace_and_stack(context, log, tid, at_fault);
@@ -433,6 +446,26 @@ static void dump_thread(const ptrace_context_t* context, log_t* log, pid_t tid,
     }
 }
 
+/* Return true if the thread is not detached cleanly */
+static bool dump_sibling_thread(const ptrace_context_t* context,
+        log_t* log, pid_t pid, pid_t new_tid, int* total_sleep_time_usec,
+        pthread_mutex_t* sleep_lock) {
+    /* Skip this thread if cannot ptrace it */
+    if (ptrace(PTRACE_ATTACH, new_tid, 0, 0) < 0) {
+        return false;
+    }
+
+    _LOG(log, 0, "--- --- --- --- --- --- --- --- --- --- --- --- --- --- --- ---\n");
+    dump_thread_info(log, pid, new_tid, false);
+    dump_thread(context, log, new_tid, false, total_sleep_time_usec, sleep_lock);
+
+    if (ptrace(PTRACE_DETACH, new_tid, 0, 0) != 0) {
+        LOG("ptrace detach from %d failed: %s\n", new_tid, strerror(errno));
+        return true;
+    }
+    return false;
+}
+
 /* Return true if some thread is not detached cleanly */
 static bool dump_sibling_thread_report(const ptrace_context_t* context,
         log_t* log, pid_t pid, pid_t tid, int* total_sleep_time_usec) {
@@ -461,17 +494,7 @@ static bool dump_sibling_thread_report(const ptrace_context_t* context,
             continue;
         }
 
-        /* Skip this thread if cannot ptrace it */
-        if (ptrace(PTRACE_ATTACH, new_tid, 0, 0) < 0) {
-            continue;
-        }
-
-        _LOG(log, 0, "--- --- --- --- --- --- --- --- --- --- --- --- --- --- --- ---\n");
-        dump_thread_info(log, pid, new_tid, false);
-        dump_thread(context, log, new_tid, false, total_sleep_time_usec);
-
-        if (ptrace(PTRACE_DETACH, new_tid, 0, 0) != 0) {
-            LOG("ptrace detach from %d failed: %s\n", new_tid, strerror(errno));
+        if (dump_sibling_thread(context, log, pid, new_tid, total_sleep_time_usec, NULL)) {
             detach_failed = true;
         }
     }
@@ -624,11 +647,169 @@ static void dump_logs(log_t* log, pid_t pid, bool tailOnly)
     dump_log_file(log, pid, "/dev/log/main", tailOnly);
 }
 
-static void dump_abort_message(log_t* log, pid_t tid, uintptr_t address) {
+/*
+ * State shared by the workers of dump_sibling_thread_report_parallel().
+ * The workers take the threads in turn, and each thread is dumped to its
+ * own buffer.
+ */
+typedef struct {
+    const ptrace_context_t* context;
+    pid_t pid;
+    pid_t* tids;
+    log_buffer_t* buffers;
+    size_t count;
+    pthread_mutex_t mutex;
+    size_t next;
+    bool detach_failed;
+    int total_sleep_time_usec;  /* shared wait_for_stop budget, under mutex */
+} sibling_report_t;
+
+static void* sibling_report_worker(void* arg) {
+    sibling_report_t* report = (sibling_report_t*)arg;
+    bool detach_failed = false;
+    for (;;) {
+        pthread_mutex_lock(&report->mutex);
+        size_t i = report->next++;
+        pthread_mutex_unlock(&report->mutex);
+        if (i >= report->count) {
+            break;
+        }
+
+        /* The thread that attaches is the tracer, so it does everything */
+        log_t log;
+        log.tfd = -1;
+        log.tgz = NULL;
+        log.buffer = &report->buffers[i];
+        log.amfd = -1;
+        log.quiet = true;
+        if (dump_sibling_thread(report->context, &log, report->pid, report->tids[i],
+                &report->total_sleep_time_usec, &report->mutex)) {
+            detach_failed = true;
+        }
+    }
+
+    pthread_mutex_lock(&report->mutex);
+    report->detach_failed |= detach_failed;
+    pthread_mutex_unlock(&report->mutex);
+    return NULL;
+}
+
+static int compare_tids(const void* a, const void* b) {
+    pid_t ta = *(const pid_t*)a;
+    pid_t tb = *(const pid_t*)b;
+    return (ta > tb) - (ta < tb);
+}
+
+/*
+ * Returns the number of threads to dump the sibling threads with, 1 dumps
+ * them one after the other.
+ */
+static int get_dump_worker_count() {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("persist.debuggerd.dump_threads", value, "");
+    int workers = value[0] ? atoi(value) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1) {
+        return 1;
+    }
+    return workers < MAX_DUMP_WORKERS ? workers : MAX_DUMP_WORKERS;
+}
+
+/*
+ * Like dump_sibling_thread_report() followed by the full logs if want_logs,
+ * but the threads are unwound by several workers, and the logs are read
+ * meanwhile. The tombstone is the same, with the threads in tid order.
+ * Return true if some thread is not detached cleanly.
+ */
+static bool dump_sibling_thread_report_parallel(const ptrace_context_t* context,
+        log_t* log, pid_t pid, pid_t tid, int workers, bool want_logs,
+        int* total_sleep_time_usec) {
+    sibling_report_t report;
+    memset(&report, 0, sizeof(report));
+    report.context = context;
+    report.pid = pid;
+    report.total_sleep_time_usec = *total_sleep_time_usec;
+    pthread_mutex_init(&report.mutex, NULL);
+
+    char task_path[64];
+    snprintf(task_path, sizeof(task_path), "/proc/%d/task", pid);
+    DIR* d = opendir(task_path);
+    if (d == NULL) {
+        XLOG("Cannot open /proc/%d/task\n", pid);
+    } else {
+        size_t capacity = 0;
+        struct dirent* de;
+        while ((de = readdir(d)) != NULL) {
+            char* end;
+            pid_t new_tid = strtoul(de->d_name, &end, 10);
+            if (!de->d_name[0] || *end || new_tid == tid) {
+                continue;
+            }
+            if (report.count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                pid_t* tids = realloc(report.tids, capacity * sizeof(pid_t));
+                if (!tids) {
+                    break;
+                }
+                report.tids = tids;
+            }
+            report.tids[report.count++] = new_tid;
+        }
+        closedir(d);
+        qsort(report.tids, report.count, sizeof(pid_t), compare_tids);
+        report.buffers = calloc(report.count, sizeof(log_buffer_t));
+        if (!report.buffers) {
+            report.count = 0;
+        }
+    }
+
+    pthread_t threads[MAX_DUMP_WORKERS];
+    int started = 0;
+    while (started < workers && (size_t)started < report.count
+            && !pthread_create(&threads[started], NULL, sibling_report_worker, &report)) {
+        started++;
+    }
+
+    log_buffer_t logs;
+    memset(&logs, 0, sizeof(logs));
+    if (want_logs) {
+        log_t logs_log;
+        logs_log.tfd = -1;
+        logs_log.tgz = NULL;
+        logs_log.buffer = &logs;
+        logs_log.amfd = -1;
+        logs_log.quiet = true;
+        dump_logs(&logs_log, pid, false);
+    }
+
+    /* Help with the threads left once the logs are read */
+    sibling_report_worker(&report);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < report.count; i++) {
+        write_log_buffer(log, &report.buffers[i]);
+        free_log_buffer(&report.buffers[i]);
+    }
+    write_log_buffer(log, &logs);
+    free_log_buffer(&logs);
+
+    free(report.buffers);
+    free(report.tids);
+    pthread_mutex_destroy(&report.mutex);
+    *total_sleep_time_usec = report.total_sleep_time_usec;
+    return report.detach_failed;
+}
+
+static void dump_abort_message(const ptrace_context_t* context, log_t* log, pid_t tid,
+        uintptr_t address, char* out_msg, size_t out_msg_size) {
   if (address == 0) {
     return;
   }
 
+  memory_t memory;
+  init_memory_ptrace_context(&memory, tid, context);
+
   address += sizeof(size_t); // Skip the buffer length.
 
   char msg[512];
@@ -636,7 +817,7 @@ static void dump_abort_message(log_t* log, pid_t tid, uintptr_t address) {
   char* p = &msg[0];
   while (p < &msg[sizeof(msg)]) {
     uint32_t data;
-    if (!try_get_word_ptrace(tid, address, &data)) {
+    if (!try_get_word(&memory, address, &data)) {
       break;
     }
     address += sizeof(uint32_t);
@@ -657,12 +838,14 @@ static void dump_abort_message(log_t* log, pid_t tid, uintptr_t address) {
   msg[sizeof(msg) - 1] = '\0';
 
   _LOG(log, SCOPE_AT_FAULT, "Abort message: '%s'\n", msg);
+  snprintf(out_msg, out_msg_size, "%s", msg);
 }
 
 /*
  * Dumps all information about the specified pid to the tombstone.
  */
 static bool dump_crash(log_t* log, pid_t pid, pid_t tid, int signal, uintptr_t abort_msg_address,
+                       char* abort_msg, size_t abort_msg_size,
                        bool dump_sibling_threads, int* total_sleep_time_usec)
 {
     /* don't copy log messages to tombstone unless this is a dev device */
@@ -690,20 +873,31 @@ static bool dump_crash(log_t* log, pid_t pid, pid_t tid, int signal, uintptr_t a
     if (signal) {
         dump_fault_addr(log, tid, signal);
     }
-    dump_abort_message(log, tid, abort_msg_address);
 
     ptrace_context_t* context = load_ptrace_context(tid);
-    dump_thread(context, log, tid, true, total_sleep_time_usec);
+    dump_abort_message(context, log, tid, abort_msg_address, abort_msg, abort_msg_size);
+    dump_thread(context, log, tid, true, total_sleep_time_usec, NULL);
 
     if (want_logs) {
         dump_logs(log, pid, true);
     }
 
     bool detach_failed = false;
-    if (dump_sibling_threads) {
+    int workers = dump_sibling_threads ? get_dump_worker_count() : 1;
+    if (workers > 1) {
+        detach_failed = dump_sibling_thread_report_parallel(context, log, pid, tid, workers,
+                want_logs, total_sleep_time_usec);
+        want_logs = false; /* already dumped */
+    } else if (dump_sibling_threads) {
         detach_failed = dump_sibling_thread_report(context, log, pid, tid, total_sleep_time_usec);
     }
 
+    if (context->memory_cache) {
+        memory_cache_stats_t stats;
+        get_memory_cache_stats(context->memory_cache, &stats);
+        XLOG("memory cache: %u hits, %u misses, %u unreadable, %u uncached\n",
+                stats.hits, stats.misses, stats.unreadable, stats.uncached);
+    }
     free_ptrace_context(context);
 
     if (want_logs) {
@@ -819,7 +1013,9 @@ char* engrave_tombstone(pid_t pid, pid_t tid, int signal, uintptr_t abort_msg_ad
     }
 
     int fd;
-    char* path = find_and_open_tombstone(&fd);
+    bool store = tombstone_store_enabled();
+    char* path = store ? create_tombstone_record(TOMBSTONE_DIR, &fd)
+            : find_and_open_tombstone(&fd);
     if (!path) {
         *detach_failed = false;
         return NULL;
@@ -827,12 +1023,33 @@ char* engrave_tombstone(pid_t pid, pid_t tid, int signal, uintptr_t abort_msg_ad
 
     log_t log;
     log.tfd = fd;
+    log.tgz = NULL;
+    log.buffer = NULL;
+    if (store) {
+        /* compressed as it is written */
+        log.tgz = gzdopen(fd, "wb");
+        if (!log.tgz) {
+            LOG("failed to compress tombstone file '%s'\n", path);
+            close(fd);
+            unlink(path);
+            free(path);
+            *detach_failed = false;
+            return NULL;
+        }
+    }
     log.amfd = activity_manager_connect();
     log.quiet = quiet;
-    *detach_failed = dump_crash(&log, pid, tid, signal, abort_msg_address, dump_sibling_threads,
-            total_sleep_time_usec);
+    time_t timestamp = time(NULL);
+    char abort_msg[512] = "";
+    *detach_failed = dump_crash(&log, pid, tid, signal, abort_msg_address,
+            abort_msg, sizeof(abort_msg), dump_sibling_threads, total_sleep_time_usec);
 
     close(log.amfd);
-    close(fd);
+    if (log.tgz) {
+        gzclose(log.tgz);
+        add_tombstone_record(TOMBSTONE_DIR, path, pid, tid, signal, timestamp, abort_msg);
+    } else {
+        close(fd);
+    }
     return path;
 }
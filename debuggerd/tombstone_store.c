@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <private/android_filesystem_config.h>
+
+#include <cutils/properties.h>
+
+#include "tombstone_store.h"
+#include "utility.h"
+
+#define TOMBSTONE_INDEX       "index"
+#define TOMBSTONE_PREFIX      "tombstone_"
+#define DEFAULT_STORE_BYTES   (10 * 1024 * 1024)
+
+/* Tries of the next sequence number if a record is left out of the index */
+#define MAX_CREATE_TRIES      100
+
+typedef struct {
+    char* line;         /* the line of the index, without the new line */
+    const char* name;   /* first field of 'line', terminated by a tab */
+    size_t name_length;
+    size_t bytes;
+} tombstone_record_t;
+
+bool tombstone_store_enabled() {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("persist.debuggerd.store", value, "0");
+    return !strcmp(value, "1");
+}
+
+static size_t get_store_budget() {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("persist.debuggerd.store_bytes", value, "");
+    char* end;
+    long bytes = strtol(value, &end, 10);
+    if (end == value || *end || bytes <= 0) {
+        return DEFAULT_STORE_BYTES;
+    }
+    return bytes;
+}
+
+/*
+ * Reads the index of the store into 'data', which is split in lines.
+ * Returns the number of records, allocated in '*records' (NULL if there are
+ * none), the caller must free both.
+ */
+static size_t read_tombstone_index(const char* dir, char** data, tombstone_record_t** records) {
+    char path[PATH_MAX];
+    *data = NULL;
+    *records = NULL;
+    snprintf(path, sizeof(path), "%s/" TOMBSTONE_INDEX, dir);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    size_t length = 0;
+    size_t capacity = 0;
+    for (;;) {
+        if (capacity - length < 4096) {
+            capacity = capacity ? capacity * 2 : 16384;
+            char* new_data = realloc(*data, capacity + 1);
+            if (!new_data) {
+                break;
+            }
+            *data = new_data;
+        }
+        ssize_t n = TEMP_FAILURE_RETRY(read(fd, *data + length, capacity - length));
+        if (n <= 0) {
+            break;
+        }
+        length += n;
+    }
+    close(fd);
+    if (!*data) {
+        return 0;
+    }
+    (*data)[length] = '\0';
+
+    size_t count = 0;
+    size_t records_capacity = 0;
+    char* line = *data;
+    while (*line) {
+        char* eol = strchr(line, '\n');
+        if (eol) {
+            *eol = '\0';
+        }
+        char* tab = strchr(line, '\t');
+        char* bytes = tab;
+        for (int i = 0; bytes && i < 4; i++) {
+            bytes = strchr(bytes + 1, '\t');
+        }
+        /* skip what we can't parse rather than losing the whole index */
+        if (bytes && tab - line > (ptrdiff_t) strlen(TOMBSTONE_PREFIX)) {
+            if (count == records_capacity) {
+                records_capacity = records_capacity ? records_capacity * 2 : 64;
+                tombstone_record_t* new_records = realloc(*records,
+                        records_capacity * sizeof(tombstone_record_t));
+                if (!new_records) {
+                    break;
+                }
+                *records = new_records;
+            }
+            tombstone_record_t* record = &(*records)[count++];
+            record->line = line;
+            record->name = line;
+            record->name_length = tab - line;
+            record->bytes = strtoul(bytes + 1, NULL, 10);
+        }
+        if (!eol) {
+            break;
+        }
+        line = eol + 1;
+    }
+    return count;
+}
+
+/* Only deletes what looks like a record of the store, the index isn't trusted. */
+static void delete_tombstone_record(const char* dir, const tombstone_record_t* record) {
+    if (strncmp(record->name, TOMBSTONE_PREFIX, strlen(TOMBSTONE_PREFIX))
+            || memchr(record->name, '/', record->name_length)) {
+        return;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%.*s", dir, (int) record->name_length, record->name);
+    if (unlink(path) && errno != ENOENT) {
+        LOG("failed to delete tombstone file '%s': %s\n", path, strerror(errno));
+    }
+}
+
+char* create_tombstone_record(const char* dir, int* fd) {
+    char* data;
+    tombstone_record_t* records;
+    size_t count = read_tombstone_index(dir, &data, &records);
+    unsigned sequence = 0;
+    if (count) {
+        const tombstone_record_t* last = &records[count - 1];
+        sequence = strtoul(last->name + strlen(TOMBSTONE_PREFIX), NULL, 10) + 1;
+    }
+    free(records);
+    free(data);
+
+    char path[PATH_MAX];
+    for (int i = 0; i < MAX_CREATE_TRIES; i++, sequence++) {
+        snprintf(path, sizeof(path), "%s/" TOMBSTONE_PREFIX "%06u.gz", dir, sequence % 1000000);
+        *fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0600);
+        if (*fd >= 0) {
+            fchown(*fd, AID_SYSTEM, AID_SYSTEM);
+            return strdup(path);
+        }
+        if (errno != EEXIST) {
+            break;
+        }
+    }
+    LOG("failed to open tombstone file '%s': %s\n", path, strerror(errno));
+    return NULL;
+}
+
+static void write_all(int fd, const char* data, size_t length, bool* ok) {
+    while (*ok && length) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, data, length));
+        if (n <= 0) {
+            *ok = false;
+            break;
+        }
+        data += n;
+        length -= n;
+    }
+}
+
+void add_tombstone_record(const char* dir, const char* path, pid_t pid, pid_t tid,
+        int signal, time_t timestamp, const char* abort_msg) {
+    struct stat sb;
+    if (stat(path, &sb)) {
+        return;
+    }
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    char line[1024];
+    int length = snprintf(line, sizeof(line), "%s\t%ld\t%d\t%d\t%d\t%lld\t",
+            name, (long) timestamp, pid, tid, signal, (long long) sb.st_size);
+    if (length < 0 || (size_t) length >= sizeof(line) - 1) {
+        return;
+    }
+    /* the abort message is the last field, on a single line */
+    for (const char* p = abort_msg; *p && (size_t) length < sizeof(line) - 1; p++) {
+        line[length++] = (*p == '\n' || *p == '\r' || *p == '\t') ? ' ' : *p;
+    }
+    line[length++] = '\n';
+
+    char* data;
+    tombstone_record_t* records;
+    size_t count = read_tombstone_index(dir, &data, &records);
+
+    /* the oldest records go first, but the new one is always kept */
+    size_t budget = get_store_budget();
+    size_t total = sb.st_size;
+    for (size_t i = 0; i < count; i++) {
+        total += records[i].bytes;
+    }
+    size_t first = 0;
+    while (first < count && total > budget) {
+        delete_tombstone_record(dir, &records[first]);
+        total -= records[first].bytes;
+        first++;
+    }
+
+    char index_path[PATH_MAX];
+    char temp_path[PATH_MAX];
+    snprintf(index_path, sizeof(index_path), "%s/" TOMBSTONE_INDEX, dir);
+    snprintf(temp_path, sizeof(temp_path), "%s/" TOMBSTONE_INDEX ".tmp", dir);
+    int fd = open(temp_path, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+    if (fd >= 0) {
+        bool ok = true;
+        for (size_t i = first; i < count; i++) {
+            write_all(fd, records[i].line, strlen(records[i].line), &ok);
+            write_all(fd, "\n", 1, &ok);
+        }
+        write_all(fd, line, length, &ok);
+        fchown(fd, AID_SYSTEM, AID_SYSTEM);
+        if (fsync(fd)) {
+            ok = false;
+        }
+        close(fd);
+        if (!ok || rename(temp_path, index_path)) {
+            LOG("failed to write tombstone index '%s': %s\n", index_path, strerror(errno));
+            unlink(temp_path);
+        }
+    } else {
+        LOG("failed to open tombstone index '%s': %s\n", temp_path, strerror(errno));
+    }
+
+    free(records);
+    free(data);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DEBUGGERD_TOMBSTONE_STORE_H
+#define _DEBUGGERD_TOMBSTONE_STORE_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * With persist.debuggerd.store=1, tombstones are gzip compressed records
+ * named tombstone_NNNNNN.gz, and the most recent ones are kept as long as
+ * they fit in persist.debuggerd.store_bytes (10MB by default) instead of
+ * keeping a fixed number of them.
+ *
+ * The records are listed, oldest first, in the "index" file of the store,
+ * one per line, so that they can be found without a scan of the directory
+ * or decompressing them:
+ *
+ *   name <tab> time <tab> pid <tab> tid <tab> signal <tab> bytes <tab> abort message
+ */
+
+/* Returns true if the tombstones go to the store. */
+bool tombstone_store_enabled();
+
+/* Creates a new record in the store 'dir' and opens it for writing.
+ * Returns the path of the record, which must be freed using free(),
+ * or NULL on failure. */
+char* create_tombstone_record(const char* dir, int* fd);
+
+/* Adds the record 'path', once written and closed, to the index of the store
+ * and deletes the oldest records if the store is over its budget. */
+void add_tombstone_record(const char* dir, const char* path, pid_t pid, pid_t tid,
+        int signal, time_t timestamp, const char* abort_msg);
+
+#endif // _DEBUGGERD_TOMBSTONE_STORE_H
@@ -18,6 +18,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
@@ -47,6 +48,49 @@ static int write_to_am(int fd, const char* buf, int len) {
     return len;
 }
 
+static void append_to_buffer(log_buffer_t* buffer, const char* buf, size_t len) {
+    if (buffer->length + len > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < buffer->length + len) {
+            capacity *= 2;
+        }
+        char* data = realloc(buffer->data, capacity);
+        if (!data) {
+            return;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, buf, len);
+    buffer->length += len;
+}
+
+void write_log_buffer(log_t* log, const log_buffer_t* buffer) {
+    if (log->buffer) {
+        append_to_buffer(log->buffer, buffer->data, buffer->length);
+    } else if (log->tgz) {
+        if (buffer->length) {
+            gzwrite(log->tgz, buffer->data, buffer->length);
+        }
+    } else if (log->tfd >= 0) {
+        size_t written = 0;
+        while (written < buffer->length) {
+            ssize_t n = TEMP_FAILURE_RETRY( write(log->tfd, buffer->data + written,
+                    buffer->length - written) );
+            if (n <= 0) {
+                break;
+            }
+            written += n;
+        }
+    }
+}
+
+void free_log_buffer(log_buffer_t* buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->length = buffer->capacity = 0;
+}
+
 void _LOG(log_t* log, int scopeFlags, const char *fmt, ...) {
     char buf[512];
     bool want_tfd_write;
@@ -58,7 +102,7 @@ void _LOG(log_t* log, int scopeFlags, const char *fmt, ...) {
     va_start(ap, fmt);
 
     // where is the information going to go?
-    want_tfd_write = log && log->tfd >= 0;
+    want_tfd_write = log && (log->tfd >= 0 || log->tgz || log->buffer);
     want_log_write = IS_AT_FAULT(scopeFlags) && (!log || !log->quiet);
     want_amfd_write = IS_AT_FAULT(scopeFlags) && !IS_SENSITIVE(scopeFlags) && log && log->amfd >= 0;
 
@@ -69,7 +113,13 @@ void _LOG(log_t* log, int scopeFlags, const char *fmt, ...) {
     }
 
     if (want_tfd_write) {
-        write(log->tfd, buf, len);
+        if (log->buffer) {
+            append_to_buffer(log->buffer, buf, len);
+        } else if (log->tgz) {
+            gzwrite(log->tgz, buf, len);
+        } else {
+            write(log->tfd, buf, len);
+        }
     }
 
     if (want_log_write) {
@@ -117,14 +167,29 @@ int wait_for_signal(pid_t tid, int* total_sleep_time_usec) {
 }
 
 void wait_for_stop(pid_t tid, int* total_sleep_time_usec) {
+    wait_for_stop_locked(tid, total_sleep_time_usec, NULL);
+}
+
+void wait_for_stop_locked(pid_t tid, int* total_sleep_time_usec, pthread_mutex_t* lock) {
     siginfo_t si;
     while (TEMP_FAILURE_RETRY(ptrace(PTRACE_GETSIGINFO, tid, 0, &si)) < 0 && errno == ESRCH) {
-        if (*total_sleep_time_usec > max_total_sleep_usec) {
+        /* the sleep is counted before it's taken, so that concurrent
+         * waiters can't all spend the rest of the budget at once */
+        if (lock) {
+            pthread_mutex_lock(lock);
+        }
+        bool timed_out = *total_sleep_time_usec > max_total_sleep_usec;
+        if (!timed_out) {
+            *total_sleep_time_usec += sleep_time_usec;
+        }
+        if (lock) {
+            pthread_mutex_unlock(lock);
+        }
+        if (timed_out) {
             LOG("timed out waiting for tid=%d to stop\n", tid);
             break;
         }
 
         usleep(sleep_time_usec);
-        *total_sleep_time_usec += sleep_time_usec;
     }
 }
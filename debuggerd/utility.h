@@ -20,10 +20,23 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <zlib.h>
+
+/* Text of the tombstone kept in memory. */
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} log_buffer_t;
 
 typedef struct {
     /* tombstone file descriptor */
     int tfd;
+    /* if not NULL, the tombstone is compressed here instead of written to tfd */
+    gzFile tgz;
+    /* if not NULL, what goes to the tombstone is appended here instead of tfd */
+    log_buffer_t* buffer;
     /* Activity Manager socket file descriptor */
     int amfd;
     /* if true, does not log anything to the Android logcat or Activity Manager */
@@ -60,7 +73,14 @@ void _LOG(log_t* log, int scopeFlags, const char *fmt, ...)
 #define XLOG2(fmt...) do {} while(0)
 #endif
 
+/* Writes a log buffer to the tombstone. */
+void write_log_buffer(log_t* log, const log_buffer_t* buffer);
+/* Frees the text of a log buffer. */
+void free_log_buffer(log_buffer_t* buffer);
+
 int wait_for_signal(pid_t tid, int* total_sleep_time_usec);
 void wait_for_stop(pid_t tid, int* total_sleep_time_usec);
+/* Like wait_for_stop(), for a sleep budget shared by threads under lock. */
+void wait_for_stop_locked(pid_t tid, int* total_sleep_time_usec, pthread_mutex_t* lock);
 
 #endif // _DEBUGGERD_UTILITY_H
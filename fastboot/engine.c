@@ -40,9 +40,12 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <sparse/sparse.h>
+
 #ifdef USE_MINGW
 #include <fcntl.h>
 #else
+#include <pthread.h>
 #include <sys/mman.h>
 #endif
 
@@ -55,6 +58,26 @@ double now()
     return (double)tv.tv_sec + (double)tv.tv_usec / 1000000;
 }
 
+/* Serial of the device this thread is flashing, when flashing several */
+static FB_THREAD_LOCAL const char *cur_serial;
+
+/* Progress output, prefixed with the device serial when flashing several */
+static void fb_status(const char *fmt, ...)
+{
+    char buf[512];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if (cur_serial) {
+        fprintf(stderr, "%s: %s", cur_serial, buf);
+    } else {
+        fputs(buf, stderr);
+    }
+}
+
 char *mkmsg(const char *fmt, ...)
 {
     char buf[256];
@@ -75,7 +98,8 @@ char *mkmsg(const char *fmt, ...)
 #define OP_QUERY      3
 #define OP_NOTICE     4
 #define OP_FORMAT     5
-#define OP_DOWNLOAD_SPARSE 6
+#define OP_FLASH_SPARSE 6
+#define OP_FLASH      7
 
 typedef struct Action Action;
 
@@ -179,10 +203,10 @@ int fb_format_supported(usb_handle *usb, const char *partition)
 static int cb_default(Action *a, int status, char *resp)
 {
     if (status) {
-        fprintf(stderr,"FAILED (%s)\n", resp);
+        fb_status("FAILED (%s)\n", resp);
     } else {
         double split = now();
-        fprintf(stderr,"OKAY [%7.3fs]\n", (split - a->start));
+        fb_status("OKAY [%7.3fs]\n", (split - a->start));
         a->start = split;
     }
     return status;
@@ -296,6 +320,10 @@ void generate_ext4_image(struct image_data *image)
     close(fd);
 }
 
+#ifndef USE_MINGW
+static pthread_mutex_t generate_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 int fb_format(Action *a, usb_handle *usb, int skip_if_not_supported)
 {
     const char *partition = a->cmd;
@@ -310,13 +338,13 @@ int fb_format(Action *a, usb_handle *usb, int skip_if_not_supported)
     status = fb_getvar(usb, response, "partition-type:%s", partition);
     if (status) {
         if (skip_if_not_supported) {
-            fprintf(stderr,
+            fb_status(
                     "Erase successful, but not automatically formatting.\n");
-            fprintf(stderr,
+            fb_status(
                     "Can't determine partition type.\n");
             return 0;
         }
-        fprintf(stderr,"FAILED (%s)\n", fb_get_error());
+        fb_status("FAILED (%s)\n", fb_get_error());
         return status;
     }
 
@@ -328,13 +356,13 @@ int fb_format(Action *a, usb_handle *usb, int skip_if_not_supported)
     }
     if (!generator) {
         if (skip_if_not_supported) {
-            fprintf(stderr,
+            fb_status(
                     "Erase successful, but not automatically formatting.\n");
-            fprintf(stderr,
+            fb_status(
                     "File system type %s not supported.\n", response);
             return 0;
         }
-        fprintf(stderr,"Formatting is not supported for filesystem with type '%s'.\n",
+        fb_status("Formatting is not supported for filesystem with type '%s'.\n",
                 response);
         return -1;
     }
@@ -342,29 +370,36 @@ int fb_format(Action *a, usb_handle *usb, int skip_if_not_supported)
     status = fb_getvar(usb, response, "partition-size:%s", partition);
     if (status) {
         if (skip_if_not_supported) {
-            fprintf(stderr,
+            fb_status(
                     "Erase successful, but not automatically formatting.\n");
-            fprintf(stderr, "Unable to get partition size\n.");
+            fb_status("Unable to get partition size\n.");
             return 0;
         }
-        fprintf(stderr,"FAILED (%s)\n", fb_get_error());
+        fb_status("FAILED (%s)\n", fb_get_error());
         return status;
     }
     image.partition_size = strtoll(response, (char **)NULL, 16);
 
+#ifndef USE_MINGW
+    /* make_ext4fs keeps its state in globals */
+    pthread_mutex_lock(&generate_lock);
+    generator->generate(&image);
+    pthread_mutex_unlock(&generate_lock);
+#else
     generator->generate(&image);
+#endif
     if (!image.buffer) {
-        fprintf(stderr,"Cannot generate image.\n");
+        fb_status("Cannot generate image.\n");
         return -1;
     }
 
     // Following piece of code is similar to fb_queue_flash() but executes
     // actions directly without queuing
-    fprintf(stderr, "sending '%s' (%lli KB)...\n", partition, image.image_size/1024);
+    fb_status("sending '%s' (%lli KB)...\n", partition, image.image_size/1024);
     status = fb_download_data(usb, image.buffer, image.image_size);
     if (status) goto cleanup;
 
-    fprintf(stderr, "writing '%s'...\n", partition);
+    fb_status("writing '%s'...\n", partition);
     snprintf(cmd, sizeof(cmd), "flash:%s", partition);
     status = fb_command(usb, cmd);
     if (status) goto cleanup;
@@ -388,26 +423,141 @@ void fb_queue_flash(const char *ptn, void *data, unsigned sz)
 {
     Action *a;
 
-    a = queue_action(OP_DOWNLOAD, "");
+    a = queue_action(OP_FLASH, "flash:%s", ptn);
     a->data = data;
     a->size = sz;
-    a->msg = mkmsg("sending '%s' (%d KB)", ptn, sz / 1024);
+}
+
+/* Devices that have flash-stream get the image written as it arrives,
+ * the others get it downloaded and then flashed.
+ */
+static int fb_flash(usb_handle *usb, Action *a)
+{
+    const char *ptn = a->cmd + strlen("flash:");
+    char resp[FB_RESPONSE_SZ + 1];
+    int status;
+
+    if (fb_getvar(usb, resp, "flash-stream") == 0 && !strcmp(resp, "yes")) {
+        fb_status("sending and writing '%s' (%d KB)...\n", ptn, a->size / 1024);
+        status = fb_flash_stream(usb, ptn, a->data, a->size);
+        return a->func(a, status, status ? fb_get_error() : "");
+    }
+
+    fb_status("sending '%s' (%d KB)...\n", ptn, a->size / 1024);
+    status = fb_download_data(usb, a->data, a->size);
+    status = a->func(a, status, status ? fb_get_error() : "");
+    if (status) {
+        return status;
+    }
 
-    a = queue_action(OP_COMMAND, "flash:%s", ptn);
-    a->msg = mkmsg("writing '%s'", ptn);
+    fb_status("writing '%s'...\n", ptn);
+    status = fb_command(usb, a->cmd);
+    return a->func(a, status, status ? fb_get_error() : "");
 }
 
-void fb_queue_flash_sparse(const char *ptn, struct sparse_file *s, unsigned sz)
+/* The pieces of a sparse image, split off as the first device to get to
+ * each one needs it and kept for any other devices being flashed.
+ */
+struct sparse_source {
+    struct sparse_file *s;
+    unsigned max_size;
+    struct sparse_file **pieces;
+    int count;
+    int done;
+#ifndef USE_MINGW
+    pthread_mutex_t lock;
+#endif
+};
+
+/* s is split into pieces of at most max_size bytes as they are sent, so the
+ * first piece goes out without waiting for the whole image to be resparsed.
+ */
+void fb_queue_flash_sparse(const char *ptn, struct sparse_file *s,
+        unsigned max_size)
 {
     Action *a;
+    struct sparse_source *src;
+
+    src = calloc(1, sizeof(*src));
+    if (src == 0) die("out of memory");
+    src->s = s;
+    src->max_size = max_size;
+#ifndef USE_MINGW
+    pthread_mutex_init(&src->lock, NULL);
+#endif
+
+    a = queue_action(OP_FLASH_SPARSE, "flash:%s", ptn);
+    a->data = src;
+}
+
+/* Sets *piece to piece n, or NULL past the last one */
+static int sparse_source_get(struct sparse_source *src, int n,
+        struct sparse_file **piece)
+{
+    struct sparse_file *next;
+    int status = 0;
+
+#ifndef USE_MINGW
+    pthread_mutex_lock(&src->lock);
+#endif
+    while (!src->done && src->count <= n) {
+        status = sparse_file_resparse_next(src->s, src->max_size, &next);
+        if (status == 0 && src->count == 0) {
+            /* an image without chunks is still flashed, as one empty piece */
+            next = src->s;
+            status = 1;
+        }
+        if (status <= 0) {
+            src->done = 1;
+            break;
+        }
+        src->pieces = realloc(src->pieces, (src->count + 1) * sizeof(next));
+        if (src->pieces == 0) die("out of memory");
+        src->pieces[src->count++] = next;
+        status = 0;
+    }
+    *piece = (n < src->count) ? src->pieces[n] : NULL;
+#ifndef USE_MINGW
+    pthread_mutex_unlock(&src->lock);
+#endif
+
+    return status;
+}
+
+static int fb_flash_sparse(usb_handle *usb, Action *a)
+{
+    const char *ptn = a->cmd + strlen("flash:");
+    struct sparse_file *piece;
+    int64_t sz64;
+    int status;
+    int n;
 
-    a = queue_action(OP_DOWNLOAD_SPARSE, "");
-    a->data = s;
-    a->size = 0;
-    a->msg = mkmsg("sending sparse '%s' (%d KB)", ptn, sz / 1024);
+    for (n = 0; ; n++) {
+        status = sparse_source_get(a->data, n, &piece);
+        if (status < 0) {
+            fb_status("FAILED (cannot resparse '%s')\n", ptn);
+            return status;
+        }
+        if (!piece) {
+            return 0;
+        }
+
+        sz64 = sparse_file_len(piece, true, false);
+        fb_status("sending sparse '%s' %d (%lld KB)...\n", ptn, n + 1,
+                (long long)(sz64 / 1024));
+        status = fb_download_data_sparse(usb, piece);
+        status = a->func(a, status, status ? fb_get_error() : "");
+        if (status) {
+            return status;
+        }
 
-    a = queue_action(OP_COMMAND, "flash:%s", ptn);
-    a->msg = mkmsg("writing '%s'", ptn);
+        fb_status("writing '%s' %d...\n", ptn, n + 1);
+        status = fb_command(usb, a->cmd);
+        status = a->func(a, status, status ? fb_get_error() : "");
+        if (status) {
+            return status;
+        }
+    }
 }
 
 static int match(char *str, const char **value, unsigned count)
@@ -442,16 +592,18 @@ static int cb_check(Action *a, int status, char *resp, int invert)
     unsigned count = a->size;
     unsigned n;
     int yes;
+    char values[256];
+    int len;
 
     if (status) {
-        fprintf(stderr,"FAILED (%s)\n", resp);
+        fb_status("FAILED (%s)\n", resp);
         return status;
     }
 
     if (a->prod) {
         if (strcmp(a->prod, cur_product) != 0) {
             double split = now();
-            fprintf(stderr,"IGNORE, product is %s required only for %s [%7.3fs]\n",
+            fb_status("IGNORE, product is %s required only for %s [%7.3fs]\n",
                     cur_product, a->prod, (split - a->start));
             a->start = split;
             return 0;
@@ -463,19 +615,18 @@ static int cb_check(Action *a, int status, char *resp, int invert)
 
     if (yes) {
         double split = now();
-        fprintf(stderr,"OKAY [%7.3fs]\n", (split - a->start));
+        fb_status("OKAY [%7.3fs]\n", (split - a->start));
         a->start = split;
         return 0;
     }
 
-    fprintf(stderr,"FAILED\n\n");
-    fprintf(stderr,"Device %s is '%s'.\n", a->cmd + 7, resp);
-    fprintf(stderr,"Update %s '%s'",
-            invert ? "rejects" : "requires", value[0]);
-    for (n = 1; n < count; n++) {
-        fprintf(stderr," or '%s'", value[n]);
+    fb_status("FAILED\n\n");
+    fb_status("Device %s is '%s'.\n", a->cmd + 7, resp);
+    len = snprintf(values, sizeof(values), "'%s'", value[0]);
+    for (n = 1; n < count && len < (int) sizeof(values); n++) {
+        len += snprintf(values + len, sizeof(values) - len, " or '%s'", value[n]);
     }
-    fprintf(stderr,".\n\n");
+    fb_status("Update %s %s.\n\n", invert ? "rejects" : "requires", values);
     return -1;
 }
 
@@ -505,10 +656,10 @@ void fb_queue_require(const char *prod, const char *var,
 static int cb_display(Action *a, int status, char *resp)
 {
     if (status) {
-        fprintf(stderr, "%s FAILED (%s)\n", a->cmd, resp);
+        fb_status("%s FAILED (%s)\n", a->cmd, resp);
         return status;
     }
-    fprintf(stderr, "%s: %s\n", (char*) a->data, resp);
+    fb_status("%s: %s\n", (char*) a->data, resp);
     return 0;
 }
 
@@ -524,7 +675,7 @@ void fb_queue_display(const char *var, const char *prettyname)
 static int cb_save(Action *a, int status, char *resp)
 {
     if (status) {
-        fprintf(stderr, "%s FAILED (%s)\n", a->cmd, resp);
+        fb_status("%s FAILED (%s)\n", a->cmd, resp);
         return status;
     }
     strncpy(a->data, resp, a->size);
@@ -542,7 +693,7 @@ void fb_queue_query_save(const char *var, char *dest, unsigned dest_size)
 
 static int cb_do_nothing(Action *a, int status, char *resp)
 {
-    fprintf(stderr,"\n");
+    fb_status("\n");
     return 0;
 }
 
@@ -573,24 +724,24 @@ void fb_queue_notice(const char *notice)
     a->data = (void*) notice;
 }
 
-int fb_execute_queue(usb_handle *usb)
+static int execute_actions(usb_handle *usb, Action *list)
 {
     Action *a;
     char resp[FB_RESPONSE_SZ+1];
     int status = 0;
 
-    a = action_list;
+    a = list;
     if (!a)
         return status;
     resp[FB_RESPONSE_SZ] = 0;
 
     double start = -1;
-    for (a = action_list; a; a = a->next) {
+    for (a = list; a; a = a->next) {
         a->start = now();
         if (start < 0) start = a->start;
         if (a->msg) {
-            // fprintf(stderr,"%30s... ",a->msg);
-            fprintf(stderr,"%s...\n",a->msg);
+            // fb_status("%30s... ",a->msg);
+            fb_status("%s...\n",a->msg);
         }
         if (a->op == OP_DOWNLOAD) {
             status = fb_download_data(usb, a->data, a->size);
@@ -605,24 +756,117 @@ int fb_execute_queue(usb_handle *usb)
             status = a->func(a, status, status ? fb_get_error() : resp);
             if (status) break;
         } else if (a->op == OP_NOTICE) {
-            fprintf(stderr,"%s\n",(char*)a->data);
+            fb_status("%s\n",(char*)a->data);
         } else if (a->op == OP_FORMAT) {
             status = fb_format(a, usb, (int)a->data);
             status = a->func(a, status, status ? fb_get_error() : "");
             if (status) break;
-        } else if (a->op == OP_DOWNLOAD_SPARSE) {
-            status = fb_download_data_sparse(usb, a->data);
-            status = a->func(a, status, status ? fb_get_error() : "");
+        } else if (a->op == OP_FLASH_SPARSE) {
+            status = fb_flash_sparse(usb, a);
+            if (status) break;
+        } else if (a->op == OP_FLASH) {
+            status = fb_flash(usb, a);
             if (status) break;
         } else {
             die("bogus action");
         }
     }
 
-    fprintf(stderr,"finished. total time: %.3fs\n", (now() - start));
+    fb_status("finished. total time: %.3fs\n", (now() - start));
     return status;
 }
 
+int fb_execute_queue(usb_handle *usb)
+{
+    return execute_actions(usb, action_list);
+}
+
+struct device_run {
+    usb_handle *usb;
+    const char *serial;
+    char *product;
+    int status;
+#ifndef USE_MINGW
+    pthread_t thread;
+#endif
+};
+
+/* Runs the queue against one of several devices.  Each device gets its own
+ * copy of the actions, for their timing, while the images they point at are
+ * shared.  The product query saves into this thread's cur_product.
+ */
+static void *device_run_thread(void *priv)
+{
+    struct device_run *run = priv;
+    Action *list = NULL;
+    Action **tail = &list;
+    Action *a;
+    Action *copy;
+
+    cur_serial = run->serial;
+
+    for (a = action_list; a; a = a->next) {
+        copy = malloc(sizeof(*copy));
+        if (copy == 0) die("out of memory");
+        *copy = *a;
+        if (copy->data == run->product) {
+            copy->data = cur_product;
+        }
+        copy->next = NULL;
+        *tail = copy;
+        tail = &copy->next;
+    }
+
+    run->status = execute_actions(run->usb, list);
+
+    while (list) {
+        a = list->next;
+        free(list);
+        list = a;
+    }
+
+    return NULL;
+}
+
+int fb_execute_queue_multi(usb_handle **usbs, const char **serials, int count)
+{
+    struct device_run *runs;
+    int failed = 0;
+    int i;
+
+    runs = calloc(count, sizeof(*runs));
+    if (runs == 0) die("out of memory");
+
+    for (i = 0; i < count; i++) {
+        runs[i].usb = usbs[i];
+        runs[i].serial = serials[i];
+        runs[i].product = cur_product;
+#ifndef USE_MINGW
+        if (pthread_create(&runs[i].thread, NULL, device_run_thread, &runs[i])) {
+            die("cannot start thread for %s", serials[i]);
+        }
+#else
+        device_run_thread(&runs[i]);
+#endif
+    }
+
+    for (i = 0; i < count; i++) {
+#ifndef USE_MINGW
+        pthread_join(runs[i].thread, NULL);
+#endif
+        if (runs[i].status) {
+            failed++;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        fprintf(stderr, "%s: %s\n", serials[i], runs[i].status ? "FAILED" : "OKAY");
+    }
+    free(runs);
+
+    return failed ? -1 : 0;
+}
+
 int fb_queue_is_empty(void)
 {
     return (action_list == NULL);
@@ -57,7 +57,7 @@
 
 #define ARRAY_SIZE(a) (sizeof(a)/sizeof(*(a)))
 
-char cur_product[FB_RESPONSE_SZ + 1];
+FB_THREAD_LOCAL char cur_product[FB_RESPONSE_SZ + 1];
 
 void bootimg_set_cmdline(boot_img_hdr *h, const char *cmdline);
 
@@ -67,8 +67,13 @@ boot_img_hdr *mkbootimg(void *kernel, unsigned kernel_size, unsigned kernel_offs
                         unsigned page_size, unsigned base, unsigned tags_offset,
                         unsigned *bootimg_size);
 
+#define MAX_DEVICES 64
+
 static usb_handle *usb = 0;
 static const char *serial = 0;
+static const char *serials[MAX_DEVICES];
+static usb_handle *usbs[MAX_DEVICES];
+static int device_count = 0;
 static const char *product = 0;
 static const char *cmdline = 0;
 static int wipe_data = 0;
@@ -281,6 +286,28 @@ usb_handle *open_device(void)
     }
 }
 
+/* Opens every device given with -s, to be flashed in parallel */
+static void open_devices(void)
+{
+    int announce;
+    int i;
+
+    for (i = 0; i < device_count; i++) {
+        serial = serials[i];
+        announce = 1;
+        for (;;) {
+            usbs[i] = usb_open(match_fastboot);
+            if (usbs[i]) break;
+            if (announce) {
+                announce = 0;
+                fprintf(stderr,"< waiting for %s >\n", serial);
+            }
+            sleep(1);
+        }
+    }
+    serial = serials[0];
+}
+
 void list_devices(void) {
     // We don't actually open a USB device here,
     // just getting our callback called so we can
@@ -315,7 +342,8 @@ void usage(void)
             "  -u                                       do not first erase partition before\n"
             "                                           formatting\n"
             "  -s <specific device>                     specify device serial number\n"
-            "                                           or path to device port\n"
+            "                                           or path to device port.  Repeat\n"
+            "                                           to flash several devices at once\n"
             "  -l                                       with \"devices\", lists device paths\n"
             "  -p <product>                             specify product name\n"
             "  -c <cmdline>                             override kernel commandline\n"
@@ -414,27 +442,46 @@ void *unzip_file(zipfile_t zip, const char *name, unsigned *sz)
     return data;
 }
 
+static int write_to_fd(void *cookie, const void *data, size_t len)
+{
+    int fd = *(int *)cookie;
+    const char *ptr = data;
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = write(fd, ptr, len);
+        if (ret <= 0) {
+            return -1;
+        }
+        ptr += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
 static int unzip_to_file(zipfile_t zip, char *name)
 {
     int fd;
-    char *data;
-    unsigned sz;
+    zipentry_t entry;
 
-    fd = fileno(tmpfile());
-    if (fd < 0) {
+    entry = lookup_zipentry(zip, name);
+    if (entry == NULL) {
+        fprintf(stderr, "archive does not contain '%s'\n", name);
         return -1;
     }
 
-    data = unzip_file(zip, name, &sz);
-    if (data == 0) {
+    fd = fileno(tmpfile());
+    if (fd < 0) {
         return -1;
     }
 
-    if (write(fd, data, sz) != sz) {
-        fd = -1;
+    /* inflate a piece at a time rather than holding the image in memory */
+    if (decompress_zipentry_stream(entry, write_to_fd, &fd)) {
+        fprintf(stderr, "failed to unzip '%s' from archive\n", name);
+        close(fd);
+        return -1;
     }
 
-    free(data);
     lseek(fd, 0, SEEK_SET);
     return fd;
 }
@@ -537,33 +584,16 @@ void queue_info_dump(void)
     fb_queue_notice("--------------------------------------------");
 }
 
-static struct sparse_file **load_sparse_files(int fd, int max_size)
+static struct sparse_file *load_sparse_file(int fd)
 {
     struct sparse_file *s;
-    int files;
-    struct sparse_file **out_s;
 
     s = sparse_file_import_auto(fd, false);
     if (!s) {
         die("cannot sparse read file\n");
     }
 
-    files = sparse_file_resparse(s, max_size, NULL, 0);
-    if (files < 0) {
-        die("Failed to resparse\n");
-    }
-
-    out_s = calloc(sizeof(struct sparse_file *), files + 1);
-    if (!out_s) {
-        die("Failed to allocate sparse file array\n");
-    }
-
-    files = sparse_file_resparse(s, max_size, out_s, files);
-    if (files < 0) {
-        die("Failed to resparse\n");
-    }
-
-    return out_s;
+    return s;
 }
 
 static int64_t get_target_sparse_limit(struct usb_handle *usb)
@@ -634,12 +664,14 @@ static int load_buf_fd(usb_handle *usb, int fd,
     }
     limit = get_sparse_limit(usb, sz64);
     if (limit) {
-        struct sparse_file **s = load_sparse_files(fd, limit);
+        /* split into pieces of at most limit bytes as it is sent */
+        struct sparse_file *s = load_sparse_file(fd);
         if (s == NULL) {
             return -1;
         }
         buf->type = FB_BUFFER_SPARSE;
         buf->data = s;
+        buf->sz = limit;
     } else {
         unsigned int sz;
         data = load_fd(fd, &sz);
@@ -667,15 +699,9 @@ static int load_buf(usb_handle *usb, const char *fname,
 
 static void flash_buf(const char *pname, struct fastboot_buffer *buf)
 {
-    struct sparse_file **s;
-
     switch (buf->type) {
         case FB_BUFFER_SPARSE:
-            s = buf->data;
-            while (*s) {
-                int64_t sz64 = sparse_file_len(*s, true, false);
-                fb_queue_flash_sparse(pname, *s++, sz64);
-            }
+            fb_queue_flash_sparse(pname, buf->data, buf->sz);
             break;
         case FB_BUFFER:
             fb_queue_flash(pname, buf->data, buf->sz);
@@ -707,11 +733,10 @@ void do_update_signature(zipfile_t zip, char *fn)
 
 void do_update(usb_handle *usb, char *fn, int erase_first)
 {
-    void *zdata;
-    unsigned zsize;
     void *data;
     unsigned sz;
     zipfile_t zip;
+    int zfd;
     int fd;
     int rc;
     struct fastboot_buffer buf;
@@ -721,11 +746,12 @@ void do_update(usb_handle *usb, char *fn, int erase_first)
 
     fb_queue_query_save("product", cur_product, sizeof(cur_product));
 
-    zdata = load_file(fn, &zsize);
-    if (zdata == 0) die("failed to load '%s': %s", fn, strerror(errno));
+    zfd = open(fn, O_RDONLY | O_BINARY);
+    if (zfd < 0) die("failed to load '%s': %s", fn, strerror(errno));
 
-    zip = init_zipfile(zdata, zsize);
-    if(zip == 0) die("failed to access zipdata in '%s'");
+    zip = init_zipfile_fd(zfd);
+    if(zip == 0) die("failed to access zipdata in '%s'", fn);
+    close(zfd);
 
     data = unzip_file(zip, "android-info.txt", &sz);
     if (data == 0) {
@@ -945,7 +971,11 @@ int main(int argc, char **argv)
             ramdisk_offset = strtoul(optarg, 0, 16);
             break;
         case 's':
+            if (device_count == MAX_DEVICES) {
+                die("too many devices (max %d)", MAX_DEVICES);
+            }
             serial = optarg;
+            serials[device_count++] = optarg;
             break;
         case 'S':
             sparse_limit = parse_num(optarg);
@@ -985,7 +1015,15 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    usb = open_device();
+    /* With several devices the queue is built once, against the first one,
+     * and the loaded images are shared by all of them.
+     */
+    if (device_count > 1) {
+        open_devices();
+        usb = usbs[0];
+    } else {
+        usb = open_device();
+    }
 
     while (argc > 0) {
         if(!strcmp(*argv, "getvar")) {
@@ -1107,6 +1145,10 @@ int main(int argc, char **argv)
     if (fb_queue_is_empty())
         return 0;
 
-    status = fb_execute_queue(usb);
+    if (device_count > 1) {
+        status = fb_execute_queue_multi(usbs, serials, device_count);
+    } else {
+        status = fb_execute_queue(usb);
+    }
     return (status) ? 1 : 0;
 }
@@ -33,11 +33,22 @@
 
 struct sparse_file;
 
+/* State touched while running the queue is kept per thread, so that several
+ * devices can be flashed at once.
+ */
+#ifdef USE_MINGW
+#define FB_THREAD_LOCAL
+#else
+#define FB_THREAD_LOCAL __thread
+#endif
+
 /* protocol.c - fastboot protocol */
 int fb_command(usb_handle *usb, const char *cmd);
 int fb_command_response(usb_handle *usb, const char *cmd, char *response);
 int fb_download_data(usb_handle *usb, const void *data, unsigned size);
 int fb_download_data_sparse(usb_handle *usb, struct sparse_file *s);
+int fb_flash_stream(usb_handle *usb, const char *ptn, const void *data,
+                    unsigned size);
 char *fb_get_error(void);
 
 #define FB_COMMAND_SZ 64
@@ -47,7 +58,8 @@ char *fb_get_error(void);
 int fb_getvar(struct usb_handle *usb, char *response, const char *fmt, ...);
 int fb_format_supported(usb_handle *usb, const char *partition);
 void fb_queue_flash(const char *ptn, void *data, unsigned sz);
-void fb_queue_flash_sparse(const char *ptn, struct sparse_file *s, unsigned sz);
+void fb_queue_flash_sparse(const char *ptn, struct sparse_file *s,
+        unsigned max_size);
 void fb_queue_erase(const char *ptn);
 void fb_queue_format(const char *ptn, int skip_if_not_supported);
 void fb_queue_require(const char *prod, const char *var, int invert,
@@ -59,12 +71,13 @@ void fb_queue_command(const char *cmd, const char *msg);
 void fb_queue_download(const char *name, void *data, unsigned size);
 void fb_queue_notice(const char *notice);
 int fb_execute_queue(usb_handle *usb);
+int fb_execute_queue_multi(usb_handle **usbs, const char **serials, int count);
 int fb_queue_is_empty(void);
 
 /* util stuff */
 void die(const char *fmt, ...);
 
 /* Current product */
-extern char cur_product[FB_RESPONSE_SZ + 1];
+extern FB_THREAD_LOCAL char cur_product[FB_RESPONSE_SZ + 1];
 
 #endif
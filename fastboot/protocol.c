@@ -28,19 +28,21 @@
 
 #define min(a, b) \
     ({ typeof(a) _a = (a); typeof(b) _b = (b); (_a < _b) ? _a : _b; })
-#define round_down(a, b) \
-    ({ typeof(a) _a = (a); typeof(b) _b = (b); _a - (_a % _b); })
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
+#ifndef USE_MINGW
+#include <pthread.h>
+#endif
+
 #include <sparse/sparse.h>
 
 #include "fastboot.h"
 
-static char ERROR[128];
+static FB_THREAD_LOCAL char ERROR[128];
 
 char *fb_get_error(void)
 {
@@ -219,73 +221,218 @@ int fb_download_data(usb_handle *usb, const void *data, unsigned size)
     }
 }
 
-#define USB_BUF_SIZE 512
-static char usb_buf[USB_BUF_SIZE];
-static int usb_buf_len;
+/* Sends the image in the data phase of flash-stream, so the device writes it
+ * to the partition as it arrives instead of staging it like download.
+ */
+int fb_flash_stream(usb_handle *usb, const char *ptn, const void *data,
+                    unsigned size)
+{
+    char cmd[FB_COMMAND_SZ + 1];
+    int r;
+
+    if(snprintf(cmd, sizeof(cmd), "flash-stream:%s:%08x", ptn, size) >
+            FB_COMMAND_SZ) {
+        sprintf(ERROR, "command too large");
+        return -1;
+    }
+    r = _command_send(usb, cmd, data, size, 0);
+
+    if(r < 0) {
+        return -1;
+    } else {
+        return 0;
+    }
+}
+
+/*
+ * Sparse downloads are streamed: sparse_file_callback() runs on a producer
+ * thread filling FB_SPARSE_BUF_COUNT buffers of FB_SPARSE_BUF_SIZE bytes,
+ * while the calling thread writes full buffers to usb, so reading the image
+ * overlaps with the transfer.  Every buffer but the last is a multiple of
+ * the usb packet size.
+ */
+#define FB_SPARSE_BUF_SIZE (1024 * 1024)
+#define FB_SPARSE_BUF_COUNT 3
+
+struct sparse_stream {
+    usb_handle *usb;
+    struct sparse_file *s;
+    char *buf[FB_SPARSE_BUF_COUNT];
+    unsigned len[FB_SPARSE_BUF_COUNT];
+    unsigned filled;    /* buffers handed to the writer */
+    unsigned sent;      /* buffers written to usb */
+    int status;
+    int done;
+    int abort;
+#ifndef USE_MINGW
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
+/* Hands the buffer being filled to the writer, and waits for a free one */
+static int sparse_stream_submit(struct sparse_stream *ss)
+{
+#ifndef USE_MINGW
+    int r = 0;
+
+    pthread_mutex_lock(&ss->lock);
+    ss->filled++;
+    pthread_cond_broadcast(&ss->cond);
+    while (!ss->abort && ss->filled - ss->sent >= FB_SPARSE_BUF_COUNT) {
+        pthread_cond_wait(&ss->cond, &ss->lock);
+    }
+    if (ss->abort) {
+        r = -1;
+    }
+    pthread_mutex_unlock(&ss->lock);
+
+    ss->len[ss->filled % FB_SPARSE_BUF_COUNT] = 0;
+    return r;
+#else
+    unsigned n = ss->filled % FB_SPARSE_BUF_COUNT;
+    unsigned len = ss->len[n];
+
+    if (_command_data(ss->usb, ss->buf[n], len) != (int) len) {
+        return -1;
+    }
+    ss->filled++;
+    ss->sent++;
+    ss->len[ss->filled % FB_SPARSE_BUF_COUNT] = 0;
+    return 0;
+#endif
+}
 
 static int fb_download_data_sparse_write(void *priv, const void *data, int len)
 {
-    int r;
-    usb_handle *usb = priv;
-    int to_write;
+    struct sparse_stream *ss = priv;
     const char *ptr = data;
+    unsigned n;
+    int to_write;
 
-    if (usb_buf_len) {
-        to_write = min(USB_BUF_SIZE - usb_buf_len, len);
+    while (len > 0) {
+        n = ss->filled % FB_SPARSE_BUF_COUNT;
+        to_write = min(FB_SPARSE_BUF_SIZE - ss->len[n], (unsigned) len);
 
-        memcpy(usb_buf + usb_buf_len, ptr, to_write);
-        usb_buf_len += to_write;
+        memcpy(ss->buf[n] + ss->len[n], ptr, to_write);
+        ss->len[n] += to_write;
         ptr += to_write;
         len -= to_write;
-    }
 
-    if (usb_buf_len == USB_BUF_SIZE) {
-        r = _command_data(usb, usb_buf, USB_BUF_SIZE);
-        if (r != USB_BUF_SIZE) {
+        if (ss->len[n] == FB_SPARSE_BUF_SIZE && sparse_stream_submit(ss)) {
             return -1;
         }
-        usb_buf_len = 0;
     }
 
-    if (len > USB_BUF_SIZE) {
-        if (usb_buf_len > 0) {
-            sprintf(ERROR, "internal error: usb_buf not empty\n");
-            return -1;
+    return 0;
+}
+
+static void *sparse_stream_producer(void *priv)
+{
+    struct sparse_stream *ss = priv;
+    int r;
+
+    r = sparse_file_callback(ss->s, true, false,
+                             fb_download_data_sparse_write, ss);
+    if (r >= 0 && ss->len[ss->filled % FB_SPARSE_BUF_COUNT] > 0) {
+        r = sparse_stream_submit(ss);
+    }
+
+#ifndef USE_MINGW
+    pthread_mutex_lock(&ss->lock);
+    ss->status = r;
+    ss->done = 1;
+    pthread_cond_broadcast(&ss->cond);
+    pthread_mutex_unlock(&ss->lock);
+#else
+    ss->status = r;
+    ss->done = 1;
+#endif
+
+    return NULL;
+}
+
+#ifndef USE_MINGW
+/* Writes buffers to usb as the producer fills them */
+static int sparse_stream_consume(struct sparse_stream *ss)
+{
+    unsigned n;
+    int r;
+
+    pthread_mutex_lock(&ss->lock);
+    for (;;) {
+        while (ss->sent == ss->filled && !ss->done) {
+            pthread_cond_wait(&ss->cond, &ss->lock);
         }
-        to_write = round_down(len, USB_BUF_SIZE);
-        r = _command_data(usb, ptr, to_write);
-        if (r != to_write) {
-            return -1;
+        if (ss->sent == ss->filled) {
+            break;
         }
-        ptr += to_write;
-        len -= to_write;
-    }
+        n = ss->sent % FB_SPARSE_BUF_COUNT;
+        pthread_mutex_unlock(&ss->lock);
+
+        r = _command_data(ss->usb, ss->buf[n], ss->len[n]);
 
-    if (len > 0) {
-        if (len > USB_BUF_SIZE) {
-            sprintf(ERROR, "internal error: too much left for usb_buf\n");
+        pthread_mutex_lock(&ss->lock);
+        if (r != (int) ss->len[n]) {
+            ss->abort = 1;
+            pthread_cond_broadcast(&ss->cond);
+            pthread_mutex_unlock(&ss->lock);
             return -1;
         }
-        memcpy(usb_buf, ptr, len);
-        usb_buf_len = len;
+        ss->sent++;
+        pthread_cond_broadcast(&ss->cond);
     }
+    pthread_mutex_unlock(&ss->lock);
 
-    return 0;
+    if (ss->status < 0) {
+        sprintf(ERROR, "sparse data read failure");
+    }
+    return ss->status;
 }
+#endif
 
-static int fb_download_data_sparse_flush(usb_handle *usb)
+static int fb_download_data_sparse_stream(usb_handle *usb,
+                                          struct sparse_file *s)
 {
-    int r;
-
-    if (usb_buf_len > 0) {
-        r = _command_data(usb, usb_buf, usb_buf_len);
-        if (r != usb_buf_len) {
-            return -1;
+    struct sparse_stream ss;
+#ifndef USE_MINGW
+    pthread_t producer;
+#endif
+    unsigned i;
+    int r = -1;
+
+    memset(&ss, 0, sizeof(ss));
+    ss.usb = usb;
+    ss.s = s;
+    for (i = 0; i < FB_SPARSE_BUF_COUNT; i++) {
+        ss.buf[i] = malloc(FB_SPARSE_BUF_SIZE);
+        if (!ss.buf[i]) {
+            sprintf(ERROR, "out of memory");
+            goto out;
         }
-        usb_buf_len = 0;
     }
 
-    return 0;
+#ifndef USE_MINGW
+    pthread_mutex_init(&ss.lock, NULL);
+    pthread_cond_init(&ss.cond, NULL);
+    if (pthread_create(&producer, NULL, sparse_stream_producer, &ss)) {
+        sprintf(ERROR, "cannot start sparse producer (%s)", strerror(errno));
+    } else {
+        r = sparse_stream_consume(&ss);
+        pthread_join(producer, NULL);
+    }
+    pthread_mutex_destroy(&ss.lock);
+    pthread_cond_destroy(&ss.cond);
+#else
+    sparse_stream_producer(&ss);
+    r = ss.status;
+#endif
+
+out:
+    for (i = 0; i < FB_SPARSE_BUF_COUNT; i++) {
+        free(ss.buf[i]);
+    }
+    return r;
 }
 
 int fb_download_data_sparse(usb_handle *usb, struct sparse_file *s)
@@ -303,12 +450,10 @@ int fb_download_data_sparse(usb_handle *usb, struct sparse_file *s)
         return -1;
     }
 
-    r = sparse_file_callback(s, true, false, fb_download_data_sparse_write, usb);
+    r = fb_download_data_sparse_stream(usb, s);
     if (r < 0) {
         return -1;
     }
 
-    fb_download_data_sparse_flush(usb);
-
     return _command_end(usb);
 }
@@ -67,12 +67,18 @@
  */
 #define MAX_USBFS_BULK_SIZE (16 * 1024)
 
+/* Large writes keep this many bulk urbs queued so the bus never idles
+ * between transfers.
+ */
+#define MAX_URBS_IN_FLIGHT 8
+
 struct usb_handle
 {
     char fname[64];
     int desc;
     unsigned char ep_in;
     unsigned char ep_out;
+    int no_urbs;
 };
 
 static inline int badname(const char *name)
@@ -308,6 +314,93 @@ static usb_handle *find_usb_device(const char *base, ifc_match_func callback)
     return usb;
 }
 
+/* Cancels the urbs that may still be in flight, they must be reaped before
+ * urbs[] and the data they point to go away.
+ */
+static void usb_discard_urbs(usb_handle *h, struct usbdevfs_urb *urbs,
+                             unsigned reaped, unsigned submitted)
+{
+    unsigned i;
+
+    /* urbs can complete out of order, discarding a reaped one is harmless */
+    for(i = reaped; i < submitted; i++) {
+        ioctl(h->desc, USBDEVFS_DISCARDURB, &urbs[i % MAX_URBS_IN_FLIGHT]);
+    }
+}
+
+/* Returns the number of bytes written, -1 on error, or -2 if the kernel
+ * doesn't support urbs.
+ */
+static int usb_write_urbs(usb_handle *h, unsigned char *data, int len)
+{
+    struct usbdevfs_urb urbs[MAX_URBS_IN_FLIGHT];
+    struct usbdevfs_urb *urb;
+    unsigned submitted = 0;
+    unsigned reaped = 0;
+    int offset = 0;
+    int count = 0;
+    int failed = 0;
+
+    for(;;) {
+        while(!failed && offset < len &&
+              submitted - reaped < MAX_URBS_IN_FLIGHT) {
+            int xfer = (len - offset > MAX_USBFS_BULK_SIZE) ?
+                    MAX_USBFS_BULK_SIZE : len - offset;
+
+            urb = &urbs[submitted % MAX_URBS_IN_FLIGHT];
+            memset(urb, 0, sizeof(*urb));
+            urb->type = USBDEVFS_URB_TYPE_BULK;
+            urb->endpoint = h->ep_out;
+            urb->buffer = data + offset;
+            urb->buffer_length = xfer;
+
+            if(ioctl(h->desc, USBDEVFS_SUBMITURB, urb) < 0) {
+                if(submitted == 0 && (errno == ENOTTY || errno == EINVAL)) {
+                    return -2;
+                }
+                DBG("ERROR: submit urb, errno = %d (%s)\n",
+                    errno, strerror(errno));
+                failed = 1;
+                break;
+            }
+            submitted++;
+            offset += xfer;
+        }
+
+        if(reaped == submitted) {
+            break;
+        }
+
+        if(ioctl(h->desc, USBDEVFS_REAPURB, &urb) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            DBG("ERROR: reap urb, errno = %d (%s)\n", errno, strerror(errno));
+            if(failed) {
+                /* still can't reap once cancelled: the device is gone and
+                 * the kernel has already released the urbs */
+                return -1;
+            }
+            failed = 1;
+            usb_discard_urbs(h, urbs, reaped, submitted);
+            continue;
+        }
+        reaped++;
+
+        if(!failed && (urb->status != 0 ||
+                       urb->actual_length != urb->buffer_length)) {
+            DBG("ERROR: urb status = %d, %d of %d bytes\n", urb->status,
+                urb->actual_length, urb->buffer_length);
+            /* later urbs must not land after a gap, cancel them */
+            failed = 1;
+            usb_discard_urbs(h, urbs, reaped, submitted);
+        }
+        count += urb->actual_length;
+    }
+
+    return failed ? -1 : count;
+}
+
 int usb_write(usb_handle *h, const void *_data, int len)
 {
     unsigned char *data = (unsigned char*) _data;
@@ -334,6 +427,14 @@ int usb_write(usb_handle *h, const void *_data, int len)
         return 0;
     }
 
+    if(len > MAX_USBFS_BULK_SIZE && !h->no_urbs) {
+        n = usb_write_urbs(h, data, len);
+        if(n != -2) {
+            return n;
+        }
+        h->no_urbs = 1;
+    }
+
     while(len > 0) {
         int xfer;
         xfer = (len > MAX_USBFS_BULK_SIZE) ? MAX_USBFS_BULK_SIZE : len;
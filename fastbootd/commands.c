@@ -29,12 +29,15 @@
  * SUCH DAMAGE.
  */
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 
 #include "bootimg.h"
 #include "debug.h"
+#include "flash.h"
 #include "protocol.h"
 
 static void cmd_boot(struct protocol_handle *phandle, const char *arg)
@@ -104,42 +107,69 @@ static void cmd_erase(struct protocol_handle *phandle, const char *arg)
 
 static void cmd_flash(struct protocol_handle *phandle, const char *arg)
 {
-#if 0
-    struct ptentry *ptn;
-    struct ptable *ptable;
-    unsigned extra = 0;
-
-    ptable = flash_get_ptable();
-    if (ptable == NULL) {
-        fastboot_fail(phandle, "partition table doesn't exist");
-        return;
-    }
+    char magic[BOOT_MAGIC_SIZE];
+    int fd;
+    int ret;
 
-    ptn = ptable_find(ptable, arg);
-    if (ptn == NULL) {
-        fastboot_fail(phandle, "unknown partition name");
+    fd = protocol_get_download(phandle);
+    if (fd < 0) {
+        fastboot_fail(phandle, "no image downloaded");
         return;
     }
 
-    if (!strcmp(ptn->name, "boot") || !strcmp(ptn->name, "recovery")) {
-        if (memcmp((void *)data, BOOT_MAGIC, BOOT_MAGIC_SIZE)) {
+    if (!strcmp(arg, "boot") || !strcmp(arg, "recovery")) {
+        if (pread(fd, magic, BOOT_MAGIC_SIZE, 0) != BOOT_MAGIC_SIZE ||
+                memcmp(magic, BOOT_MAGIC, BOOT_MAGIC_SIZE)) {
+            close(fd);
             fastboot_fail(phandle, "image is not a boot image");
             return;
         }
     }
 
-    if (!strcmp(ptn->name, "system") || !strcmp(ptn->name, "userdata"))
-        extra = 64;
-    else
-        sz = ROUND_TO_PAGE(sz);
+    ret = flash_from_fd(arg, fd);
+    close(fd);
+    if (ret < 0) {
+        fastboot_fail(phandle, "flash write failure");
+        return;
+    }
 
-    D(INFO, "writing %d bytes to '%s'\n", sz, ptn->name);
-    if (flash_write(ptn, extra, data, sz)) {
+    fastboot_okay(phandle, "");
+}
+
+/*
+ * flash-stream:<partition>:<size> takes the image in its data phase like
+ * download, but writes it to the partition as it arrives instead of staging
+ * the whole image first.
+ */
+static void cmd_flash_stream(struct protocol_handle *phandle, const char *arg)
+{
+    char partition[64];
+    const char *sep;
+    unsigned len;
+    int ret;
+
+    sep = strchr(arg, ':');
+    if (sep == NULL || (size_t)(sep - arg) >= sizeof(partition)) {
+        fastboot_fail(phandle, "invalid argument");
+        return;
+    }
+
+    memcpy(partition, arg, sep - arg);
+    partition[sep - arg] = '\0';
+    len = strtoul(sep + 1, NULL, 16);
+
+    fastboot_data(phandle, len);
+
+    ret = protocol_handle_flash(phandle, partition, len);
+    if (ret == -ENOEXEC) {
+        fastboot_fail(phandle, "image is not a boot image");
+        return;
+    }
+    if (ret < 0) {
         fastboot_fail(phandle, "flash write failure");
         return;
     }
-    D(INFO, "partition '%s' updated\n", ptn->name);
-#endif
+
     fastboot_okay(phandle, "");
 }
 
@@ -197,9 +227,11 @@ void commands_init()
     fastboot_register("boot", cmd_boot);
     fastboot_register("erase:", cmd_erase);
     fastboot_register("flash:", cmd_flash);
+    fastboot_register("flash-stream:", cmd_flash_stream);
     fastboot_register("continue", cmd_continue);
     fastboot_register("getvar:", cmd_getvar);
     fastboot_register("download:", cmd_download);
+    fastboot_publish("flash-stream", "yes");
     //fastboot_publish("version", "0.5");
     //fastboot_publish("product", "swordfish");
     //fastboot_publish("kernel", "lk");
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <linux/fs.h>
+
+#include <sparse/sparse.h>
+
+#include "bootimg.h"
+#include "debug.h"
+#include "flash.h"
+#include "transport.h"
+
+#define BLOCK_DEV_PATH "/dev/block/by-name/"
+
+/* Device writes are collected in a window of this size before hitting the
+ * disk, so the memory used does not depend on the image size */
+#define FLASH_WINDOW_SIZE (4 * 1024 * 1024)
+#define FLASH_ALIGN 4096
+
+/* from libsparse's sparse_format.h, which is not exported */
+#define SPARSE_HEADER_MAGIC 0xed26ff3a
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct flash_stream {
+    /* input, either the usb transport or a staged download */
+    struct transport_handle *thandle;
+    int src_fd;
+    size_t remaining;
+    char head[BOOT_MAGIC_SIZE];
+    size_t head_len;
+
+    /* output */
+    int fd;
+    bool direct;
+    size_t align;
+    int64_t dev_size;
+    char *buf;
+    size_t buf_len;
+    int64_t buf_off;
+};
+
+static int flash_source_read(struct flash_stream *fs, void *data, size_t len)
+{
+    char *ptr = data;
+    ssize_t ret;
+
+    if (len > fs->remaining + fs->head_len)
+        return -EOVERFLOW;
+
+    if (fs->head_len) {
+        size_t n = min(len, fs->head_len);
+        memcpy(ptr, fs->head, n);
+        memmove(fs->head, fs->head + n, fs->head_len - n);
+        fs->head_len -= n;
+        ptr += n;
+        len -= n;
+    }
+
+    while (len) {
+        if (fs->thandle)
+            ret = fs->thandle->transport->read(fs->thandle, ptr, len);
+        else
+            ret = read(fs->src_fd, ptr, len);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            D(WARN, "flash source read failed, ret=%zd %s", ret, strerror(errno));
+            return ret < 0 ? -errno : -EIO;
+        }
+        ptr += ret;
+        len -= ret;
+        fs->remaining -= ret;
+    }
+
+    return 0;
+}
+
+static int flash_pwrite(int fd, const char *data, size_t len, int64_t off)
+{
+    ssize_t ret;
+
+    while (len) {
+        ret = pwrite64(fd, data, len, off);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            D(ERR, "write of %zu bytes at %lld failed: %d %s", len,
+                    (long long)off, errno, strerror(errno));
+            return ret < 0 ? -errno : -EIO;
+        }
+        data += ret;
+        len -= ret;
+        off += ret;
+    }
+
+    return 0;
+}
+
+static void flash_drop_direct(struct flash_stream *fs)
+{
+    D(INFO, "unaligned write to %lld, disabling O_DIRECT", (long long)fs->buf_off);
+    fcntl(fs->fd, F_SETFL, fcntl(fs->fd, F_GETFL) & ~O_DIRECT);
+    fs->direct = false;
+}
+
+static int flash_flush(struct flash_stream *fs)
+{
+    size_t aligned = fs->buf_len;
+    int ret;
+
+    if (fs->buf_len == 0)
+        return 0;
+
+    if (fs->direct && (fs->buf_off & (fs->align - 1)))
+        flash_drop_direct(fs);
+
+    if (fs->direct)
+        aligned &= ~(fs->align - 1);
+
+    ret = flash_pwrite(fs->fd, fs->buf, aligned, fs->buf_off);
+    if (ret < 0)
+        return ret;
+
+    if (aligned < fs->buf_len) {
+        /* O_DIRECT can't write a partial sector, finish without it */
+        flash_drop_direct(fs);
+        ret = flash_pwrite(fs->fd, fs->buf + aligned, fs->buf_len - aligned,
+                fs->buf_off + aligned);
+        if (ret < 0)
+            return ret;
+    }
+
+    fs->buf_off += fs->buf_len;
+    fs->buf_len = 0;
+
+    return 0;
+}
+
+static int flash_write(void *priv, int64_t off, const void *data, int len)
+{
+    struct flash_stream *fs = priv;
+    const char *ptr = data;
+    size_t n;
+    int ret;
+
+    if (fs->dev_size >= 0 && off + len > fs->dev_size) {
+        D(ERR, "image is larger than the partition (%lld bytes)",
+                (long long)fs->dev_size);
+        return -ENOSPC;
+    }
+
+    if (fs->buf_len && off != fs->buf_off + (int64_t)fs->buf_len) {
+        ret = flash_flush(fs);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (fs->buf_len == 0)
+        fs->buf_off = off;
+
+    while (len) {
+        n = min((size_t)len, FLASH_WINDOW_SIZE - fs->buf_len);
+        memcpy(fs->buf + fs->buf_len, ptr, n);
+        fs->buf_len += n;
+        ptr += n;
+        len -= n;
+
+        if (fs->buf_len == FLASH_WINDOW_SIZE) {
+            ret = flash_flush(fs);
+            if (ret < 0)
+                return ret;
+        }
+    }
+
+    return 0;
+}
+
+static int flash_read(void *priv, void *data, int len)
+{
+    return flash_source_read(priv, data, len);
+}
+
+/* Raw images are read straight into the window, with no extra copy */
+static int flash_raw(struct flash_stream *fs)
+{
+    size_t n;
+    int ret;
+
+    fs->buf_off = 0;
+    memcpy(fs->buf, fs->head, fs->head_len);
+    fs->buf_len = fs->head_len;
+    fs->head_len = 0;
+
+    if (fs->dev_size >= 0 && (int64_t)(fs->buf_len + fs->remaining) > fs->dev_size) {
+        D(ERR, "image is larger than the partition (%lld bytes)",
+                (long long)fs->dev_size);
+        return -ENOSPC;
+    }
+
+    while (fs->remaining) {
+        n = min(fs->remaining, FLASH_WINDOW_SIZE - fs->buf_len);
+        ret = flash_source_read(fs, fs->buf + fs->buf_len, n);
+        if (ret < 0)
+            return ret;
+        fs->buf_len += n;
+
+        if (fs->buf_len == FLASH_WINDOW_SIZE) {
+            ret = flash_flush(fs);
+            if (ret < 0)
+                return ret;
+        }
+    }
+
+    return flash_flush(fs);
+}
+
+static int flash_open(struct flash_stream *fs, const char *partition)
+{
+    char path[PATH_MAX];
+    uint64_t size;
+    int sector;
+
+    if (strchr(partition, '/')) {
+        D(ERR, "invalid partition name '%s'", partition);
+        return -EINVAL;
+    }
+
+    snprintf(path, sizeof(path), BLOCK_DEV_PATH "%s", partition);
+
+    fs->direct = true;
+    fs->fd = open(path, O_WRONLY | O_DIRECT);
+    if (fs->fd < 0 && errno == EINVAL) {
+        D(WARN, "%s does not support O_DIRECT", path);
+        fs->direct = false;
+        fs->fd = open(path, O_WRONLY);
+    }
+    if (fs->fd < 0) {
+        D(ERR, "failed to open %s: %d %s", path, errno, strerror(errno));
+        return -errno;
+    }
+
+    fs->align = FLASH_ALIGN;
+    if (ioctl(fs->fd, BLKSSZGET, &sector) == 0 && sector > FLASH_ALIGN
+            && (sector & (sector - 1)) == 0)
+        fs->align = sector;
+
+    fs->dev_size = -1;
+    if (ioctl(fs->fd, BLKGETSIZE64, &size) == 0)
+        fs->dev_size = size;
+
+    return 0;
+}
+
+static int flash_stream(const char *partition, struct flash_stream *fs)
+{
+    unsigned int block_size = 0;
+    char head[BOOT_MAGIC_SIZE];
+    uint32_t magic = 0;
+    size_t head_len;
+    void *buf;
+    int ret;
+
+    /* peek at the magic, flash_source_read hands it out again later */
+    head_len = min(fs->remaining, sizeof(head));
+    ret = flash_source_read(fs, head, head_len);
+    if (ret < 0)
+        return ret;
+    memcpy(fs->head, head, head_len);
+    fs->head_len = head_len;
+    if (head_len >= sizeof(magic))
+        memcpy(&magic, head, sizeof(magic));
+
+    if (!strcmp(partition, "boot") || !strcmp(partition, "recovery")) {
+        if (head_len != BOOT_MAGIC_SIZE ||
+                memcmp(head, BOOT_MAGIC, BOOT_MAGIC_SIZE)) {
+            D(ERR, "image for '%s' is not a boot image", partition);
+            return -ENOEXEC;
+        }
+    }
+
+    if (posix_memalign(&buf, FLASH_ALIGN, FLASH_WINDOW_SIZE))
+        return -ENOMEM;
+    fs->buf = buf;
+
+    ret = flash_open(fs, partition);
+    if (ret < 0)
+        goto out;
+
+    D(INFO, "writing %zu bytes to '%s'", fs->remaining + fs->head_len, partition);
+
+    if (head_len >= sizeof(magic) && magic == SPARSE_HEADER_MAGIC) {
+        ret = sparse_stream_decode(flash_read, flash_write, fs, true, &block_size);
+        if (ret == 0)
+            ret = flash_flush(fs);
+        if (ret == 0 && fs->remaining)
+            D(WARN, "%zu bytes of trailing data after sparse image", fs->remaining);
+    } else {
+        ret = flash_raw(fs);
+    }
+
+    if (ret == 0 && fsync(fs->fd) < 0)
+        ret = -errno;
+
+    if (ret == 0)
+        D(INFO, "partition '%s' updated", partition);
+
+    close(fs->fd);
+out:
+    free(fs->buf);
+    return ret;
+}
+
+/*
+ * Flash an image that was staged by a previous download.
+ */
+int flash_from_fd(const char *partition, int fd)
+{
+    struct flash_stream fs;
+    off_t len;
+
+    len = lseek(fd, 0, SEEK_END);
+    if (len < 0 || lseek(fd, 0, SEEK_SET) < 0)
+        return -errno;
+
+    memset(&fs, 0, sizeof(fs));
+    fs.src_fd = fd;
+    fs.remaining = len;
+
+    return flash_stream(partition, &fs);
+}
+
+/*
+ * Flash len bytes as they arrive from the host, without staging the image.
+ * On error the rest of the transfer is still read and dropped, so the host
+ * stays in step with the protocol.
+ */
+int flash_from_transport(const char *partition,
+        struct transport_handle *thandle, size_t len)
+{
+    struct flash_stream fs;
+    char drain[4096];
+    int ret;
+
+    memset(&fs, 0, sizeof(fs));
+    fs.thandle = thandle;
+    fs.src_fd = -1;
+    fs.remaining = len;
+
+    ret = flash_stream(partition, &fs);
+
+    while (fs.remaining) {
+        fs.head_len = 0;
+        if (flash_source_read(&fs, drain, min(fs.remaining, sizeof(drain))) < 0)
+            break;
+    }
+
+    return ret;
+}
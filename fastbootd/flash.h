@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FASTBOOTD_FLASH_H_
+#define _FASTBOOTD_FLASH_H_
+
+#include <stddef.h>
+
+struct transport_handle;
+
+/*
+ * Both return 0 on success or a negative errno, -ENOEXEC when the image
+ * for the boot or recovery partition is not a boot image.
+ */
+int flash_from_fd(const char *partition, int fd);
+int flash_from_transport(const char *partition,
+        struct transport_handle *thandle, size_t len);
+
+#endif
@@ -35,6 +35,7 @@
 #include <string.h>
 
 #include "debug.h"
+#include "flash.h"
 #include "protocol.h"
 #include "transport.h"
 
@@ -104,6 +105,12 @@ int protocol_handle_download(struct protocol_handle *phandle, size_t len)
     return transport_handle_download(phandle->transport_handle, len);
 }
 
+int protocol_handle_flash(struct protocol_handle *phandle,
+        const char *partition, size_t len)
+{
+    return flash_from_transport(partition, phandle->transport_handle, len);
+}
+
 static ssize_t protocol_handle_write(struct protocol_handle *phandle,
         char *buffer, size_t len)
 {
@@ -35,10 +35,12 @@ typedef struct map_info {
     bool is_writable;
     bool is_executable;
     void* data; // arbitrary data associated with the map by the user, initially NULL
+    struct map_info_index* index; // sorted maps of the whole list, on its first map
     char name[];
 } map_info_t;
 
-/* Loads memory map from /proc/<tid>/maps. */
+/* Loads memory map from /proc/<tid>/maps.
+ * The maps are listed from the highest address to the lowest. */
 map_info_t* load_map_info_list(pid_t tid);
 
 /* Frees memory map. */
@@ -30,16 +30,29 @@
 extern "C" {
 #endif
 
+/* A cache of the pages of memory read from another process. */
+typedef struct memory_cache memory_cache_t;
+
+/* Counters of a memory cache, for tuning. */
+typedef struct {
+    uint32_t hits;          /* words read from a cached page */
+    uint32_t misses;        /* pages loaded in the cache */
+    uint32_t unreadable;    /* pages found to be unreadable */
+    uint32_t uncached;      /* words read with ptrace() because their page couldn't be loaded */
+} memory_cache_stats_t;
+
 /* Stores information about a process that is used for several different
  * ptrace() based operations. */
 typedef struct {
     map_info_t* map_info_list;
+    memory_cache_t* memory_cache;
 } ptrace_context_t;
 
 /* Describes how to access memory from a process. */
 typedef struct {
     pid_t tid;
     const map_info_t* map_info_list;
+    memory_cache_t* cache;
 } memory_t;
 
 #if __i386__
@@ -89,6 +102,13 @@ void init_memory(memory_t* memory, const map_info_t* map_info_list);
  */
 void init_memory_ptrace(memory_t* memory, pid_t tid);
 
+/*
+ * Initializes a memory structure for accessing memory from another process
+ * through the page cache of a ptrace context, which is much cheaper than one
+ * ptrace() per word. The context may be NULL.
+ */
+void init_memory_ptrace_context(memory_t* memory, pid_t tid, const ptrace_context_t* context);
+
 /*
  * Reads a word of memory safely.
  * If the memory is local, ensures that the address is readable before dereferencing it.
@@ -119,6 +139,31 @@ ptrace_context_t* load_ptrace_context(pid_t pid);
  */
 void free_ptrace_context(ptrace_context_t* context);
 
+/*
+ * Creates a cache of the memory of a remote process. Pages are read whole
+ * with process_vm_readv(), or from /proc/<pid>/mem, and word by word with
+ * ptrace() when neither is available. The map list, which may be NULL,
+ * tells which pages can't change.
+ * The cache can be shared between threads.
+ */
+memory_cache_t* create_memory_cache(pid_t pid, const map_info_t* map_info_list);
+
+/*
+ * Frees a memory cache.
+ */
+void free_memory_cache(memory_cache_t* cache);
+
+/*
+ * Drops the cached pages which the process may have written since they were
+ * read, e.g. after stopping another of its threads.
+ */
+void flush_memory_cache(memory_cache_t* cache);
+
+/*
+ * Gets the counters of a memory cache.
+ */
+void get_memory_cache_stats(memory_cache_t* cache, memory_cache_stats_t* out_stats);
+
 /*
  * Finds a symbol using ptrace.
  * Returns the containing map and information about the symbol, or
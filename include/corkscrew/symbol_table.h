@@ -33,6 +33,8 @@ typedef struct {
 typedef struct {
     symbol_t* symbols;
     size_t num_symbols;
+    char* names;            /* storage of the names of the symbols */
+    size_t names_size;
 } symbol_table_t;
 
 /*
@@ -46,6 +48,33 @@ symbol_table_t* load_symbol_table(const char* filename);
  */
 void free_symbol_table(symbol_table_t* table);
 
+/*
+ * Gets the symbol table of a file from a cache shared by the whole process,
+ * which avoids parsing the same libraries over and over. The file is
+ * reloaded if it changed since it was cached.
+ * The table must be released with release_symbol_table().
+ * Returns NULL on error.
+ */
+const symbol_table_t* acquire_symbol_table(const char* filename);
+
+/*
+ * Releases a symbol table returned by acquire_symbol_table().
+ */
+void release_symbol_table(const symbol_table_t* table);
+
+/*
+ * Sets the number of bytes the cached symbol tables may take, the least
+ * recently used ones which aren't acquired are freed above it.
+ */
+void set_symbol_table_cache_size(size_t bytes);
+
+/*
+ * Sets a directory where the symbol tables are saved once sorted, so
+ * acquire_symbol_table() can load them from there instead of parsing the
+ * file, or NULL to not use one (the default).
+ */
+void set_symbol_table_index_dir(const char* dir);
+
 /*
  * Finds a symbol associated with an address in the symbol table.
  * Returns NULL if not found.
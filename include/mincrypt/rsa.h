@@ -45,12 +45,38 @@ typedef struct RSAPublicKey {
     int exponent;             /* 3 or 65537 */
 } RSAPublicKey;
 
+/* A public key prepared by RSA_init_context for many verifications */
+typedef struct RSAKeyContext {
+    RSAPublicKey key;
+    int exponent;
+    uint64_t n0inv;               /* -1 / n[0] mod 2^64 */
+    uint64_t n[RSANUMWORDS / 2];  /* modulus as little endian array */
+    uint64_t rr[RSANUMWORDS / 2]; /* R^2 as little endian array */
+} RSAKeyContext;
+
 int RSA_verify(const RSAPublicKey *key,
                const uint8_t* signature,
                const int len,
                const uint8_t* hash,
                const int hash_len);
 
+int RSA_init_context(RSAKeyContext* ctx,
+                     const RSAPublicKey* key);
+
+int RSA_verify_context(const RSAKeyContext* ctx,
+                       const uint8_t* signature,
+                       const int len,
+                       const uint8_t* hash,
+                       const int hash_len);
+
+int RSA_verify_batch(const RSAKeyContext* ctx,
+                     const uint8_t* const* signatures,
+                     const int len,
+                     const uint8_t* const* hashes,
+                     const int hash_len,
+                     const int count,
+                     int* results);
+
 #ifdef __cplusplus
 }
 #endif
@@ -21,6 +21,12 @@ const uint8_t* SHA_final(SHA_CTX* ctx);
 // NOTE: *digest needs to hold SHA_DIGEST_SIZE bytes.
 const uint8_t* SHA_hash(const void* data, int len, uint8_t* digest);
 
+// Hashes count independent messages, data[i] of len[i] bytes, into
+// digest[i], several at a time where the cpu allows.
+// NOTE: each digest[i] needs to hold SHA_DIGEST_SIZE bytes.
+void SHA_hash_multi(const void* const* data, const int* len,
+                   uint8_t* const* digest, int count);
+
 #define SHA_DIGEST_SIZE 20
 
 #ifdef __cplusplus
@@ -20,6 +20,12 @@ const uint8_t* SHA256_final(SHA256_CTX* ctx);
 // Convenience method. Returns digest address.
 const uint8_t* SHA256_hash(const void* data, int len, uint8_t* digest);
 
+// Hashes count independent messages, data[i] of len[i] bytes, into
+// digest[i], several at a time where the cpu allows.
+// NOTE: each digest[i] needs to hold SHA256_DIGEST_SIZE bytes.
+void SHA256_hash_multi(const void* const* data, const int* len,
+                   uint8_t* const* digest, int count);
+
 #define SHA256_DIGEST_SIZE 32
 
 #ifdef __cplusplus
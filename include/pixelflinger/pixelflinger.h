@@ -73,6 +73,7 @@ enum GGLNames {
     GGL_AA                          = 0x80000001,
     GGL_W_LERP                      = 0x80000004,
     GGL_POINT_SMOOTH_NICE           = 0x80000005,
+    GGL_TILED_RENDERING             = 0x80000006,
 
     // buffers, pixel drawing/reading
     GGL_COLOR                       = 0x1800,
@@ -321,6 +322,24 @@ GGLint gglBitBlit(
         GGLint crop[4],
         GGLint where[4]);
 
+// gglBlitSurface() flags
+enum {
+    GGL_BLIT_DITHER     = 0x00000001,   // dither if dst has fewer bits
+    GGL_BLIT_BLEND      = 0x00000002,   // premultiplied SRC_OVER
+};
+
+// Converts the rectangle crop (left, top, width, height) of src to the
+// format of dst and writes it at (x, y) in dst, clipped to dst. Any pair of color
+// formats can be used, the surfaces must not overlap.
+// Returns 0, or -EINVAL if the formats or the crop are invalid.
+GGLint gglBlitSurface(
+        const GGLSurface* dst,
+        GGLint x,
+        GGLint y,
+        const GGLSurface* src,
+        const GGLint crop[4],
+        GGLbitfield flags);
+
 #ifdef __cplusplus
 };
 #endif
@@ -121,7 +121,7 @@ template<bool> struct CTA;
 template<> struct CTA<true> { };
 
 #define GGL_CONTEXT(con, c)         context_t *con = static_cast<context_t *>(c)
-#define GGL_OFFSETOF(field)         int(&(((context_t*)0)->field))
+#define GGL_OFFSETOF(field)         int(uintptr_t(&(((context_t*)0)->field)))
 #define GGL_INIT_PROC(p, f)         p.f = ggl_ ## f;
 #define GGL_BETWEEN(x, L, H)        (uint32_t((x)-(L)) <= ((H)-(L)))
 
@@ -229,7 +229,8 @@ enum {
     GGL_ENABLE_W            = 0x00000200,
     GGL_ENABLE_DITHER       = 0x00000400,
     GGL_ENABLE_FOG          = 0x00000800,
-    GGL_ENABLE_POINT_AA_NICE= 0x00001000
+    GGL_ENABLE_POINT_AA_NICE= 0x00001000,
+    GGL_ENABLE_TILED        = 0x00002000
 };
 
 // ----------------------------------------------------------------------------
@@ -480,7 +481,7 @@ struct generated_tex_vars_t {
     uint32_t    width;
     uint32_t    height;
     uint32_t    stride;
-    int32_t     data;
+    uintptr_t   data;
     int32_t     dsdx;
     int32_t     dtdx;
     int32_t     spill[2];
@@ -493,7 +494,7 @@ struct generated_vars_t {
     } argb[4];
     int32_t     aref;
     int32_t     dzdx;
-    int32_t     zbase;
+    uintptr_t   zbase;
     int32_t     f;
     int32_t     dfdx;
     int32_t     spill[3];
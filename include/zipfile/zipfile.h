@@ -29,6 +29,10 @@ typedef void* zipentry_t;
 // Provide a buffer.  Returns NULL on failure.
 zipfile_t init_zipfile(const void* data, size_t size);
 
+// Map the zip file open on fd.  The fd may be closed once this returns.
+// Returns NULL on failure.
+zipfile_t init_zipfile_fd(int fd);
+
 // Release the zipfile resources.
 void release_zipfile(zipfile_t file);
 
@@ -47,6 +51,13 @@ char* get_zipentry_name(zipentry_t entry);
 // by get_zipentry_size.  Returns nonzero on failure.
 int decompress_zipentry(zipentry_t entry, void* buf, int bufsize);
 
+// Decompress the entry a piece at a time, calling callback with each piece
+// of at most 64KB, and check its CRC.  Returns nonzero on failure, or the
+// first nonzero value returned by callback.
+int decompress_zipentry_stream(zipentry_t entry,
+        int (*callback)(void* cookie, const void* data, size_t len),
+        void* cookie);
+
 // iterate through the entries in the zip file.  pass a pointer to
 // a void* initialized to NULL to start.  Returns NULL when done
 zipentry_t iterate_zipfile(zipfile_t file, void** cookie);
@@ -21,31 +21,28 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <dirent.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <fcntl.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include "bootchart.h"
+#include "util.h"
 
 #define VERSION         "0.8"
-#define SAMPLE_PERIOD   0.2
 #define LOG_ROOT        "/data/bootchart"
-#define LOG_STAT        LOG_ROOT"/proc_stat.log"
-#define LOG_PROCS       LOG_ROOT"/proc_ps.log"
-#define LOG_DISK        LOG_ROOT"/proc_diskstats.log"
-#define LOG_HEADER      LOG_ROOT"/header"
+#define LOG_BINARY      LOG_ROOT"/bootchart.bin"
 #define LOG_ACCT        LOG_ROOT"/kernel_pacct"
 
 #define LOG_STARTFILE   "/data/bootchart-start"
 #define LOG_STOPFILE    "/data/bootchart-stop"
 
+#define NS_PER_MS       1000000LL
+
 static int
 unix_read(int  fd, void*  buff, int  len)
 {
@@ -75,6 +72,59 @@ proc_read(const char*  filename, char* buff, size_t  buffsize)
     return len;
 }
 
+/* a growable scratch buffer used to assemble one record's payload */
+typedef struct {
+    char*  data;
+    int    count;
+    int    size;
+} ScratchRec, *Scratch;
+
+static int
+scratch_reserve( Scratch  s, int  len )
+{
+    if (s->count + len > s->size) {
+        int    size = s->size ? s->size : 16384;
+        char*  data;
+        while (size < s->count + len)
+            size *= 2;
+        data = realloc(s->data, size);
+        if (data == NULL)
+            return -1;
+        s->data = data;
+        s->size = size;
+    }
+    return 0;
+}
+
+static void
+scratch_append( Scratch  s, const void*  src, int  len )
+{
+    if (scratch_reserve(s, len) < 0)
+        return;
+    memcpy(s->data + s->count, src, len);
+    s->count += len;
+}
+
+/* append the whole content of 'path' to the scratch buffer */
+static void
+scratch_append_file( Scratch  s, const char*  path )
+{
+    int  fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    for (;;) {
+        int  ret;
+        if (scratch_reserve(s, 4096) < 0)
+            break;
+        ret = unix_read(fd, s->data + s->count, s->size - s->count);
+        if (ret <= 0)
+            break;
+        s->count += ret;
+    }
+    close(fd);
+}
+
 #define FILE_BUFF_SIZE    65536
 
 typedef struct {
@@ -87,55 +137,78 @@ static void
 file_buff_open( FileBuff  buff, const char*  path )
 {
     buff->count = 0;
-    buff->fd    = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0755);
+    buff->fd    = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC, 0755);
 }
 
 static void
-file_buff_write( FileBuff  buff, const void*  src, int  len )
+file_buff_done( FileBuff  buff )
 {
-    while (len > 0) {
-        int  avail = sizeof(buff->data) - buff->count;
-        if (avail > len)
-            avail = len;
-
-        memcpy( buff->data + buff->count, src, avail );
-        len -= avail;
-        src  = (char*)src + avail;
-
-        buff->count += avail;
-        if (buff->count == FILE_BUFF_SIZE) {
-            unix_write( buff->fd, buff->data, buff->count );
-            buff->count = 0;
-        }
+    if (buff->count > 0) {
+        unix_write( buff->fd, buff->data, buff->count );
+        buff->count = 0;
     }
 }
 
+/* Append one record. The buffer is only ever flushed on record boundaries,
+ * so records written directly to the fd by forked children (see
+ * bootchart_service_event) can never land in the middle of one of ours.
+ */
 static void
-file_buff_done( FileBuff  buff )
+file_buff_write_record( FileBuff  buff, uint32_t  type, int64_t  time_ns,
+                        const void*  payload, int  len )
 {
-    if (buff->count > 0) {
-        unix_write( buff->fd, buff->data, buff->count );
-        buff->count = 0;
+    struct bootchart_record  rec;
+    int                      total = sizeof(rec) + len;
+
+    if (buff->fd < 0)
+        return;
+
+    rec.type    = type;
+    rec.len     = len;
+    rec.time_ns = time_ns;
+
+    if (buff->count + total > FILE_BUFF_SIZE)
+        file_buff_done(buff);
+
+    if (total > FILE_BUFF_SIZE) {
+        struct iovec  iov[2];
+        iov[0].iov_base = &rec;
+        iov[0].iov_len  = sizeof(rec);
+        iov[1].iov_base = (void*)payload;
+        iov[1].iov_len  = len;
+        writev(buff->fd, iov, 2);
+        return;
     }
+
+    memcpy( buff->data + buff->count, &rec, sizeof(rec) );
+    memcpy( buff->data + buff->count + sizeof(rec), payload, len );
+    buff->count += total;
 }
 
+static FileBuffRec  log_bin[1] = { { 0, -1, { 0 } } };
+static ScratchRec   scratch[1];
+
+static int64_t      start_ns;
+static int64_t      end_ns;
+static int64_t      next_sample_ns;
+static int64_t      next_procs_ns;
+static int          sample_period_ms = BOOTCHART_POLLING_MS;
+static int          procs_period_ms  = BOOTCHART_POLLING_MS;
+
 static void
 log_header(void)
 {
-    FILE*      out;
+    char       header[4096];
     char       cmdline[1024];
     char       uname[128];
     char       cpuinfo[128];
     char*      cpu;
     char       date[32];
+    int        len;
     time_t     now_t = time(NULL);
     struct tm  now = *localtime(&now_t);
     strftime(date, sizeof(date), "%x %X", &now);
 
-    out = fopen( LOG_HEADER, "w" );
-    if (out == NULL)
-        return;
-
     proc_read("/proc/cmdline", cmdline, sizeof(cmdline));
     proc_read("/proc/version", uname, sizeof(uname));
     proc_read("/proc/cpuinfo", cpuinfo, sizeof(cpuinfo));
@@ -148,104 +221,38 @@ log_header(void)
             *p = 0;
     }
 
-    fprintf(out, "version = %s\n", VERSION);
-    fprintf(out, "title = Boot chart for Android ( %s )\n", date);
-    fprintf(out, "system.uname = %s\n", uname);
-    fprintf(out, "system.release = 0.0\n");
-    fprintf(out, "system.cpu = %s\n", cpu);
-    fprintf(out, "system.kernel.options = %s\n", cmdline);
-    fclose(out);
-}
-
-static void
-close_on_exec(int  fd)
-{
-    fcntl(fd, F_SETFD, FD_CLOEXEC);
-}
-
-static void
-open_log_file(int*  plogfd, const char*  logfile)
-{
-    int    logfd = *plogfd;
-
-    /* create log file if needed */
-    if (logfd < 0) 
-    {
-        logfd = open(logfile,O_WRONLY|O_CREAT|O_TRUNC,0755);
-        if (logfd < 0) {
-            *plogfd = -2;
-            return;
-        }
-        close_on_exec(logfd);
-        *plogfd = logfd;
-    }
-}
-
-static void
-do_log_uptime(FileBuff  log)
-{
-    char  buff[65];
-    int   fd, ret, len;
-
-    fd = open("/proc/uptime",O_RDONLY);
-    if (fd >= 0) {
-        int  ret;
-        ret = unix_read(fd, buff, 64);
-        close(fd);
-        buff[64] = 0;
-        if (ret >= 0) {
-            long long  jiffies = 100LL*strtod(buff,NULL);
-            int        len;
-            snprintf(buff,sizeof(buff),"%lld\n",jiffies);
-            len = strlen(buff);
-            file_buff_write(log, buff, len);
-        }
-    }
+    len = snprintf(header, sizeof(header),
+                   "version = %s\n"
+                   "title = Boot chart for Android ( %s )\n"
+                   "system.uname = %s\n"
+                   "system.release = 0.0\n"
+                   "system.cpu = %s\n"
+                   "system.kernel.options = %s\n",
+                   VERSION, date, uname, cpu ? cpu : "", cmdline);
+    if (len >= (int)sizeof(header))
+        len = sizeof(header) - 1;
+
+    file_buff_write_record(log_bin, BOOTCHART_REC_HEADER, gettime_ns(), header, len);
 }
 
 static void
-do_log_ln(FileBuff  log)
+do_log_file(int64_t  now, uint32_t  type, const char*  procfile)
 {
-    file_buff_write(log, "\n", 1);
+    scratch->count = 0;
+    scratch_append_file(scratch, procfile);
+    file_buff_write_record(log_bin, type, now, scratch->data, scratch->count);
 }
 
-
 static void
-do_log_file(FileBuff  log, const char*  procfile)
-{
-    char   buff[1024];
-    int    fd;
-
-    do_log_uptime(log);
-
-    /* append file content */
-    fd = open(procfile,O_RDONLY);
-    if (fd >= 0) {
-        close_on_exec(fd);
-        for (;;) {
-            int  ret;
-            ret = unix_read(fd, buff, sizeof(buff));
-            if (ret <= 0)
-                break;
-
-            file_buff_write(log, buff, ret);
-            if (ret < (int)sizeof(buff))
-                break;
-        }
-        close(fd);
-    }
-
-    do_log_ln(log);
-}
-
-static void
-do_log_procs(FileBuff  log)
+do_log_procs(int64_t  now)
 {
     DIR*  dir = opendir("/proc");
     struct dirent*  entry;
 
-    do_log_uptime(log);
+    if (dir == NULL)
+        return;
 
+    scratch->count = 0;
     while ((entry = readdir(dir)) != NULL) {
         /* only match numeric values */
         char*  end;
@@ -269,43 +276,75 @@ do_log_procs(FileBuff  log)
                close(fd);
                if (len > 0) {
                     int  len2 = strlen(cmdline);
-                    if (len2 > 0) {
+                    const char*  p1;
+                    const char*  p2;
+                    buff[len] = 0;
+                    p1 = strchr(buff, '(');
+                    p2 = p1 ? strrchr(p1, ')') : NULL;
+                    if (len2 > 0 && p2 != NULL) {
                         /* we want to substitute the process name with its real name */
-                        const char*  p1;
-                        const char*  p2;
-                        buff[len] = 0;
-                        p1 = strchr(buff, '(');
-                        p2 = strchr(p1, ')');
-                        file_buff_write(log, buff, p1+1-buff);
-                        file_buff_write(log, cmdline, strlen(cmdline));
-                        file_buff_write(log, p2, strlen(p2));
+                        scratch_append(scratch, buff, p1+1-buff);
+                        scratch_append(scratch, cmdline, len2);
+                        scratch_append(scratch, p2, strlen(p2));
                     } else {
                         /* no substitution */
-                        file_buff_write(log,buff,len);
+                        scratch_append(scratch, buff, len);
                     }
                }
             }
         }
     }
     closedir(dir);
-    do_log_ln(log);
+
+    file_buff_write_record(log_bin, BOOTCHART_REC_PROCS, now, scratch->data, scratch->count);
+}
+
+/* returns the number at *s, or 'def' if there is none, and moves *s past it */
+static int
+parse_start_option(char**  s, int  def)
+{
+    char*  end;
+    long   value = strtol(*s, &end, 10);
+
+    if (end == *s)
+        return def;
+    *s = end;
+    return value;
 }
 
-static FileBuffRec  log_stat[1];
-static FileBuffRec  log_procs[1];
-static FileBuffRec  log_disks[1];
+/* parse "<timeout> [<period_ms> [<procs_period_ms>]]" */
+static int
+parse_start_options(const char*  s)
+{
+    char*  p = (char*) s;
+    int    timeout = parse_start_option(&p, 0);
+
+    sample_period_ms = parse_start_option(&p, BOOTCHART_POLLING_MS);
+    if (sample_period_ms < BOOTCHART_MIN_POLLING_MS)
+        sample_period_ms = BOOTCHART_MIN_POLLING_MS;
+
+    /* the process table is the expensive part of a sample; by default
+     * take it at the same rate as the rest
+     */
+    procs_period_ms = parse_start_option(&p, sample_period_ms);
+    if (procs_period_ms < sample_period_ms)
+        procs_period_ms = sample_period_ms;
+
+    return timeout;
+}
 
-/* called to setup bootcharting */
+/* called to setup bootcharting, returns the bootcharting time in seconds */
 int   bootchart_init( void )
 {
-    int  ret;
-    char buff[4];
-    int  timeout = 0, count = 0;
+    int      ret;
+    char     buff[64];
+    int      timeout = 0;
+    uint32_t file_header[2] = { BOOTCHART_LOG_MAGIC, BOOTCHART_LOG_VERSION };
 
     buff[0] = 0;
     proc_read( LOG_STARTFILE, buff, sizeof(buff) );
     if (buff[0] != 0) {
-        timeout = atoi(buff);
+        timeout = parse_start_options(buff);
     }
     else {
         /* when running with emulator, androidboot.bootchart=<timeout>
@@ -323,19 +362,18 @@ int   bootchart_init( void )
             timeout = atoi(s);
         }
     }
-    if (timeout == 0)
+    if (timeout <= 0)
         return 0;
 
     if (timeout > BOOTCHART_MAX_TIME_SEC)
         timeout = BOOTCHART_MAX_TIME_SEC;
 
-    count = (timeout*1000 + BOOTCHART_POLLING_MS-1)/BOOTCHART_POLLING_MS;
-
     do {ret=mkdir(LOG_ROOT,0755);}while (ret < 0 && errno == EINTR);
 
-    file_buff_open(log_stat,  LOG_STAT);
-    file_buff_open(log_procs, LOG_PROCS);
-    file_buff_open(log_disks, LOG_DISK);
+    file_buff_open(log_bin, LOG_BINARY);
+    if (log_bin->fd < 0)
+        return -1;
+    unix_write(log_bin->fd, file_header, sizeof(file_header));
 
     /* create kernel process accounting file */
     {
@@ -347,32 +385,91 @@ int   bootchart_init( void )
     }
 
     log_header();
-    return count;
+
+    start_ns       = gettime_ns();
+    end_ns         = start_ns + timeout * 1000LL * NS_PER_MS;
+    next_sample_ns = start_ns;
+    next_procs_ns  = start_ns;
+    return timeout;
 }
 
-/* called each time you want to perform a bootchart sampling op */
+int  bootchart_get_period_ms( void )
+{
+    return sample_period_ms;
+}
+
+/* Called from init's main loop; takes a sample when one is due. Returns
+ * the number of ms until the next sample is due, or -1 once bootcharting
+ * should stop.
+ */
 int  bootchart_step( void )
 {
-    do_log_file(log_stat,   "/proc/stat");
-    do_log_file(log_disks,  "/proc/diskstats");
-    do_log_procs(log_procs);
+    int64_t  now = gettime_ns();
 
-    /* we stop when /data/bootchart-stop contains 1 */
-    {
-        char  buff[2];
-        if (proc_read(LOG_STOPFILE,buff,sizeof(buff)) > 0 && buff[0] == '1') {
-            return -1;
+    if (now >= end_ns)
+        return -1;
+
+    if (now >= next_sample_ns) {
+        do_log_file(now, BOOTCHART_REC_STAT,      "/proc/stat");
+        do_log_file(now, BOOTCHART_REC_DISKSTATS, "/proc/diskstats");
+        if (now >= next_procs_ns) {
+            do_log_procs(now);
+            next_procs_ns = now + procs_period_ms * NS_PER_MS;
+        }
+        next_sample_ns = now + sample_period_ms * NS_PER_MS;
+
+        /* we stop when /data/bootchart-stop contains 1 */
+        {
+            char  buff[2];
+            if (proc_read(LOG_STOPFILE,buff,sizeof(buff)) > 0 && buff[0] == '1') {
+                return -1;
+            }
         }
     }
 
-    return 0;
+    return (int)((next_sample_ns - now + NS_PER_MS - 1) / NS_PER_MS);
+}
+
+/* Records a service lifecycle event. EXEC events are logged from the
+ * forked child right before execve(), so they bypass the buffer and go
+ * straight to the (O_APPEND) log as a single write.
+ */
+void  bootchart_service_event( const char*  name, int  pid, int  event )
+{
+    struct {
+        struct bootchart_record           rec;
+        struct bootchart_service_payload  payload;
+        char                              name[64];
+    } ev;
+    int  len;
+
+    if (log_bin->fd < 0)
+        return;
+
+    ev.payload.event = event;
+    ev.payload.pid   = pid;
+    strlcpy(ev.name, name, sizeof(ev.name));
+    len = sizeof(ev.payload) + strlen(ev.name) + 1;
+
+    if (event == BOOTCHART_EVENT_EXEC) {
+        ev.rec.type    = BOOTCHART_REC_SERVICE;
+        ev.rec.len     = len;
+        ev.rec.time_ns = gettime_ns();
+        unix_write(log_bin->fd, &ev, sizeof(ev.rec) + len);
+    } else {
+        file_buff_write_record(log_bin, BOOTCHART_REC_SERVICE, gettime_ns(),
+                               &ev.payload, len);
+    }
 }
 
 void  bootchart_finish( void )
 {
     unlink( LOG_STOPFILE );
-    file_buff_done(log_stat);
-    file_buff_done(log_disks);
-    file_buff_done(log_procs);
+    file_buff_done(log_bin);
+    close(log_bin->fd);
+    log_bin->fd = -1;
+    free(scratch->data);
+    scratch->data = NULL;
+    scratch->count = scratch->size = 0;
     acct(NULL);
 }
@@ -17,20 +17,62 @@
 #ifndef _BOOTCHART_H
 #define _BOOTCHART_H
 
+#include <stdint.h>
+
 #ifndef BOOTCHART
 # define  BOOTCHART  0
 #endif
 
+/* service lifecycle events recorded in the bootchart timeline */
+#define BOOTCHART_EVENT_FORK    1
+#define BOOTCHART_EVENT_EXEC    2
+#define BOOTCHART_EVENT_READY   3
+#define BOOTCHART_EVENT_EXIT    4
+
 #if BOOTCHART
 
 extern int   bootchart_init(void);
 extern int   bootchart_step(void);
+extern int   bootchart_get_period_ms(void);
 extern void  bootchart_finish(void);
+extern void  bootchart_service_event(const char*  name, int  pid, int  event);
 
-# define BOOTCHART_POLLING_MS   200   /* polling period in ms */
+# define BOOTCHART_POLLING_MS   200   /* default polling period in ms */
+# define BOOTCHART_MIN_POLLING_MS      10      /* min polling period in ms */
 # define BOOTCHART_DEFAULT_TIME_SEC    (2*60)  /* default polling time in seconds */
 # define BOOTCHART_MAX_TIME_SEC        (10*60) /* max polling time in seconds */
 
+/* The on-device log is a sequence of records, each a bootchart_record
+ * header immediately followed by 'len' bytes of payload. Records are only
+ * ever appended, so a log cut short by a reboot is still readable up to
+ * the last complete record. Use bootchart_convert.py on the host to turn
+ * it into the text logs the bootchart.org tools expect.
+ */
+# define BOOTCHART_LOG_MAGIC    0x54484342  /* "BCHT" */
+# define BOOTCHART_LOG_VERSION  1
+
+# define BOOTCHART_REC_HEADER     1  /* text, contents of the 'header' file */
+# define BOOTCHART_REC_STAT       2  /* raw /proc/stat */
+# define BOOTCHART_REC_DISKSTATS  3  /* raw /proc/diskstats */
+# define BOOTCHART_REC_PROCS      4  /* one /proc/<pid>/stat line per process */
+# define BOOTCHART_REC_SERVICE    5  /* bootchart_service_payload + name */
+
+struct bootchart_record {
+    uint32_t  type;
+    uint32_t  len;
+    int64_t   time_ns;   /* CLOCK_MONOTONIC, i.e. uptime */
+};
+
+struct bootchart_service_payload {
+    int32_t   event;
+    int32_t   pid;
+    /* followed by the NUL-terminated service name */
+};
+
+#else
+
+# define bootchart_service_event(name, pid, event)  do { } while (0)
+
 #endif /* BOOTCHART */
 
 #endif /* _BOOTCHART_H */
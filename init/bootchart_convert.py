@@ -0,0 +1,122 @@
+#! /usr/bin/env python
+
+# Copyright (C) 2013 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Converts the binary bootchart.bin log written by init (see bootchart.h)
+# into the text logs expected by the bootchart.org tools, plus a
+# services.log timeline of service lifecycle events.
+
+from __future__ import print_function
+import getopt, os, posixpath, struct, sys
+
+BOOTCHART_LOG_MAGIC = 0x54484342
+BOOTCHART_LOG_VERSION = 1
+
+REC_HEADER = 1
+REC_STAT = 2
+REC_DISKSTATS = 3
+REC_PROCS = 4
+REC_SERVICE = 5
+
+EVENTS = { 1: "fork", 2: "exec", 3: "ready", 4: "exit" }
+
+def usage(argv0):
+  print("""
+Usage: %s [-o output_dir] bootchart.bin
+ -o output_dir  directory to write the text logs to (default: .)
+""" % ( argv0 ))
+  sys.exit(2)
+
+def jiffies(time_ns):
+  # the text logs are stamped with uptime in 1/100 s
+  return time_ns // 10000000
+
+def read_records(path):
+  FH = open(path, 'rb')
+  magic, version = struct.unpack("<2I", FH.read(8))
+  if magic != BOOTCHART_LOG_MAGIC:
+    raise ValueError("%s: bad magic 0x%08x" % (path, magic))
+  if version != BOOTCHART_LOG_VERSION:
+    raise ValueError("%s: unsupported version %d" % (path, version))
+
+  records = []
+  while True:
+    rec_bin = FH.read(16)
+    if len(rec_bin) < 16:
+      break
+    rec_type, rec_len, time_ns = struct.unpack("<2Iq", rec_bin)
+    payload = FH.read(rec_len)
+    if len(payload) < rec_len:
+      # the log was cut short (e.g. by a reboot), keep what we have
+      break
+    records.append((time_ns, len(records), rec_type, payload))
+  FH.close()
+
+  # events logged by forked children are appended as they happen, and may
+  # land ahead of older, still-buffered samples
+  records.sort()
+  return records
+
+def main():
+  me = posixpath.basename(sys.argv[0])
+
+  outdir = "."
+  try:
+    opts, args = getopt.getopt(sys.argv[1:], "o:", ["output="])
+  except getopt.GetoptError as e:
+    print(e)
+    usage(me)
+  for o, a in opts:
+    if o in ("-o", "--output"):
+      outdir = a
+    else:
+      print("Unrecognized option \"%s\"" % (o))
+      usage(me)
+
+  if len(args) != 1:
+    usage(me)
+
+  records = read_records(args[0])
+
+  files = {}
+  def out(name):
+    if name not in files:
+      files[name] = open(os.path.join(outdir, name), 'wb')
+    return files[name]
+
+  sample_logs = { REC_STAT: "proc_stat.log",
+                  REC_DISKSTATS: "proc_diskstats.log",
+                  REC_PROCS: "proc_ps.log" }
+
+  for time_ns, _, rec_type, payload in records:
+    if rec_type == REC_HEADER:
+      out("header").write(payload)
+    elif rec_type in sample_logs:
+      FH = out(sample_logs[rec_type])
+      FH.write(("%d\n" % jiffies(time_ns)).encode())
+      FH.write(payload)
+      FH.write(b"\n")
+    elif rec_type == REC_SERVICE:
+      event, pid = struct.unpack("<2i", payload[:8])
+      name = payload[8:].split(b"\0", 1)[0].decode()
+      out("services.log").write(("%d.%06d %-6s %5d %s\n" % (
+          time_ns // 1000000000, (time_ns // 1000) % 1000000,
+          EVENTS.get(event, "?%d" % event), pid, name)).encode())
+
+  for FH in files.values():
+    FH.close()
+
+if __name__ == "__main__":
+  main()
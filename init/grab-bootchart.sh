@@ -11,12 +11,15 @@ mkdir -p $TMPDIR
 
 LOGROOT=/data/bootchart
 TARBALL=bootchart.tgz
+CONVERT=$(dirname $0)/bootchart_convert.py
 
 FILES="header proc_stat.log proc_ps.log proc_diskstats.log kernel_pacct"
 
-for f in $FILES; do
+for f in bootchart.bin kernel_pacct; do
     adb pull $LOGROOT/$f $TMPDIR/$f 2>&1 > /dev/null
 done
+python $CONVERT -o $TMPDIR $TMPDIR/bootchart.bin || exit 1
 (cd $TMPDIR && tar -czf $TARBALL $FILES)
 cp -f $TMPDIR/$TARBALL ./$TARBALL
+cp -f $TMPDIR/services.log ./bootchart-services.log 2>/dev/null
 echo "look at $TARBALL"
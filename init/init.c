@@ -24,7 +24,8 @@
 #include <sys/wait.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <mtd/mtd-user.h>
@@ -66,7 +67,7 @@ struct selabel_handle *sehandle_prop;
 static int property_triggers_enabled = 0;
 
 #if BOOTCHART
-static int   bootchart_count;
+static int   bootchart_active;
 #endif
 
 static char console[32];
@@ -79,6 +80,17 @@ static struct action *cur_action = NULL;
 static struct command *cur_command = NULL;
 static struct listnode *command_queue = NULL;
 
+/* Upper bound on queued commands run per main loop wakeup, so that property
+ * sets, signals and keychords are still serviced while a long queue drains.
+ */
+#define MAX_COMMANDS_PER_WAKEUP 16
+
+static int epoll_fd = -1;
+
+/* Set whenever something a pending service may be waiting on changes. */
+static int pending_services_dirty = 0;
+static int socket_watch_fd = -1;
+
 void notify_service_state(const char *name, const char *state)
 {
     char pname[PROP_NAME_MAX];
@@ -235,6 +247,81 @@ static void publish_socket(const char *name, int fd)
     fcntl(fd, F_SETFD, 0);
 }
 
+/*
+ * service_is_ready() - whether dependents of svc may be started. A oneshot
+ * service is ready once it has run to completion; any other service once
+ * update_service_ready() has seen it come up.
+ */
+static int service_is_ready(struct service *svc)
+{
+    if (svc->flags & SVC_ONESHOT)
+        return svc->time_started && !(svc->flags & SVC_RUNNING);
+
+    return (svc->flags & SVC_READY) != 0;
+}
+
+/*
+ * update_service_ready() - marks a running service SVC_READY once all of
+ * its sockets exist and its "ready" property, if any, matches. The flag
+ * stays set until the service exits, so a dependent that was started
+ * isn't left behind by a later property change.
+ */
+static void update_service_ready(struct service *svc)
+{
+    struct socketinfo *si;
+    struct stat s;
+    char path[128];
+    char value[PROP_VALUE_MAX];
+
+    /* oneshot services are ready when they complete, not when they start */
+    if (svc->flags & (SVC_READY | SVC_ONESHOT))
+        return;
+
+    for (si = svc->sockets; si; si = si->next) {
+        snprintf(path, sizeof(path), ANDROID_SOCKET_DIR"/%s", si->name);
+        if (stat(path, &s) != 0)
+            return;
+    }
+
+    if (svc->ready_prop_name) {
+        if (!properties_inited())
+            return;
+        property_get(svc->ready_prop_name, value);
+        if (!strcmp(svc->ready_prop_value, "*")) {
+            if (!value[0])
+                return;
+        } else if (strcmp(svc->ready_prop_value, value)) {
+            return;
+        }
+    }
+
+    svc->flags |= SVC_READY;
+    bootchart_service_event(svc->name, svc->pid, BOOTCHART_EVENT_READY);
+}
+
+static int service_deps_ready(struct service *svc)
+{
+    struct svcdepinfo *di;
+    struct service *dep;
+
+    for (di = svc->deps; di; di = di->next) {
+        dep = service_find_by_name(di->name);
+        if (!dep) {
+            ERROR("service '%s' depends on unknown service '%s', ignoring\n",
+                  svc->name, di->name);
+            continue;
+        }
+        if (!service_is_ready(dep))
+            return 0;
+    }
+    return 1;
+}
+
+void service_deps_changed(void)
+{
+    pending_services_dirty = 1;
+}
+
 void service_start(struct service *svc, const char *dynamic_args)
 {
     struct stat s;
@@ -248,7 +335,7 @@ void service_start(struct service *svc, const char *dynamic_args)
          * state and immediately takes it out of the restarting
          * state if it was in there
          */
-    svc->flags &= (~(SVC_DISABLED|SVC_RESTARTING|SVC_RESET|SVC_RESTART));
+    svc->flags &= (~(SVC_DISABLED|SVC_RESTARTING|SVC_RESET|SVC_RESTART|SVC_PENDING));
     svc->time_started = 0;
 
         /* running processes require no additional work -- if
@@ -280,6 +367,19 @@ void service_start(struct service *svc, const char *dynamic_args)
         return;
     }
 
+        /* defer the fork until everything we depend on is ready;
+         * start_pending_services() will retry as they come up
+         */
+    if (!service_deps_ready(svc)) {
+        INFO("deferring '%s' until its dependencies are ready\n", svc->name);
+        if (dynamic_args != svc->pending_args) {
+            free(svc->pending_args);
+            svc->pending_args = dynamic_args ? strdup(dynamic_args) : NULL;
+        }
+        svc->flags |= SVC_PENDING;
+        return;
+    }
+
     if (is_selinux_enabled() > 0) {
         if (svc->seclabel) {
             scon = strdup(svc->seclabel);
@@ -402,6 +502,8 @@ void service_start(struct service *svc, const char *dynamic_args)
             }
         }
 
+        bootchart_service_event(svc->name, getpid(), BOOTCHART_EVENT_EXEC);
+
         if (!dynamic_args) {
             if (execve(svc->args[0], (char**) svc->args, (char**) ENV) < 0) {
                 ERROR("cannot execve('%s'): %s\n", svc->args[0], strerror(errno));
@@ -438,6 +540,8 @@ void service_start(struct service *svc, const char *dynamic_args)
     svc->time_started = gettime();
     svc->pid = pid;
     svc->flags |= SVC_RUNNING;
+    bootchart_service_event(svc->name, pid, BOOTCHART_EVENT_FORK);
+    service_deps_changed();
 
     if (properties_inited())
         notify_service_state(svc->name, "running");
@@ -448,7 +552,11 @@ static void service_stop_or_reset(struct service *svc, int how)
 {
     /* The service is still SVC_RUNNING until its process exits, but if it has
      * already exited it shoudn't attempt a restart yet. */
-    svc->flags &= (~SVC_RESTARTING);
+    svc->flags &= (~(SVC_RESTARTING|SVC_PENDING));
+
+    /* a deferred start won't happen anymore, drop its arguments */
+    free(svc->pending_args);
+    svc->pending_args = NULL;
 
     if ((how != SVC_DISABLED) && (how != SVC_RESET) && (how != SVC_RESTART)) {
         /* Hrm, an illegal flag.  Default to SVC_DISABLED */
@@ -497,6 +605,7 @@ void property_changed(const char *name, const char *value)
 {
     if (property_triggers_enabled)
         queue_property_triggers(name, value);
+    service_deps_changed();
 }
 
 static void restart_service_if_needed(struct service *svc)
@@ -522,6 +631,62 @@ static void restart_processes()
                            restart_service_if_needed);
 }
 
+static void start_service_if_ready(struct service *svc)
+{
+    char *args;
+
+    if (!service_deps_ready(svc))
+        return;
+
+    args = svc->pending_args;
+    svc->pending_args = NULL;
+    service_start(svc, args);
+    free(args);
+}
+
+/*
+ * start_pending_services() - forks every deferred service whose
+ * dependencies have become ready. Starting one service can in turn
+ * satisfy others, so keep going until a pass changes nothing.
+ */
+static void start_pending_services(void)
+{
+    while (pending_services_dirty) {
+        pending_services_dirty = 0;
+        service_for_each_flags(SVC_RUNNING, update_service_ready);
+        service_for_each_flags(SVC_PENDING, start_service_if_ready);
+    }
+}
+
+static void handle_socket_watch(void)
+{
+    char buf[512];
+
+    /* we only care that something changed under ANDROID_SOCKET_DIR */
+    while (read(socket_watch_fd, buf, sizeof(buf)) > 0)
+        ;
+    service_deps_changed();
+}
+
+static void socket_watch_init(void)
+{
+    socket_watch_fd = inotify_init();
+    if (socket_watch_fd < 0) {
+        ERROR("inotify_init failed: %s\n", strerror(errno));
+        return;
+    }
+    fcntl(socket_watch_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(socket_watch_fd, F_SETFL, O_NONBLOCK);
+
+    if (inotify_add_watch(socket_watch_fd, ANDROID_SOCKET_DIR, IN_CREATE) < 0) {
+        ERROR("cannot watch %s: %s\n", ANDROID_SOCKET_DIR, strerror(errno));
+        close(socket_watch_fd);
+        socket_watch_fd = -1;
+        return;
+    }
+    register_epoll_handler(socket_watch_fd, handle_socket_watch);
+}
+
 static void msg_start(const char *name)
 {
     struct service *svc = NULL;
@@ -612,16 +777,30 @@ static int is_last_command(struct action *act, struct command *cmd)
     return (list_tail(&act->commands) == &cmd->clist);
 }
 
+static void finish_current_action(void)
+{
+    int64_t elapsed_ns;
+
+    if (!cur_action)
+        return;
+
+    elapsed_ns = gettime_ns() - cur_action->time_started_ns;
+    INFO("action %p (%s) took %lld.%03lld ms\n", cur_action, cur_action->name,
+         (long long) (elapsed_ns / 1000000), (long long) ((elapsed_ns / 1000) % 1000));
+}
+
 void execute_one_command(void)
 {
     int ret;
 
     if (!cur_action || !cur_command || is_last_command(cur_action, cur_command)) {
+        finish_current_action();
         cur_action = action_remove_queue_head();
         cur_command = NULL;
         if (!cur_action)
             return;
         INFO("processing action %p (%s)\n", cur_action, cur_action->name);
+        cur_action->time_started_ns = gettime_ns();
         cur_command = get_first_command(cur_action);
     } else {
         cur_command = get_next_command(cur_action, cur_command);
@@ -634,6 +813,41 @@ void execute_one_command(void)
     INFO("command '%s' r=%d\n", cur_command->args[0], ret);
 }
 
+static int has_pending_commands(void)
+{
+    if (cur_action && cur_command && !is_last_command(cur_action, cur_command))
+        return 1;
+    return !action_queue_empty();
+}
+
+/*
+ * execute_commands() - runs up to max_commands queued commands, stopping
+ * early once the action queue has drained.
+ */
+static void execute_commands(int max_commands)
+{
+    while (max_commands-- > 0 && has_pending_commands())
+        execute_one_command();
+
+    /* close out the timing of a fully executed action right away */
+    if (cur_action && !has_pending_commands()) {
+        finish_current_action();
+        cur_action = NULL;
+        cur_command = NULL;
+    }
+}
+
+void register_epoll_handler(int fd, void (*fn)(void))
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = (void *) fn;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        ERROR("epoll_ctl failed for fd %d: %s\n", fd, strerror(errno));
+    }
+}
+
 static int wait_for_coldboot_done_action(int nargs, char **args)
 {
     int ret;
@@ -915,11 +1129,13 @@ static int queue_property_triggers_action(int nargs, char **args)
 #if BOOTCHART
 static int bootchart_init_action(int nargs, char **args)
 {
-    bootchart_count = bootchart_init();
-    if (bootchart_count < 0) {
+    int timeout = bootchart_init();
+    if (timeout < 0) {
         ERROR("bootcharting init failure\n");
-    } else if (bootchart_count > 0) {
-        NOTICE("bootcharting started (period=%d ms)\n", bootchart_count*BOOTCHART_POLLING_MS);
+    } else if (timeout > 0) {
+        NOTICE("bootcharting started (%d s, period=%d ms)\n", timeout,
+               bootchart_get_period_ms());
+        bootchart_active = 1;
     } else {
         NOTICE("bootcharting ignored\n");
     }
@@ -1047,14 +1263,9 @@ static void selinux_initialize(void)
 
 int main(int argc, char **argv)
 {
-    int fd_count = 0;
-    struct pollfd ufds[4];
     char *tmpdev;
     char* debuggable;
     char tmp[32];
-    int property_set_fd_init = 0;
-    int signal_fd_init = 0;
-    int keychord_fd_init = 0;
     bool is_charger = false;
 
     if (!strcmp(basename(argv[0]), "ueventd"))
@@ -1092,6 +1303,15 @@ int main(int argc, char **argv)
          */
     open_devnull_stdio();
     klog_init();
+
+    epoll_fd = epoll_create(1);
+    if (epoll_fd == -1) {
+        ERROR("epoll_create failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+    socket_watch_init();
+
     property_init();
 
     get_hardware_name(hardware, &revision);
@@ -1167,32 +1387,12 @@ int main(int argc, char **argv)
 #endif
 
     for(;;) {
-        int nr, i, timeout = -1;
+        struct epoll_event ev;
+        int nr, timeout = -1;
 
-        execute_one_command();
+        execute_commands(MAX_COMMANDS_PER_WAKEUP);
         restart_processes();
-
-        if (!property_set_fd_init && get_property_set_fd() > 0) {
-            ufds[fd_count].fd = get_property_set_fd();
-            ufds[fd_count].events = POLLIN;
-            ufds[fd_count].revents = 0;
-            fd_count++;
-            property_set_fd_init = 1;
-        }
-        if (!signal_fd_init && get_signal_fd() > 0) {
-            ufds[fd_count].fd = get_signal_fd();
-            ufds[fd_count].events = POLLIN;
-            ufds[fd_count].revents = 0;
-            fd_count++;
-            signal_fd_init = 1;
-        }
-        if (!keychord_fd_init && get_keychord_fd() > 0) {
-            ufds[fd_count].fd = get_keychord_fd();
-            ufds[fd_count].events = POLLIN;
-            ufds[fd_count].revents = 0;
-            fd_count++;
-            keychord_fd_init = 1;
-        }
+        start_pending_services();
 
         if (process_needs_restart) {
             timeout = (process_needs_restart - gettime()) * 1000;
@@ -1200,33 +1400,26 @@ int main(int argc, char **argv)
                 timeout = 0;
         }
 
-        if (!action_queue_empty() || cur_action)
+        if (has_pending_commands())
             timeout = 0;
 
 #if BOOTCHART
-        if (bootchart_count > 0) {
-            if (timeout < 0 || timeout > BOOTCHART_POLLING_MS)
-                timeout = BOOTCHART_POLLING_MS;
-            if (bootchart_step() < 0 || --bootchart_count == 0) {
+        if (bootchart_active) {
+            int next_sample = bootchart_step();
+            if (next_sample < 0) {
                 bootchart_finish();
-                bootchart_count = 0;
+                bootchart_active = 0;
+            } else if (timeout < 0 || timeout > next_sample) {
+                timeout = next_sample;
             }
         }
 #endif
 
-        nr = poll(ufds, fd_count, timeout);
-        if (nr <= 0)
-            continue;
-
-        for (i = 0; i < fd_count; i++) {
-            if (ufds[i].revents == POLLIN) {
-                if (ufds[i].fd == get_property_set_fd())
-                    handle_property_set_fd();
-                else if (ufds[i].fd == get_keychord_fd())
-                    handle_keychord();
-                else if (ufds[i].fd == get_signal_fd())
-                    handle_signal();
-            }
+        nr = TEMP_FAILURE_RETRY(epoll_wait(epoll_fd, &ev, 1, timeout));
+        if (nr == -1) {
+            ERROR("epoll_wait failed: %s\n", strerror(errno));
+        } else if (nr == 1) {
+            ((void (*)(void)) ev.data.ptr)();
         }
     }
 
@@ -19,10 +19,14 @@
 
 #include <cutils/list.h>
 
+#include <stdint.h>
 #include <sys/stat.h>
 
 void handle_control_message(const char *msg, const char *arg);
 
+/* Registers fd with init's main loop; fn is called whenever fd is readable. */
+void register_epoll_handler(int fd, void (*fn)(void));
+
 struct command
 {
         /* list of commands in an action */
@@ -46,6 +50,9 @@ struct action {
     
     struct listnode commands;
     struct command *current;
+
+        /* monotonic time the action started executing, for boot timing */
+    int64_t time_started_ns;
 };
 
 struct socketinfo {
@@ -63,6 +70,11 @@ struct svcenvinfo {
     const char *value;
 };
 
+struct svcdepinfo {
+    struct svcdepinfo *next;
+    const char *name;
+};
+
 #define SVC_DISABLED    0x01  /* do not autostart with class */
 #define SVC_ONESHOT     0x02  /* do not restart on exit */
 #define SVC_RUNNING     0x04  /* currently active */
@@ -73,6 +85,8 @@ struct svcenvinfo {
                                  so it can be restarted with its class */
 #define SVC_RC_DISABLED 0x80  /* Remember if the disabled flag was set in the rc script */
 #define SVC_RESTART     0x100 /* Use to safely restart (stop, wait, start) a service */
+#define SVC_PENDING     0x200 /* start requested, waiting for dependencies */
+#define SVC_READY       0x400 /* running and its readiness condition is met */
 
 #define NR_SVC_SUPP_GIDS 32    /* 32 supplementary groups */
 
@@ -101,6 +115,14 @@ struct service {
     struct socketinfo *sockets;
     struct svcenvinfo *envvars;
 
+    /* services that must be ready before this one is started */
+    struct svcdepinfo *deps;
+    char *pending_args;     /* dynamic args of a deferred start */
+
+    /* optional "property:<name>=<value>" readiness condition */
+    const char *ready_prop_name;
+    const char *ready_prop_value;
+
     struct action onrestart;  /* Actions to execute on restart. */
     
     /* keycodes for triggering this service via /dev/keychord */
@@ -130,6 +152,7 @@ void service_stop(struct service *svc);
 void service_reset(struct service *svc);
 void service_restart(struct service *svc);
 void service_start(struct service *svc, const char *dynamic_args);
+void service_deps_changed(void);
 void property_changed(const char *name, const char *value);
 
 #define INIT_IMAGE_FILE	"/initlogo.rle"
@@ -79,6 +79,9 @@ struct {
 int lookup_keyword(const char *s)
 {
     switch (*s++) {
+    case 'a':
+        if (!strcmp(s, "fter")) return K_after;
+        break;
     case 'c':
     if (!strcmp(s, "opy")) return K_copy;
         if (!strcmp(s, "apability")) return K_capability;
@@ -133,6 +136,7 @@ int lookup_keyword(const char *s)
     case 'p':
         if (!strcmp(s, "owerctl")) return K_powerctl;
     case 'r':
+        if (!strcmp(s, "eady")) return K_ready;
         if (!strcmp(s, "estart")) return K_restart;
         if (!strcmp(s, "estorecon")) return K_restorecon;
         if (!strcmp(s, "mdir")) return K_rmdir;
@@ -659,6 +663,22 @@ static void parse_line_service(struct parse_state *state, int nargs, char **args
 
     kw = lookup_keyword(args[0]);
     switch (kw) {
+    case K_after:
+        if (nargs < 2) {
+            parse_error(state, "after option requires at least one service name\n");
+            break;
+        }
+        for (i = 1; i < nargs; i++) {
+            struct svcdepinfo *di = calloc(1, sizeof(*di));
+            if (!di) {
+                parse_error(state, "out of memory\n");
+                break;
+            }
+            di->name = args[i];
+            di->next = svc->deps;
+            svc->deps = di;
+        }
+        break;
     case K_capability:
         break;
     case K_class:
@@ -805,6 +825,23 @@ static void parse_line_service(struct parse_state *state, int nargs, char **args
             svc->uid = decode_uid(args[1]);
         }
         break;
+    case K_ready: { /* property:<name>=<value> */
+        char *name, *equals;
+        if (nargs != 2 || strncmp(args[1], "property:", strlen("property:"))) {
+            parse_error(state, "ready option usage: ready property:<name>=<value>\n");
+            break;
+        }
+        name = args[1] + strlen("property:");
+        equals = strchr(name, '=');
+        if (!equals || equals == name) {
+            parse_error(state, "ready option usage: ready property:<name>=<value>\n");
+            break;
+        }
+        *equals = '\0';
+        svc->ready_prop_name = name;
+        svc->ready_prop_value = equals + 1;
+        break;
+    }
     case K_seclabel:
         if (nargs != 2) {
             parse_error(state, "seclabel option requires a label string\n");
@@ -90,6 +90,8 @@ void keychord_init()
     keychords = 0;
 
     keychord_fd = fd;
+    if (keychord_fd >= 0)
+        register_epoll_handler(keychord_fd, handle_keychord);
 }
 
 void handle_keychord()
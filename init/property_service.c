@@ -603,6 +603,7 @@ void start_property_service(void)
 
     listen(fd, 8);
     property_set_fd = fd;
+    register_epoll_handler(property_set_fd, handle_property_set_fd);
 }
 
 int get_property_set_fd()
@@ -29,6 +29,7 @@
 #include "init.h"
 #include "util.h"
 #include "log.h"
+#include "bootchart.h"
 
 static int signal_fd = -1;
 static int signal_recv_fd = -1;
@@ -75,8 +76,11 @@ static int wait_for_one_process(int block)
         unlink(tmp);
     }
 
+    bootchart_service_event(svc->name, pid, BOOTCHART_EVENT_EXIT);
+
     svc->pid = 0;
-    svc->flags &= (~SVC_RUNNING);
+    svc->flags &= (~(SVC_RUNNING|SVC_READY));
+    service_deps_changed();
 
         /* oneshot processes go into the disabled state on exit,
          * except when manually restarted. */
@@ -146,6 +150,7 @@ void signal_init(void)
         fcntl(s[0], F_SETFL, O_NONBLOCK);
         fcntl(s[1], F_SETFD, FD_CLOEXEC);
         fcntl(s[1], F_SETFL, O_NONBLOCK);
+        register_epoll_handler(signal_recv_fd, handle_signal);
     }
 
     handle_signal();
@@ -272,6 +272,24 @@ time_t gettime(void)
     return ts.tv_sec;
 }
 
+/*
+ * gettime_ns() - returns the time in nanoseconds of the system's monotonic
+ * clock or zero on error.
+ */
+int64_t gettime_ns(void)
+{
+    struct timespec ts;
+    int ret;
+
+    ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    if (ret < 0) {
+        ERROR("clock_gettime(CLOCK_MONOTONIC) failed: %s\n", strerror(errno));
+        return 0;
+    }
+
+    return ((int64_t) ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
 int mkdir_recursive(const char *pathname, mode_t mode)
 {
     char buf[128];
@@ -17,6 +17,7 @@
 #ifndef _INIT_UTIL_H_
 #define _INIT_UTIL_H_
 
+#include <stdint.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -29,6 +30,7 @@ int create_socket(const char *name, int type, mode_t perm,
                   uid_t uid, gid_t gid);
 void *read_file(const char *fn, unsigned *_sz);
 time_t gettime(void);
+int64_t gettime_ns(void);
 unsigned int decode_uid(const char *s);
 
 int mkdir_recursive(const char *pathname, mode_t mode);
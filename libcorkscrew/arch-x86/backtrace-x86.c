@@ -114,26 +114,40 @@ uintptr_t rewind_pc_arch(const memory_t* memory __attribute__((unused)), uintptr
        To recognize signal frames we should read cie_info property. */
 }
 
-/* Read byte through 4 byte cache. Usually we read byte by byte and updating cursor. */
-static bool try_get_byte(const memory_t* memory, uintptr_t ptr, uint8_t* out_value, uint32_t* cursor) {
-    static uintptr_t lastptr;
-    static uint32_t buf;
+/* Memory of the unwound thread, with the last word read by try_get_byte.
+   One per unwind, so that threads unwinding at the same time don't share it. */
+typedef struct {
+    const memory_t* memory;
+    uintptr_t lastptr;
+    uint32_t buf;
+    bool valid;
+} dwarf_memory_t;
+
+static void init_dwarf_memory(dwarf_memory_t* memory, const memory_t* source) {
+    memory->memory = source;
+    memory->lastptr = 0;
+    memory->buf = 0;
+    memory->valid = false;
+}
 
+/* Read byte through 4 byte cache. Usually we read byte by byte and updating cursor. */
+static bool try_get_byte(dwarf_memory_t* memory, uintptr_t ptr, uint8_t* out_value, uint32_t* cursor) {
     ptr += *cursor;
 
-    if (ptr < lastptr || lastptr + 3 < ptr) {
-        lastptr = (ptr >> 2) << 2;
-        if (!try_get_word(memory, lastptr, &buf)) {
+    if (!memory->valid || ptr < memory->lastptr || memory->lastptr + 3 < ptr) {
+        memory->lastptr = (ptr >> 2) << 2;
+        memory->valid = try_get_word(memory->memory, memory->lastptr, &memory->buf);
+        if (!memory->valid) {
             return false;
         }
     }
-    *out_value = (uint8_t)((buf >> ((ptr & 3) * 8)) & 0xff);
+    *out_value = (uint8_t)((memory->buf >> ((ptr & 3) * 8)) & 0xff);
     ++*cursor;
     return true;
 }
 
 /* Getting X bytes. 4 is maximum for now. */
-static bool try_get_xbytes(const memory_t* memory, uintptr_t ptr, uint32_t* out_value, uint8_t bytes, uint32_t* cursor) {
+static bool try_get_xbytes(dwarf_memory_t* memory, uintptr_t ptr, uint32_t* out_value, uint8_t bytes, uint32_t* cursor) {
     uint32_t data = 0;
     if (bytes > 4) {
         ALOGE("can't read more than 4 bytes, trying to read %d", bytes);
@@ -151,7 +165,7 @@ static bool try_get_xbytes(const memory_t* memory, uintptr_t ptr, uint32_t* out_
 }
 
 /* Reads signed/unsigned LEB128 encoded data. From 1 to 4 bytes. */
-static bool try_get_leb128(const memory_t* memory, uintptr_t ptr, uint32_t* out_value, uint32_t* cursor, bool sign_extend) {
+static bool try_get_leb128(dwarf_memory_t* memory, uintptr_t ptr, uint32_t* out_value, uint32_t* cursor, bool sign_extend) {
     uint8_t buf = 0;
     uint32_t val = 0;
     uint8_t c = 0;
@@ -176,17 +190,17 @@ static bool try_get_leb128(const memory_t* memory, uintptr_t ptr, uint32_t* out_
 }
 
 /* Reads signed LEB128 encoded data. From 1 to 4 bytes. */
-static bool try_get_sleb128(const memory_t* memory, uintptr_t ptr, uint32_t* out_value, uint32_t* cursor) {
+static bool try_get_sleb128(dwarf_memory_t* memory, uintptr_t ptr, uint32_t* out_value, uint32_t* cursor) {
   return try_get_leb128(memory, ptr, out_value, cursor, true);
 }
 
 /* Reads unsigned LEB128 encoded data. From 1 to 4 bytes. */
-static bool try_get_uleb128(const memory_t* memory, uintptr_t ptr, uint32_t* out_value, uint32_t* cursor) {
+static bool try_get_uleb128(dwarf_memory_t* memory, uintptr_t ptr, uint32_t* out_value, uint32_t* cursor) {
   return try_get_leb128(memory, ptr, out_value, cursor, false);
 }
 
 /* Getting data encoded by dwarf encodings. */
-static bool read_dwarf(const memory_t* memory, uintptr_t ptr, uint32_t* out_value, uint8_t encoding, uint32_t* cursor) {
+static bool read_dwarf(dwarf_memory_t* memory, uintptr_t ptr, uint32_t* out_value, uint8_t encoding, uint32_t* cursor) {
     uint32_t data = 0;
     bool issigned = true;
     uintptr_t addr = ptr + *cursor;
@@ -239,7 +253,7 @@ static bool read_dwarf(const memory_t* memory, uintptr_t ptr, uint32_t* out_valu
 }
 
 /* Having PC find corresponding FDE by reading .eh_frame_hdr section data. */
-static uintptr_t find_fde(const memory_t* memory,
+static uintptr_t find_fde(dwarf_memory_t* memory,
                           const map_info_t* map_info_list, uintptr_t pc) {
     if (!pc) {
         ALOGV("find_fde: pc is zero, no eh_frame");
@@ -316,7 +330,7 @@ static uintptr_t find_fde(const memory_t* memory,
 }
 
 /* Execute single dwarf instruction and update dwarf state accordingly. */
-static bool execute_dwarf(const memory_t* memory, uintptr_t ptr, cie_info_t* cie_info,
+static bool execute_dwarf(dwarf_memory_t* memory, uintptr_t ptr, cie_info_t* cie_info,
                           dwarf_state_t* dstate, uint32_t* cursor,
                           dwarf_state_t* stack, uint8_t* stack_ptr) {
     uint8_t inst;
@@ -480,7 +494,7 @@ static bool execute_dwarf(const memory_t* memory, uintptr_t ptr, cie_info_t* cie
 }
 
 /* Restoring particular register value based on dwarf state. */
-static bool get_old_register_value(const memory_t* memory, uint32_t cfa,
+static bool get_old_register_value(dwarf_memory_t* memory, uint32_t cfa,
                                    dwarf_state_t* dstate, uint8_t reg,
                                    unwind_state_t* state, unwind_state_t* newstate) {
     uint32_t addr;
@@ -500,7 +514,7 @@ static bool get_old_register_value(const memory_t* memory, uint32_t cfa,
             break;
         case 'o':
             addr = cfa + (int32_t)dstate->regs[reg].value;
-            if (!try_get_word(memory, addr, &newstate->reg[reg])) {
+            if (!try_get_word(memory->memory, addr, &newstate->reg[reg])) {
                 ALOGE("get_old_register_value: can't read from 0x%x", addr);
                 return false;
             }
@@ -519,7 +533,7 @@ static bool get_old_register_value(const memory_t* memory, uint32_t cfa,
 }
 
 /* Updaing state based on dwarf state. */
-static bool update_state(const memory_t* memory, unwind_state_t* state,
+static bool update_state(dwarf_memory_t* memory, unwind_state_t* state,
                          dwarf_state_t* dstate, cie_info_t* cie_info) {
     unwind_state_t newstate;
     /* We can restore more registers here if we need them. Meanwile doing minimal work here. */
@@ -549,7 +563,7 @@ static bool update_state(const memory_t* memory, unwind_state_t* state,
 }
 
 /* Execute CIE and FDE instructions for FDE found with find_fde. */
-static bool execute_fde(const memory_t* memory,
+static bool execute_fde(dwarf_memory_t* memory,
                         const map_info_t* map_info_list,
                         uintptr_t fde,
                         unwind_state_t* state) {
@@ -574,14 +588,14 @@ static bool execute_fde(const memory_t* memory,
         1st word is length;
         2nd word is ID: 0 for CIE, CIE pointer for FDE.
     */
-    if (!try_get_word(memory, fde, &fde_length)) {
+    if (!try_get_word(memory->memory, fde, &fde_length)) {
         return false;
     }
     if ((int32_t)fde_length == -1) {
         ALOGV("execute_fde: 64-bit dwarf detected, not implemented yet");
         return false;
     }
-    if (!try_get_word(memory, fde + 4, &cie_offset)) {
+    if (!try_get_word(memory->memory, fde + 4, &cie_offset)) {
         return false;
     }
     if (cie_offset == 0) {
@@ -592,14 +606,14 @@ static bool execute_fde(const memory_t* memory,
         /* Find CIE. */
         /* Positive cie_offset goes backward from current field. */
         cie = fde + 4 - cie_offset;
-        if (!try_get_word(memory, cie, &cie_length)) {
+        if (!try_get_word(memory->memory, cie, &cie_length)) {
            return false;
         }
         if ((int32_t)cie_length == -1) {
            ALOGV("execute_fde: 64-bit dwarf detected, not implemented yet");
            return false;
         }
-        if (!try_get_word(memory, cie + 4, &cie_offset)) {
+        if (!try_get_word(memory->memory, cie + 4, &cie_offset)) {
            return false;
         }
         if (cie_offset != 0) {
@@ -756,7 +770,7 @@ static bool execute_fde(const memory_t* memory,
     return update_state(memory, state, dstate, cie_info);
 }
 
-static ssize_t unwind_backtrace_common(const memory_t* memory,
+static ssize_t unwind_backtrace_common(dwarf_memory_t* memory,
         const map_info_t* map_info_list,
         unwind_state_t* state, backtrace_frame_t* backtrace,
         size_t ignore_depth, size_t max_depth) {
@@ -764,7 +778,7 @@ static ssize_t unwind_backtrace_common(const memory_t* memory,
     size_t ignored_frames = 0;
     size_t returned_frames = 0;
 
-    ALOGV("Unwinding tid: %d", memory->tid);
+    ALOGV("Unwinding tid: %d", memory->memory->tid);
     ALOGV("IP: %x", state->reg[DWARF_EIP]);
     ALOGV("BP: %x", state->reg[DWARF_EBP]);
     ALOGV("SP: %x", state->reg[DWARF_ESP]);
@@ -777,19 +791,19 @@ static ssize_t unwind_backtrace_common(const memory_t* memory,
         if (!fde) {
             uint32_t ip;
             ALOGV("trying to restore registers from stack");
-            if (!try_get_word(memory, state->reg[DWARF_EBP] + 4, &ip) ||
+            if (!try_get_word(memory->memory, state->reg[DWARF_EBP] + 4, &ip) ||
                 ip == state->reg[DWARF_EIP]) {
                 ALOGV("can't get IP from stack");
                 break;
             }
             /* We've been able to get IP from stack so recording the frame before continue. */
             backtrace_frame_t* frame = add_backtrace_entry(
-                    index ? rewind_pc_arch(memory, state->reg[DWARF_EIP]) : state->reg[DWARF_EIP],
+                    index ? rewind_pc_arch(memory->memory, state->reg[DWARF_EIP]) : state->reg[DWARF_EIP],
                     backtrace, ignore_depth, max_depth,
                     &ignored_frames, &returned_frames);
             state->reg[DWARF_EIP] = ip;
             state->reg[DWARF_ESP] = state->reg[DWARF_EBP] + 8;
-            if (!try_get_word(memory, state->reg[DWARF_EBP], &state->reg[DWARF_EBP])) {
+            if (!try_get_word(memory->memory, state->reg[DWARF_EBP], &state->reg[DWARF_EBP])) {
                 ALOGV("can't get EBP from stack");
                 break;
             }
@@ -799,7 +813,7 @@ static ssize_t unwind_backtrace_common(const memory_t* memory,
             continue;
         }
         backtrace_frame_t* frame = add_backtrace_entry(
-                index ? rewind_pc_arch(memory, state->reg[DWARF_EIP]) : state->reg[DWARF_EIP],
+                index ? rewind_pc_arch(memory->memory, state->reg[DWARF_EIP]) : state->reg[DWARF_EIP],
                 backtrace, ignore_depth, max_depth,
                 &ignored_frames, &returned_frames);
 
@@ -835,8 +849,10 @@ ssize_t unwind_backtrace_signal_arch(siginfo_t* siginfo __attribute__((unused)),
 #endif
 
     memory_t memory;
+    dwarf_memory_t dwarf_memory;
     init_memory(&memory, map_info_list);
-    return unwind_backtrace_common(&memory, map_info_list,
+    init_dwarf_memory(&dwarf_memory, &memory);
+    return unwind_backtrace_common(&dwarf_memory, map_info_list,
             &state, backtrace, ignore_depth, max_depth);
 }
 
@@ -856,8 +872,10 @@ ssize_t unwind_backtrace_ptrace_arch(pid_t tid, const ptrace_context_t* context,
     state.reg[DWARF_ESP] = regs.esp;
 
     memory_t memory;
-    init_memory_ptrace(&memory, tid);
-    return unwind_backtrace_common(&memory, context->map_info_list,
+    dwarf_memory_t dwarf_memory;
+    init_memory_ptrace_context(&memory, tid, context);
+    init_dwarf_memory(&dwarf_memory, &memory);
+    return unwind_backtrace_common(&dwarf_memory, context->map_info_list,
             &state, backtrace, ignore_depth, max_depth);
 #endif
 }
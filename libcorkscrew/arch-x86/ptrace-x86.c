@@ -23,26 +23,26 @@
 #include <elf.h>
 #include <cutils/log.h>
 
-static void load_eh_frame_hdr(pid_t pid, map_info_t* mi, uintptr_t *eh_frame_hdr) {
+static void load_eh_frame_hdr(const memory_t* memory, map_info_t* mi, uintptr_t *eh_frame_hdr) {
     uint32_t elf_phoff;
     uint32_t elf_phentsize_ehsize;
     uint32_t elf_shentsize_phnum;
-    if (try_get_word_ptrace(pid, mi->start + offsetof(Elf32_Ehdr, e_phoff), &elf_phoff)
-            && try_get_word_ptrace(pid, mi->start + offsetof(Elf32_Ehdr, e_ehsize),
+    if (try_get_word(memory, mi->start + offsetof(Elf32_Ehdr, e_phoff), &elf_phoff)
+            && try_get_word(memory, mi->start + offsetof(Elf32_Ehdr, e_ehsize),
                     &elf_phentsize_ehsize)
-            && try_get_word_ptrace(pid, mi->start + offsetof(Elf32_Ehdr, e_phnum),
+            && try_get_word(memory, mi->start + offsetof(Elf32_Ehdr, e_phnum),
                     &elf_shentsize_phnum)) {
         uint32_t elf_phentsize = elf_phentsize_ehsize >> 16;
         uint32_t elf_phnum = elf_shentsize_phnum & 0xffff;
         for (uint32_t i = 0; i < elf_phnum; i++) {
             uintptr_t elf_phdr = mi->start + elf_phoff + i * elf_phentsize;
             uint32_t elf_phdr_type;
-            if (!try_get_word_ptrace(pid, elf_phdr + offsetof(Elf32_Phdr, p_type), &elf_phdr_type)) {
+            if (!try_get_word(memory, elf_phdr + offsetof(Elf32_Phdr, p_type), &elf_phdr_type)) {
                 break;
             }
             if (elf_phdr_type == PT_GNU_EH_FRAME) {
                 uint32_t elf_phdr_offset;
-                if (!try_get_word_ptrace(pid, elf_phdr + offsetof(Elf32_Phdr, p_offset),
+                if (!try_get_word(memory, elf_phdr + offsetof(Elf32_Phdr, p_offset),
                         &elf_phdr_offset)) {
                     break;
                 }
@@ -55,8 +55,9 @@ static void load_eh_frame_hdr(pid_t pid, map_info_t* mi, uintptr_t *eh_frame_hdr
     *eh_frame_hdr = 0;
 }
 
-void load_ptrace_map_info_data_arch(pid_t pid, map_info_t* mi, map_info_data_t* data) {
-    load_eh_frame_hdr(pid, mi, &data->eh_frame_hdr);
+void load_ptrace_map_info_data_arch(const memory_t* memory, map_info_t* mi,
+        map_info_data_t* data) {
+    load_eh_frame_hdr(memory, mi, &data->eh_frame_hdr);
 }
 
 void free_ptrace_map_info_data_arch(map_info_t* mi __attribute__((unused)),
@@ -20,6 +20,7 @@
 #include <corkscrew/map_info.h>
 
 #include <ctype.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +30,63 @@
 #include <cutils/log.h>
 #include <sys/time.h>
 
+/* The maps of a list sorted by address, so that find_map_info() is a binary
+ * search of one array rather than a walk of the list. */
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    const map_info_t* mi;
+} map_info_range_t;
+
+struct map_info_index {
+    size_t count;
+    map_info_range_t ranges[];
+};
+
+static int compare_map_info_ranges(const void* a, const void* b) {
+    const map_info_range_t* ra = (const map_info_range_t*)a;
+    const map_info_range_t* rb = (const map_info_range_t*)b;
+    if (ra->start > rb->start) return 1;
+    if (ra->start < rb->start) return -1;
+    return 0;
+}
+
+/* Attaches the index to the first map of the list. Lists with overlapping
+ * maps don't get one, the first match in the list wins for those. */
+static map_info_t* index_map_info_list(map_info_t* milist) {
+    size_t count = 0;
+    for (const map_info_t* mi = milist; mi; mi = mi->next) {
+        count++;
+    }
+    if (!count) {
+        return milist;
+    }
+
+    struct map_info_index* index = malloc(sizeof(struct map_info_index)
+            + count * sizeof(map_info_range_t));
+    if (!index) {
+        return milist;
+    }
+    index->count = count;
+    size_t i = 0;
+    for (const map_info_t* mi = milist; mi; mi = mi->next, i++) {
+        index->ranges[i].start = mi->start;
+        index->ranges[i].end = mi->end;
+        index->ranges[i].mi = mi;
+    }
+    qsort(index->ranges, count, sizeof(map_info_range_t), compare_map_info_ranges);
+    for (i = 1; i < count; i++) {
+        if (index->ranges[i].start < index->ranges[i - 1].end) {
+            ALOGV("Not indexing map list %p, maps overlap at 0x%08x.",
+                    milist, index->ranges[i].start);
+            free(index);
+            return milist;
+        }
+    }
+    milist->index = index;
+    return milist;
+}
+
 #if defined(__APPLE__)
 
 // Mac OS vmmap(1) output:
@@ -84,7 +142,7 @@ map_info_t* load_map_info_list(pid_t pid) {
         }
     }
     pclose(fp);
-    return milist;
+    return index_map_info_list(milist);
 }
 
 #else
@@ -93,25 +151,22 @@ map_info_t* load_map_info_list(pid_t pid) {
 // 6f000000-6f01e000 rwxp 00000000 00:0c 16389419   /system/lib/libcomposer.so\n
 // 012345678901234567890123456789012345678901234567890123456789
 // 0         1         2         3         4         5
-static map_info_t* parse_maps_line(const char* line)
+static map_info_t* parse_maps_line(const char* line, size_t length)
 {
     unsigned long int start;
     unsigned long int end;
     char permissions[5];
     int name_pos;
     if (sscanf(line, "%lx-%lx %4s %*x %*x:%*x %*d%n", &start, &end,
-            permissions, &name_pos) != 3) {
+            permissions, &name_pos) != 3 || (size_t)name_pos > length) {
         return NULL;
     }
 
-    while (isspace(line[name_pos])) {
+    while ((size_t)name_pos < length && isspace(line[name_pos])) {
         name_pos += 1;
     }
     const char* name = line + name_pos;
-    size_t name_len = strlen(name);
-    if (name_len && name[name_len - 1] == '\n') {
-        name_len -= 1;
-    }
+    size_t name_len = length - name_pos;
 
     map_info_t* mi = calloc(1, sizeof(map_info_t) + name_len + 1);
     if (mi) {
@@ -131,30 +186,155 @@ static map_info_t* parse_maps_line(const char* line)
     return mi;
 }
 
-map_info_t* load_map_info_list(pid_t tid) {
+/* Reads all of /proc/<tid>/maps, NUL terminated. */
+static char* read_maps_file(pid_t tid, size_t* out_length) {
     char path[PATH_MAX];
-    char line[1024];
-    FILE* fp;
-    map_info_t* milist = NULL;
-
     snprintf(path, PATH_MAX, "/proc/%d/maps", tid);
-    fp = fopen(path, "r");
-    if (fp) {
-        while(fgets(line, sizeof(line), fp)) {
-            map_info_t* mi = parse_maps_line(line);
-            if (mi) {
-                mi->next = milist;
-                milist = mi;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    size_t capacity = 16 * 1024;
+    size_t length = 0;
+    char* maps = malloc(capacity);
+    while (maps) {
+        if (length + 1 == capacity) {
+            char* new_maps = realloc(maps, capacity * 2);
+            if (!new_maps) {
+                free(maps);
+                maps = NULL;
+                break;
             }
+            maps = new_maps;
+            capacity *= 2;
+        }
+        ssize_t n = read(fd, maps + length, capacity - length - 1);
+        if (n < 0) {
+            free(maps);
+            maps = NULL;
+        } else if (n == 0) {
+            maps[length] = '\0';
+            *out_length = length;
+            break;
+        } else {
+            length += n;
+        }
+    }
+    close(fd);
+    return maps;
+}
+
+static size_t count_lines(const char* text, size_t length) {
+    size_t count = 0;
+    for (const char* p = text; (p = memchr(p, '\n', text + length - p)); p++) {
+        count++;
+    }
+    return count;
+}
+
+static bool is_line_start(const char* text, size_t pos, size_t head) {
+    return pos == head || text[pos - 1] == '\n';
+}
+
+static map_info_t* copy_map_info(const map_info_t* mi) {
+    size_t name_len = strlen(mi->name);
+    map_info_t* copy = calloc(1, sizeof(map_info_t) + name_len + 1);
+    if (copy) {
+        copy->start = mi->start;
+        copy->end = mi->end;
+        copy->is_readable = mi->is_readable;
+        copy->is_writable = mi->is_writable;
+        copy->is_executable = mi->is_executable;
+        memcpy(copy->name, mi->name, name_len + 1);
+    }
+    return copy;
+}
+
+/*
+ * Parses the contents of a maps file. If 'old' is the list parsed from
+ * 'old_maps', the maps of the lines both files start and end with are
+ * copied from it instead of being parsed again.
+ */
+static map_info_t* parse_maps(const char* maps, size_t length,
+        const map_info_t* old, const char* old_maps, size_t old_length) {
+    size_t head = 0;
+    size_t tail = 0;
+    size_t head_lines = 0;
+    size_t tail_lines = 0;
+    const struct map_info_index* index = old ? old->index : NULL;
+    if (index && count_lines(old_maps, old_length) == index->count) {
+        // Only whole lines are reused: the common head ends after a newline,
+        // and the common tail starts after one.
+        size_t limit = length < old_length ? length : old_length;
+        while (head < limit && maps[head] == old_maps[head]) {
+            head++;
+        }
+        while (head && maps[head - 1] != '\n') {
+            head--;
+        }
+        limit -= head;
+        while (tail < limit && maps[length - tail - 1] == old_maps[old_length - tail - 1]) {
+            tail++;
+        }
+        while (tail && !(is_line_start(maps, length - tail, head)
+                && is_line_start(old_maps, old_length - tail, head))) {
+            tail--;
+        }
+        head_lines = count_lines(maps, head);
+        tail_lines = count_lines(maps + length - tail, tail);
+        ALOGV("Reparsing maps, %d lines kept at the start and %d at the end.",
+                head_lines, tail_lines);
+    }
+
+    map_info_t* milist = NULL;
+    for (size_t i = 0; i < head_lines; i++) {
+        map_info_t* mi = copy_map_info(index->ranges[i].mi);
+        if (mi) {
+            mi->next = milist;
+            milist = mi;
+        }
+    }
+    const char* end = maps + length - tail;
+    for (const char* line = maps + head; line < end; ) {
+        const char* eol = memchr(line, '\n', end - line);
+        if (!eol) {
+            eol = end;
+        }
+        map_info_t* mi = parse_maps_line(line, eol - line);
+        if (mi) {
+            mi->next = milist;
+            milist = mi;
+        }
+        line = eol + 1;
+    }
+    for (size_t i = tail_lines; i > 0; i--) {
+        map_info_t* mi = copy_map_info(index->ranges[index->count - i].mi);
+        if (mi) {
+            mi->next = milist;
+            milist = mi;
         }
-        fclose(fp);
     }
+    return index_map_info_list(milist);
+}
+
+map_info_t* load_map_info_list(pid_t tid) {
+    size_t length;
+    char* maps = read_maps_file(tid, &length);
+    if (!maps) {
+        return NULL;
+    }
+    map_info_t* milist = parse_maps(maps, length, NULL, NULL, 0);
+    free(maps);
     return milist;
 }
 
 #endif
 
 void free_map_info_list(map_info_t* milist) {
+    if (milist) {
+        free(milist->index);
+    }
     while (milist) {
         map_info_t* next = milist->next;
         free(milist);
@@ -163,6 +343,25 @@ void free_map_info_list(map_info_t* milist) {
 }
 
 const map_info_t* find_map_info(const map_info_t* milist, uintptr_t addr) {
+    const struct map_info_index* index = milist ? milist->index : NULL;
+    if (index) {
+        // the last map that starts at or below addr
+        size_t low = 0;
+        size_t high = index->count;
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (index->ranges[mid].start <= addr) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        if (low && addr < index->ranges[low - 1].end) {
+            return index->ranges[low - 1].mi;
+        }
+        return NULL;
+    }
+
     const map_info_t* mi = milist;
     while (mi && !(addr >= mi->start && addr < mi->end)) {
         mi = mi->next;
@@ -193,6 +392,8 @@ static const int64_t MAX_CACHE_AGE = 5 * 1000 * 1000000LL;
 typedef struct {
     uint32_t refs;
     int64_t timestamp;
+    char* maps; // the contents of /proc/self/maps the list was parsed from
+    size_t maps_length;
 } my_map_info_data_t;
 
 static int64_t now_ns() {
@@ -211,11 +412,57 @@ static int64_t now_ns() {
 static void dec_ref(map_info_t* milist, my_map_info_data_t* data) {
     if (!--data->refs) {
         ALOGV("Freed my_map_info_list %p.", milist);
+        free(data->maps);
         free(data);
         free_map_info_list(milist);
     }
 }
 
+/* Replaces g_my_map_info_list with the current maps. It is kept if
+ * /proc/self/maps didn't change, and otherwise only the lines that changed
+ * are parsed again. */
+static void refresh_my_map_info_list(int64_t time) {
+    map_info_t* old = g_my_map_info_list;
+    my_map_info_data_t* old_data = old ? (my_map_info_data_t*)old->data : NULL;
+    char* maps = NULL;
+    size_t length = 0;
+    map_info_t* milist;
+#if !defined(__APPLE__)
+    maps = read_maps_file(getpid(), &length);
+    if (maps && old && length == old_data->maps_length && !memcmp(maps, old_data->maps, length)) {
+        ALOGV("Revalidated my_map_info_list %p.", old);
+        old_data->timestamp = time;
+        free(maps);
+        return;
+    }
+    milist = maps ? parse_maps(maps, length, old, old ? old_data->maps : NULL,
+            old ? old_data->maps_length : 0) : NULL;
+#else
+    milist = load_map_info_list(getpid());
+#endif
+
+    if (old) {
+        ALOGV("Invalidated my_map_info_list %p.", old);
+        dec_ref(old, old_data);
+        g_my_map_info_list = NULL;
+    }
+
+    my_map_info_data_t* data = (my_map_info_data_t*)malloc(sizeof(my_map_info_data_t));
+    if (milist != NULL && data != NULL) {
+        ALOGV("Loaded my_map_info_list %p.", milist);
+        milist->data = data;
+        data->refs = 1;
+        data->timestamp = time;
+        data->maps = maps;
+        data->maps_length = length;
+        g_my_map_info_list = milist;
+    } else {
+        free(data);
+        free(maps);
+        free_map_info_list(milist);
+    }
+}
+
 map_info_t* acquire_my_map_info_list() {
     pthread_mutex_lock(&g_my_map_info_list_mutex);
 
@@ -224,25 +471,12 @@ map_info_t* acquire_my_map_info_list() {
         my_map_info_data_t* data = (my_map_info_data_t*)g_my_map_info_list->data;
         int64_t age = time - data->timestamp;
         if (age >= MAX_CACHE_AGE) {
-            ALOGV("Invalidated my_map_info_list %p, age=%lld.", g_my_map_info_list, age);
-            dec_ref(g_my_map_info_list, data);
-            g_my_map_info_list = NULL;
+            refresh_my_map_info_list(time);
         } else {
             ALOGV("Reusing my_map_info_list %p, age=%lld.", g_my_map_info_list, age);
         }
-    }
-
-    if (g_my_map_info_list == NULL) {
-        my_map_info_data_t* data = (my_map_info_data_t*)malloc(sizeof(my_map_info_data_t));
-        g_my_map_info_list = load_map_info_list(getpid());
-        if (g_my_map_info_list != NULL) {
-            ALOGV("Loaded my_map_info_list %p.", g_my_map_info_list);
-            g_my_map_info_list->data = data;
-            data->refs = 1;
-            data->timestamp = time;
-        } else {
-            free(data);
-        }
+    } else {
+        refresh_my_map_info_list(time);
     }
 
     map_info_t* milist = g_my_map_info_list;
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#define _LARGEFILE64_SOURCE 1
 #define LOG_TAG "Corkscrew"
 //#define LOG_NDEBUG 0
 
@@ -21,8 +22,14 @@
 #include <corkscrew/ptrace.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <cutils/log.h>
 
 static const uint32_t ELF_MAGIC = 0x464C457f; // "ELF\0177"
@@ -35,14 +42,197 @@ static const uint32_t ELF_MAGIC = 0x464C457f; // "ELF\0177"
 #define PAGE_MASK (~(PAGE_SIZE - 1))
 #endif
 
+/* The memory cache is 4-way set associative. The pages of a stack, or of the
+ * headers of a library, are consecutive so they land in different sets. */
+#define MEMORY_CACHE_SETS 32
+#define MEMORY_CACHE_WAYS 4
+
+enum {
+    PAGE_EMPTY,
+    PAGE_LOADED,
+    PAGE_UNREADABLE,
+};
+
+typedef struct {
+    uintptr_t page;
+    uint32_t age;           // 0 when empty, so empty ways are evicted first
+    uint8_t state;
+    bool immutable;         // in a read-only map, kept when flushing
+    uint32_t* data;         // allocated on first use, kept when evicted
+} memory_cache_entry_t;
+
+struct memory_cache {
+    pid_t pid;
+    const map_info_t* map_info_list;
+    pthread_mutex_t mutex;
+    bool use_vm_readv;
+    int mem_fd;             // /proc/<pid>/mem, -1 if not opened yet, -2 if it can't be
+    uint32_t clock;
+    memory_cache_stats_t stats;
+    memory_cache_entry_t entries[MEMORY_CACHE_SETS][MEMORY_CACHE_WAYS];
+};
+
 void init_memory(memory_t* memory, const map_info_t* map_info_list) {
     memory->tid = -1;
     memory->map_info_list = map_info_list;
+    memory->cache = NULL;
 }
 
 void init_memory_ptrace(memory_t* memory, pid_t tid) {
     memory->tid = tid;
     memory->map_info_list = NULL;
+    memory->cache = NULL;
+}
+
+void init_memory_ptrace_context(memory_t* memory, pid_t tid, const ptrace_context_t* context) {
+    memory->tid = tid;
+    memory->map_info_list = NULL;
+    memory->cache = context ? context->memory_cache : NULL;
+}
+
+memory_cache_t* create_memory_cache(pid_t pid, const map_info_t* map_info_list) {
+    memory_cache_t* cache = (memory_cache_t*)calloc(1, sizeof(memory_cache_t));
+    if (cache) {
+        cache->pid = pid;
+        cache->map_info_list = map_info_list;
+        pthread_mutex_init(&cache->mutex, NULL);
+#ifdef __NR_process_vm_readv
+        cache->use_vm_readv = true;
+#endif
+        cache->mem_fd = -1;
+    }
+    return cache;
+}
+
+void free_memory_cache(memory_cache_t* cache) {
+    for (size_t i = 0; i < MEMORY_CACHE_SETS; i++) {
+        for (size_t j = 0; j < MEMORY_CACHE_WAYS; j++) {
+            free(cache->entries[i][j].data);
+        }
+    }
+    if (cache->mem_fd >= 0) {
+        close(cache->mem_fd);
+    }
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache);
+}
+
+void flush_memory_cache(memory_cache_t* cache) {
+    pthread_mutex_lock(&cache->mutex);
+    for (size_t i = 0; i < MEMORY_CACHE_SETS; i++) {
+        for (size_t j = 0; j < MEMORY_CACHE_WAYS; j++) {
+            memory_cache_entry_t* entry = &cache->entries[i][j];
+            if (!entry->immutable) {
+                entry->state = PAGE_EMPTY;
+                entry->age = 0;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void get_memory_cache_stats(memory_cache_t* cache, memory_cache_stats_t* out_stats) {
+    pthread_mutex_lock(&cache->mutex);
+    *out_stats = cache->stats;
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+/* Reads a whole page of the process with a single syscall. On failure, sets
+ * *out_unreadable if the page isn't mapped, as opposed to the process not
+ * letting us read it in bulk. */
+static bool load_page(memory_cache_t* cache, uintptr_t page, uint32_t* data,
+        bool* out_unreadable) {
+    *out_unreadable = false;
+#ifdef __NR_process_vm_readv
+    if (cache->use_vm_readv) {
+        struct iovec local = { data, PAGE_SIZE };
+        struct iovec remote = { (void*)page, PAGE_SIZE };
+        ssize_t n = syscall(__NR_process_vm_readv, cache->pid, &local, 1, &remote, 1, 0);
+        if (n == PAGE_SIZE) {
+            return true;
+        }
+        if (n < 0 && (errno == ENOSYS || errno == EPERM)) {
+            ALOGV("load_page: process_vm_readv() unavailable, errno=%d", errno);
+            cache->use_vm_readv = false;
+        }
+        // Unlike ptrace(), process_vm_readv() honors the protection of the
+        // map, so a page it can't read may still be readable below.
+    }
+#endif
+    if (cache->mem_fd == -1) {
+        char path[32];
+        snprintf(path, sizeof(path), "/proc/%d/mem", cache->pid);
+        cache->mem_fd = open(path, O_RDONLY);
+        if (cache->mem_fd < 0) {
+            ALOGV("load_page: cannot open %s, errno=%d", path, errno);
+            cache->mem_fd = -2;
+        }
+    }
+    if (cache->mem_fd >= 0) {
+        ssize_t n = pread64(cache->mem_fd, data, PAGE_SIZE, (off64_t)page);
+        if (n == PAGE_SIZE) {
+            return true;
+        }
+        *out_unreadable = n < 0 && errno == EIO;
+    }
+    return false;
+}
+
+/* Returns 1 and the word if its page is cached or could be loaded, 0 if the
+ * page is unreadable, and -1 if the word must be read with ptrace(). */
+static int get_cached_word(memory_cache_t* cache, uintptr_t ptr, uint32_t* out_value) {
+    uintptr_t page = ptr & PAGE_MASK;
+    memory_cache_entry_t* set = cache->entries[(page / PAGE_SIZE) % MEMORY_CACHE_SETS];
+    memory_cache_entry_t* entry = NULL;
+    int result;
+
+    pthread_mutex_lock(&cache->mutex);
+    for (size_t i = 0; i < MEMORY_CACHE_WAYS; i++) {
+        if (set[i].state != PAGE_EMPTY && set[i].page == page) {
+            entry = &set[i];
+            break;
+        }
+    }
+    if (entry) {
+        cache->stats.hits++;
+    } else {
+        entry = &set[0];
+        for (size_t i = 1; i < MEMORY_CACHE_WAYS; i++) {
+            if (set[i].age < entry->age) {
+                entry = &set[i];
+            }
+        }
+        entry->state = PAGE_EMPTY;
+        entry->age = 0;
+        if (!entry->data) {
+            entry->data = (uint32_t*)malloc(PAGE_SIZE);
+        }
+        bool unreadable = false;
+        if (entry->data && load_page(cache, page, entry->data, &unreadable)) {
+            entry->state = PAGE_LOADED;
+            cache->stats.misses++;
+        } else if (unreadable) {
+            entry->state = PAGE_UNREADABLE;
+            cache->stats.unreadable++;
+        } else {
+            cache->stats.uncached++;
+            pthread_mutex_unlock(&cache->mutex);
+            return -1;
+        }
+        const map_info_t* mi = find_map_info(cache->map_info_list, page);
+        entry->page = page;
+        entry->immutable = mi && !mi->is_writable;
+    }
+    entry->age = ++cache->clock;
+    if (entry->state == PAGE_LOADED) {
+        *out_value = entry->data[(ptr - page) / sizeof(uint32_t)];
+        result = 1;
+    } else {
+        *out_value = 0xffffffffL;
+        result = 0;
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    return result;
 }
 
 bool try_get_word(const memory_t* memory, uintptr_t ptr, uint32_t* out_value) {
@@ -65,6 +255,15 @@ bool try_get_word(const memory_t* memory, uintptr_t ptr, uint32_t* out_value) {
         ALOGV("no ptrace on Mac OS");
         return false;
 #else
+        if (memory->cache) {
+            int result = get_cached_word(memory->cache, ptr, out_value);
+            if (result >= 0) {
+                ALOGV_IF(!result, "try_get_word: pointer %p not readable in tid %d",
+                        (void*) ptr, memory->tid);
+                return result;
+            }
+        }
+
         // ptrace() returns -1 and sets errno when the operation fails.
         // To disambiguate -1 from a valid result, we clear errno beforehand.
         errno = 0;
@@ -85,18 +284,18 @@ bool try_get_word_ptrace(pid_t tid, uintptr_t ptr, uint32_t* out_value) {
     return try_get_word(&memory, ptr, out_value);
 }
 
-static void load_ptrace_map_info_data(pid_t pid, map_info_t* mi) {
+static void load_ptrace_map_info_data(const memory_t* memory, map_info_t* mi) {
     if (mi->is_executable && mi->is_readable) {
         uint32_t elf_magic;
-        if (try_get_word_ptrace(pid, mi->start, &elf_magic) && elf_magic == ELF_MAGIC) {
+        if (try_get_word(memory, mi->start, &elf_magic) && elf_magic == ELF_MAGIC) {
             map_info_data_t* data = (map_info_data_t*)calloc(1, sizeof(map_info_data_t));
             if (data) {
                 mi->data = data;
                 if (mi->name[0]) {
-                    data->symbol_table = load_symbol_table(mi->name);
+                    data->symbol_table = acquire_symbol_table(mi->name);
                 }
 #ifdef CORKSCREW_HAVE_ARCH
-                load_ptrace_map_info_data_arch(pid, mi, data);
+                load_ptrace_map_info_data_arch(memory, mi, data);
 #endif
             }
         }
@@ -108,8 +307,12 @@ ptrace_context_t* load_ptrace_context(pid_t pid) {
             (ptrace_context_t*)calloc(1, sizeof(ptrace_context_t));
     if (context) {
         context->map_info_list = load_map_info_list(pid);
+        context->memory_cache = create_memory_cache(pid, context->map_info_list);
+
+        memory_t memory;
+        init_memory_ptrace_context(&memory, pid, context);
         for (map_info_t* mi = context->map_info_list; mi; mi = mi->next) {
-            load_ptrace_map_info_data(pid, mi);
+            load_ptrace_map_info_data(&memory, mi);
         }
     }
     return context;
@@ -119,7 +322,7 @@ static void free_ptrace_map_info_data(map_info_t* mi) {
     map_info_data_t* data = (map_info_data_t*)mi->data;
     if (data) {
         if (data->symbol_table) {
-            free_symbol_table(data->symbol_table);
+            release_symbol_table(data->symbol_table);
         }
 #ifdef CORKSCREW_HAVE_ARCH
         free_ptrace_map_info_data_arch(mi, data);
@@ -134,6 +337,9 @@ void free_ptrace_context(ptrace_context_t* context) {
         free_ptrace_map_info_data(mi);
     }
     free_map_info_list(context->map_info_list);
+    if (context->memory_cache) {
+        free_memory_cache(context->memory_cache);
+    }
     free(context);
 }
 
@@ -19,10 +19,15 @@
 
 #include <corkscrew/symbol_table.h>
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <cutils/log.h>
@@ -107,6 +112,8 @@ symbol_table_t* load_symbol_table(const char *filename) {
         goto out_unmap;
     }
     table->num_symbols = 0;
+    table->names = NULL;
+    table->names_size = 0;
 
     Elf32_Sym *dynsyms = NULL;
     int dynnumsyms = 0;
@@ -134,6 +141,7 @@ symbol_table_t* load_symbol_table(const char *filename) {
         // are actually defined
         for (int i = 0; i < dynnumsyms; i++) {
             if (dynsyms[i].st_shndx != SHN_UNDEF) {
+                table->names_size += strlen(dynstr + dynsyms[i].st_name) + 1;
                 dynsymbol_count++;
             }
         }
@@ -148,6 +156,7 @@ symbol_table_t* load_symbol_table(const char *filename) {
                     && str[syms[i].st_name]
                     && syms[i].st_value
                     && syms[i].st_size) {
+                table->names_size += strlen(str + syms[i].st_name) + 1;
                 symbol_count++;
             }
         }
@@ -156,18 +165,24 @@ symbol_table_t* load_symbol_table(const char *filename) {
     // Now, create an entry in our symbol table structure for each symbol...
     table->num_symbols += symbol_count + dynsymbol_count;
     table->symbols = malloc(table->num_symbols * sizeof(symbol_t));
-    if (!table->symbols) {
+    table->names = malloc(table->names_size);
+    if (!table->symbols || !table->names) {
+        free(table->symbols);
+        free(table->names);
         free(table);
         table = NULL;
         goto out_unmap;
     }
 
+    // The names are all copied in one buffer
+    char* name = table->names;
     size_t symbol_index = 0;
     if (dynsym_idx != -1) {
         // ...and populate them
         for (int i = 0; i < dynnumsyms; i++) {
             if (dynsyms[i].st_shndx != SHN_UNDEF) {
-                table->symbols[symbol_index].name = strdup(dynstr + dynsyms[i].st_name);
+                table->symbols[symbol_index].name = name;
+                name = stpcpy(name, dynstr + dynsyms[i].st_name) + 1;
                 table->symbols[symbol_index].start = dynsyms[i].st_value;
                 table->symbols[symbol_index].end = dynsyms[i].st_value + dynsyms[i].st_size;
                 ALOGV("  [%d] '%s' 0x%08x-0x%08x (DYNAMIC)",
@@ -185,7 +200,8 @@ symbol_table_t* load_symbol_table(const char *filename) {
                     && str[syms[i].st_name]
                     && syms[i].st_value
                     && syms[i].st_size) {
-                table->symbols[symbol_index].name = strdup(str + syms[i].st_name);
+                table->symbols[symbol_index].name = name;
+                name = stpcpy(name, str + syms[i].st_name) + 1;
                 table->symbols[symbol_index].start = syms[i].st_value;
                 table->symbols[symbol_index].end = syms[i].st_value + syms[i].st_size;
                 ALOGV("  [%d] '%s' 0x%08x-0x%08x",
@@ -212,9 +228,7 @@ out:
 
 void free_symbol_table(symbol_table_t* table) {
     if (table) {
-        for (size_t i = 0; i < table->num_symbols; i++) {
-            free(table->symbols[i].name);
-        }
+        free(table->names);
         free(table->symbols);
         free(table);
     }
@@ -225,3 +239,313 @@ const symbol_t* find_symbol(const symbol_table_t* table, uintptr_t addr) {
     return (const symbol_t*)bsearch(&addr, table->symbols, table->num_symbols,
             sizeof(symbol_t), bcompar);
 }
+
+/* A symbol table of the cache, and the identity of the file it was loaded
+ * from. */
+typedef struct symbol_table_entry {
+    struct symbol_table_entry* next;
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    off_t size;
+    symbol_table_t* table;
+    size_t bytes;
+    int refs;
+    bool stale;             // the file changed, freed once released
+    char path[];
+} symbol_table_entry_t;
+
+/* Symbol index files are a header, the path of the file, the symbols sorted
+ * by address and then their names. */
+#define SYMBOL_INDEX_MAGIC 0x58444953 // "SIDX"
+#define SYMBOL_INDEX_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime;
+    int64_t size;
+    uint32_t path_length;
+    uint32_t num_symbols;
+    uint32_t names_size;
+    uint32_t reserved;
+} symbol_index_header_t;
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    uint32_t name;
+} symbol_index_entry_t;
+
+#define DEFAULT_SYMBOL_TABLE_CACHE_SIZE (8 * 1024 * 1024)
+
+static pthread_mutex_t g_symbol_table_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static symbol_table_entry_t* g_symbol_table_cache; // most recently used first
+static size_t g_symbol_table_cache_bytes;
+static size_t g_symbol_table_cache_size = DEFAULT_SYMBOL_TABLE_CACHE_SIZE;
+static char* g_symbol_table_index_dir;
+
+static void get_symbol_index_path(const char* filename, char* path, size_t size) {
+    // FNV-1a, the base name is only there to make the directory readable
+    uint32_t hash = 2166136261u;
+    for (const char* p = filename; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    const char* base = strrchr(filename, '/');
+    snprintf(path, size, "%s/%s.%08x", g_symbol_table_index_dir,
+            base ? base + 1 : filename, hash);
+}
+
+static symbol_table_t* load_symbol_index(const symbol_table_entry_t* entry) {
+    char path[PATH_MAX];
+    get_symbol_index_path(entry->path, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    symbol_table_t* table = NULL;
+    char* buf = NULL;
+    struct stat sb;
+    if (fstat(fd, &sb) || (size_t)sb.st_size < sizeof(symbol_index_header_t)) {
+        goto out;
+    }
+    size_t length = sb.st_size;
+    buf = malloc(length);
+    if (!buf || read(fd, buf, length) != (ssize_t)length) {
+        goto out;
+    }
+
+    symbol_index_header_t hdr;
+    memcpy(&hdr, buf, sizeof(hdr));
+    size_t entries_offset = sizeof(hdr) + hdr.path_length;
+    size_t names_offset = entries_offset + hdr.num_symbols * sizeof(symbol_index_entry_t);
+    if (hdr.magic != SYMBOL_INDEX_MAGIC || hdr.version != SYMBOL_INDEX_VERSION
+            || hdr.dev != (uint64_t)entry->dev || hdr.ino != (uint64_t)entry->ino
+            || hdr.mtime != (int64_t)entry->mtime || hdr.size != (int64_t)entry->size
+            || hdr.path_length != strlen(entry->path)
+            || memcmp(buf + sizeof(hdr), entry->path, hdr.path_length)
+            || hdr.num_symbols > length / sizeof(symbol_index_entry_t)
+            || names_offset + hdr.names_size != length
+            || (hdr.names_size && buf[length - 1])) {
+        ALOGV("Ignoring stale symbol index '%s'.", path);
+        goto out;
+    }
+
+    table = calloc(1, sizeof(symbol_table_t));
+    if (!table) {
+        goto out;
+    }
+    table->num_symbols = hdr.num_symbols;
+    table->names_size = hdr.names_size;
+    table->symbols = malloc(table->num_symbols * sizeof(symbol_t));
+    table->names = malloc(table->names_size);
+    if (!table->symbols || !table->names) {
+        goto out_free;
+    }
+    memcpy(table->names, buf + names_offset, table->names_size);
+    for (size_t i = 0; i < table->num_symbols; i++) {
+        symbol_index_entry_t e;
+        memcpy(&e, buf + entries_offset + i * sizeof(e), sizeof(e));
+        if (e.name >= table->names_size) {
+            goto out_free;
+        }
+        table->symbols[i].start = e.start;
+        table->symbols[i].end = e.end;
+        table->symbols[i].name = table->names + e.name;
+    }
+    ALOGV("Loaded %d symbols of '%s' from '%s'.", table->num_symbols, entry->path, path);
+    goto out;
+
+out_free:
+    free_symbol_table(table);
+    table = NULL;
+out:
+    free(buf);
+    close(fd);
+    return table;
+}
+
+static void save_symbol_index(const symbol_table_entry_t* entry) {
+    const symbol_table_t* table = entry->table;
+    symbol_index_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SYMBOL_INDEX_MAGIC;
+    hdr.version = SYMBOL_INDEX_VERSION;
+    hdr.dev = entry->dev;
+    hdr.ino = entry->ino;
+    hdr.mtime = entry->mtime;
+    hdr.size = entry->size;
+    hdr.path_length = strlen(entry->path);
+    hdr.num_symbols = table->num_symbols;
+    hdr.names_size = table->names_size;
+
+    size_t length = sizeof(hdr) + hdr.path_length
+            + hdr.num_symbols * sizeof(symbol_index_entry_t) + hdr.names_size;
+    char* buf = malloc(length);
+    if (!buf) {
+        return;
+    }
+    char* p = buf;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    memcpy(p, entry->path, hdr.path_length);
+    p += hdr.path_length;
+    for (size_t i = 0; i < table->num_symbols; i++) {
+        symbol_index_entry_t e;
+        e.start = table->symbols[i].start;
+        e.end = table->symbols[i].end;
+        e.name = table->symbols[i].name - table->names;
+        memcpy(p, &e, sizeof(e));
+        p += sizeof(e);
+    }
+    memcpy(p, table->names, hdr.names_size);
+
+    // Written aside then renamed, so a reader never sees half a file
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    get_symbol_index_path(entry->path, path, sizeof(path));
+    int fd = -1;
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) < (int)sizeof(tmp_path)) {
+        fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    }
+    if (fd >= 0) {
+        bool ok = write(fd, buf, length) == (ssize_t)length;
+        close(fd);
+        if (!ok || rename(tmp_path, path)) {
+            ALOGV("Cannot write symbol index '%s': %s", path, strerror(errno));
+            unlink(tmp_path);
+        }
+    }
+    free(buf);
+}
+
+static void free_symbol_table_entry(symbol_table_entry_t* entry) {
+    free_symbol_table(entry->table);
+    free(entry);
+}
+
+/* Frees the least recently used tables which aren't acquired, until the
+ * cache fits in its size. */
+static void trim_symbol_table_cache_locked(void) {
+    while (g_symbol_table_cache_bytes > g_symbol_table_cache_size) {
+        symbol_table_entry_t** victim = NULL;
+        for (symbol_table_entry_t** p = &g_symbol_table_cache; *p; p = &(*p)->next) {
+            if (!(*p)->refs) {
+                victim = p;
+            }
+        }
+        if (!victim) {
+            break;
+        }
+        symbol_table_entry_t* entry = *victim;
+        *victim = entry->next;
+        g_symbol_table_cache_bytes -= entry->bytes;
+        ALOGV("Evicting symbol table of '%s'.", entry->path);
+        free_symbol_table_entry(entry);
+    }
+}
+
+const symbol_table_t* acquire_symbol_table(const char* filename) {
+    struct stat sb;
+    if (stat(filename, &sb)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_symbol_table_cache_mutex);
+    symbol_table_entry_t* entry = NULL;
+    for (symbol_table_entry_t** p = &g_symbol_table_cache; *p; p = &(*p)->next) {
+        symbol_table_entry_t* e = *p;
+        if (!e->stale && e->ino == sb.st_ino && e->dev == sb.st_dev
+                && !strcmp(e->path, filename)) {
+            if (e->mtime == sb.st_mtime && e->size == sb.st_size) {
+                *p = e->next;
+                entry = e;
+            } else if (e->refs) {
+                e->stale = true;
+            } else {
+                *p = e->next;
+                g_symbol_table_cache_bytes -= e->bytes;
+                free_symbol_table_entry(e);
+            }
+            break;
+        }
+    }
+
+    if (!entry) {
+        size_t path_length = strlen(filename);
+        entry = calloc(1, sizeof(symbol_table_entry_t) + path_length + 1);
+        if (!entry) {
+            pthread_mutex_unlock(&g_symbol_table_cache_mutex);
+            return NULL;
+        }
+        memcpy(entry->path, filename, path_length + 1);
+        entry->dev = sb.st_dev;
+        entry->ino = sb.st_ino;
+        entry->mtime = sb.st_mtime;
+        entry->size = sb.st_size;
+        if (g_symbol_table_index_dir) {
+            entry->table = load_symbol_index(entry);
+        }
+        if (!entry->table) {
+            entry->table = load_symbol_table(filename);
+            if (entry->table && g_symbol_table_index_dir) {
+                save_symbol_index(entry);
+            }
+        }
+        // a file without symbols is cached too, so it isn't parsed again
+        entry->bytes = sizeof(symbol_table_entry_t) + path_length + 1;
+        if (entry->table) {
+            entry->bytes += sizeof(symbol_table_t)
+                    + entry->table->num_symbols * sizeof(symbol_t) + entry->table->names_size;
+        }
+        g_symbol_table_cache_bytes += entry->bytes;
+    }
+
+    entry->next = g_symbol_table_cache;
+    g_symbol_table_cache = entry;
+    const symbol_table_t* table = entry->table;
+    if (table) {
+        entry->refs++;
+    }
+    trim_symbol_table_cache_locked();
+    pthread_mutex_unlock(&g_symbol_table_cache_mutex);
+    return table;
+}
+
+void release_symbol_table(const symbol_table_t* table) {
+    if (!table) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_symbol_table_cache_mutex);
+    for (symbol_table_entry_t** p = &g_symbol_table_cache; *p; p = &(*p)->next) {
+        symbol_table_entry_t* entry = *p;
+        if (entry->table == table) {
+            if (!--entry->refs && entry->stale) {
+                *p = entry->next;
+                g_symbol_table_cache_bytes -= entry->bytes;
+                free_symbol_table_entry(entry);
+            }
+            break;
+        }
+    }
+    trim_symbol_table_cache_locked();
+    pthread_mutex_unlock(&g_symbol_table_cache_mutex);
+}
+
+void set_symbol_table_cache_size(size_t bytes) {
+    pthread_mutex_lock(&g_symbol_table_cache_mutex);
+    g_symbol_table_cache_size = bytes;
+    trim_symbol_table_cache_locked();
+    pthread_mutex_unlock(&g_symbol_table_cache_mutex);
+}
+
+void set_symbol_table_index_dir(const char* dir) {
+    pthread_mutex_lock(&g_symbol_table_cache_mutex);
+    free(g_symbol_table_index_dir);
+    g_symbol_table_index_dir = dir ? strdup(dir) : NULL;
+    pthread_mutex_unlock(&g_symbol_table_cache_mutex);
+}
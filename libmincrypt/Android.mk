@@ -4,13 +4,13 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_MODULE := libmincrypt
-LOCAL_SRC_FILES := rsa.c sha.c sha256.c
+LOCAL_SRC_FILES := rsa.c sha.c sha256.c sha_multi.c sha_x86.c sha_arm.c
 include $(BUILD_STATIC_LIBRARY)
 
 include $(CLEAR_VARS)
 
 LOCAL_MODULE := libmincrypt
-LOCAL_SRC_FILES := rsa.c sha.c sha256.c
+LOCAL_SRC_FILES := rsa.c sha.c sha256.c sha_multi.c sha_x86.c sha_arm.c
 include $(BUILD_HOST_STATIC_LIBRARY)
 
 
@@ -29,6 +29,8 @@
 #include "mincrypt/sha.h"
 #include "mincrypt/sha256.h"
 
+#if !defined(__SIZEOF_INT128__)
+
 // a[] -= mod
 static void subM(const RSAPublicKey* key,
                  uint32_t* a) {
@@ -142,6 +144,128 @@ static void modpow(const RSAPublicKey* key,
     }
 }
 
+#else  // __SIZEOF_INT128__
+
+// The same Montgomery arithmetic on 64 bit limbs, for cpus with a 64x64->128
+// multiply.  R is 2^2048 either way, so key->rr carries over unchanged.
+
+typedef unsigned __int128 uint128_t;
+
+#define RSANUMLIMBS (RSANUMWORDS / 2)
+
+// a[] -= mod
+static void subM64(const RSAKeyContext* ctx,
+                   uint64_t* a) {
+    uint64_t borrow = 0;
+    int i;
+    for (i = 0; i < RSANUMLIMBS; ++i) {
+        uint128_t A = (uint128_t)a[i] - ctx->n[i] - borrow;
+        a[i] = (uint64_t)A;
+        borrow = (uint64_t)(A >> 64) & 1;
+    }
+}
+
+// return a[] >= mod
+static int geM64(const RSAKeyContext* ctx,
+                 const uint64_t* a) {
+    int i;
+    for (i = RSANUMLIMBS; i;) {
+        --i;
+        if (a[i] < ctx->n[i]) return 0;
+        if (a[i] > ctx->n[i]) return 1;
+    }
+    return 1;  // equal
+}
+
+// montgomery c[] += a * b[] / R % mod
+static void montMulAdd64(const RSAKeyContext* ctx,
+                         uint64_t* c,
+                         const uint64_t a,
+                         const uint64_t* b) {
+    uint128_t A = (uint128_t)a * b[0] + c[0];
+    uint64_t d0 = (uint64_t)A * ctx->n0inv;
+    uint128_t B = (uint128_t)d0 * ctx->n[0] + (uint64_t)A;
+    int i;
+
+    for (i = 1; i < RSANUMLIMBS; ++i) {
+        A = (A >> 64) + (uint128_t)a * b[i] + c[i];
+        B = (B >> 64) + (uint128_t)d0 * ctx->n[i] + (uint64_t)A;
+        c[i - 1] = (uint64_t)B;
+    }
+
+    A = (A >> 64) + (B >> 64);
+
+    c[i - 1] = (uint64_t)A;
+
+    if (A >> 64) {
+        subM64(ctx, c);
+    }
+}
+
+// montgomery c[] = a[] * b[] / R % mod
+static void montMul64(const RSAKeyContext* ctx,
+                      uint64_t* c,
+                      const uint64_t* a,
+                      const uint64_t* b) {
+    int i;
+    for (i = 0; i < RSANUMLIMBS; ++i) {
+        c[i] = 0;
+    }
+    for (i = 0; i < RSANUMLIMBS; ++i) {
+        montMulAdd64(ctx, c, a[i], b);
+    }
+}
+
+// In-place public exponentiation, as modpow.
+static void modpow64(const RSAKeyContext* ctx,
+                     uint8_t* inout) {
+    uint64_t a[RSANUMLIMBS];
+    uint64_t aR[RSANUMLIMBS];
+    uint64_t aaR[RSANUMLIMBS];
+    uint64_t* aaa = 0;
+    int i, j;
+
+    // Convert from big endian byte array to little endian limb array.
+    for (i = 0; i < RSANUMLIMBS; ++i) {
+        const uint8_t* p = inout + (RSANUMLIMBS - 1 - i) * 8;
+        uint64_t tmp = 0;
+        for (j = 0; j < 8; ++j) {
+            tmp = (tmp << 8) | p[j];
+        }
+        a[i] = tmp;
+    }
+
+    if (ctx->exponent == 65537) {
+        aaa = aaR;  // Re-use location.
+        montMul64(ctx, aR, a, ctx->rr);  // aR = a * RR / R mod M
+        for (i = 0; i < 16; i += 2) {
+            montMul64(ctx, aaR, aR, aR);  // aaR = aR * aR / R mod M
+            montMul64(ctx, aR, aaR, aaR);  // aR = aaR * aaR / R mod M
+        }
+        montMul64(ctx, aaa, aR, a);  // aaa = aR * a / R mod M
+    } else if (ctx->exponent == 3) {
+        aaa = aR;  // Re-use location.
+        montMul64(ctx, aR, a, ctx->rr);  /* aR = a * RR / R mod M   */
+        montMul64(ctx, aaR, aR, aR);     /* aaR = aR * aR / R mod M */
+        montMul64(ctx, aaa, aaR, a);     /* aaa = aaR * a / R mod M */
+    }
+
+    // Make sure aaa < mod; aaa is at most 1x mod too large.
+    if (geM64(ctx, aaa)) {
+        subM64(ctx, aaa);
+    }
+
+    // Convert to bigendian byte array
+    for (i = RSANUMLIMBS - 1; i >= 0; --i) {
+        uint64_t tmp = aaa[i];
+        for (j = 56; j >= 0; j -= 8) {
+            *inout++ = tmp >> j;
+        }
+    }
+}
+
+#endif  // __SIZEOF_INT128__
+
 // Expected PKCS1.5 signature padding bytes, for a keytool RSA signature.
 // Has the 0-length optional parameter encoded in the ASN1 (as opposed to the
 // other flavor which omits the optional parameter entirely). This code does not
@@ -239,26 +363,52 @@ static const uint8_t kExpectedPadSha256Rsa2048[SHA256_DIGEST_SIZE] = {
     0x90, 0xe8, 0x7d, 0x8b, 0xe1, 0x7c, 0x87, 0x59,
 };
 
-// Verify a 2048-bit RSA PKCS1.5 signature against an expected hash.
-// Both e=3 and e=65537 are supported.  hash_len may be
-// SHA_DIGEST_SIZE (== 20) to indicate a SHA-1 hash, or
-// SHA256_DIGEST_SIZE (== 32) to indicate a SHA-256 hash.  No other
-// values are supported.
+// Prepare a key for repeated verification.  Checks the key once and
+// converts it to the form the fastest available arithmetic wants.
 //
-// Returns 1 on successful verification, 0 on failure.
-int RSA_verify(const RSAPublicKey *key,
-               const uint8_t *signature,
-               const int len,
-               const uint8_t *hash,
-               const int hash_len) {
-    uint8_t buf[RSANUMBYTES];
+// Returns 1 on success, 0 if the key is not supported.
+int RSA_init_context(RSAKeyContext* ctx,
+                     const RSAPublicKey* key) {
     int i;
-    const uint8_t* padding_hash;
 
     if (key->len != RSANUMWORDS) {
         return 0;  // Wrong key passed in.
     }
 
+    if (key->exponent != 3 && key->exponent != 65537) {
+        return 0;  // Unsupported exponent.
+    }
+
+    ctx->key = *key;
+    ctx->exponent = key->exponent;
+
+    for (i = 0; i < RSANUMWORDS / 2; ++i) {
+        ctx->n[i] = key->n[2 * i] | ((uint64_t)key->n[2 * i + 1] << 32);
+        ctx->rr[i] = key->rr[2 * i] | ((uint64_t)key->rr[2 * i + 1] << 32);
+    }
+
+    // Lift -1 / n[0] from mod 2^32 to mod 2^64 with one Newton step on the
+    // inverse x = 1 / n[0], which doubles its number of correct bits.
+    {
+        uint64_t x = (uint32_t)-key->n0inv;
+        x *= 2 - ctx->n[0] * x;
+        ctx->n0inv = -x;
+    }
+
+    return 1;
+}
+
+// Verify a 2048-bit RSA PKCS1.5 signature against an expected hash, using a
+// key prepared by RSA_init_context.  See RSA_verify.
+int RSA_verify_context(const RSAKeyContext* ctx,
+                       const uint8_t *signature,
+                       const int len,
+                       const uint8_t *hash,
+                       const int hash_len) {
+    uint8_t buf[RSANUMBYTES];
+    int i;
+    const uint8_t* padding_hash;
+
     if (len != sizeof(buf)) {
         return 0;  // Wrong input length.
     }
@@ -268,15 +418,15 @@ int RSA_verify(const RSAPublicKey *key,
         return 0;  // Unsupported hash.
     }
 
-    if (key->exponent != 3 && key->exponent != 65537) {
-        return 0;  // Unsupported exponent.
-    }
-
     for (i = 0; i < len; ++i) {  // Copy input to local workspace.
         buf[i] = signature[i];
     }
 
-    modpow(key, buf);  // In-place exponentiation.
+#if defined(__SIZEOF_INT128__)
+    modpow64(ctx, buf);  // In-place exponentiation.
+#else
+    modpow(&ctx->key, buf);  // In-place exponentiation.
+#endif
 
     // Xor sha portion, so it all becomes 00 iff equal.
     for (i = len - hash_len; i < len; ++i) {
@@ -306,3 +456,51 @@ int RSA_verify(const RSAPublicKey *key,
 
     return 1;  // All checked out OK.
 }
+
+// Verify count signatures made with the same key, signatures[i] against
+// hashes[i].  results[i], if results is not NULL, is set to 1 or 0 as
+// RSA_verify would return.
+//
+// Returns the number of signatures that verified.
+int RSA_verify_batch(const RSAKeyContext* ctx,
+                     const uint8_t* const* signatures,
+                     const int len,
+                     const uint8_t* const* hashes,
+                     const int hash_len,
+                     const int count,
+                     int* results) {
+    int verified = 0;
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        int ret = RSA_verify_context(ctx, signatures[i], len,
+                                     hashes[i], hash_len);
+        if (results) {
+            results[i] = ret;
+        }
+        verified += ret;
+    }
+
+    return verified;
+}
+
+// Verify a 2048-bit RSA PKCS1.5 signature against an expected hash.
+// Both e=3 and e=65537 are supported.  hash_len may be
+// SHA_DIGEST_SIZE (== 20) to indicate a SHA-1 hash, or
+// SHA256_DIGEST_SIZE (== 32) to indicate a SHA-256 hash.  No other
+// values are supported.
+//
+// Returns 1 on successful verification, 0 on failure.
+int RSA_verify(const RSAPublicKey *key,
+               const uint8_t *signature,
+               const int len,
+               const uint8_t *hash,
+               const int hash_len) {
+    RSAKeyContext ctx;
+
+    if (!RSA_init_context(&ctx, key)) {
+        return 0;
+    }
+
+    return RSA_verify_context(&ctx, signature, len, hash, hash_len);
+}
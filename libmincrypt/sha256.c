@@ -25,9 +25,11 @@
 ** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-// Optimized for minimal code size.
+// The portable block function is optimized for minimal code size; where the
+// cpu has SHA instructions SHA256_update uses those instead.
 
 #include "mincrypt/sha256.h"
+#include "sha_accel.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -36,7 +38,7 @@
 #define ror(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
 #define shr(value, bits) ((value) >> (bits))
 
-static const uint32_t K[64] = {
+const uint32_t SHA256_K[64] = {
     0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
     0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
     0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
@@ -54,10 +56,9 @@ static const uint32_t K[64] = {
     0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
     0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
 
-static void SHA256_Transform(SHA256_CTX* ctx) {
+static void SHA256_Transform(uint32_t* state, const uint8_t* p) {
     uint32_t W[64];
     uint32_t A, B, C, D, E, F, G, H;
-    uint8_t* p = ctx->buf;
     int t;
 
     for(t = 0; t < 16; ++t) {
@@ -74,14 +75,14 @@ static void SHA256_Transform(SHA256_CTX* ctx) {
         W[t] = W[t-16] + s0 + W[t-7] + s1;
     }
 
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
-    F = ctx->state[5];
-    G = ctx->state[6];
-    H = ctx->state[7];
+    A = state[0];
+    B = state[1];
+    C = state[2];
+    D = state[3];
+    E = state[4];
+    F = state[5];
+    G = state[6];
+    H = state[7];
 
     for(t = 0; t < 64; t++) {
         uint32_t s0 = ror(A, 2) ^ ror(A, 13) ^ ror(A, 22);
@@ -89,7 +90,7 @@ static void SHA256_Transform(SHA256_CTX* ctx) {
         uint32_t t2 = s0 + maj;
         uint32_t s1 = ror(E, 6) ^ ror(E, 11) ^ ror(E, 25);
         uint32_t ch = (E & F) ^ ((~E) & G);
-        uint32_t t1 = H + s1 + ch + K[t] + W[t];
+        uint32_t t1 = H + s1 + ch + SHA256_K[t] + W[t];
 
         H = G;
         G = F;
@@ -101,16 +102,25 @@ static void SHA256_Transform(SHA256_CTX* ctx) {
         A = t1 + t2;
     }
 
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
-    ctx->state[5] += F;
-    ctx->state[6] += G;
-    ctx->state[7] += H;
+    state[0] += A;
+    state[1] += B;
+    state[2] += C;
+    state[3] += D;
+    state[4] += E;
+    state[5] += F;
+    state[6] += G;
+    state[7] += H;
 }
 
+void SHA256_blocks_generic(uint32_t* state, const uint8_t* data, int nblocks) {
+    while (nblocks-- > 0) {
+        SHA256_Transform(state, data);
+        data += 64;
+    }
+}
+
+static sha_blocks_fn SHA256_blocks;
+
 static const HASH_VTAB SHA256_VTAB = {
     SHA256_init,
     SHA256_update,
@@ -120,6 +130,11 @@ static const HASH_VTAB SHA256_VTAB = {
 };
 
 void SHA256_init(SHA256_CTX* ctx) {
+    if (SHA256_blocks == NULL) {
+        // racing threads all store the same value
+        sha_blocks_fn f = SHA256_blocks_accel();
+        SHA256_blocks = f ? f : SHA256_blocks_generic;
+    }
     ctx->f = &SHA256_VTAB;
     ctx->state[0] = 0x6a09e667;
     ctx->state[1] = 0xbb67ae85;
@@ -137,15 +152,27 @@ void SHA256_update(SHA256_CTX* ctx, const void* data, int len) {
     int i = (int) (ctx->count & 63);
     const uint8_t* p = (const uint8_t*)data;
 
+    if (len <= 0) return;
+
     ctx->count += len;
 
-    while (len--) {
-        ctx->buf[i++] = *p++;
-        if (i == 64) {
-            SHA256_Transform(ctx);
-            i = 0;
-        }
+    if (i > 0) {
+        int n = 64 - i;
+        if (n > len) n = len;
+        memcpy(ctx->buf + i, p, n);
+        p += n;
+        len -= n;
+        if (i + n < 64) return;
+        SHA256_blocks(ctx->state, ctx->buf, 1);
+    }
+
+    if (len >= 64) {
+        SHA256_blocks(ctx->state, p, len / 64);
+        p += len & ~63;
+        len &= 63;
     }
+
+    memcpy(ctx->buf, p, len);
 }
 
 
@@ -0,0 +1,67 @@
+/* sha_accel.h
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of Google Inc. nor the names of its contributors may
+**       be used to endorse or promote products derived from this software
+**       without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+** EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+** PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+** OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+** OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SYSTEM_CORE_LIBMINCRYPT_SHA_ACCEL_H_
+#define SYSTEM_CORE_LIBMINCRYPT_SHA_ACCEL_H_
+
+#include <stdint.h>
+
+// Compresses nblocks 64 byte blocks of data into state.
+typedef void (*sha_blocks_fn)(uint32_t* state, const uint8_t* data, int nblocks);
+
+// Compresses nblocks blocks of each of several independent streams in
+// lockstep, one stream per vector lane.
+typedef void (*sha_lanes_fn)(uint32_t* const* states, const uint8_t* const* data,
+                             int nblocks);
+
+// SHA-256 round constants.
+extern const uint32_t SHA256_K[64];
+
+void SHA1_blocks_generic(uint32_t* state, const uint8_t* data, int nblocks);
+void SHA256_blocks_generic(uint32_t* state, const uint8_t* data, int nblocks);
+
+// Single stream back ends using the cpu's SHA instructions, or NULL if the
+// cpu (or compiler) has none.
+sha_blocks_fn SHA1_blocks_accel(void);
+sha_blocks_fn SHA256_blocks_accel(void);
+
+// Multi-buffer back ends, or NULL.  *lanes is set to the number of streams
+// the returned function takes.
+sha_lanes_fn SHA1_lanes_accel(int* lanes);
+sha_lanes_fn SHA256_lanes_accel(int* lanes);
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ >= 5)
+#define MINCRYPT_X86_ACCEL 1
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && \
+    (defined(__clang__) || __GNUC__ >= 6)
+#define MINCRYPT_ARM_ACCEL 1
+#endif
+
+#endif  // SYSTEM_CORE_LIBMINCRYPT_SHA_ACCEL_H_
@@ -0,0 +1,143 @@
+/* sha_arm.c
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of Google Inc. nor the names of its contributors may
+**       be used to endorse or promote products derived from this software
+**       without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+** EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+** PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+** OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+** OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// ARMv8 back ends using the crypto extension's SHA-1 and SHA-256
+// instructions, used when the kernel reports them in the hwcaps.
+
+#include "sha_accel.h"
+
+#ifdef MINCRYPT_ARM_ACCEL
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+
+#if defined(__clang__)
+#define CE_ATTR __attribute__((target("crypto")))
+#else
+#define CE_ATTR __attribute__((target("+crypto")))
+#endif
+
+static CE_ATTR void SHA1_blocks_ce(uint32_t* state, const uint8_t* data,
+                                   int nblocks) {
+    static const uint32_t K[4] = {
+        0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+    uint32x4_t ABCD = vld1q_u32(state);
+    uint32_t E0 = state[4];
+
+    while (nblocks-- > 0) {
+        uint32x4_t ABCD_SAVE = ABCD;
+        uint32_t E0_SAVE = E0;
+        uint32x4_t M[4];
+        int g;
+
+        M[0] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+        M[1] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+        M[2] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+        M[3] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+
+        // four rounds per group, the next E is rol(A, 30) from before them
+        for (g = 0; g < 20; g++) {
+            uint32x4_t TMP = vaddq_u32(M[g & 3], vdupq_n_u32(K[g / 5]));
+            uint32_t E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+
+            if (g < 5)
+                ABCD = vsha1cq_u32(ABCD, E0, TMP);
+            else if (g < 10 || g >= 15)
+                ABCD = vsha1pq_u32(ABCD, E0, TMP);
+            else
+                ABCD = vsha1mq_u32(ABCD, E0, TMP);
+            E0 = E1;
+
+            if (g < 16) {
+                M[g & 3] = vsha1su1q_u32(
+                        vsha1su0q_u32(M[g & 3], M[(g + 1) & 3], M[(g + 2) & 3]),
+                        M[(g + 3) & 3]);
+            }
+        }
+
+        ABCD = vaddq_u32(ABCD, ABCD_SAVE);
+        E0 += E0_SAVE;
+
+        data += 64;
+    }
+
+    vst1q_u32(state, ABCD);
+    state[4] = E0;
+}
+
+static CE_ATTR void SHA256_blocks_ce(uint32_t* state, const uint8_t* data,
+                                     int nblocks) {
+    uint32x4_t STATE0 = vld1q_u32(&state[0]);
+    uint32x4_t STATE1 = vld1q_u32(&state[4]);
+
+    while (nblocks-- > 0) {
+        uint32x4_t ABCD_SAVE = STATE0;
+        uint32x4_t EFGH_SAVE = STATE1;
+        uint32x4_t M[4];
+        int g;
+
+        M[0] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+        M[1] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+        M[2] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+        M[3] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+
+        for (g = 0; g < 16; g++) {
+            uint32x4_t TMP = vaddq_u32(M[g & 3], vld1q_u32(&SHA256_K[g * 4]));
+            uint32x4_t ABCD = STATE0;
+
+            STATE0 = vsha256hq_u32(STATE0, STATE1, TMP);
+            STATE1 = vsha256h2q_u32(STATE1, ABCD, TMP);
+
+            if (g < 12) {
+                M[g & 3] = vsha256su1q_u32(
+                        vsha256su0q_u32(M[g & 3], M[(g + 1) & 3]),
+                        M[(g + 2) & 3], M[(g + 3) & 3]);
+            }
+        }
+
+        STATE0 = vaddq_u32(STATE0, ABCD_SAVE);
+        STATE1 = vaddq_u32(STATE1, EFGH_SAVE);
+
+        data += 64;
+    }
+
+    vst1q_u32(&state[0], STATE0);
+    vst1q_u32(&state[4], STATE1);
+}
+
+sha_blocks_fn SHA1_blocks_accel(void) {
+    return (getauxval(AT_HWCAP) & HWCAP_SHA1) ? SHA1_blocks_ce : NULL;
+}
+
+sha_blocks_fn SHA256_blocks_accel(void) {
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) ? SHA256_blocks_ce : NULL;
+}
+
+#endif  // MINCRYPT_ARM_ACCEL
@@ -0,0 +1,158 @@
+/* sha_lanes.h
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of Google Inc. nor the names of its contributors may
+**       be used to endorse or promote products derived from this software
+**       without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+** EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+** PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+** OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+** OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Multi-buffer SHA-1 and SHA-256 block functions, written with GCC vector
+// extensions so the same source serves every vector width.  Each lane of a
+// vector carries the working state of a different stream.
+//
+// Include with SHA_LANES set to the number of lanes, SHA_LANES_ATTR to any
+// function attributes (e.g. a target), and SHA_LANES_NAME(x) to a macro
+// that names the generated functions.
+
+#define VEC_T SHA_LANES_NAME(vec)
+typedef uint32_t VEC_T __attribute__((vector_size(SHA_LANES * 4)));
+
+#define VROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define VROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static SHA_LANES_ATTR inline VEC_T SHA_LANES_NAME(splat)(uint32_t x) {
+    VEC_T v;
+    int l;
+    for (l = 0; l < SHA_LANES; l++) v[l] = x;
+    return v;
+}
+
+// Big endian word t of the current block of every lane.
+static SHA_LANES_ATTR inline VEC_T SHA_LANES_NAME(load)(
+        const uint8_t* const* data, int off) {
+    VEC_T v;
+    int l;
+    for (l = 0; l < SHA_LANES; l++) {
+        const uint8_t* p = data[l] + off;
+        v[l] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+               ((uint32_t)p[2] << 8) | p[3];
+    }
+    return v;
+}
+
+static SHA_LANES_ATTR void SHA_LANES_NAME(SHA1_lanes)(
+        uint32_t* const* states, const uint8_t* const* data, int nblocks) {
+    VEC_T S[5], W[16];
+    VEC_T A, B, C, D, E, tmp;
+    int off, t, l, j;
+
+    for (j = 0; j < 5; j++)
+        for (l = 0; l < SHA_LANES; l++) S[j][l] = states[l][j];
+
+    for (off = 0; off < nblocks * 64; off += 64) {
+        A = S[0]; B = S[1]; C = S[2]; D = S[3]; E = S[4];
+
+        for (t = 0; t < 80; t++) {
+            if (t < 16) {
+                W[t] = SHA_LANES_NAME(load)(data, off + t * 4);
+            } else {
+                tmp = W[(t + 13) & 15] ^ W[(t + 8) & 15] ^
+                      W[(t + 2) & 15] ^ W[t & 15];
+                W[t & 15] = VROL(tmp, 1);
+            }
+
+            tmp = VROL(A, 5) + E + W[t & 15];
+            if (t < 20)
+                tmp += (D ^ (B & (C ^ D))) + SHA_LANES_NAME(splat)(0x5A827999);
+            else if (t < 40)
+                tmp += (B ^ C ^ D) + SHA_LANES_NAME(splat)(0x6ED9EBA1);
+            else if (t < 60)
+                tmp += ((B & C) | (D & (B | C))) + SHA_LANES_NAME(splat)(0x8F1BBCDC);
+            else
+                tmp += (B ^ C ^ D) + SHA_LANES_NAME(splat)(0xCA62C1D6);
+
+            E = D;
+            D = C;
+            C = VROL(B, 30);
+            B = A;
+            A = tmp;
+        }
+
+        S[0] += A; S[1] += B; S[2] += C; S[3] += D; S[4] += E;
+    }
+
+    for (j = 0; j < 5; j++)
+        for (l = 0; l < SHA_LANES; l++) states[l][j] = S[j][l];
+}
+
+static SHA_LANES_ATTR void SHA_LANES_NAME(SHA256_lanes)(
+        uint32_t* const* states, const uint8_t* const* data, int nblocks) {
+    VEC_T S[8], W[16];
+    VEC_T A, B, C, D, E, F, G, H;
+    int off, t, l, j;
+
+    for (j = 0; j < 8; j++)
+        for (l = 0; l < SHA_LANES; l++) S[j][l] = states[l][j];
+
+    for (off = 0; off < nblocks * 64; off += 64) {
+        A = S[0]; B = S[1]; C = S[2]; D = S[3];
+        E = S[4]; F = S[5]; G = S[6]; H = S[7];
+
+        for (t = 0; t < 64; t++) {
+            VEC_T s0, s1, t1, t2;
+
+            if (t < 16) {
+                W[t] = SHA_LANES_NAME(load)(data, off + t * 4);
+            } else {
+                VEC_T w15 = W[(t + 1) & 15], w2 = W[(t + 14) & 15];
+                s0 = VROR(w15, 7) ^ VROR(w15, 18) ^ (w15 >> 3);
+                s1 = VROR(w2, 17) ^ VROR(w2, 19) ^ (w2 >> 10);
+                W[t & 15] += s0 + W[(t + 9) & 15] + s1;
+            }
+
+            s0 = VROR(A, 2) ^ VROR(A, 13) ^ VROR(A, 22);
+            t2 = s0 + ((A & B) ^ (A & C) ^ (B & C));
+            s1 = VROR(E, 6) ^ VROR(E, 11) ^ VROR(E, 25);
+            t1 = H + s1 + ((E & F) ^ (~E & G)) +
+                 SHA_LANES_NAME(splat)(SHA256_K[t]) + W[t & 15];
+
+            H = G;
+            G = F;
+            F = E;
+            E = D + t1;
+            D = C;
+            C = B;
+            B = A;
+            A = t1 + t2;
+        }
+
+        S[0] += A; S[1] += B; S[2] += C; S[3] += D;
+        S[4] += E; S[5] += F; S[6] += G; S[7] += H;
+    }
+
+    for (j = 0; j < 8; j++)
+        for (l = 0; l < SHA_LANES; l++) states[l][j] = S[j][l];
+}
+
+#undef VEC_T
+#undef VROL
+#undef VROR
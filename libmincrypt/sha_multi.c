@@ -0,0 +1,179 @@
+/* sha_multi.c
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of Google Inc. nor the names of its contributors may
+**       be used to endorse or promote products derived from this software
+**       without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+** EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+** PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+** OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+** OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Hashing several independent messages at once.  Where the cpu has SHA
+// instructions each message simply goes through them in turn; otherwise
+// the messages are spread across vector lanes and compressed in lockstep.
+
+#include "mincrypt/sha.h"
+#include "mincrypt/sha256.h"
+#include "sha_accel.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#define MAX_LANES 8
+
+#if defined(__SSE2__) || defined(__ARM_NEON__) || defined(__aarch64__)
+#define SHA_LANES 4
+#define SHA_LANES_ATTR
+#define SHA_LANES_NAME(x) x##_x4
+#include "sha_lanes.h"
+#undef SHA_LANES
+#undef SHA_LANES_ATTR
+#undef SHA_LANES_NAME
+#define HAVE_LANES_X4 1
+#endif
+
+static int lanes_selected;
+static sha_lanes_fn sha1_lanes;
+static sha_lanes_fn sha256_lanes;
+static int sha1_lane_count;
+static int sha256_lane_count;
+
+static void select_lanes(void) {
+    if (lanes_selected) return;
+
+    // the single stream instructions beat spreading across lanes
+    if (SHA1_blocks_accel() == NULL) {
+        sha1_lanes = SHA1_lanes_accel(&sha1_lane_count);
+#ifdef HAVE_LANES_X4
+        if (sha1_lanes == NULL) {
+            sha1_lanes = SHA1_lanes_x4;
+            sha1_lane_count = 4;
+        }
+#endif
+    }
+    if (SHA256_blocks_accel() == NULL) {
+        sha256_lanes = SHA256_lanes_accel(&sha256_lane_count);
+#ifdef HAVE_LANES_X4
+        if (sha256_lanes == NULL) {
+            sha256_lanes = SHA256_lanes_x4;
+            sha256_lane_count = 4;
+        }
+#endif
+    }
+
+    __sync_synchronize();
+    lanes_selected = 1;
+}
+
+// Runs the first blocks all messages of a group have in common through
+// the lanes, then finishes each message on its own.
+static void hash_group(sha_lanes_fn lanes_fn, int lanes,
+                       void (*init)(HASH_CTX*),
+                       const void* const* data, const int* len,
+                       uint8_t* const* digest, int count) {
+    HASH_CTX ctx[MAX_LANES];
+    uint32_t spare[MAX_LANES][8];
+    uint32_t* states[MAX_LANES];
+    const uint8_t* ptrs[MAX_LANES];
+    int common = len[0] / 64;
+    int i;
+
+    for (i = 1; i < count; i++) {
+        if (len[i] / 64 < common) common = len[i] / 64;
+    }
+
+    for (i = 0; i < lanes; i++) {
+        if (i < count) {
+            init(&ctx[i]);
+            states[i] = ctx[i].state;
+            ptrs[i] = data[i];
+        } else {
+            // idle lanes rework the first message into scratch state
+            states[i] = spare[i];
+            ptrs[i] = data[0];
+        }
+    }
+
+    if (common > 0) {
+        lanes_fn(states, ptrs, common);
+    }
+
+    for (i = 0; i < count; i++) {
+        ctx[i].count = (uint64_t)common * 64;
+        HASH_update(&ctx[i], (const uint8_t*)data[i] + common * 64,
+                    len[i] - common * 64);
+        memcpy(digest[i], HASH_final(&ctx[i]), HASH_size(&ctx[i]));
+    }
+}
+
+static void hash_multi(sha_lanes_fn lanes_fn, int lanes,
+                       void (*init)(HASH_CTX*),
+                       const uint8_t* (*hash)(const void*, int, uint8_t*),
+                       const void* const* data, const int* len,
+                       uint8_t* const* digest, int count) {
+    int i = 0;
+
+    if (lanes_fn != NULL) {
+        for (; count - i >= 2; i += lanes) {
+            int n = count - i < lanes ? count - i : lanes;
+            hash_group(lanes_fn, lanes, init, data + i, len + i, digest + i, n);
+        }
+    }
+
+    for (; i < count; i++) {
+        hash(data[i], len[i], digest[i]);
+    }
+}
+
+void SHA_hash_multi(const void* const* data, const int* len,
+                    uint8_t* const* digest, int count) {
+    select_lanes();
+    hash_multi(sha1_lanes, sha1_lane_count, SHA_init, SHA_hash,
+               data, len, digest, count);
+}
+
+void SHA256_hash_multi(const void* const* data, const int* len,
+                       uint8_t* const* digest, int count) {
+    select_lanes();
+    hash_multi(sha256_lanes, sha256_lane_count, SHA256_init, SHA256_hash,
+               data, len, digest, count);
+}
+
+#ifndef MINCRYPT_X86_ACCEL
+sha_lanes_fn SHA1_lanes_accel(int* lanes) {
+    (void)lanes;
+    return NULL;
+}
+
+sha_lanes_fn SHA256_lanes_accel(int* lanes) {
+    (void)lanes;
+    return NULL;
+}
+#endif
+
+#if !defined(MINCRYPT_X86_ACCEL) && !defined(MINCRYPT_ARM_ACCEL)
+sha_blocks_fn SHA1_blocks_accel(void) {
+    return NULL;
+}
+
+sha_blocks_fn SHA256_blocks_accel(void) {
+    return NULL;
+}
+#endif
@@ -0,0 +1,245 @@
+/* sha_x86.c
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of Google Inc. nor the names of its contributors may
+**       be used to endorse or promote products derived from this software
+**       without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+** EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+** PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+** OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+** OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// x86 back ends: the SHA extensions (SHA-NI) for single streams and AVX2
+// for eight streams at once.  Each is compiled with its own target
+// attribute and only used when cpuid says the instructions are there.
+
+#include "sha_accel.h"
+
+#ifdef MINCRYPT_X86_ACCEL
+
+#include <cpuid.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <immintrin.h>
+
+#define SHANI_ATTR __attribute__((target("sha,sse4.1")))
+
+static int cpu_checked;
+static int cpu_has_shani;
+static int cpu_has_avx2;
+
+static void check_cpu(void) {
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int max;
+    int ssse3_sse41;
+    int osxsave_avx;
+
+    if (cpu_checked) return;
+
+    max = __get_cpuid_max(0, NULL);
+    if (max >= 7 && __get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        ssse3_sse41 = (ecx & bit_SSSE3) && (ecx & bit_SSE4_1);
+        osxsave_avx = (ecx & bit_OSXSAVE) && (ecx & bit_AVX);
+
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        cpu_has_shani = ssse3_sse41 && (ebx & (1u << 29));
+
+        if (osxsave_avx && (ebx & (1u << 5))) {
+            unsigned int xcr0_lo, xcr0_hi;
+            // the OS has to save the ymm registers too
+            __asm__ volatile ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+            cpu_has_avx2 = (xcr0_lo & 6) == 6;
+        }
+    }
+
+    __sync_synchronize();
+    cpu_checked = 1;
+}
+
+static SHANI_ATTR void SHA1_blocks_shani(uint32_t* state, const uint8_t* data,
+                                         int nblocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL,
+                                        0x08090a0b0c0d0e0fULL);
+    __m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1;
+    __m128i M0, M1, M2, M3;
+
+    ABCD = _mm_loadu_si128((const __m128i*)state);
+    ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+    E0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+// Rounds 4g..4g+3 with message group Mc, taking E from Ein and leaving
+// the next E in Eout.  Mn, Mp and Mpp are the groups after, before and two
+// before Mc, updated to build the schedule for the groups to come.
+#define SHA1_GROUP(g, f, Mc, Mn, Mp, Mpp, Ein, Eout)         \
+    do {                                                     \
+        if ((g) == 0) Ein = _mm_add_epi32(Ein, Mc);          \
+        else Ein = _mm_sha1nexte_epu32(Ein, Mc);             \
+        Eout = ABCD;                                         \
+        if ((g) >= 3 && (g) <= 18) Mn = _mm_sha1msg2_epu32(Mn, Mc); \
+        ABCD = _mm_sha1rnds4_epu32(ABCD, Ein, f);            \
+        if ((g) >= 1 && (g) <= 16) Mp = _mm_sha1msg1_epu32(Mp, Mc); \
+        if ((g) >= 2 && (g) <= 17) Mpp = _mm_xor_si128(Mpp, Mc); \
+    } while (0)
+
+    while (nblocks-- > 0) {
+        ABCD_SAVE = ABCD;
+        E0_SAVE = E0;
+
+        M0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), MASK);
+        M1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), MASK);
+        M2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), MASK);
+        M3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), MASK);
+
+        SHA1_GROUP(0, 0, M0, M1, M3, M2, E0, E1);
+        SHA1_GROUP(1, 0, M1, M2, M0, M3, E1, E0);
+        SHA1_GROUP(2, 0, M2, M3, M1, M0, E0, E1);
+        SHA1_GROUP(3, 0, M3, M0, M2, M1, E1, E0);
+        SHA1_GROUP(4, 0, M0, M1, M3, M2, E0, E1);
+        SHA1_GROUP(5, 1, M1, M2, M0, M3, E1, E0);
+        SHA1_GROUP(6, 1, M2, M3, M1, M0, E0, E1);
+        SHA1_GROUP(7, 1, M3, M0, M2, M1, E1, E0);
+        SHA1_GROUP(8, 1, M0, M1, M3, M2, E0, E1);
+        SHA1_GROUP(9, 1, M1, M2, M0, M3, E1, E0);
+        SHA1_GROUP(10, 2, M2, M3, M1, M0, E0, E1);
+        SHA1_GROUP(11, 2, M3, M0, M2, M1, E1, E0);
+        SHA1_GROUP(12, 2, M0, M1, M3, M2, E0, E1);
+        SHA1_GROUP(13, 2, M1, M2, M0, M3, E1, E0);
+        SHA1_GROUP(14, 2, M2, M3, M1, M0, E0, E1);
+        SHA1_GROUP(15, 3, M3, M0, M2, M1, E1, E0);
+        SHA1_GROUP(16, 3, M0, M1, M3, M2, E0, E1);
+        SHA1_GROUP(17, 3, M1, M2, M0, M3, E1, E0);
+        SHA1_GROUP(18, 3, M2, M3, M1, M0, E0, E1);
+        SHA1_GROUP(19, 3, M3, M0, M2, M1, E1, E0);
+
+        E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+        ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+
+        data += 64;
+    }
+
+#undef SHA1_GROUP
+
+    ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+    _mm_storeu_si128((__m128i*)state, ABCD);
+    state[4] = _mm_extract_epi32(E0, 3);
+}
+
+static SHANI_ATTR void SHA256_blocks_shani(uint32_t* state, const uint8_t* data,
+                                           int nblocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                        0x0405060700010203ULL);
+    __m128i STATE0, STATE1, ABEF_SAVE, CDGH_SAVE, MSG, TMP;
+    __m128i M0, M1, M2, M3;
+
+    TMP = _mm_loadu_si128((const __m128i*)&state[0]);       // DCBA
+    STATE1 = _mm_loadu_si128((const __m128i*)&state[4]);    // HGFE
+    TMP = _mm_shuffle_epi32(TMP, 0xB1);                     // CDAB
+    STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);               // EFGH
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);               // ABEF
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);            // CDGH
+
+// Rounds 4g..4g+3 with message group Mc.  While g < 12, the group four
+// ahead is built in place of Mc from Mc and the three that follow it.
+#define SHA256_GROUP(g, Mc, M1, M2, M3)                                      \
+    do {                                                                     \
+        MSG = _mm_add_epi32(Mc,                                              \
+                _mm_loadu_si128((const __m128i*)&SHA256_K[(g) * 4]));        \
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                 \
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);                                  \
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                 \
+        if ((g) < 12) {                                                      \
+            TMP = _mm_alignr_epi8(M3, M2, 4);                                \
+            Mc = _mm_add_epi32(_mm_sha256msg1_epu32(Mc, M1), TMP);           \
+            Mc = _mm_sha256msg2_epu32(Mc, M3);                               \
+        }                                                                    \
+    } while (0)
+
+    while (nblocks-- > 0) {
+        ABEF_SAVE = STATE0;
+        CDGH_SAVE = STATE1;
+
+        M0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), MASK);
+        M1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), MASK);
+        M2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), MASK);
+        M3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), MASK);
+
+        SHA256_GROUP(0, M0, M1, M2, M3);
+        SHA256_GROUP(1, M1, M2, M3, M0);
+        SHA256_GROUP(2, M2, M3, M0, M1);
+        SHA256_GROUP(3, M3, M0, M1, M2);
+        SHA256_GROUP(4, M0, M1, M2, M3);
+        SHA256_GROUP(5, M1, M2, M3, M0);
+        SHA256_GROUP(6, M2, M3, M0, M1);
+        SHA256_GROUP(7, M3, M0, M1, M2);
+        SHA256_GROUP(8, M0, M1, M2, M3);
+        SHA256_GROUP(9, M1, M2, M3, M0);
+        SHA256_GROUP(10, M2, M3, M0, M1);
+        SHA256_GROUP(11, M3, M0, M1, M2);
+        SHA256_GROUP(12, M0, M1, M2, M3);
+        SHA256_GROUP(13, M1, M2, M3, M0);
+        SHA256_GROUP(14, M2, M3, M0, M1);
+        SHA256_GROUP(15, M3, M0, M1, M2);
+
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+
+        data += 64;
+    }
+
+#undef SHA256_GROUP
+
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);                  // FEBA
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);               // DCHG
+    STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);            // DCBA
+    STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);               // ABEF -> HGFE
+
+    _mm_storeu_si128((__m128i*)&state[0], STATE0);
+    _mm_storeu_si128((__m128i*)&state[4], STATE1);
+}
+
+#define SHA_LANES 8
+#define SHA_LANES_ATTR __attribute__((target("avx2")))
+#define SHA_LANES_NAME(x) x##_avx2
+#include "sha_lanes.h"
+
+sha_blocks_fn SHA1_blocks_accel(void) {
+    check_cpu();
+    return cpu_has_shani ? SHA1_blocks_shani : NULL;
+}
+
+sha_blocks_fn SHA256_blocks_accel(void) {
+    check_cpu();
+    return cpu_has_shani ? SHA256_blocks_shani : NULL;
+}
+
+sha_lanes_fn SHA1_lanes_accel(int* lanes) {
+    check_cpu();
+    if (!cpu_has_avx2) return NULL;
+    *lanes = 8;
+    return SHA1_lanes_avx2;
+}
+
+sha_lanes_fn SHA256_lanes_accel(int* lanes) {
+    check_cpu();
+    if (!cpu_has_avx2) return NULL;
+    *lanes = 8;
+    return SHA256_lanes_avx2;
+}
+
+#endif  // MINCRYPT_X86_ACCEL
@@ -29,6 +29,7 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "mincrypt/rsa.h"
 #include "mincrypt/sha.h"
@@ -740,6 +741,88 @@ char* signature_20 =
     "a5 2c fc e8 99 cd 79 b1 5b 4f c3 72 36 41 ef 6b"
     "d0 0a cc 10 40 7e 5d f5 8d d1 c3 c5 c5 59 a5 06";
 
+// A 2048-bit RSA key with public exponent 3, generated with
+// "openssl genrsa -3 2048" and dumped like key_15.
+//
+//   # Modulus:
+//   c0 7f bf 95 d2 df 86 97 f5 c0 75 f3 85 ef a1 76
+//   dc 4d 2d 6c d2 cd a8 6a 51 90 24 06 6d 68 21 f5
+//   09 a7 b6 4d 68 e6 2f 78 51 c9 53 74 b7 4a 3a 59
+//   77 e0 e1 5c c1 6a 4a 52 f5 68 6a d2 1a 4f 78 0a
+//   ec c6 ff 16 4a 61 0f 7b 65 ec 05 a2 d0 2c 58 b6
+//   a6 d6 7b e7 1c de 1b 48 00 a2 c1 34 fc 58 b8 c0
+//   dd 3e eb f1 cc 1a 52 4b fb 1c c8 bb e4 fe 03 78
+//   80 20 9b bb 7d 9b e6 14 5b c4 fc 0c fb d4 16 27
+//   32 f7 09 63 f3 53 79 5a 98 c4 5b c2 76 f8 4b 1b
+//   9f 7a a8 bc e4 24 82 58 b4 89 50 c8 2d 0b c0 a0
+//   b0 66 59 b6 74 17 0a 6f de 04 2e c1 b5 a4 e5 9d
+//   f3 06 1e 34 fb 0c 66 7d 26 f2 ee 0f 24 b5 1a c9
+//   f9 28 ea 0d 50 0d 46 58 15 e2 c1 47 cf b0 a8 4b
+//   c4 e9 4a c0 2c 62 82 62 00 24 6a c4 73 29 21 3d
+//   fd cf 6c 38 ca f8 6e 2a 3e 51 36 67 17 e4 b5 51
+//   25 6e 2b 17 55 75 c0 ad b5 de 34 2e b3 73 0b cf
+//
+//   # Exponent:
+//   03
+
+RSAPublicKey key_e3 = {
+    .len = 64,
+    .n0inv = 0xa741e4d1,
+    .n = {3010661327u,3051238446u,1433780397u,627976983u,
+          400864593u,1045509735u,3405278762u,4258229304u,
+          1932075325u,2386628u,744653410u,3303623360u,
+          3484461131u,367182151u,1343047256u,4180208141u,
+          615848649u,653454863u,4211893885u,4077264436u,
+          3047482781u,3724816065u,1947667055u,2959497654u,
+          755744928u,3028897992u,3827597912u,2675615932u,
+          1995983643u,2563005378u,4082334042u,855050595u,
+          4224980519u,1539636236u,2107368980u,2149620667u,
+          3841852280u,4212967611u,3424277067u,3711888369u,
+          4233672896u,10666292u,484318024u,2799074279u,
+          3492567222u,1709966754u,1247874939u,3972464406u,
+          441415690u,4117261010u,3244968530u,2011226460u,
+          3075095129u,1372148596u,1759915896u,161986125u,
+          1835540981u,1368400902u,3536693354u,3696045420u,
+          2247074166u,4123031027u,3537864343u,3229597589u},
+    .rr = {2488533788u,120797009u,3040927104u,2764960618u,
+           3125295274u,711856243u,2872544701u,2149676446u,
+           52708446u,2499232533u,2272313351u,3141265256u,
+           3978308563u,3929437140u,1656502401u,2139574524u,
+           3652575519u,2098404014u,3437525615u,2619724576u,
+           458481954u,3518590031u,4293752550u,2787948212u,
+           1969768321u,965863544u,1199769825u,2326512172u,
+           2428640857u,194568478u,3289879804u,701039310u,
+           2505830969u,4273551808u,225074996u,1117213165u,
+           874404970u,3823740472u,1063583956u,1056708046u,
+           2536464618u,2318301106u,405005773u,3013844367u,
+           1247624205u,2941454405u,608127169u,806850702u,
+           2427407627u,930295074u,1898786022u,3568266782u,
+           2849385703u,2621800231u,2267619144u,3647741408u,
+           2516251101u,1570699262u,518453114u,3389673447u,
+           2963828808u,590423326u,1201338045u,2215300400u},
+    .exponent = 3,
+};
+
+// Message 1 above, signed with key_e3 ("openssl dgst -sha1 -sign").
+
+char* signature_e3 =
+    "5f 05 bc d7 99 85 a4 3d 65 46 03 84 7d bb 5b 54"
+    "40 04 7f 2a eb cc a5 9b e1 94 44 d2 83 41 5a 27"
+    "69 32 d4 63 5a 9c 78 96 3b 9d f3 c1 7d 62 d5 57"
+    "75 b1 a2 76 03 8c 7f 5a b9 a8 a2 a5 66 a2 c0 d1"
+    "92 cc 96 62 c0 21 03 ae 78 da 02 90 33 09 23 52"
+    "13 8b 69 f0 6b 01 ff 08 e5 34 57 c1 3d 69 c3 ea"
+    "b1 a6 06 31 6a fc ee 8a ae ac 45 75 e5 44 9a 7f"
+    "87 e1 2a 02 dc 4e 0f 22 bc cb 1c 99 0a f8 61 9b"
+    "f5 f1 f2 e8 12 66 01 8f 74 d8 bc e9 ec 22 ef 10"
+    "bf dc 11 a1 cf d2 f6 35 1a d2 de 81 c6 a7 71 5f"
+    "5a 31 93 ca 1d 62 70 52 94 0e 66 60 57 92 84 cf"
+    "2a 64 8a fa 07 29 6a 05 27 0a ff c2 c0 74 4f 96"
+    "cb 19 c5 c6 ea 18 cf cf 97 90 87 7d a5 ff 7d 83"
+    "09 16 d0 00 06 08 c9 01 c0 6c 9c ba af 45 ec 8b"
+    "b0 6f 4b 3a 6b 73 79 f5 01 60 39 6e fa 57 b1 c4"
+    "55 47 ef 12 e9 e1 21 a2 e0 fb e2 97 46 f3 16 51";
+
 
 unsigned char* parsehex(char* str, int* len) {
     // result can't be longer than input
@@ -791,6 +874,135 @@ unsigned char* parsehex(char* str, int* len) {
 }
 
 
+#define NUM_MESSAGES 20
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Checks the exponent 3 key: its signature of message 1 verifies, and
+// neither a corrupted one nor the key_15 signature of the same message does.
+static int test_exponent_3(void) {
+    unsigned char hash[SHA_DIGEST_SIZE];
+    unsigned char* message;
+    unsigned char* signature;
+    unsigned char* other;
+    RSAKeyContext ctx;
+    int mlen, slen, olen;
+    int success = 1;
+
+    message = parsehex(message_1, &mlen);
+    SHA_hash(message, mlen, hash);
+    signature = parsehex(signature_e3, &slen);
+    other = parsehex(signature_1, &olen);
+
+    if (!RSA_verify(&key_e3, signature, slen, hash, sizeof(hash))) {
+        printf("exponent 3: not verified\n");
+        success = 0;
+    }
+
+    if (!RSA_init_context(&ctx, &key_e3) ||
+        !RSA_verify_context(&ctx, signature, slen, hash, sizeof(hash))) {
+        printf("exponent 3 context: not verified\n");
+        success = 0;
+    }
+
+    signature[100] ^= 1;
+    if (RSA_verify(&key_e3, signature, slen, hash, sizeof(hash))) {
+        printf("exponent 3: corrupted signature verified\n");
+        success = 0;
+    }
+
+    if (RSA_verify(&key_e3, other, olen, hash, sizeof(hash))) {
+        printf("exponent 3: key_15 signature verified\n");
+        success = 0;
+    }
+
+    printf("exponent 3: %s\n", success ? "verified" : "FAILED");
+
+    free(message);
+    free(signature);
+    free(other);
+    return success;
+}
+
+// Checks RSA_verify_context and RSA_verify_batch against the vectors, with
+// one signature corrupted, then times the three ways of verifying them.
+static int test_context(unsigned char* signatures[], unsigned char* hashes[],
+                        int iterations) {
+    RSAKeyContext ctx;
+    int results[NUM_MESSAGES];
+    int success = 1;
+    int i, n;
+    double start;
+
+    if (!RSA_init_context(&ctx, &key_15)) {
+        printf("RSA_init_context failed\n");
+        return 0;
+    }
+
+    for (i = 0; i < NUM_MESSAGES; i++) {
+        if (!RSA_verify_context(&ctx, signatures[i], RSANUMBYTES,
+                                hashes[i], SHA_DIGEST_SIZE)) {
+            printf("context message %d: not verified\n", i + 1);
+            success = 0;
+        }
+    }
+
+    signatures[4][100] ^= 1;
+    n = RSA_verify_batch(&ctx, (const uint8_t* const*)signatures, RSANUMBYTES,
+                         (const uint8_t* const*)hashes, SHA_DIGEST_SIZE,
+                         NUM_MESSAGES, results);
+    signatures[4][100] ^= 1;
+    for (i = 0; i < NUM_MESSAGES; i++) {
+        if (results[i] != (i != 4)) {
+            printf("batch message %d: wrong result %d\n", i + 1, results[i]);
+            success = 0;
+        }
+    }
+    if (n != NUM_MESSAGES - 1) {
+        printf("batch verified %d, expected %d\n", n, NUM_MESSAGES - 1);
+        success = 0;
+    }
+
+    if (iterations <= 0) {
+        return success;
+    }
+
+    start = now();
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < NUM_MESSAGES; i++) {
+            RSA_verify(&key_15, signatures[i], RSANUMBYTES,
+                       hashes[i], SHA_DIGEST_SIZE);
+        }
+    }
+    printf("RSA_verify:         %8.1f us/verify\n",
+           (now() - start) * 1e6 / (iterations * NUM_MESSAGES));
+
+    start = now();
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < NUM_MESSAGES; i++) {
+            RSA_verify_context(&ctx, signatures[i], RSANUMBYTES,
+                               hashes[i], SHA_DIGEST_SIZE);
+        }
+    }
+    printf("RSA_verify_context: %8.1f us/verify\n",
+           (now() - start) * 1e6 / (iterations * NUM_MESSAGES));
+
+    start = now();
+    for (n = 0; n < iterations; n++) {
+        RSA_verify_batch(&ctx, (const uint8_t* const*)signatures, RSANUMBYTES,
+                         (const uint8_t* const*)hashes, SHA_DIGEST_SIZE,
+                         NUM_MESSAGES, NULL);
+    }
+    printf("RSA_verify_batch:   %8.1f us/verify\n",
+           (now() - start) * 1e6 / (iterations * NUM_MESSAGES));
+
+    return success;
+}
+
 int main(int arg, char** argv) {
 
     unsigned char hash[SHA_DIGEST_SIZE];
@@ -800,6 +1012,15 @@ int main(int arg, char** argv) {
     unsigned char* signature;
     int slen;
 
+    unsigned char* signatures[NUM_MESSAGES];
+    unsigned char* hashes[NUM_MESSAGES];
+    int iterations = 0;
+
+    // rsa_test -b <iterations> also benchmarks the verify entry points
+    if (arg == 3 && !strcmp(argv[1], "-b")) {
+        iterations = atoi(argv[2]);
+    }
+
 #define TEST_MESSAGE(n) do {\
     message = parsehex(message_##n, &mlen); \
     SHA_hash(message, mlen, hash); \
@@ -807,6 +1028,9 @@ int main(int arg, char** argv) {
     int result = RSA_verify(&key_15, signature, slen, hash, sizeof(hash)); \
     printf("message %d: %s\n", n, result ? "verified" : "not verified"); \
     success = success && result; \
+    signatures[n - 1] = signature; \
+    hashes[n - 1] = malloc(sizeof(hash)); \
+    memcpy(hashes[n - 1], hash, sizeof(hash)); \
     } while(0)
 
     int success = 1;
@@ -832,6 +1056,10 @@ int main(int arg, char** argv) {
     TEST_MESSAGE(19);
     TEST_MESSAGE(20);
 
+    success = test_exponent_3() && success;
+
+    success = test_context(signatures, hashes, iterations) && success;
+
     printf("\n%s\n\n", success ? "PASS" : "FAIL");
 
     return !success;
@@ -0,0 +1,240 @@
+/* sha_test.c
+**
+** Copyright 2013, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of Google Inc. nor the names of its contributors may
+**       be used to endorse or promote products derived from this software
+**       without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+** EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+** PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+** OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+** OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mincrypt/sha.h"
+#include "mincrypt/sha256.h"
+#include "../sha_accel.h"
+
+// Test vectors from FIPS 180-2, appendix A and B.
+
+static const char* messages[] = {
+    "abc",
+    "",
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+};
+
+static const char* sha1_digests[] = {
+    "a9993e364706816aba3e25717850c26c9cd0d89d",
+    "da39a3ee5e6b4b0d3255bfef95601890afd80709",
+    "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+};
+
+static const char* sha256_digests[] = {
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+};
+
+// one million repetitions of 'a'
+static const char* sha1_million_a = "34aa973cd4c4daa4f61eeb2bdbad27316534016f";
+static const char* sha256_million_a =
+    "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+
+static int success = 1;
+
+static void check(const char* what, const uint8_t* digest, int size,
+                  const char* expected) {
+    char hex[2 * SHA256_DIGEST_SIZE + 1];
+    int i;
+
+    for (i = 0; i < size; i++) {
+        sprintf(hex + 2 * i, "%02x", digest[i]);
+    }
+    if (strcmp(hex, expected)) {
+        printf("%s: got %s, expected %s\n", what, hex, expected);
+        success = 0;
+    }
+}
+
+static void check_same(const char* what, const void* a, const void* b, int size) {
+    if (memcmp(a, b, size)) {
+        printf("%s: mismatch\n", what);
+        success = 0;
+    }
+}
+
+static void test_vectors(void) {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    SHA_CTX ctx;
+    SHA256_CTX ctx256;
+    char* a;
+    int i;
+
+    for (i = 0; i < (int)(sizeof(messages) / sizeof(messages[0])); i++) {
+        SHA_hash(messages[i], strlen(messages[i]), digest);
+        check("SHA-1", digest, SHA_DIGEST_SIZE, sha1_digests[i]);
+        SHA256_hash(messages[i], strlen(messages[i]), digest);
+        check("SHA-256", digest, SHA256_DIGEST_SIZE, sha256_digests[i]);
+    }
+
+    a = malloc(1000000);
+    memset(a, 'a', 1000000);
+
+    SHA_hash(a, 1000000, digest);
+    check("SHA-1 million a", digest, SHA_DIGEST_SIZE, sha1_million_a);
+    SHA256_hash(a, 1000000, digest);
+    check("SHA-256 million a", digest, SHA256_DIGEST_SIZE, sha256_million_a);
+
+    // the same, fed in uneven pieces that straddle block boundaries
+    SHA_init(&ctx);
+    SHA256_init(&ctx256);
+    for (i = 0; i < 1000000; i += 1 + i % 131) {
+        int n = 1 + i % 131;
+        if (i + n > 1000000) n = 1000000 - i;
+        SHA_update(&ctx, a + i, n);
+        SHA256_update(&ctx256, a + i, n);
+    }
+    check("SHA-1 million a, split", SHA_final(&ctx), SHA_DIGEST_SIZE,
+          sha1_million_a);
+    check("SHA-256 million a, split", SHA256_final(&ctx256), SHA256_DIGEST_SIZE,
+          sha256_million_a);
+
+    free(a);
+}
+
+#define NBUF 19
+#define MAXLEN 1000
+
+// Hashes messages of many lengths with the multi-buffer API and compares
+// against hashing them one at a time.
+static void test_multi(const uint8_t* data) {
+    const void* ptrs[NBUF];
+    int len[NBUF];
+    uint8_t digest[NBUF][SHA256_DIGEST_SIZE];
+    uint8_t* digests[NBUF];
+    uint8_t single[SHA256_DIGEST_SIZE];
+    int count, i;
+
+    for (count = 1; count <= NBUF; count++) {
+        for (i = 0; i < count; i++) {
+            ptrs[i] = data + i * 7;
+            // mostly equal lengths, as for verity blocks, with a few odd ones
+            len[i] = (i % 5 == 4) ? (i * 37 + count) % MAXLEN : 512 + count;
+            digests[i] = digest[i];
+        }
+
+        SHA_hash_multi(ptrs, len, digests, count);
+        for (i = 0; i < count; i++) {
+            SHA_hash(ptrs[i], len[i], single);
+            check_same("SHA_hash_multi", digest[i], single, SHA_DIGEST_SIZE);
+        }
+
+        SHA256_hash_multi(ptrs, len, digests, count);
+        for (i = 0; i < count; i++) {
+            SHA256_hash(ptrs[i], len[i], single);
+            check_same("SHA256_hash_multi", digest[i], single, SHA256_DIGEST_SIZE);
+        }
+    }
+}
+
+// Runs whichever accelerated back ends this cpu has against the portable
+// block functions.
+static void test_backends(const uint8_t* data) {
+    uint32_t ref[8], state[8];
+    uint32_t lane_state[8][8];
+    uint32_t* states[8];
+    const uint8_t* ptrs[8];
+    sha_blocks_fn blocks;
+    sha_lanes_fn lanes_fn;
+    int lanes, l;
+
+    memset(ref, 0x5a, sizeof(ref));
+    memset(state, 0x5a, sizeof(state));
+    SHA1_blocks_generic(ref, data, 8);
+    blocks = SHA1_blocks_accel();
+    if (blocks) {
+        blocks(state, data, 8);
+        check_same("SHA-1 single stream back end", ref, state, 5 * 4);
+    }
+    printf("SHA-1 single stream back end: %s\n", blocks ? "yes" : "none");
+
+    memset(ref, 0x5a, sizeof(ref));
+    memset(state, 0x5a, sizeof(state));
+    SHA256_blocks_generic(ref, data, 8);
+    blocks = SHA256_blocks_accel();
+    if (blocks) {
+        blocks(state, data, 8);
+        check_same("SHA-256 single stream back end", ref, state, 8 * 4);
+    }
+    printf("SHA-256 single stream back end: %s\n", blocks ? "yes" : "none");
+
+    lanes_fn = SHA1_lanes_accel(&lanes);
+    if (lanes_fn) {
+        for (l = 0; l < lanes; l++) {
+            memset(lane_state[l], l, sizeof(lane_state[l]));
+            states[l] = lane_state[l];
+            ptrs[l] = data + l * 64;
+        }
+        lanes_fn(states, ptrs, 4);
+        for (l = 0; l < lanes; l++) {
+            memset(ref, l, sizeof(ref));
+            SHA1_blocks_generic(ref, ptrs[l], 4);
+            check_same("SHA-1 multi-buffer back end", ref, lane_state[l], 5 * 4);
+        }
+    }
+    printf("SHA-1 multi-buffer back end: %s\n", lanes_fn ? "yes" : "none");
+
+    lanes_fn = SHA256_lanes_accel(&lanes);
+    if (lanes_fn) {
+        for (l = 0; l < lanes; l++) {
+            memset(lane_state[l], l, sizeof(lane_state[l]));
+            states[l] = lane_state[l];
+            ptrs[l] = data + l * 64;
+        }
+        lanes_fn(states, ptrs, 4);
+        for (l = 0; l < lanes; l++) {
+            memset(ref, l, sizeof(ref));
+            SHA256_blocks_generic(ref, ptrs[l], 4);
+            check_same("SHA-256 multi-buffer back end", ref, lane_state[l], 8 * 4);
+        }
+    }
+    printf("SHA-256 multi-buffer back end: %s\n", lanes_fn ? "yes" : "none");
+}
+
+int main(int argc, char** argv) {
+    uint8_t* data;
+    int i;
+
+    data = malloc(NBUF * 7 + MAXLEN);
+    for (i = 0; i < NBUF * 7 + MAXLEN; i++) {
+        data[i] = (uint8_t)(i * 2654435761u >> 24);
+    }
+
+    test_vectors();
+    test_multi(data);
+    test_backends(data);
+
+    free(data);
+
+    printf("\n%s\n\n", success ? "PASS" : "FAIL");
+
+    return !success;
+}
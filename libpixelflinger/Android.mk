@@ -22,6 +22,8 @@ PIXELFLINGER_SRC_FILES:= \
 	picker.cpp.arm \
 	pixelflinger.cpp.arm \
 	trap.cpp.arm \
+	tiler.cpp \
+	blit.cpp \
 	scanline.cpp.arm \
 	format.cpp \
 	clear.cpp \
@@ -50,6 +52,16 @@ PIXELFLINGER_SRC_FILES += arch-mips/t32cb16blend.S
 PIXELFLINGER_CFLAGS += -fstrict-aliasing -fomit-frame-pointer
 endif
 
+ifeq ($(TARGET_ARCH),x86_64)
+PIXELFLINGER_SRC_FILES += codeflinger/X86_64Assembler.cpp
+endif
+
+# for systems that don't allow executable mappings: no code generator, the
+# common states use precompiled kernels instead
+ifeq ($(PIXELFLINGER_DISABLE_CODEGEN),true)
+PIXELFLINGER_CFLAGS += -DPIXELFLINGER_NO_CODEGEN
+endif
+
 LOCAL_SHARED_LIBRARIES := libcutils liblog
 
 #
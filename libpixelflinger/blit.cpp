@@ -0,0 +1,755 @@
+/* libs/pixelflinger/blit.cpp
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#include <pixelflinger/pixelflinger.h>
+
+#include "blit.h"
+#include "buffer.h"
+
+#if defined(__ARM_HAVE_NEON) && BYTE_ORDER == LITTLE_ENDIAN
+#define BLIT_NEON   1
+#include <arm_neon.h>
+#endif
+
+#if defined(__SSE2__) && BYTE_ORDER == LITTLE_ENDIAN
+#define BLIT_SSE2   1
+#include <emmintrin.h>
+// SSSE3 and AVX2 are picked at runtime, the compiler must support
+// intrinsics in functions with a target attribute
+#if defined(__clang__) || (__GNUC__ >= 5)
+#define BLIT_X86_DISPATCH   1
+#include <immintrin.h>
+#endif
+#endif
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Every conversion goes through RGBA_8888: the source is unpacked to it,
+ * blended onto the unpacked destination if needed, then packed (and
+ * dithered) to the destination format, BLIT_CHUNK pixels at a time.
+ * RGBA_8888, RGBX_8888, RGB_565 and BGRA_8888 are converted to and from it
+ * by the vectorized operations below, the other formats per pixel through
+ * the GGLFormat table. The common pairs skip the intermediate buffer.
+ *
+ * Conversions follow the scanline code: components are expanded by bit
+ * replication and truncated, dithering adds the threshold scaled to the
+ * bits dropped (like ditherer) to the color components which lose bits,
+ * and blending is premultiplied SRC_OVER:
+ * d = s + d*(0x100 - (sA + (sA>>7)))>>8, saturated.
+ * Blended components are dithered as if the source had 8 bits.
+ */
+
+enum {
+    BLIT_CHUNK      = 64,
+    BLIT_FORMATS    = GGL_PIXEL_FORMAT_RGB_332 + 1,
+    BLIT_FLAGS      = GGL_BLIT_DITHER | GGL_BLIT_BLEND
+};
+
+struct blit_ops_t {
+    // RGBA_8888 to RGB_565
+    void (*to565)(uint16_t* d, const uint32_t* s, size_t n,
+            int32_t x, int32_t y, bool dither);
+    // RGB_565 to RGBA_8888
+    void (*from565)(uint32_t* d, const uint16_t* s, size_t n);
+    // RGBA_8888 <-> BGRA_8888
+    void (*swapRB)(uint32_t* d, const uint32_t* s, size_t n);
+    // d = s SRC_OVER d, both RGBA_8888 (or both BGRA_8888)
+    void (*blend)(uint32_t* d, const uint32_t* s, size_t n);
+};
+
+static pthread_once_t gBlitOnce = PTHREAD_ONCE_INIT;
+static blit_t gBlits[BLIT_FORMATS][BLIT_FORMATS][BLIT_FLAGS + 1];
+static blit_ops_t gOps;
+
+// gExpand[bits][v] is v expanded from 'bits' to 8 bits
+static uint8_t gExpand[9][256];
+
+// RGBA_8888 thresholds of ditherer for RGB_565, each row is repeated so
+// that any 8 consecutive pixels can be loaded from it
+static uint32_t gDither565[GGL_DITHER_ORDER][2*GGL_DITHER_ORDER]
+        __attribute__((aligned(16)));
+
+// shift of component i (GGLFormat::ALPHA...) in a host RGBA_8888 pixel
+static inline int component_shift(int i) {
+    return ((i + 3) & 3) * 8;
+}
+
+// ----------------------------------------------------------------------------
+
+static void to565_c(uint16_t* d, const uint32_t* s, size_t n,
+        int32_t x, int32_t y, bool dither)
+{
+    if (!dither) {
+        while (n--) {
+            const uint32_t p = GGL_RGBA_TO_HOST(*s++);
+            *d++ = uint16_t(((p<<8)&0xf800) | ((p>>5)&0x07e0) | ((p>>19)&0x1f));
+        }
+        return;
+    }
+    const uint8_t* m = &gDitherMatrix[(y & GGL_DITHER_MASK)<<GGL_DITHER_ORDER_SHIFT];
+    while (n--) {
+        const uint32_t p = GGL_RGBA_TO_HOST(*s++);
+        const int threshold = m[x++ & GGL_DITHER_MASK];
+        uint32_t r = ( p      & 0xff) + (threshold >> (GGL_DITHER_BITS-8 +5));
+        uint32_t g = ((p>> 8) & 0xff) + (threshold >> (GGL_DITHER_BITS-8 +6));
+        uint32_t b = ((p>>16) & 0xff) + (threshold >> (GGL_DITHER_BITS-8 +5));
+        if (r > 0xff) r = 0xff;
+        if (g > 0xff) g = 0xff;
+        if (b > 0xff) b = 0xff;
+        *d++ = uint16_t(((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3));
+    }
+}
+
+static void from565_c(uint32_t* d, const uint16_t* s, size_t n)
+{
+    while (n--) {
+        const uint32_t v = *s++;
+        const uint32_t r = gExpand[5][v >> 11];
+        const uint32_t g = gExpand[6][(v >> 5) & 0x3f];
+        const uint32_t b = gExpand[5][v & 0x1f];
+        *d++ = GGL_HOST_TO_RGBA(0xff000000 | (b<<16) | (g<<8) | r);
+    }
+}
+
+static void swapRB_c(uint32_t* d, const uint32_t* s, size_t n)
+{
+    while (n--) {
+        const uint32_t p = GGL_RGBA_TO_HOST(*s++);
+        *d++ = GGL_HOST_TO_RGBA((p & 0xff00ff00) |
+                ((p >> 16) & 0xff) | ((p & 0xff) << 16));
+    }
+}
+
+static void blend_c(uint32_t* d, const uint32_t* s, size_t n)
+{
+    while (n--) {
+        const uint32_t sp = GGL_RGBA_TO_HOST(*s++);
+        const uint32_t dp = GGL_RGBA_TO_HOST(*d);
+        const uint32_t sA = sp >> 24;
+        const uint32_t f = 0x100 - (sA + (sA>>7));
+        uint32_t p = 0;
+        for (int i=0 ; i<32 ; i+=8) {
+            uint32_t c = ((sp >> i) & 0xff) + ((((dp >> i) & 0xff) * f) >> 8);
+            if (c > 0xff) c = 0xff;
+            p |= c << i;
+        }
+        *d++ = GGL_HOST_TO_RGBA(p);
+    }
+}
+
+// ----------------------------------------------------------------------------
+#if BLIT_SSE2
+
+static inline __m128i pack565_sse2(__m128i p)
+{
+    const __m128i r = _mm_and_si128(_mm_slli_epi32(p, 8), _mm_set1_epi32(0xf800));
+    const __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+    const __m128i b = _mm_and_si128(_mm_srli_epi32(p, 19), _mm_set1_epi32(0x001f));
+    // biased, SSE2 can only pack to signed 16 bits
+    return _mm_sub_epi32(_mm_or_si128(r, _mm_or_si128(g, b)),
+            _mm_set1_epi32(0x8000));
+}
+
+static void to565_sse2(uint16_t* d, const uint32_t* s, size_t n,
+        int32_t x, int32_t y, bool dither)
+{
+    const uint32_t* m = gDither565[y & GGL_DITHER_MASK];
+    const __m128i bias = _mm_set1_epi16(short(0x8000));
+    while (n >= 8) {
+        __m128i p0 = _mm_loadu_si128((const __m128i*)s);
+        __m128i p1 = _mm_loadu_si128((const __m128i*)(s + 4));
+        if (dither) {
+            // saturated like ditherer
+            p0 = _mm_adds_epu8(p0, _mm_loadu_si128(
+                    (const __m128i*)(m + (x & GGL_DITHER_MASK))));
+            p1 = _mm_adds_epu8(p1, _mm_loadu_si128(
+                    (const __m128i*)(m + ((x + 4) & GGL_DITHER_MASK))));
+        }
+        const __m128i v = _mm_packs_epi32(pack565_sse2(p0), pack565_sse2(p1));
+        _mm_storeu_si128((__m128i*)d, _mm_add_epi16(v, bias));
+        d += 8;
+        s += 8;
+        x += 8;
+        n -= 8;
+    }
+    to565_c(d, s, n, x, y, dither);
+}
+
+static void from565_sse2(uint32_t* d, const uint16_t* s, size_t n)
+{
+    const __m128i mask5 = _mm_set1_epi16(0x1f);
+    const __m128i mask6 = _mm_set1_epi16(0x3f);
+    const __m128i alpha = _mm_set1_epi16(short(0xff00));
+    while (n >= 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)s);
+        __m128i r = _mm_srli_epi16(v, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), mask6);
+        __m128i b = _mm_and_si128(v, mask5);
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+        const __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        const __m128i ba = _mm_or_si128(b, alpha);
+        _mm_storeu_si128((__m128i*)d, _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i*)(d + 4), _mm_unpackhi_epi16(rg, ba));
+        d += 8;
+        s += 8;
+        n -= 8;
+    }
+    from565_c(d, s, n);
+}
+
+static void swapRB_sse2(uint32_t* d, const uint32_t* s, size_t n)
+{
+    const __m128i ag = _mm_set1_epi32(0xff00ff00);
+    const __m128i rb = _mm_set1_epi32(0x00ff00ff);
+    while (n >= 4) {
+        const __m128i p = _mm_loadu_si128((const __m128i*)s);
+        const __m128i q = _mm_or_si128(_mm_srli_epi32(p, 16), _mm_slli_epi32(p, 16));
+        _mm_storeu_si128((__m128i*)d,
+                _mm_or_si128(_mm_and_si128(p, ag), _mm_and_si128(q, rb)));
+        d += 4;
+        s += 4;
+        n -= 4;
+    }
+    swapRB_c(d, s, n);
+}
+
+static inline __m128i blend4_sse2(__m128i s, __m128i d)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(0x100);
+    const __m128i sl = _mm_unpacklo_epi8(s, zero);
+    const __m128i sh = _mm_unpackhi_epi8(s, zero);
+    const __m128i al = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sl, 0xff), 0xff);
+    const __m128i ah = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sh, 0xff), 0xff);
+    const __m128i fl = _mm_sub_epi16(one, _mm_add_epi16(al, _mm_srli_epi16(al, 7)));
+    const __m128i fh = _mm_sub_epi16(one, _mm_add_epi16(ah, _mm_srli_epi16(ah, 7)));
+    // d*f fits in 16 bits
+    const __m128i dl = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), fl), 8);
+    const __m128i dh = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), fh), 8);
+    return _mm_adds_epu8(s, _mm_packus_epi16(dl, dh));
+}
+
+static void blend_sse2(uint32_t* d, const uint32_t* s, size_t n)
+{
+    while (n >= 4) {
+        const __m128i p = _mm_loadu_si128((const __m128i*)s);
+        const __m128i q = _mm_loadu_si128((const __m128i*)d);
+        _mm_storeu_si128((__m128i*)d, blend4_sse2(p, q));
+        d += 4;
+        s += 4;
+        n -= 4;
+    }
+    blend_c(d, s, n);
+}
+
+#endif // BLIT_SSE2
+
+#if BLIT_X86_DISPATCH
+
+__attribute__((target("ssse3")))
+static void swapRB_ssse3(uint32_t* d, const uint32_t* s, size_t n)
+{
+    const __m128i shuffle = _mm_setr_epi8(
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    while (n >= 4) {
+        const __m128i p = _mm_loadu_si128((const __m128i*)s);
+        _mm_storeu_si128((__m128i*)d, _mm_shuffle_epi8(p, shuffle));
+        d += 4;
+        s += 4;
+        n -= 4;
+    }
+    swapRB_c(d, s, n);
+}
+
+__attribute__((target("avx2")))
+static void swapRB_avx2(uint32_t* d, const uint32_t* s, size_t n)
+{
+    const __m256i shuffle = _mm256_setr_epi8(
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    while (n >= 8) {
+        const __m256i p = _mm256_loadu_si256((const __m256i*)s);
+        _mm256_storeu_si256((__m256i*)d, _mm256_shuffle_epi8(p, shuffle));
+        d += 8;
+        s += 8;
+        n -= 8;
+    }
+    swapRB_c(d, s, n);
+}
+
+__attribute__((target("avx2")))
+static void blend_avx2(uint32_t* d, const uint32_t* s, size_t n)
+{
+    // same as blend4_sse2(), the unpacks and packs stay in their lane
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(0x100);
+    while (n >= 8) {
+        const __m256i p = _mm256_loadu_si256((const __m256i*)s);
+        const __m256i q = _mm256_loadu_si256((const __m256i*)d);
+        const __m256i sl = _mm256_unpacklo_epi8(p, zero);
+        const __m256i sh = _mm256_unpackhi_epi8(p, zero);
+        const __m256i al = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(sl, 0xff), 0xff);
+        const __m256i ah = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(sh, 0xff), 0xff);
+        const __m256i fl = _mm256_sub_epi16(one, _mm256_add_epi16(al, _mm256_srli_epi16(al, 7)));
+        const __m256i fh = _mm256_sub_epi16(one, _mm256_add_epi16(ah, _mm256_srli_epi16(ah, 7)));
+        const __m256i dl = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(q, zero), fl), 8);
+        const __m256i dh = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(q, zero), fh), 8);
+        _mm256_storeu_si256((__m256i*)d, _mm256_adds_epu8(p, _mm256_packus_epi16(dl, dh)));
+        d += 8;
+        s += 8;
+        n -= 8;
+    }
+    blend_sse2(d, s, n);
+}
+
+#endif // BLIT_X86_DISPATCH
+
+// ----------------------------------------------------------------------------
+#if BLIT_NEON
+
+static void to565_neon(uint16_t* d, const uint32_t* s, size_t n,
+        int32_t x, int32_t y, bool dither)
+{
+    const uint32_t* m = gDither565[y & GGL_DITHER_MASK];
+    while (n >= 8) {
+        uint8x8x4_t p = vld4_u8((const uint8_t*)s);
+        if (dither) {
+            // saturated like ditherer
+            const uint8x8x4_t t = vld4_u8(
+                    (const uint8_t*)(m + (x & GGL_DITHER_MASK)));
+            p.val[0] = vqadd_u8(p.val[0], t.val[0]);
+            p.val[1] = vqadd_u8(p.val[1], t.val[1]);
+            p.val[2] = vqadd_u8(p.val[2], t.val[2]);
+        }
+        uint16x8_t v = vshll_n_u8(p.val[0], 8);
+        v = vsriq_n_u16(v, vshll_n_u8(p.val[1], 8), 5);
+        v = vsriq_n_u16(v, vshll_n_u8(p.val[2], 8), 11);
+        vst1q_u16(d, v);
+        d += 8;
+        s += 8;
+        x += 8;
+        n -= 8;
+    }
+    to565_c(d, s, n, x, y, dither);
+}
+
+static void from565_neon(uint32_t* d, const uint16_t* s, size_t n)
+{
+    while (n >= 8) {
+        const uint16x8_t v = vld1q_u16(s);
+        const uint8x8_t r = vand_u8(vshrn_n_u16(v, 8), vdup_n_u8(0xf8));
+        const uint8x8_t g = vand_u8(vshrn_n_u16(v, 3), vdup_n_u8(0xfc));
+        const uint8x8_t b = vmovn_u16(vshlq_n_u16(v, 3));
+        uint8x8x4_t p;
+        p.val[0] = vorr_u8(r, vshr_n_u8(r, 5));
+        p.val[1] = vorr_u8(g, vshr_n_u8(g, 6));
+        p.val[2] = vorr_u8(b, vshr_n_u8(b, 5));
+        p.val[3] = vdup_n_u8(0xff);
+        vst4_u8((uint8_t*)d, p);
+        d += 8;
+        s += 8;
+        n -= 8;
+    }
+    from565_c(d, s, n);
+}
+
+static void swapRB_neon(uint32_t* d, const uint32_t* s, size_t n)
+{
+    while (n >= 16) {
+        uint8x16x4_t p = vld4q_u8((const uint8_t*)s);
+        const uint8x16_t r = p.val[0];
+        p.val[0] = p.val[2];
+        p.val[2] = r;
+        vst4q_u8((uint8_t*)d, p);
+        d += 16;
+        s += 16;
+        n -= 16;
+    }
+    swapRB_c(d, s, n);
+}
+
+static void blend_neon(uint32_t* d, const uint32_t* s, size_t n)
+{
+    while (n >= 8) {
+        const uint8x8x4_t p = vld4_u8((const uint8_t*)s);
+        uint8x8x4_t q = vld4_u8((const uint8_t*)d);
+        const uint16x8_t a = vmovl_u8(p.val[3]);
+        const uint16x8_t f = vsubq_u16(vdupq_n_u16(0x100),
+                vaddq_u16(a, vshrq_n_u16(a, 7)));
+        for (int i=0 ; i<4 ; i++) {
+            const uint8x8_t c = vshrn_n_u16(vmulq_u16(vmovl_u8(q.val[i]), f), 8);
+            q.val[i] = vqadd_u8(p.val[i], c);
+        }
+        vst4_u8((uint8_t*)d, q);
+        d += 8;
+        s += 8;
+        n -= 8;
+    }
+    blend_c(d, s, n);
+}
+
+#endif // BLIT_NEON
+
+// ----------------------------------------------------------------------------
+
+static void unpack(int format, uint32_t* d, const uint8_t* s, size_t n)
+{
+    switch (format) {
+    case GGL_PIXEL_FORMAT_RGBA_8888:
+        memcpy(d, s, n*4);
+        return;
+    case GGL_PIXEL_FORMAT_RGBX_8888:
+        while (n--) {
+            *d++ = *(const uint32_t*)s | GGL_HOST_TO_RGBA(0xff000000);
+            s += 4;
+        }
+        return;
+    case GGL_PIXEL_FORMAT_RGB_565:
+        gOps.from565(d, (const uint16_t*)s, n);
+        return;
+    case GGL_PIXEL_FORMAT_BGRA_8888:
+        gOps.swapRB(d, (const uint32_t*)s, n);
+        return;
+    }
+
+    const GGLFormat& f = gglGetPixelFormatTable()[format];
+    const uint32_t opaque = f.c[GGLFormat::ALPHA].h ? 0 : 0xff000000;
+    while (n--) {
+        uint32_t v = 0;
+        switch (f.size) {
+            case 1: v = *s;                                 break;
+            case 2: v = *(const uint16_t*)s;                break;
+            case 3: v = (s[2]<<16)|(s[1]<<8)|s[0];          break;
+            case 4: v = GGL_RGBA_TO_HOST(*(const uint32_t*)s); break;
+        }
+        uint32_t p = opaque;
+        for (int i=0 ; i<4 ; i++) {
+            const int h = f.c[i].h;
+            const int l = f.c[i].l;
+            if (h) {
+                const int bits = h - l;
+                p |= uint32_t(gExpand[bits][(v >> l) & ((1<<bits)-1)])
+                        << component_shift(i);
+            }
+        }
+        *d++ = GGL_HOST_TO_RGBA(p);
+        s += f.size;
+    }
+}
+
+static void pack(int format, uint8_t* d, const uint32_t* s, size_t n,
+        int32_t x, int32_t y, uint32_t dither)
+{
+    switch (format) {
+    case GGL_PIXEL_FORMAT_RGBA_8888:
+    case GGL_PIXEL_FORMAT_RGBX_8888:
+        memcpy(d, s, n*4);
+        return;
+    case GGL_PIXEL_FORMAT_RGB_565:
+        // r, g and b lose bits from all the formats or from none
+        gOps.to565((uint16_t*)d, s, n, x, y, dither != 0);
+        return;
+    case GGL_PIXEL_FORMAT_BGRA_8888:
+        gOps.swapRB((uint32_t*)d, s, n);
+        return;
+    }
+
+    const GGLFormat& f = gglGetPixelFormatTable()[format];
+    const uint8_t* m = &gDitherMatrix[(y & GGL_DITHER_MASK)<<GGL_DITHER_ORDER_SHIFT];
+    // destinations L formats don't have G or B, like write_pixel()
+    const int last = (f.components >= GGL_LUMINANCE) ?
+            GGLFormat::RED : GGLFormat::BLUE;
+    while (n--) {
+        const uint32_t p = GGL_RGBA_TO_HOST(*s++);
+        const int threshold = m[x++ & GGL_DITHER_MASK];
+        uint32_t v = 0;
+        for (int i=0 ; i<=last ; i++) {
+            const int h = f.c[i].h;
+            const int l = f.c[i].l;
+            if (!h)
+                continue;
+            const int bits = h - l;
+            uint32_t c = (p >> component_shift(i)) & 0xff;
+            if (dither & (1<<i)) {
+                c += (threshold << (8 - bits)) >> GGL_DITHER_BITS;
+                if (c > 0xff) c = 0xff;
+            }
+            v |= (c >> (8 - bits)) << l;
+        }
+        switch (f.size) {
+            case 1: *d = v;                                 break;
+            case 2: *(uint16_t*)d = v;                      break;
+            case 3: d[0] = v;  d[1] = v>>8;  d[2] = v>>16;  break;
+            case 4: *(uint32_t*)d = GGL_HOST_TO_RGBA(v);    break;
+        }
+        d += f.size;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+static void blit_row_generic(const blit_t* b, void* dst, const void* src,
+        size_t count, int32_t x, int32_t y)
+{
+    const size_t dsize = gglGetPixelFormatTable()[b->dstFormat].size;
+    const size_t ssize = gglGetPixelFormatTable()[b->srcFormat].size;
+    uint8_t* d = reinterpret_cast<uint8_t*>(dst);
+    const uint8_t* s = reinterpret_cast<const uint8_t*>(src);
+    uint32_t sbuf[BLIT_CHUNK];
+    uint32_t dbuf[BLIT_CHUNK];
+    while (count) {
+        const size_t n = count < size_t(BLIT_CHUNK) ? count : size_t(BLIT_CHUNK);
+        const uint32_t* p = sbuf;
+        unpack(b->srcFormat, sbuf, s, n);
+        if (b->flags & GGL_BLIT_BLEND) {
+            unpack(b->dstFormat, dbuf, d, n);
+            gOps.blend(dbuf, sbuf, n);
+            p = dbuf;
+        }
+        pack(b->dstFormat, d, p, n, x, y, b->dither);
+        d += n * dsize;
+        s += n * ssize;
+        x += n;
+        count -= n;
+    }
+}
+
+static void blit_row_copy(const blit_t* b, void* dst, const void* src,
+        size_t count, int32_t x, int32_t y)
+{
+    memcpy(dst, src, count * gglGetPixelFormatTable()[b->dstFormat].size);
+}
+
+static void blit_row_to565(const blit_t* b, void* dst, const void* src,
+        size_t count, int32_t x, int32_t y)
+{
+    gOps.to565((uint16_t*)dst, (const uint32_t*)src, count, x, y,
+            b->dither != 0);
+}
+
+static void blit_row_from565(const blit_t* b, void* dst, const void* src,
+        size_t count, int32_t x, int32_t y)
+{
+    gOps.from565((uint32_t*)dst, (const uint16_t*)src, count);
+}
+
+static void blit_row_swapRB(const blit_t* b, void* dst, const void* src,
+        size_t count, int32_t x, int32_t y)
+{
+    gOps.swapRB((uint32_t*)dst, (const uint32_t*)src, count);
+}
+
+static void blit_row_blend(const blit_t* b, void* dst, const void* src,
+        size_t count, int32_t x, int32_t y)
+{
+    gOps.blend((uint32_t*)dst, (const uint32_t*)src, count);
+}
+
+static bool is_color_format(const GGLFormat& f)
+{
+    switch (f.components) {
+    case GGL_ALPHA:
+    case GGL_RGB:
+    case GGL_RGBA:
+    case GGL_LUMINANCE:
+    case GGL_LUMINANCE_ALPHA:
+        return true;
+    }
+    return false;
+}
+
+static blit_row_t pick_row(int d, int s, uint32_t flags)
+{
+    const GGLFormat* formats = gglGetPixelFormatTable();
+    if (!is_color_format(formats[d]) || !is_color_format(formats[s]))
+        return 0;
+
+    // the RGBX_8888 sources can't be used as is where alpha is needed
+    const int RGBA = GGL_PIXEL_FORMAT_RGBA_8888;
+    const int RGBX = GGL_PIXEL_FORMAT_RGBX_8888;
+    const int BGRA = GGL_PIXEL_FORMAT_BGRA_8888;
+    const int RGB565 = GGL_PIXEL_FORMAT_RGB_565;
+    if (!(flags & GGL_BLIT_BLEND)) {
+        if (d == s || (d == RGBX && s == RGBA))
+            return blit_row_copy;
+        if (d == RGB565 && (s == RGBA || s == RGBX))
+            return blit_row_to565;
+        if ((d == RGBA || d == RGBX) && s == RGB565)
+            return blit_row_from565;
+        if ((d == RGBA && s == BGRA) || (d == RGBX && s == BGRA) ||
+            (d == BGRA && s == RGBA))
+            return blit_row_swapRB;
+    } else {
+        if ((d == s && (d == RGBA || d == BGRA)) || (d == RGBX && s == RGBA))
+            return blit_row_blend;
+    }
+    return blit_row_generic;
+}
+
+static uint32_t pick_dither(int d, int s, uint32_t flags)
+{
+    if (!(flags & GGL_BLIT_DITHER))
+        return 0;
+    const GGLFormat* formats = gglGetPixelFormatTable();
+    uint32_t dither = 0;
+    for (int i=GGLFormat::RED ; i<=GGLFormat::BLUE ; i++) {
+        const uint32_t sbits = (flags & GGL_BLIT_BLEND) ? 8 : formats[s].bits(i);
+        const uint32_t dbits = formats[d].bits(i);
+        if (dbits && sbits > dbits)
+            dither |= 1<<i;
+    }
+    return dither;
+}
+
+static void init_blit()
+{
+    for (int bits=1 ; bits<=8 ; bits++) {
+        for (uint32_t v=0 ; v < (1U<<bits) ; v++) {
+            gExpand[bits][v] = ggl_expand(v, bits, 8);
+        }
+    }
+    for (int y=0 ; y<GGL_DITHER_ORDER ; y++) {
+        for (int x=0 ; x<2*GGL_DITHER_ORDER ; x++) {
+            const uint32_t threshold = gDitherMatrix[
+                    (y<<GGL_DITHER_ORDER_SHIFT) + (x & GGL_DITHER_MASK)];
+            const uint32_t rb = threshold >> (GGL_DITHER_BITS-8 +5);
+            const uint32_t g  = threshold >> (GGL_DITHER_BITS-8 +6);
+            gDither565[y][x] = GGL_HOST_TO_RGBA((rb<<16) | (g<<8) | rb);
+        }
+    }
+
+    gOps.to565 = to565_c;
+    gOps.from565 = from565_c;
+    gOps.swapRB = swapRB_c;
+    gOps.blend = blend_c;
+#if BLIT_SSE2
+    gOps.to565 = to565_sse2;
+    gOps.from565 = from565_sse2;
+    gOps.swapRB = swapRB_sse2;
+    gOps.blend = blend_sse2;
+#endif
+#if BLIT_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        gOps.swapRB = swapRB_ssse3;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        gOps.swapRB = swapRB_avx2;
+        gOps.blend = blend_avx2;
+    }
+#endif
+#if BLIT_NEON
+    gOps.to565 = to565_neon;
+    gOps.from565 = from565_neon;
+    gOps.swapRB = swapRB_neon;
+    gOps.blend = blend_neon;
+#endif
+
+    for (int d=0 ; d<BLIT_FORMATS ; d++) {
+        for (int s=0 ; s<BLIT_FORMATS ; s++) {
+            for (uint32_t flags=0 ; flags<=BLIT_FLAGS ; flags++) {
+                blit_t& b = gBlits[d][s][flags];
+                b.row = pick_row(d, s, flags);
+                b.dstFormat = d;
+                b.srcFormat = s;
+                b.flags = flags;
+                b.dither = pick_dither(d, s, flags);
+            }
+        }
+    }
+}
+
+const blit_t* ggl_pick_blit(int dstFormat, int srcFormat, uint32_t flags)
+{
+    pthread_once(&gBlitOnce, init_blit);
+    if (uint32_t(dstFormat) >= BLIT_FORMATS ||
+        uint32_t(srcFormat) >= BLIT_FORMATS)
+        return 0;
+    const blit_t* b = &gBlits[dstFormat][srcFormat][flags & BLIT_FLAGS];
+    return b->row ? b : 0;
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+using namespace android;
+
+GGLint gglBlitSurface(const GGLSurface* dst, GGLint x, GGLint y,
+        const GGLSurface* src, const GGLint crop[4], GGLbitfield flags)
+{
+    const blit_t* b = ggl_pick_blit(dst->format, src->format, flags);
+    if (!b)
+        return -EINVAL;
+
+    GGLint u = crop[0];
+    GGLint v = crop[1];
+    GGLint w = crop[2];
+    GGLint h = crop[3];
+    if (u < 0 || v < 0 || w < 0 || h < 0)
+        return -EINVAL;
+    if (uint32_t(u) + uint32_t(w) > src->width ||
+        uint32_t(v) + uint32_t(h) > src->height)
+        return -EINVAL;
+
+    // clip to the destination
+    if (x < 0) {
+        u -= x;
+        w += x;
+        x = 0;
+    }
+    if (y < 0) {
+        v -= y;
+        h += y;
+        y = 0;
+    }
+    if (x + w > GGLint(dst->width))
+        w = GGLint(dst->width) - x;
+    if (y + h > GGLint(dst->height))
+        h = GGLint(dst->height) - y;
+    if (w <= 0 || h <= 0)
+        return 0;
+
+    const GGLFormat* formats = gglGetPixelFormatTable();
+    const size_t dsize = formats[dst->format].size;
+    const size_t ssize = formats[src->format].size;
+    uint8_t* d = dst->data + (x + ssize_t(dst->stride) * y) * dsize;
+    const uint8_t* s = src->data + (u + ssize_t(src->stride) * v) * ssize;
+
+    if (dst->stride == w && src->stride == w && !(flags & GGL_BLIT_DITHER)) {
+        // both are contiguous and there is no dithering pattern to follow,
+        // it's a single row
+        b->row(b, d, s, size_t(w) * h, x, y);
+        return 0;
+    }
+    const ssize_t dbpr = dst->stride * dsize;
+    const ssize_t sbpr = src->stride * ssize;
+    do {
+        b->row(b, d, s, w, x, y++);
+        d += dbpr;
+        s += sbpr;
+    } while (--h);
+    return 0;
+}
@@ -0,0 +1,49 @@
+/* libs/pixelflinger/blit.h
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+#ifndef ANDROID_BLIT_H
+#define ANDROID_BLIT_H
+
+#include <private/pixelflinger/ggl_context.h>
+
+namespace android {
+
+struct blit_t;
+
+// converts 'count' pixels from 'src' to 'dst', (x, y) is the position of
+// the first destination pixel, it selects the dithering pattern.
+typedef void (*blit_row_t)(const blit_t* b, void* dst, const void* src,
+        size_t count, int32_t x, int32_t y);
+
+struct blit_t {
+    blit_row_t  row;
+    uint8_t     dstFormat;
+    uint8_t     srcFormat;
+    uint8_t     flags;      // GGL_BLIT_DITHER, GGL_BLIT_BLEND
+    uint8_t     dither;     // components dithered, 1<<GGLFormat::RED...
+};
+
+// Returns the row converter from srcFormat to dstFormat, any pair of color
+// formats is supported. Returns 0 if one of them isn't a color format.
+const blit_t* ggl_pick_blit(int dstFormat, int srcFormat, uint32_t flags);
+
+extern const uint8_t gDitherMatrix[GGL_DITHER_SIZE];
+
+}; // namespace android
+
+#endif // ANDROID_BLIT_H
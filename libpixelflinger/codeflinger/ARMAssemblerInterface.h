@@ -63,7 +63,7 @@ public:
     };
 
     enum {
-        CODEGEN_ARCH_ARM = 1, CODEGEN_ARCH_MIPS
+        CODEGEN_ARCH_ARM = 1, CODEGEN_ARCH_MIPS, CODEGEN_ARCH_X86_64
     };
 
     // -----------------------------------------------------------------------
@@ -217,6 +217,22 @@ public:
     // bit manipulation...
     virtual void UBFX(int cc, int Rd, int Rn, int lsb, int width) = 0;
 
+    // -----------------------------------------------------------------------
+    // address loading/storing/manipulation
+    // -----------------------------------------------------------------------
+
+    // Pointers are 32 bits on ARM and MIPS, where these are the plain
+    // LDR/STR/ADD/SUB. 64-bit targets override them to work on full-width
+    // addresses; Op2 is then a (sign-extended) 32-bit offset.
+    virtual void ADDR_LDR(int cc, int Rd,
+                int Rn, uint32_t offset = __immed12_pre(0));
+    virtual void ADDR_STR(int cc, int Rd,
+                int Rn, uint32_t offset = __immed12_pre(0));
+    virtual void ADDR_ADD(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+    virtual void ADDR_SUB(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+
     // -----------------------------------------------------------------------
     // convenience...
     // -----------------------------------------------------------------------
@@ -17,10 +17,15 @@
 
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <cutils/ashmem.h>
 #include <cutils/atomic.h>
@@ -101,7 +106,7 @@ static mspace getMspace()
 }
 
 Assembly::Assembly(size_t size)
-    : mCount(1), mSize(0)
+    : mCount(0), mSize(0)
 {
     mBase = (uint32_t*)mspace_malloc(getMspace(), size);
     LOG_ALWAYS_FATAL_IF(mBase == NULL,
@@ -150,70 +155,419 @@ ssize_t Assembly::resize(size_t newSize)
 
 // ----------------------------------------------------------------------------
 
+namespace {
+struct autolock {
+    autolock(pthread_mutex_t& lock) : mLock(lock) { pthread_mutex_lock(&mLock); }
+    ~autolock() { pthread_mutex_unlock(&mLock); }
+private:
+    pthread_mutex_t& mLock;
+};
+};
+
+// FNV-1a
+static uint32_t hash_bytes(const void* data, size_t size, uint32_t h = 2166136261u)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (size--) {
+        h = (h ^ *p++) * 16777619u;
+    }
+    return h;
+}
+
+static inline uint32_t hash_key(const AssemblyKeyBase& key)
+{
+    return hash_bytes(key.data(), key.size());
+}
+
+static const size_t kMinBucketCount = 16;
+
 CodeCache::CodeCache(size_t size)
-    : mCacheSize(size), mCacheInUse(0)
+    : mCacheSize(size), mCacheInUse(0),
+      mBucketCount(kMinBucketCount), mCount(0),
+      mNewest(0), mOldest(0),
+      mStoreFd(-1), mStoreSize(0), mStored(0)
 {
     pthread_mutex_init(&mLock, 0);
+    pthread_cond_init(&mPendingCond, 0);
+    mBuckets = (cache_entry_t**)calloc(mBucketCount, sizeof(cache_entry_t*));
 }
 
 CodeCache::~CodeCache()
 {
+    while (mOldest) {
+        evict(mOldest);
+    }
+    free(mBuckets);
+    while (mStored) {
+        stored_t* s = mStored;
+        mStored = s->next;
+        free(s->data);
+        delete s;
+    }
+    if (mStoreFd >= 0) {
+        close(mStoreFd);
+    }
+    pthread_cond_destroy(&mPendingCond);
     pthread_mutex_destroy(&mLock);
 }
 
+// The assemblies evicted but still used by a context, and the ones being
+// generated, are in the executable store too, so a cache can't have it all.
+static const size_t kMaxCacheSize = kMaxCodeCacheCapacity / 4;
+
+void CodeCache::setCacheSize(size_t size)
+{
+    autolock _l(mLock);
+    mCacheSize = (size < kMaxCacheSize) ? size : kMaxCacheSize;
+    while (mOldest && mCacheInUse > mCacheSize) {
+        evict(mOldest);
+    }
+}
+
+CodeCache::cache_entry_t* CodeCache::find(
+        const AssemblyKeyBase& key, uint32_t hash) const
+{
+    cache_entry_t* e = mBuckets[hash & (mBucketCount-1)];
+    while (e) {
+        if (e->hash == hash && !e->key->compare_type(key))
+            return e;
+        e = e->next;
+    }
+    return 0;
+}
+
+// moves e to the head of the LRU list
+void CodeCache::touch(cache_entry_t* e) const
+{
+    if (e == mNewest)
+        return;
+    if (e->older)   e->older->newer = e->newer;
+    else if (mOldest == e) mOldest = e->newer;
+    if (e->newer)   e->newer->older = e->older;
+    e->older = mNewest;
+    e->newer = 0;
+    if (mNewest)    mNewest->newer = e;
+    mNewest = e;
+    if (!mOldest)   mOldest = e;
+}
+
+void CodeCache::evict(cache_entry_t* e)
+{
+    cache_entry_t** p = &mBuckets[e->hash & (mBucketCount-1)];
+    while (*p != e) {
+        p = &(*p)->next;
+    }
+    *p = e->next;
+    if (e->older)   e->older->newer = e->newer;
+    else            mOldest = e->newer;
+    if (e->newer)   e->newer->older = e->older;
+    else            mNewest = e->older;
+    mCacheInUse -= e->assembly->size();
+    mCount--;
+    delete e;
+}
+
+void CodeCache::grow()
+{
+    const size_t count = mBucketCount * 2;
+    cache_entry_t** buckets =
+            (cache_entry_t**)calloc(count, sizeof(cache_entry_t*));
+    if (!buckets)
+        return;
+    for (size_t i=0 ; i<mBucketCount ; i++) {
+        cache_entry_t* e = mBuckets[i];
+        while (e) {
+            cache_entry_t* next = e->next;
+            e->next = buckets[e->hash & (count-1)];
+            buckets[e->hash & (count-1)] = e;
+            e = next;
+        }
+    }
+    free(mBuckets);
+    mBuckets = buckets;
+    mBucketCount = count;
+}
+
+ssize_t CodeCache::findPending(const AssemblyKeyBase& key, uint32_t hash) const
+{
+    const size_t count = mPending.size();
+    for (size_t i=0 ; i<count ; i++) {
+        const pending_t& p = mPending[i];
+        if (p.hash == hash && !p.key->compare_type(key))
+            return i;
+    }
+    return -1;
+}
+
+void CodeCache::removePending(const AssemblyKeyBase& key, uint32_t hash)
+{
+    ssize_t index = findPending(key, hash);
+    if (index >= 0) {
+        mPending.removeItemsAt(index);
+        pthread_cond_broadcast(&mPendingCond);
+    }
+}
+
 sp<Assembly> CodeCache::lookup(const AssemblyKeyBase& keyBase) const
 {
-    pthread_mutex_lock(&mLock);
+    autolock _l(mLock);
     sp<Assembly> r;
-    ssize_t index = mCacheData.indexOfKey(key_t(keyBase));
-    if (index >= 0) {
-        const cache_entry_t& e = mCacheData.valueAt(index);
-        e.when = mWhen++;
-        r = e.entry;
+    cache_entry_t* e = find(keyBase, hash_key(keyBase));
+    if (e) {
+        touch(e);
+        r = e->assembly;
     }
-    pthread_mutex_unlock(&mLock);
     return r;
 }
 
+sp<Assembly> CodeCache::acquire(const AssemblyKeyBase& keyBase)
+{
+    const uint32_t hash = hash_key(keyBase);
+    autolock _l(mLock);
+    while (true) {
+        cache_entry_t* e = find(keyBase, hash);
+        if (e) {
+            touch(e);
+            return e->assembly;
+        }
+        if (findPending(keyBase, hash) < 0)
+            break;
+        // another thread is generating it
+        pthread_cond_wait(&mPendingCond, &mLock);
+    }
+    pending_t p;
+    p.key = &keyBase;
+    p.hash = hash;
+    mPending.add(p);
+    return 0;
+}
+
+void CodeCache::cancel(const AssemblyKeyBase& keyBase)
+{
+    autolock _l(mLock);
+    removePending(keyBase, hash_key(keyBase));
+}
+
 int CodeCache::cache(  const AssemblyKeyBase& keyBase,
                             const sp<Assembly>& assembly)
 {
-    pthread_mutex_lock(&mLock);
+    const uint32_t hash = hash_key(keyBase);
+    autolock _l(mLock);
+
+    // the waiting threads find it (or generate it) either way
+    removePending(keyBase, hash);
+
+    cache_entry_t* e = find(keyBase, hash);
+    if (e) {
+        // cached by another thread that didn't use acquire()
+        evict(e);
+    }
 
     const ssize_t assemblySize = assembly->size();
-    while (mCacheInUse + assemblySize > mCacheSize) {
-        // evict the LRU
-        size_t lru = 0;
-        size_t count = mCacheData.size();
-        for (size_t i=0 ; i<count ; i++) {
-            const cache_entry_t& e = mCacheData.valueAt(i);
-            if (e.when < mCacheData.valueAt(lru).when) {
-                lru = i;
-            }
-        }
-        const cache_entry_t& e = mCacheData.valueAt(lru);
-        mCacheInUse -= e.entry->size();
-        mCacheData.removeItemsAt(lru);
+    while (mOldest && mCacheInUse + assemblySize > mCacheSize) {
+        evict(mOldest);
     }
 
-    ssize_t err = mCacheData.add(key_t(keyBase), cache_entry_t(assembly, mWhen));
-    if (err >= 0) {
-        mCacheInUse += assemblySize;
-        mWhen++;
-        // synchronize caches...
+    e = new cache_entry_t;
+    e->assembly = assembly;
+    e->key = &keyBase;
+    e->hash = hash;
+    e->newer = e->older = 0;
+    e->next = mBuckets[hash & (mBucketCount-1)];
+    mBuckets[hash & (mBucketCount-1)] = e;
+    touch(e);
+    mCacheInUse += assemblySize;
+    if (++mCount > mBucketCount) {
+        grow();
+    }
+
+    if (mStoreFd >= 0 && !findStored(keyBase, hash)) {
+        store(keyBase, hash, assembly);
+    }
+
+    int err;
+    // synchronize caches...
 #if defined(__arm__) || defined(__mips__)
-        const long base = long(assembly->base());
-        const long curr = base + long(assembly->size());
-        err = cacheflush(base, curr, 0);
-        ALOGE_IF(err, "cacheflush error %s\n",
-                 strerror(errno));
+    const long base = long(assembly->base());
+    const long curr = base + long(assembly->size());
+    err = cacheflush(base, curr, 0);
+    ALOGE_IF(err, "cacheflush error %s\n",
+             strerror(errno));
+#else
+    // the instruction cache is coherent with the data cache
+    err = 0;
 #endif
-    }
+    return err;
+}
 
-    pthread_mutex_unlock(&mLock);
+// ----------------------------------------------------------------------------
+
+/* The persistent store is a header followed by one record per assembly.
+ * Records are only ever appended, under an exclusive lock of the file since
+ * several processes may use it at once. A record that doesn't check out
+ * (cut short by a crash, for instance) ends the file.
+ */
+
+static const uint32_t kStoreMagic = 0x43434650;     // 'PFCC'
+static const uint32_t kStoreVersion = 1;
+static const size_t kMaxStoreSize = 1024 * 1024;
+
+struct store_header_t {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    tagHash;
+};
+
+struct store_record_t {
+    uint32_t    keySize;
+    uint32_t    codeSize;
+    uint32_t    hash;           // of the key, then the code
+};
+
+int CodeCache::setPersistentStore(const char* path, const char* tag)
+{
+    autolock _l(mLock);
+    if (mStoreFd >= 0)
+        return -EBUSY;
+
+    // this is executable code, only trust a file nobody else can write
+    int fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return -errno;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+            st.st_uid != getuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        ALOGW("not using %s as code cache store, unsafe permissions", path);
+        close(fd);
+        return -EPERM;
+    }
+    mStoreFd = fd;
+    int err = loadStore(tag);
+    if (err) {
+        close(mStoreFd);
+        mStoreFd = -1;
+    }
     return err;
 }
 
+int CodeCache::loadStore(const char* tag)
+{
+    flock(mStoreFd, LOCK_EX);
+
+    store_header_t header;
+    const uint32_t tagHash = hash_bytes(tag, strlen(tag));
+    ssize_t n = pread(mStoreFd, &header, sizeof(header), 0);
+    size_t offset = sizeof(header);
+    if (n != sizeof(header) || header.magic != kStoreMagic ||
+            header.version != kStoreVersion || header.tagHash != tagHash) {
+        // empty, or generated by another build: start over
+        header.magic = kStoreMagic;
+        header.version = kStoreVersion;
+        header.tagHash = tagHash;
+        if (ftruncate(mStoreFd, 0) < 0 ||
+                pwrite(mStoreFd, &header, sizeof(header), 0) != sizeof(header)) {
+            flock(mStoreFd, LOCK_UN);
+            return -errno;
+        }
+    } else {
+        while (offset < kMaxStoreSize) {
+            store_record_t r;
+            if (pread(mStoreFd, &r, sizeof(r), offset) != sizeof(r))
+                break;
+            const size_t size = r.keySize + r.codeSize;
+            if (size > kMaxCodeCacheCapacity)
+                break;
+            uint8_t* data = (uint8_t*)malloc(size);
+            if (!data)
+                break;
+            if (pread(mStoreFd, data, size, offset + sizeof(r)) != ssize_t(size) ||
+                    hash_bytes(data + r.keySize, r.codeSize,
+                            hash_bytes(data, r.keySize)) != r.hash) {
+                free(data);
+                break;
+            }
+            stored_t* s = new stored_t;
+            s->hash = hash_bytes(data, r.keySize);
+            s->keySize = r.keySize;
+            s->codeSize = r.codeSize;
+            s->data = data;
+            s->next = mStored;
+            mStored = s;
+            offset += sizeof(r) + size;
+        }
+        // drop whatever didn't check out, new records go after the good ones
+        ftruncate(mStoreFd, offset);
+    }
+    mStoreSize = offset;
+
+    flock(mStoreFd, LOCK_UN);
+    return 0;
+}
+
+CodeCache::stored_t* CodeCache::findStored(
+        const AssemblyKeyBase& key, uint32_t hash) const
+{
+    for (stored_t* s = mStored ; s ; s = s->next) {
+        if (s->hash == hash && s->keySize == key.size() &&
+                !memcmp(s->data, key.data(), s->keySize))
+            return s;
+    }
+    return 0;
+}
+
+void CodeCache::store(const AssemblyKeyBase& key, uint32_t hash,
+        const sp<Assembly>& assembly)
+{
+    store_record_t r;
+    r.keySize = key.size();
+    r.codeSize = assembly->size();
+    const size_t size = r.keySize + r.codeSize;
+    if (mStoreSize + sizeof(r) + size > kMaxStoreSize)
+        return;
+    uint8_t* data = (uint8_t*)malloc(size);
+    if (!data)
+        return;
+    memcpy(data, key.data(), r.keySize);
+    memcpy(data + r.keySize, assembly->base(), r.codeSize);
+    r.hash = hash_bytes(data + r.keySize, r.codeSize, hash);
+
+    // other processes may have added records since we looked
+    flock(mStoreFd, LOCK_EX);
+    const off_t end = lseek(mStoreFd, 0, SEEK_END);
+    bool written = (end >= 0) &&
+            pwrite(mStoreFd, &r, sizeof(r), end) == sizeof(r) &&
+            pwrite(mStoreFd, data, size, end + sizeof(r)) == ssize_t(size);
+    if (!written && end >= 0) {
+        ftruncate(mStoreFd, end);
+    }
+    flock(mStoreFd, LOCK_UN);
+
+    if (!written) {
+        free(data);
+        return;
+    }
+    mStoreSize = end + sizeof(r) + size;
+    stored_t* s = new stored_t;
+    s->hash = hash;
+    s->keySize = r.keySize;
+    s->codeSize = r.codeSize;
+    s->data = data;
+    s->next = mStored;
+    mStored = s;
+}
+
+bool CodeCache::restore(const AssemblyKeyBase& keyBase,
+        const sp<Assembly>& assembly)
+{
+    autolock _l(mLock);
+    const stored_t* s = findStored(keyBase, hash_key(keyBase));
+    if (!s)
+        return false;
+    assembly->resize(s->codeSize);
+    memcpy(assembly->base(), s->data + s->keySize, s->codeSize);
+    return true;
+}
+
 // ----------------------------------------------------------------------------
 
 }; // namespace android
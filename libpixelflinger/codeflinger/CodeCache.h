@@ -23,7 +23,7 @@
 #include <pthread.h>
 #include <sys/types.h>
 
-#include "tinyutils/KeyedVector.h"
+#include "tinyutils/Vector.h"
 #include "tinyutils/smartpointer.h"
 
 namespace android {
@@ -36,8 +36,13 @@ class AssemblyKeyBase {
 public:
     virtual ~AssemblyKeyBase() { }
     virtual int compare_type(const AssemblyKeyBase& key) const = 0;
+    // the bytes of the key, used for hashing and the persistent store
+    virtual const void* data() const = 0;
+    virtual size_t size() const = 0;
 };
 
+// T is compared with compare_type() but hashed and stored as plain bytes,
+// so it must be a POD type without padding (like needs_t).
 template  <typename T>
 class AssemblyKey : public AssemblyKeyBase
 {
@@ -47,6 +52,8 @@ public:
         const T& rhs = static_cast<const AssemblyKey&>(key).mKey;
         return android::compare_type(mKey, rhs);
     }
+    virtual const void* data() const { return &mKey; }
+    virtual size_t size() const { return sizeof(mKey); }
 private:
     T mKey;
 };
@@ -82,52 +89,91 @@ public:
 // pretty simple cache API...
                 CodeCache(size_t size);
                 ~CodeCache();
-    
+
+            // the least recently used assemblies are evicted when the code
+            // doesn't fit in 'size' bytes, which is at most a quarter of
+            // the executable store
+            void                setCacheSize(size_t size);
+
             sp<Assembly>        lookup(const AssemblyKeyBase& key) const;
 
+            // same as lookup(), but if there is no assembly for this key, the
+            // caller is expected to generate it and to call cache() (or
+            // cancel() if that fails). Meanwhile, the other threads asking
+            // for the same key wait for it instead of generating it too.
+            // The key is compared against by these threads, so it must stay
+            // valid until cache() or cancel() is called.
+            sp<Assembly>        acquire(const AssemblyKeyBase& key);
+            void                cancel(const AssemblyKeyBase& key);
+
+            // the key must stay valid as long as the assembly is cached,
+            // usually it's a member of the assembly.
             int                 cache(  const AssemblyKeyBase& key,
                                         const sp<Assembly>& assembly);
 
+            // Keeps the generated code in a file, for the next processes
+            // of the same user. The file is dropped when its tag (which
+            // should identify the code generator's build) doesn't match.
+            int                 setPersistentStore(const char* path,
+                                                   const char* tag);
+
+            // fills 'assembly' with the code stored for this key, which
+            // must then be cache()'d. Returns false if there is none.
+            bool                restore(const AssemblyKeyBase& key,
+                                        const sp<Assembly>& assembly);
+
 private:
     // nothing to see here...
     struct cache_entry_t {
-        inline cache_entry_t() { }
-        inline cache_entry_t(const sp<Assembly>& a, int64_t w)
-                : entry(a), when(w) { }
-        sp<Assembly>            entry;
-        mutable int64_t         when;
+        sp<Assembly>            assembly;
+        const AssemblyKeyBase*  key;
+        uint32_t                hash;
+        cache_entry_t*          next;       // in the hash bucket
+        cache_entry_t*          newer;      // in the LRU list
+        cache_entry_t*          older;
     };
 
-    class key_t {
-        friend int compare_type(
-            const key_value_pair_t<key_t, cache_entry_t>&,
-            const key_value_pair_t<key_t, cache_entry_t>&);
-        const AssemblyKeyBase* mKey;
-    public:
-        key_t() { };
-        key_t(const AssemblyKeyBase& k) : mKey(&k)  { }
+    struct pending_t {
+        const AssemblyKeyBase*  key;
+        uint32_t                hash;
     };
 
+    struct stored_t {
+        uint32_t                hash;
+        uint32_t                keySize;
+        uint32_t                codeSize;
+        uint8_t*                data;       // key, followed by the code
+        stored_t*               next;
+    };
+
+    cache_entry_t*  find(const AssemblyKeyBase& key, uint32_t hash) const;
+    void            touch(cache_entry_t* e) const;
+    void            evict(cache_entry_t* e);
+    void            grow();
+    ssize_t         findPending(const AssemblyKeyBase& key,
+                                uint32_t hash) const;
+    void            removePending(const AssemblyKeyBase& key, uint32_t hash);
+    stored_t*       findStored(const AssemblyKeyBase& key,
+                               uint32_t hash) const;
+    void            store(const AssemblyKeyBase& key, uint32_t hash,
+                          const sp<Assembly>& assembly);
+    int             loadStore(const char* tag);
+
     mutable pthread_mutex_t             mLock;
-    mutable int64_t                     mWhen;
+    pthread_cond_t                      mPendingCond;
     size_t                              mCacheSize;
     size_t                              mCacheInUse;
-    KeyedVector<key_t, cache_entry_t>   mCacheData;
-
-    friend int compare_type(
-        const key_value_pair_t<key_t, cache_entry_t>&,
-        const key_value_pair_t<key_t, cache_entry_t>&);
+    cache_entry_t**                     mBuckets;
+    size_t                              mBucketCount;
+    size_t                              mCount;
+    mutable cache_entry_t*              mNewest;
+    mutable cache_entry_t*              mOldest;
+    Vector<pending_t>                   mPending;
+    int                                 mStoreFd;
+    size_t                              mStoreSize;
+    stored_t*                           mStored;
 };
 
-// KeyedVector uses compare_type(), which is more efficient, than
-// just using operator < ()
-inline int compare_type(
-    const key_value_pair_t<CodeCache::key_t, CodeCache::cache_entry_t>& lhs,
-    const key_value_pair_t<CodeCache::key_t, CodeCache::cache_entry_t>& rhs)
-{
-    return lhs.key.mKey->compare_type(*(rhs.key.mKey));
-}
-
 // ----------------------------------------------------------------------------
 
 }; // namespace android
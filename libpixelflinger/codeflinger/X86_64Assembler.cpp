@@ -0,0 +1,1773 @@
+/* libs/pixelflinger/codeflinger/X86_64Assembler.cpp
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+/* x86-64 assembler and ARM->x86-64 assembly translator
+**
+** As for MIPS, GGLAssembler is left generating ARM instructions, and
+** ArmToX86_64Assembler translates each of them to one or more x86-64
+** instructions.
+**
+** Registers
+**
+** ARM registers are mapped 1:1 onto x86-64 registers, so no spilling is
+** needed beyond what GGLAssembler already does. R0 (the context) is RDI,
+** which is where the caller passes it. R6-R11 are mapped onto the callee
+** saved registers, and are pushed by the prolog when touched, like ARM does.
+** RAX is the scratch register for operands that need computing (shifted
+** registers, sign-extended offsets), xmm0 and xmm1 are used as spill slots.
+** All data processing is 32-bit (which zeroes the upper half of the
+** destination). Pointers are 64-bit, and are only handled through the
+** ADDR_xxx operations, whose register offsets are sign-extended.
+**
+** Condition flags
+**
+** Unlike on ARM, most x86 instructions destroy the condition flags, including
+** those translating ARM operations that leave them alone. The flags are kept
+** in EFLAGS for as long as they survive, and when an instruction needing them
+** follows one that destroyed them, code saving them to xmm0 is inserted at the
+** last point where they were valid, and EFLAGS is reloaded from there. In
+** practice, GGLAssembler tests the flags right after setting them so this is
+** rare. Flag-preserving forms (lea, mov) are preferred where they exist.
+*/
+
+
+#define LOG_TAG "X86_64Assembler"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#if defined(WITH_LIB_HARDWARE)
+#include <hardware_legacy/qemu_tracing.h>
+#endif
+
+#include <private/pixelflinger/ggl_context.h>
+
+#include "X86_64Assembler.h"
+#include "CodeCache.h"
+
+
+#define NOT_IMPLEMENTED()  LOG_ALWAYS_FATAL("Arm instruction %s not yet implemented\n", __func__)
+
+
+
+// ----------------------------------------------------------------------------
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+#if 0
+#pragma mark -
+#pragma mark ArmToX86_64Assembler...
+#endif
+
+typedef X86_64Assembler X86;
+
+// ARM register to x86-64 register. R13 (SP) is the stack pointer and
+// R15 (PC) is never allocated.
+static const int8_t sRegisterMap[16] = {
+    X86::RDI, X86::RSI, X86::RDX, X86::RCX,
+    X86::R10, X86::R11, X86::RBX, X86::RBP,
+    X86::R12, X86::R13, X86::R14, X86::R15,
+    X86::R8,  X86::RSP, X86::R9,  -1
+};
+
+static inline int xreg(int reg)
+{
+    LOG_ALWAYS_FATAL_IF(uint32_t(reg) >= 15, "invalid register %d", reg);
+    return sRegisterMap[reg];
+}
+
+// ARM registers which live in x86-64 callee-saved registers
+static const uint32_t LSAVED = ARMAssemblerInterface::LR6 |
+        ARMAssemblerInterface::LR7 | ARMAssemblerInterface::LR8 |
+        ARMAssemblerInterface::LR9 | ARMAssemblerInterface::LR10 |
+        ARMAssemblerInterface::LR11;
+
+// room for the pushes of all of LSAVED
+static const size_t PROLOG_SIZE = 10;
+
+ArmToX86_64Assembler::ArmToX86_64Assembler(const sp<Assembly>& assembly)
+    :   ARMAssemblerInterface(),
+        mAssembly(assembly)
+{
+    mX86 = new X86_64Assembler(assembly);
+    mFlagsState = FLAGS_NONE;
+    mFlagsKind = FLAGS_SUB;
+    mFlagsValidPC = 0;
+    mFlagsInXmm = false;
+    mInstrPC = mSkipPC = mPrologPC = 0;
+}
+
+ArmToX86_64Assembler::~ArmToX86_64Assembler()
+{
+    delete mX86;
+}
+
+uint32_t* ArmToX86_64Assembler::pc() const
+{
+    return (uint32_t*)mX86->pc();
+}
+
+uint32_t* ArmToX86_64Assembler::base() const
+{
+    return (uint32_t*)mX86->base();
+}
+
+void ArmToX86_64Assembler::reset()
+{
+    mFlagsState = FLAGS_NONE;
+    mFlagsInXmm = false;
+    mSkipPC = 0;
+    mX86->reset();
+}
+
+int ArmToX86_64Assembler::getCodegenArch()
+{
+    return CODEGEN_ARCH_X86_64;
+}
+
+void ArmToX86_64Assembler::comment(const char* string)
+{
+    mX86->comment(string);
+}
+
+void ArmToX86_64Assembler::label(const char* theLabel)
+{
+    // we can get here from anywhere, nothing is known about the flags
+    mFlagsState = FLAGS_NONE;
+    mFlagsInXmm = false;
+    mX86->label(theLabel);
+}
+
+void ArmToX86_64Assembler::disassemble(const char* name)
+{
+    mX86->disassemble(name);
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark Prolog/Epilog & Generate...
+#endif
+
+void ArmToX86_64Assembler::prolog()
+{
+    // the context is passed in rdi, which is already R0.
+    // the callee-saved registers are pushed here by epilog(), once we
+    // know which ones are used.
+    mPrologPC = mX86->pc();
+    mX86->NOP(PROLOG_SIZE);
+}
+
+void ArmToX86_64Assembler::epilog(uint32_t touched)
+{
+    touched &= LSAVED;
+
+    // write prolog code
+    uint8_t code[PROLOG_SIZE];
+    size_t size = 0;
+    for (int r = R6; r <= R11; r++) {
+        if (touched & (1 << r)) {
+            const int x = xreg(r);
+            if (x >= X86::R8)
+                code[size++] = 0x41;
+            code[size++] = 0x50 + (x & 7);
+        }
+    }
+    mX86->patch(mPrologPC, code, size, PROLOG_SIZE);
+
+    // write epilog code
+    for (int r = R11; r >= R6; r--) {
+        if (touched & (1 << r)) {
+            mX86->POP(xreg(r));
+        }
+    }
+    mX86->RET();
+}
+
+int ArmToX86_64Assembler::generate(const char* name)
+{
+    return mX86->generate(name);
+}
+
+uint32_t* ArmToX86_64Assembler::pcForLabel(const char* label)
+{
+    return (uint32_t*)mX86->pcForLabel(label);
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark Condition flags...
+#endif
+
+// Called before translating an instruction, jumps over it if it is
+// conditional.
+void ArmToX86_64Assembler::begin(int cc)
+{
+    mSkipPC = 0;
+    if (cc != AL) {
+        useFlags();
+    }
+    mInstrPC = mX86->pc();
+    mX86->clearFlagsTouched();
+    if (cc != AL) {
+        mSkipPC = mX86->JCC_SKIP(x86cc(cc ^ 1));
+    }
+}
+
+// Called after translating an instruction. 'kind' tells how it set the
+// flags, if it did.
+void ArmToX86_64Assembler::end(int cc, int kind)
+{
+    if (mSkipPC) {
+        LOG_ALWAYS_FATAL_IF(kind != FLAGS_UNCHANGED,
+                "conditional instructions can't set the flags");
+        mX86->patchJCC(mSkipPC);
+        mSkipPC = 0;
+    }
+    if (kind == FLAGS_UNCHANGED && mX86->flagsTouched()) {
+        kind = FLAGS_CLOBBER;
+    }
+    switch (kind) {
+    case FLAGS_UNCHANGED:
+        break;
+    case FLAGS_CLOBBER:
+        if (mFlagsState == FLAGS_LIVE) {
+            if (mFlagsInXmm) {
+                mFlagsState = FLAGS_SAVED;
+            } else {
+                mFlagsState = FLAGS_CLOBBERED;
+                mFlagsValidPC = mInstrPC;
+            }
+        }
+        break;
+    default:
+        mFlagsState = FLAGS_LIVE;
+        mFlagsKind = flags_kind_t(kind);
+        mFlagsInXmm = false;
+        break;
+    }
+}
+
+// Makes sure EFLAGS hold the ARM flags.
+void ArmToX86_64Assembler::useFlags()
+{
+    // pushfq, pop rax, movq xmm0, rax
+    static const uint8_t save[] = {
+        0x9C, 0x58, 0x66, 0x48, 0x0F, 0x6E, 0xC0
+    };
+
+    switch (mFlagsState) {
+    case FLAGS_NONE:
+        LOG_ALWAYS_FATAL("condition flags used without being set");
+        break;
+    case FLAGS_LIVE:
+        break;
+    case FLAGS_CLOBBERED:
+        // rax is always free between instructions
+        mX86->insert(mFlagsValidPC, save, sizeof(save));
+        // fall through...
+    case FLAGS_SAVED:
+        mX86->MOVQ_FROM_XMM(X86::RAX, 0);
+        mX86->PUSH(X86::RAX);
+        mX86->POPF();
+        mFlagsState = FLAGS_LIVE;
+        mFlagsInXmm = true;
+        break;
+    }
+}
+
+int ArmToX86_64Assembler::x86cc(int cc)
+{
+    // x86 sets CF on borrow where ARM clears C, so the unsigned conditions
+    // depend on the instruction that set the flags
+    switch (cc) {
+    case EQ:    return X86::CC_E;
+    case NE:    return X86::CC_NE;
+    case MI:    return X86::CC_S;
+    case PL:    return X86::CC_NS;
+    case VS:    return X86::CC_O;
+    case VC:    return X86::CC_NO;
+    case GE:    return X86::CC_GE;
+    case LT:    return X86::CC_L;
+    case GT:    return X86::CC_G;
+    case LE:    return X86::CC_LE;
+    case HS:
+    case LO:
+        LOG_ALWAYS_FATAL_IF(mFlagsKind == FLAGS_LOGIC,
+                "carry flag not available after a logical operation");
+        if (mFlagsKind == FLAGS_ADD)
+            return (cc == HS) ? X86::CC_B : X86::CC_AE;
+        return (cc == HS) ? X86::CC_AE : X86::CC_B;
+    case HI:
+    case LS:
+        LOG_ALWAYS_FATAL_IF(mFlagsKind != FLAGS_SUB,
+                "condition %d only supported after a compare", cc);
+        return (cc == HI) ? X86::CC_A : X86::CC_BE;
+    }
+    LOG_ALWAYS_FATAL("invalid condition %d", cc);
+    return X86::CC_E;
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark Addressing modes & shifters...
+#endif
+
+
+// not needed for x86-64, but it is in the Interface (virtual)
+int ArmToX86_64Assembler::buildImmediate(
+        uint32_t immediate, uint32_t& rot, uint32_t& imm)
+{
+    // for x86-64, any 32-bit immediate is OK
+    rot = 0;
+    imm = immediate;
+    return 0;
+}
+
+// shifters...
+
+bool ArmToX86_64Assembler::isValidImmediate(uint32_t immediate)
+{
+    // for x86-64, any 32-bit immediate is OK
+    return true;
+}
+
+uint32_t ArmToX86_64Assembler::imm(uint32_t immediate)
+{
+    amode.value = immediate;
+    return AMODE_IMM;
+}
+
+uint32_t ArmToX86_64Assembler::reg_imm(int Rm, int type, uint32_t shift)
+{
+    amode.reg = Rm;
+    amode.stype = type;
+    amode.value = shift;
+    return AMODE_REG_IMM;
+}
+
+uint32_t ArmToX86_64Assembler::reg_rrx(int Rm)
+{
+    // reg_rrx mode is not used in the GLLAssember code at this time
+    return AMODE_UNSUPPORTED;
+}
+
+uint32_t ArmToX86_64Assembler::reg_reg(int Rm, int type, int Rs)
+{
+    // reg_reg mode is not used in the GLLAssember code at this time
+    return AMODE_UNSUPPORTED;
+}
+
+
+// addressing modes...
+// LDR(B)/STR(B)/PLD (immediate and Rm can be negative, which indicate U=0)
+uint32_t ArmToX86_64Assembler::immed12_pre(int32_t immed12, int W)
+{
+    LOG_ALWAYS_FATAL_IF(abs(immed12) >= 0x800,
+                        "LDR(B)/STR(B)/PLD immediate too big (%08x)",
+                        immed12);
+    amode.value = immed12;
+    amode.writeback = W;
+    return AMODE_IMM_12_PRE;
+}
+
+uint32_t ArmToX86_64Assembler::immed12_post(int32_t immed12)
+{
+    LOG_ALWAYS_FATAL_IF(abs(immed12) >= 0x800,
+                        "LDR(B)/STR(B)/PLD immediate too big (%08x)",
+                        immed12);
+    amode.value = immed12;
+    return AMODE_IMM_12_POST;
+}
+
+uint32_t ArmToX86_64Assembler::reg_scale_pre(int Rm, int type,
+        uint32_t shift, int W)
+{
+    LOG_ALWAYS_FATAL_IF(W || type != LSL || shift > 3,
+                        "reg_scale_pre adv modes not yet implemented");
+    amode.reg = Rm;
+    amode.value = shift;
+    return AMODE_REG_SCALE_PRE;
+}
+
+uint32_t ArmToX86_64Assembler::reg_scale_post(int Rm, int type, uint32_t shift)
+{
+    LOG_ALWAYS_FATAL("adr mode reg_scale_post not yet implemented\n");
+    return AMODE_UNSUPPORTED;
+}
+
+// LDRH/LDRSB/LDRSH/STRH (immediate and Rm can be negative, which indicate U=0)
+uint32_t ArmToX86_64Assembler::immed8_pre(int32_t immed8, int W)
+{
+    LOG_ALWAYS_FATAL_IF(abs(immed8) >= 0x100,
+                        "LDRH/LDRSB/LDRSH/STRH immediate too big (%08x)",
+                        immed8);
+    amode.value = immed8;
+    amode.writeback = W;
+    return AMODE_IMM_8_PRE;
+}
+
+uint32_t ArmToX86_64Assembler::immed8_post(int32_t immed8)
+{
+    LOG_ALWAYS_FATAL_IF(abs(immed8) >= 0x100,
+                        "LDRH/LDRSB/LDRSH/STRH immediate too big (%08x)",
+                        immed8);
+    amode.value = immed8;
+    return AMODE_IMM_8_POST;
+}
+
+uint32_t ArmToX86_64Assembler::reg_pre(int Rm, int W)
+{
+    LOG_ALWAYS_FATAL_IF(W, "reg_pre writeback not yet implemented");
+    amode.reg = Rm;
+    amode.value = 0;
+    return AMODE_REG_PRE;
+}
+
+uint32_t ArmToX86_64Assembler::reg_post(int Rm)
+{
+    LOG_ALWAYS_FATAL("adr mode reg_post not yet implemented\n");
+    return AMODE_UNSUPPORTED;
+}
+
+
+
+// ----------------------------------------------------------------------------
+
+#if 0
+#pragma mark -
+#pragma mark Data Processing...
+#endif
+
+static const int sShiftMap[4] = {   // LSL, LSR, ASR, ROR
+    X86::SH_SHL, X86::SH_SHR, X86::SH_SAR, X86::SH_ROR
+};
+
+// Returns SRC_IMM with the immediate in 'source', or SRC_REG with the x86
+// register holding the operand in 'source'. Shifted registers are computed
+// in rax.
+int ArmToX86_64Assembler::dataProcAdrModes(uint32_t Op2, int& source)
+{
+    if (Op2 < AMODE_REG) {
+        source = xreg(Op2);
+        return SRC_REG;
+    }
+    switch (Op2) {
+    case AMODE_IMM:
+        source = amode.value;
+        return SRC_IMM;
+    case AMODE_REG_IMM:
+        source = xreg(amode.reg);
+        if (amode.value) {
+            mX86->MOV(X86::RAX, source);
+            mX86->SHIFT(sShiftMap[amode.stype & 3], X86::RAX, amode.value);
+            source = X86::RAX;
+        }
+        return SRC_REG;
+    }
+    LOG_ALWAYS_FATAL("unsupported operand %08x", Op2);
+    return SRC_ERROR;
+}
+
+// Same as above for address offsets, which are sign-extended to 64 bits
+// into rax. Left shifts up to 3 are returned in 'scale' for use in the
+// addressing mode.
+int ArmToX86_64Assembler::addrOffset(uint32_t Op2, int& scale)
+{
+    scale = 0;
+    if (Op2 == AMODE_IMM) {
+        return SRC_IMM;
+    }
+    if (Op2 == AMODE_REG_IMM && amode.stype == LSL && amode.value <= 3) {
+        scale = amode.value;
+        Op2 = amode.reg;
+    }
+    int source;
+    dataProcAdrModes(Op2, source);
+    mX86->MOVSXD(X86::RAX, source);
+    return SRC_REG;
+}
+
+void ArmToX86_64Assembler::dataProcessing(int opcode, int cc,
+        int s, int Rd, int Rn, uint32_t Op2)
+{
+    begin(cc);
+
+    const int d = xreg(Rd);
+    int kind = FLAGS_UNCHANGED;
+    int source;
+    int type;
+    int op;
+    bool commutative = true;
+
+    // flag-preserving forms first
+    if (!s && opcode == opADD && Op2 == AMODE_REG_IMM &&
+            amode.stype == LSL && amode.value <= 3) {
+        mX86->LEA(d, xreg(Rn), xreg(amode.reg), amode.value, 0);
+        end(cc);
+        return;
+    }
+    if ((opcode == opMOV || opcode == opMVN) && Op2 == AMODE_REG_IMM) {
+        const int m = xreg(amode.reg);
+        if (!s && opcode == opMOV && amode.stype == LSL &&
+                amode.value >= 1 && amode.value <= 3) {
+            mX86->LEA(d, -1, m, amode.value, 0);
+        } else {
+            if (d != m)
+                mX86->MOV(d, m);
+            if (amode.value)
+                mX86->SHIFT(sShiftMap[amode.stype & 3], d, amode.value);
+            if (opcode == opMVN)
+                mX86->NOT(d);
+        }
+        if (s) {
+            mX86->TEST(d, d);
+            kind = FLAGS_LOGIC;
+        }
+        end(cc, kind);
+        return;
+    }
+
+    type = dataProcAdrModes(Op2, source);
+
+    switch (opcode) {
+    case opMOV:
+    case opMVN:
+        if (type == SRC_IMM) {
+            mX86->MOVI(d, (opcode == opMVN) ? ~source : source);
+        } else {
+            if (d != source)
+                mX86->MOV(d, source);
+            if (opcode == opMVN)
+                mX86->NOT(d);
+        }
+        if (s) {
+            mX86->TEST(d, d);
+            kind = FLAGS_LOGIC;
+        }
+        end(cc, kind);
+        return;
+
+    case opADD:
+        if (!s) {
+            if (type == SRC_IMM)
+                mX86->LEA(d, xreg(Rn), -1, 0, source);
+            else
+                mX86->LEA(d, xreg(Rn), source, 0, 0);
+            end(cc);
+            return;
+        }
+        op = X86::ALU_ADD;
+        kind = FLAGS_ADD;
+        break;
+
+    case opSUB:
+        if (!s && type == SRC_IMM) {
+            mX86->LEA(d, xreg(Rn), -1, 0, -source);
+            end(cc);
+            return;
+        }
+        op = X86::ALU_SUB;
+        kind = FLAGS_SUB;
+        commutative = false;
+        break;
+
+    case opRSB: {
+        const int n = xreg(Rn);
+        if (type == SRC_IMM && source == 0) {
+            if (d != n)
+                mX86->MOV(d, n);
+            mX86->NEG(d);
+        } else {
+            if (type == SRC_IMM)
+                mX86->MOVI(X86::RAX, source);
+            else if (source != X86::RAX)
+                mX86->MOV(X86::RAX, source);
+            mX86->ALU(X86::ALU_SUB, X86::RAX, n);
+            mX86->MOV(d, X86::RAX);
+        }
+        end(cc, s ? FLAGS_SUB : FLAGS_UNCHANGED);
+        return;
+    }
+
+    case opAND:
+        op = X86::ALU_AND;
+        kind = FLAGS_LOGIC;
+        break;
+
+    case opEOR:
+        op = X86::ALU_XOR;
+        kind = FLAGS_LOGIC;
+        break;
+
+    case opORR:
+        op = X86::ALU_OR;
+        kind = FLAGS_LOGIC;
+        break;
+
+    case opBIC:
+        if (type == SRC_IMM) {
+            source = ~source;
+        } else {
+            if (source != X86::RAX)
+                mX86->MOV(X86::RAX, source);
+            mX86->NOT(X86::RAX);
+            source = X86::RAX;
+        }
+        op = X86::ALU_AND;
+        kind = FLAGS_LOGIC;
+        break;
+
+    case opCMP:
+        if (type == SRC_IMM)
+            mX86->ALUI(X86::ALU_CMP, xreg(Rn), source);
+        else
+            mX86->ALU(X86::ALU_CMP, xreg(Rn), source);
+        end(cc, FLAGS_SUB);
+        return;
+
+    case opTST:
+        if (type == SRC_IMM)
+            mX86->TESTI(xreg(Rn), source);
+        else
+            mX86->TEST(xreg(Rn), source);
+        end(cc, FLAGS_LOGIC);
+        return;
+
+    case opCMN:
+    case opTEQ:
+        op = (opcode == opCMN) ? X86::ALU_ADD : X86::ALU_XOR;
+        if (type == SRC_IMM) {
+            mX86->MOV(X86::RAX, xreg(Rn));
+            mX86->ALUI(op, X86::RAX, source);
+        } else if (source == X86::RAX) {
+            mX86->ALU(op, X86::RAX, xreg(Rn));
+        } else {
+            mX86->MOV(X86::RAX, xreg(Rn));
+            mX86->ALU(op, X86::RAX, source);
+        }
+        end(cc, (opcode == opCMN) ? FLAGS_ADD : FLAGS_LOGIC);
+        return;
+
+    default:    // opADC, opSBC, opRSC
+        LOG_ALWAYS_FATAL("unsupported data processing opcode %d", opcode);
+        return;
+    }
+
+    // d = n op source
+    const int n = xreg(Rn);
+    if (type == SRC_IMM) {
+        if (d != n)
+            mX86->MOV(d, n);
+        mX86->ALUI(op, d, source);
+    } else if (d == n) {
+        mX86->ALU(op, d, source);
+    } else if (d == source) {
+        if (commutative) {
+            mX86->ALU(op, d, n);
+        } else {
+            mX86->MOV(X86::RAX, n);
+            mX86->ALU(op, X86::RAX, source);
+            mX86->MOV(d, X86::RAX);
+        }
+    } else {
+        mX86->MOV(d, n);
+        mX86->ALU(op, d, source);
+    }
+    end(cc, s ? kind : FLAGS_UNCHANGED);
+}
+
+
+
+#if 0
+#pragma mark -
+#pragma mark Multiply...
+#endif
+
+// multiply, accumulate (32x32 -> 32 bits)
+void ArmToX86_64Assembler::MLA(int cc, int s,
+        int Rd, int Rm, int Rs, int Rn)
+{
+    begin(cc);
+    mX86->MOV(X86::RAX, xreg(Rm));
+    mX86->IMUL(X86::RAX, xreg(Rs));
+    mX86->ALU(X86::ALU_ADD, X86::RAX, xreg(Rn));
+    mX86->MOV(xreg(Rd), X86::RAX);
+    if (s) {
+        mX86->TEST(xreg(Rd), xreg(Rd));
+    }
+    end(cc, s ? FLAGS_LOGIC : FLAGS_UNCHANGED);
+}
+
+void ArmToX86_64Assembler::MUL(int cc, int s,
+        int Rd, int Rm, int Rs)
+{
+    begin(cc);
+    const int d = xreg(Rd);
+    const int m = xreg(Rm);
+    const int r = xreg(Rs);
+    if (d == m) {
+        mX86->IMUL(d, r);
+    } else if (d == r) {
+        mX86->IMUL(d, m);
+    } else {
+        mX86->MOV(d, m);
+        mX86->IMUL(d, r);
+    }
+    if (s) {
+        mX86->TEST(d, d);
+    }
+    end(cc, s ? FLAGS_LOGIC : FLAGS_UNCHANGED);
+}
+
+void ArmToX86_64Assembler::UMULL(int cc, int s,
+        int RdLo, int RdHi, int Rm, int Rs)
+{
+    NOT_IMPLEMENTED();
+}
+
+void ArmToX86_64Assembler::UMUAL(int cc, int s,
+        int RdLo, int RdHi, int Rm, int Rs)
+{
+    NOT_IMPLEMENTED();
+}
+
+void ArmToX86_64Assembler::SMULL(int cc, int s,
+        int RdLo, int RdHi, int Rm, int Rs)
+{
+    NOT_IMPLEMENTED();
+}
+
+void ArmToX86_64Assembler::SMUAL(int cc, int s,
+        int RdLo, int RdHi, int Rm, int Rs)
+{
+    NOT_IMPLEMENTED();
+}
+
+
+
+#if 0
+#pragma mark -
+#pragma mark Branches...
+#endif
+
+// branches...
+
+void ArmToX86_64Assembler::B(int cc, const char* label)
+{
+    if (cc == NV) {
+        return;
+    }
+    if (cc == AL) {
+        mX86->JMP(label);
+        // only reachable through a label from now on
+        mFlagsState = FLAGS_NONE;
+        mFlagsInXmm = false;
+        return;
+    }
+    useFlags();
+    mX86->JCC(x86cc(cc), label);
+}
+
+void ArmToX86_64Assembler::BL(int cc, const char* label)
+{
+    LOG_ALWAYS_FATAL("branch-and-link not supported yet\n");
+}
+
+void ArmToX86_64Assembler::B(int cc, uint32_t* to_pc)
+{
+    LOG_ALWAYS_FATAL("branch to absolute PC not supported, use Label\n");
+}
+
+void ArmToX86_64Assembler::BL(int cc, uint32_t* pc)
+{
+    LOG_ALWAYS_FATAL("branch-and-link not supported yet\n");
+}
+
+void ArmToX86_64Assembler::BX(int cc, int Rn)
+{
+    LOG_ALWAYS_FATAL("branch to register not supported yet\n");
+}
+
+
+
+#if 0
+#pragma mark -
+#pragma mark Data Transfer...
+#endif
+
+void ArmToX86_64Assembler::memoryOp(int cc, bool load, int size,
+        int Rd, int Rn, uint32_t offset)
+{
+    begin(cc);
+
+    const int d = xreg(Rd);
+
+    // work-around for ARM default address mode of immed12_pre(0)
+    if (offset > AMODE_UNSUPPORTED) offset = 0;
+
+    // register spills (see GGLAssembler::Spill), the whole 64-bit
+    // register is saved as it may hold a pointer
+    if (Rn == SP && !load && offset == AMODE_IMM_12_PRE &&
+            amode.writeback && int32_t(amode.value) == -4) {
+        mX86->PUSH(d);
+        end(cc);
+        return;
+    }
+    if (Rn == SP && load && offset == AMODE_IMM_12_POST &&
+            int32_t(amode.value) == 4) {
+        mX86->POP(d);
+        end(cc);
+        return;
+    }
+
+    const int n = xreg(Rn);
+    int index = -1;
+    int scale = 0;
+    int32_t disp = 0;
+    bool update = false;
+    switch (offset) {
+        case 0:
+            amode.value = 0;
+            amode.writeback = 0;
+            // fall thru to next case ....
+        case AMODE_IMM_12_PRE:
+        case AMODE_IMM_8_PRE:
+            disp = amode.value;
+            update = amode.writeback;
+            break;
+        case AMODE_IMM_12_POST:
+        case AMODE_IMM_8_POST:
+            update = true;
+            break;
+        case AMODE_REG_SCALE_PRE:
+        case AMODE_REG_PRE:
+            // register offsets can be negative
+            mX86->MOVSXD(X86::RAX, xreg(amode.reg));
+            index = X86::RAX;
+            scale = amode.value;
+            break;
+        default:
+            LOG_ALWAYS_FATAL("unsupported addressing mode %08x", offset);
+            break;
+    }
+
+    if (load)
+        mX86->LOAD(size, d, n, index, scale, disp);
+    else
+        mX86->STORE(size, d, n, index, scale, disp);
+
+    if (update) {
+        mX86->LEA(n, n, -1, 0, int32_t(amode.value), true);
+    }
+    end(cc);
+}
+
+void ArmToX86_64Assembler::LDR(int cc, int Rd, int Rn, uint32_t offset)
+{
+    memoryOp(cc, true, X86::MEM_32, Rd, Rn, offset);
+}
+
+void ArmToX86_64Assembler::LDRB(int cc, int Rd, int Rn, uint32_t offset)
+{
+    memoryOp(cc, true, X86::MEM_U8, Rd, Rn, offset);
+}
+
+void ArmToX86_64Assembler::STR(int cc, int Rd, int Rn, uint32_t offset)
+{
+    memoryOp(cc, false, X86::MEM_32, Rd, Rn, offset);
+}
+
+void ArmToX86_64Assembler::STRB(int cc, int Rd, int Rn, uint32_t offset)
+{
+    memoryOp(cc, false, X86::MEM_U8, Rd, Rn, offset);
+}
+
+void ArmToX86_64Assembler::LDRH(int cc, int Rd, int Rn, uint32_t offset)
+{
+    memoryOp(cc, true, X86::MEM_U16, Rd, Rn, offset);
+}
+
+void ArmToX86_64Assembler::LDRSB(int cc, int Rd, int Rn, uint32_t offset)
+{
+    memoryOp(cc, true, X86::MEM_S8, Rd, Rn, offset);
+}
+
+void ArmToX86_64Assembler::LDRSH(int cc, int Rd, int Rn, uint32_t offset)
+{
+    memoryOp(cc, true, X86::MEM_S16, Rd, Rn, offset);
+}
+
+void ArmToX86_64Assembler::STRH(int cc, int Rd, int Rn, uint32_t offset)
+{
+    memoryOp(cc, false, X86::MEM_U16, Rd, Rn, offset);
+}
+
+void ArmToX86_64Assembler::ADDR_LDR(int cc, int Rd, int Rn, uint32_t offset)
+{
+    memoryOp(cc, true, X86::MEM_64, Rd, Rn, offset);
+}
+
+void ArmToX86_64Assembler::ADDR_STR(int cc, int Rd, int Rn, uint32_t offset)
+{
+    memoryOp(cc, false, X86::MEM_64, Rd, Rn, offset);
+}
+
+// block data transfer, only used for spills (see GGLAssembler::Spill)
+void ArmToX86_64Assembler::LDM(int cc, int dir,
+        int Rn, int W, uint32_t reg_list)
+{
+    LOG_ALWAYS_FATAL_IF(Rn != SP || !W || dir != IA,
+            "LDM only supported as a stack pop");
+    begin(cc);
+    for (int r = R0; r <= R14; r++) {
+        if (reg_list & (1 << r))
+            mX86->POP(xreg(r));
+    }
+    end(cc);
+}
+
+void ArmToX86_64Assembler::STM(int cc, int dir,
+        int Rn, int W, uint32_t reg_list)
+{
+    LOG_ALWAYS_FATAL_IF(Rn != SP || !W || dir != DB,
+            "STM only supported as a stack push");
+    begin(cc);
+    for (int r = R14; r >= R0; r--) {
+        if (reg_list & (1 << r))
+            mX86->PUSH(xreg(r));
+    }
+    end(cc);
+}
+
+// special...
+void ArmToX86_64Assembler::SWP(int cc, int Rn, int Rd, int Rm) {
+    NOT_IMPLEMENTED();
+}
+
+void ArmToX86_64Assembler::SWPB(int cc, int Rn, int Rd, int Rm) {
+    NOT_IMPLEMENTED();
+}
+
+void ArmToX86_64Assembler::SWI(int cc, uint32_t comment) {
+    NOT_IMPLEMENTED();
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark DSP instructions...
+#endif
+
+// PLD...
+void ArmToX86_64Assembler::PLD(int Rn, uint32_t offset) {
+    LOG_ALWAYS_FATAL_IF(offset != AMODE_IMM_12_PRE && offset <= AMODE_UNSUPPORTED,
+                        "PLD only supports immediate offsets");
+    if (offset > AMODE_UNSUPPORTED) amode.value = 0;
+    mX86->PREFETCH(xreg(Rn), amode.value);
+}
+
+void ArmToX86_64Assembler::CLZ(int cc, int Rd, int Rm)
+{
+    begin(cc);
+    // bsr leaves the destination alone when the source is zero
+    mX86->BSR(X86::RAX, xreg(Rm));
+    uint8_t* jnz = mX86->JCC_SKIP(X86::CC_NE);
+    mX86->MOVI(X86::RAX, 63);
+    mX86->patchJCC(jnz);
+    mX86->ALUI(X86::ALU_XOR, X86::RAX, 31);
+    mX86->MOV(xreg(Rd), X86::RAX);
+    end(cc);
+}
+
+void ArmToX86_64Assembler::QADD(int cc,  int Rd, int Rm, int Rn)
+{
+    NOT_IMPLEMENTED();
+}
+
+void ArmToX86_64Assembler::QDADD(int cc,  int Rd, int Rm, int Rn)
+{
+    NOT_IMPLEMENTED();
+}
+
+void ArmToX86_64Assembler::QSUB(int cc,  int Rd, int Rm, int Rn)
+{
+    NOT_IMPLEMENTED();
+}
+
+void ArmToX86_64Assembler::QDSUB(int cc,  int Rd, int Rm, int Rn)
+{
+    NOT_IMPLEMENTED();
+}
+
+// sign-extends the top or bottom half of Rm into Rd (x86 register)
+void ArmToX86_64Assembler::loadHalf(int Rd, int Rm, int top, bool wide)
+{
+    const int m = xreg(Rm);
+    if (top) {
+        if (wide)
+            mX86->MOVSXD(Rd, m);
+        else if (Rd != m)
+            mX86->MOV(Rd, m);
+        mX86->SHIFT(X86::SH_SAR, Rd, 16, wide);
+    } else {
+        mX86->MOVSXW(Rd, m, wide);
+    }
+}
+
+// 16 x 16 multiplication into Rd (x86 register)
+void ArmToX86_64Assembler::smul(int xy, int Rd, int Rm, int Rs)
+{
+    loadHalf(X86::RAX, Rm, xy & xyTB);
+    loadHalf(Rd, Rs, xy & xyBT);
+    mX86->IMUL(Rd, X86::RAX);
+}
+
+// signed 16 bit multiply
+void ArmToX86_64Assembler::SMUL(int cc, int xy,
+                int Rd, int Rm, int Rs)
+{
+    begin(cc);
+    smul(xy, xreg(Rd), Rm, Rs);
+    end(cc);
+}
+
+// signed 32b x 16b multiply, keeps the top 32 bits of the 48-bit product
+void ArmToX86_64Assembler::SMULW(int cc, int y,
+                int Rd, int Rm, int Rs)
+{
+    begin(cc);
+    const int d = xreg(Rd);
+    mX86->MOVSXD(X86::RAX, xreg(Rm));
+    loadHalf(d, Rs, y & yT, true);
+    mX86->IMUL(X86::RAX, d, true);
+    mX86->SHIFT(X86::SH_SAR, X86::RAX, 16, true);
+    mX86->MOV(d, X86::RAX);
+    end(cc);
+}
+
+// signed 16 bit multiply and accumulate
+void ArmToX86_64Assembler::SMLA(int cc, int xy,
+                int Rd, int Rm, int Rs, int Rn)
+{
+    begin(cc);
+    const int d = xreg(Rd);
+    const int n = xreg(Rn);
+    if (d != n) {
+        smul(xy, d, Rm, Rs);
+        mX86->ALU(X86::ALU_ADD, d, n);
+    } else {
+        // the accumulator would be overwritten, keep it in xmm1
+        mX86->MOVQ_TO_XMM(1, n);
+        smul(xy, d, Rm, Rs);
+        mX86->MOVQ_FROM_XMM(X86::RAX, 1);
+        mX86->ALU(X86::ALU_ADD, d, X86::RAX);
+    }
+    end(cc);
+}
+
+void ArmToX86_64Assembler::SMLAL(int cc, int xy,
+                int RdHi, int RdLo, int Rs, int Rm)
+{
+    NOT_IMPLEMENTED();
+}
+
+void ArmToX86_64Assembler::SMLAW(int cc, int y,
+                int Rd, int Rm, int Rs, int Rn)
+{
+    NOT_IMPLEMENTED();
+}
+
+// used by ARMv6 version of GGLAssembler::filter32
+void ArmToX86_64Assembler::UXTB16(int cc, int Rd, int Rm, int rotate)
+{
+    begin(cc);
+    const int d = xreg(Rd);
+    const int m = xreg(Rm);
+    if (d != m)
+        mX86->MOV(d, m);
+    if (rotate)
+        mX86->SHIFT(X86::SH_ROR, d, rotate * 8);
+    mX86->ALUI(X86::ALU_AND, d, 0x00FF00FF);
+    end(cc);
+}
+
+void ArmToX86_64Assembler::UBFX(int cc, int Rd, int Rn, int lsb, int width)
+{
+    begin(cc);
+    const int d = xreg(Rd);
+    const int n = xreg(Rn);
+    if (d != n)
+        mX86->MOV(d, n);
+    if (lsb)
+        mX86->SHIFT(X86::SH_SHR, d, lsb);
+    if (width < 32)
+        mX86->ALUI(X86::ALU_AND, d, (1 << width) - 1);
+    end(cc);
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark Address arithmetic...
+#endif
+
+void ArmToX86_64Assembler::ADDR_ADD(int cc, int s,
+        int Rd, int Rn, uint32_t Op2)
+{
+    LOG_ALWAYS_FATAL_IF(s, "ADDR_ADD can't set the flags");
+    begin(cc);
+    int scale;
+    if (addrOffset(Op2, scale) == SRC_IMM) {
+        mX86->LEA(xreg(Rd), xreg(Rn), -1, 0, amode.value, true);
+    } else {
+        mX86->LEA(xreg(Rd), xreg(Rn), X86::RAX, scale, 0, true);
+    }
+    end(cc);
+}
+
+void ArmToX86_64Assembler::ADDR_SUB(int cc, int s,
+        int Rd, int Rn, uint32_t Op2)
+{
+    LOG_ALWAYS_FATAL_IF(s, "ADDR_SUB can't set the flags");
+    begin(cc);
+    const int d = xreg(Rd);
+    const int n = xreg(Rn);
+    int scale;
+    if (addrOffset(Op2, scale) == SRC_IMM) {
+        mX86->LEA(d, n, -1, 0, -int32_t(amode.value), true);
+    } else {
+        if (scale)
+            mX86->SHIFT(X86::SH_SHL, X86::RAX, scale, true);
+        if (d != n)
+            mX86->MOV(d, n, true);
+        mX86->ALU(X86::ALU_SUB, d, X86::RAX, true);
+    }
+    end(cc);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+
+#if 0
+#pragma mark -
+#pragma mark X86_64Assembler...
+#endif
+
+/*
+** X86_64Assembler creates the x86-64 machine code. Each function emits a
+** single instruction, operands are x86 register numbers.
+*/
+
+X86_64Assembler::X86_64Assembler(const sp<Assembly>& assembly)
+    : mAssembly(assembly)
+{
+    mBase = mPC = (uint8_t*)assembly->base();
+    mEnd = mBase + assembly->size();
+    mOverflow = false;
+    mFlagsTouched = false;
+    mDuration = ggl_system_time();
+#if defined(WITH_LIB_HARDWARE)
+    mQemuTracing = true;
+#endif
+}
+
+X86_64Assembler::~X86_64Assembler()
+{
+}
+
+uint8_t* X86_64Assembler::pc() const
+{
+    return mPC;
+}
+
+uint8_t* X86_64Assembler::base() const
+{
+    return mBase;
+}
+
+void X86_64Assembler::reset()
+{
+    mBase = mPC = (uint8_t*)mAssembly->base();
+    mEnd = mBase + mAssembly->size();
+    mOverflow = false;
+    mBranchTargets.clear();
+    mLabels.clear();
+    mLabelsInverseMapping.clear();
+    mComments.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+void X86_64Assembler::disassemble(const char* name)
+{
+    if (name) {
+        ALOGW("%s:\n", name);
+    }
+
+    // no disassembler here, dump the code 16 bytes a line, starting a new
+    // line at each label or comment
+    uint8_t* start = mBase;
+    for (uint8_t* p = mBase ; p <= mPC ; p++) {
+        ssize_t label = mLabelsInverseMapping.indexOfKey(p);
+        ssize_t comment = mComments.indexOfKey(p);
+        if (p > start && (label >= 0 || comment >= 0 ||
+                p - start == 16 || p == mPC)) {
+            char line[16*3 + 1];
+            for (int i = 0 ; i < p - start ; i++)
+                sprintf(line + i*3, "%02x ", start[i]);
+            ALOGW("%08x:    %s", int(start - mBase), line);
+            start = p;
+        }
+        if (label >= 0) {
+            ALOGW("%s:\n", mLabelsInverseMapping.valueAt(label));
+        }
+        if (comment >= 0) {
+            ALOGW("; %s\n", mComments.valueAt(comment));
+        }
+    }
+}
+
+void X86_64Assembler::comment(const char* string)
+{
+    mComments.add(mPC, string);
+}
+
+void X86_64Assembler::label(const char* theLabel)
+{
+    mLabels.add(theLabel, mPC);
+    mLabelsInverseMapping.add(mPC, theLabel);
+}
+
+int X86_64Assembler::generate(const char* name)
+{
+    if (mOverflow) {
+        ALOGE("%s does not fit in %d bytes", name, int(mAssembly->size()));
+        return NO_MEMORY;
+    }
+
+    // fixup all the branches
+    size_t count = mBranchTargets.size();
+    while (count--) {
+        const branch_target_t& bt = mBranchTargets[count];
+        uint8_t* target_pc = mLabels.valueFor(bt.label);
+        LOG_ALWAYS_FATAL_IF(!target_pc,
+                "error resolving branch targets, target_pc is null");
+        int32_t offset = int32_t(target_pc - (bt.pc + 4));
+        memcpy(bt.pc, &offset, 4);
+    }
+
+    mAssembly->resize(int(pc()-base()));
+
+    // the instruction cache is coherent on x86, nothing to flush
+    const int64_t duration = ggl_system_time() - mDuration;
+    const char * const format = "generated %s (%d bytes) at [%p:%p] in %lld ns\n";
+    ALOGI(format, name, int(pc()-base()), base(), pc(), (long long)duration);
+
+#if defined(WITH_LIB_HARDWARE)
+    if (__builtin_expect(mQemuTracing, 0)) {
+        int err = qemu_add_mapping(uintptr_t(base()), name);
+        mQemuTracing = (err >= 0);
+    }
+#endif
+
+    char value[PROPERTY_VALUE_MAX];
+    value[0] = '\0';
+
+    property_get("debug.pf.disasm", value, "0");
+
+    if (atoi(value) != 0) {
+        disassemble(name);
+    }
+
+    return NO_ERROR;
+}
+
+uint8_t* X86_64Assembler::pcForLabel(const char* label)
+{
+    return mLabels.valueFor(label);
+}
+
+void X86_64Assembler::insert(uint8_t* at, const uint8_t* code, size_t size)
+{
+    if (mOverflow || at > mPC)
+        return;
+    if (mPC + size > mEnd) {
+        mOverflow = true;
+        mPC = mBase;
+        return;
+    }
+    memmove(at + size, at, mPC - at);
+    memcpy(at, code, size);
+    mPC += size;
+
+    // labels and branches are never found after 'at', only comments
+    KeyedVector< uint8_t*, const char* > comments;
+    for (size_t i = 0; i < mComments.size(); i++) {
+        uint8_t* pc = mComments.keyAt(i);
+        comments.add((pc > at) ? pc + size : pc, mComments.valueAt(i));
+    }
+    mComments = comments;
+}
+
+static void nop(uint8_t* p, size_t size)
+{
+    static const uint8_t nops[9][9] = {
+        { 0x90 },
+        { 0x66, 0x90 },
+        { 0x0F, 0x1F, 0x00 },
+        { 0x0F, 0x1F, 0x40, 0x00 },
+        { 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+        { 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+        { 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 },
+        { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+        { 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    };
+    while (size) {
+        size_t n = size < 9 ? size : 9;
+        memcpy(p, nops[n-1], n);
+        p += n;
+        size -= n;
+    }
+}
+
+void X86_64Assembler::patch(uint8_t* at, const uint8_t* code, size_t size,
+        size_t room)
+{
+    if (mOverflow || at + room > mPC)
+        return;
+    memcpy(at, code, size);
+    nop(at + size, room - size);
+}
+
+void X86_64Assembler::clearFlagsTouched()
+{
+    mFlagsTouched = false;
+}
+
+bool X86_64Assembler::flagsTouched() const
+{
+    return mFlagsTouched;
+}
+
+
+// ----------------------------------------------------------------------------
+#if 0
+#pragma mark -
+#pragma mark Encoding...
+#endif
+
+void X86_64Assembler::emit8(uint8_t b)
+{
+    if (mPC >= mEnd) {
+        // generate() will fail, keep going with what's left
+        mOverflow = true;
+        mPC = mBase;
+    }
+    *mPC++ = b;
+}
+
+void X86_64Assembler::emit32(uint32_t w)
+{
+    emit8(w);
+    emit8(w >> 8);
+    emit8(w >> 16);
+    emit8(w >> 24);
+}
+
+void X86_64Assembler::rex(bool w, int reg, int index, int base, bool force)
+{
+    uint8_t r = 0x40;
+    if (w)                  r |= 0x08;
+    if (reg > 0 && reg & 8)     r |= 0x04;
+    if (index > 0 && index & 8) r |= 0x02;
+    if (base > 0 && base & 8)   r |= 0x01;
+    if (r != 0x40 || force)
+        emit8(r);
+}
+
+void X86_64Assembler::modrm_reg(int reg, int rm)
+{
+    emit8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void X86_64Assembler::modrm_mem(int reg, int base, int index, int scale,
+        int32_t disp)
+{
+    const bool disp8 = (disp >= -128 && disp <= 127);
+    int mod;
+    if (base < 0) {
+        mod = 0;    // no base: disp32 follows the SIB byte
+    } else if (disp == 0 && (base & 7) != RBP) {
+        mod = 0;
+    } else {
+        mod = disp8 ? 1 : 2;
+    }
+
+    if (index < 0 && base >= 0 && (base & 7) != RSP) {
+        emit8((mod << 6) | ((reg & 7) << 3) | (base & 7));
+    } else {
+        emit8((mod << 6) | ((reg & 7) << 3) | RSP);
+        emit8((scale << 6) | (((index < 0) ? RSP : index) & 7) << 3 |
+                ((base < 0) ? RBP : (base & 7)));
+    }
+
+    if (base < 0 || mod == 2)
+        emit32(disp);
+    else if (mod == 1)
+        emit8(disp);
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark Arithmetic and logic...
+#endif
+
+void X86_64Assembler::ALU(int op, int Rd, int Rs, bool wide)
+{
+    rex(wide, Rs, -1, Rd);
+    emit8((op << 3) | 0x01);
+    modrm_reg(Rs, Rd);
+    mFlagsTouched = true;
+}
+
+void X86_64Assembler::ALUI(int op, int Rd, int32_t imm, bool wide)
+{
+    rex(wide, 0, -1, Rd);
+    if (imm >= -128 && imm <= 127) {
+        emit8(0x83);
+        modrm_reg(op, Rd);
+        emit8(imm);
+    } else {
+        emit8(0x81);
+        modrm_reg(op, Rd);
+        emit32(imm);
+    }
+    mFlagsTouched = true;
+}
+
+void X86_64Assembler::TEST(int Rd, int Rs, bool wide)
+{
+    rex(wide, Rs, -1, Rd);
+    emit8(0x85);
+    modrm_reg(Rs, Rd);
+    mFlagsTouched = true;
+}
+
+void X86_64Assembler::TESTI(int Rd, uint32_t imm)
+{
+    rex(false, 0, -1, Rd);
+    emit8(0xF7);
+    modrm_reg(0, Rd);
+    emit32(imm);
+    mFlagsTouched = true;
+}
+
+void X86_64Assembler::SHIFT(int op, int Rd, int count, bool wide)
+{
+    rex(wide, 0, -1, Rd);
+    if (count == 1) {
+        emit8(0xD1);
+        modrm_reg(op, Rd);
+    } else {
+        emit8(0xC1);
+        modrm_reg(op, Rd);
+        emit8(count);
+    }
+    mFlagsTouched = true;
+}
+
+void X86_64Assembler::NOT(int Rd)
+{
+    // the only one not touching the flags
+    rex(false, 0, -1, Rd);
+    emit8(0xF7);
+    modrm_reg(2, Rd);
+}
+
+void X86_64Assembler::NEG(int Rd)
+{
+    rex(false, 0, -1, Rd);
+    emit8(0xF7);
+    modrm_reg(3, Rd);
+    mFlagsTouched = true;
+}
+
+void X86_64Assembler::IMUL(int Rd, int Rs, bool wide)
+{
+    rex(wide, Rd, -1, Rs);
+    emit8(0x0F);
+    emit8(0xAF);
+    modrm_reg(Rd, Rs);
+    mFlagsTouched = true;
+}
+
+void X86_64Assembler::BSR(int Rd, int Rs)
+{
+    rex(false, Rd, -1, Rs);
+    emit8(0x0F);
+    emit8(0xBD);
+    modrm_reg(Rd, Rs);
+    mFlagsTouched = true;
+}
+
+void X86_64Assembler::LEA(int Rd, int base, int index, int scale,
+        int32_t disp, bool wide)
+{
+    rex(wide, Rd, index, base);
+    emit8(0x8D);
+    modrm_mem(Rd, base, index, scale, disp);
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark Register moves...
+#endif
+
+void X86_64Assembler::MOV(int Rd, int Rs, bool wide)
+{
+    rex(wide, Rs, -1, Rd);
+    emit8(0x89);
+    modrm_reg(Rs, Rd);
+}
+
+void X86_64Assembler::MOVI(int Rd, uint32_t imm)
+{
+    // not xor for zero, which would touch the flags
+    rex(false, 0, -1, Rd);
+    emit8(0xB8 + (Rd & 7));
+    emit32(imm);
+}
+
+void X86_64Assembler::MOVSXD(int Rd, int Rs)
+{
+    rex(true, Rd, -1, Rs);
+    emit8(0x63);
+    modrm_reg(Rd, Rs);
+}
+
+void X86_64Assembler::MOVSXW(int Rd, int Rs, bool wide)
+{
+    rex(wide, Rd, -1, Rs);
+    emit8(0x0F);
+    emit8(0xBF);
+    modrm_reg(Rd, Rs);
+}
+
+void X86_64Assembler::MOVQ_TO_XMM(int xmm, int Rs)
+{
+    emit8(0x66);
+    rex(true, xmm, -1, Rs);
+    emit8(0x0F);
+    emit8(0x6E);
+    modrm_reg(xmm, Rs);
+}
+
+void X86_64Assembler::MOVQ_FROM_XMM(int Rd, int xmm)
+{
+    emit8(0x66);
+    rex(true, xmm, -1, Rd);
+    emit8(0x0F);
+    emit8(0x7E);
+    modrm_reg(xmm, Rd);
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark Load/store...
+#endif
+
+void X86_64Assembler::LOAD(int size, int Rd, int base, int index, int scale,
+        int32_t disp)
+{
+    rex(size == MEM_64, Rd, index, base);
+    switch (size) {
+    case MEM_U8:    emit8(0x0F); emit8(0xB6);   break;
+    case MEM_S8:    emit8(0x0F); emit8(0xBE);   break;
+    case MEM_U16:   emit8(0x0F); emit8(0xB7);   break;
+    case MEM_S16:   emit8(0x0F); emit8(0xBF);   break;
+    default:        emit8(0x8B);                break;
+    }
+    modrm_mem(Rd, base, index, scale, disp);
+}
+
+void X86_64Assembler::STORE(int size, int Rs, int base, int index, int scale,
+        int32_t disp)
+{
+    switch (size) {
+    case MEM_U8:
+    case MEM_S8:
+        // without REX, 4-7 would be ah, ch, dh and bh
+        rex(false, Rs, index, base, Rs >= RSP && Rs <= RDI);
+        emit8(0x88);
+        break;
+    case MEM_U16:
+    case MEM_S16:
+        emit8(0x66);
+        rex(false, Rs, index, base);
+        emit8(0x89);
+        break;
+    default:
+        rex(size == MEM_64, Rs, index, base);
+        emit8(0x89);
+        break;
+    }
+    modrm_mem(Rs, base, index, scale, disp);
+}
+
+void X86_64Assembler::PREFETCH(int base, int32_t disp)
+{
+    rex(false, 0, -1, base);
+    emit8(0x0F);
+    emit8(0x18);
+    modrm_mem(1, base, -1, 0, disp);    // prefetcht0
+}
+
+void X86_64Assembler::PUSH(int Rs)
+{
+    rex(false, 0, -1, Rs);
+    emit8(0x50 + (Rs & 7));
+}
+
+void X86_64Assembler::POP(int Rd)
+{
+    rex(false, 0, -1, Rd);
+    emit8(0x58 + (Rd & 7));
+}
+
+void X86_64Assembler::PUSHF()
+{
+    emit8(0x9C);
+}
+
+void X86_64Assembler::POPF()
+{
+    emit8(0x9D);
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark Branch...
+#endif
+
+// cc < 0 for an unconditional jump
+void X86_64Assembler::jump(int cc, const char* label)
+{
+    ssize_t index = mLabels.indexOfKey(label);
+    if (index >= 0) {
+        // backward, the target is known
+        const uint8_t* target = mLabels.valueAt(index);
+        const int32_t offset = int32_t(target - (mPC + 2));
+        if (offset >= -128) {
+            emit8((cc < 0) ? 0xEB : 0x70 + cc);
+            emit8(offset);
+        } else if (cc < 0) {
+            emit8(0xE9);
+            emit32(offset - 3);
+        } else {
+            emit8(0x0F);
+            emit8(0x80 + cc);
+            emit32(offset - 4);
+        }
+        return;
+    }
+    if (cc < 0) {
+        emit8(0xE9);
+    } else {
+        emit8(0x0F);
+        emit8(0x80 + cc);
+    }
+    mBranchTargets.add(branch_target_t(label, mPC));
+    emit32(0);  // offset filled in later
+}
+
+void X86_64Assembler::JMP(const char* label)
+{
+    jump(-1, label);
+}
+
+void X86_64Assembler::JCC(int cc, const char* label)
+{
+    jump(cc, label);
+}
+
+uint8_t* X86_64Assembler::JCC_SKIP(int cc)
+{
+    uint8_t* pc = mPC;
+    emit8(0x70 + cc);
+    emit8(0);   // offset filled in by patchJCC()
+    return pc;
+}
+
+void X86_64Assembler::patchJCC(uint8_t* jcc)
+{
+    if (mOverflow || jcc + 2 > mPC)
+        return;
+    const int32_t offset = int32_t(mPC - (jcc + 2));
+    if (offset <= 127) {
+        jcc[1] = offset;
+        return;
+    }
+    // too far for a short jump, make room for a near one
+    const int cc = jcc[0] - 0x70;
+    const uint8_t room[4] = { 0 };
+    insert(jcc + 2, room, sizeof(room));
+    if (mOverflow)
+        return;
+    jcc[0] = 0x0F;
+    jcc[1] = 0x80 + cc;
+    memcpy(jcc + 2, &offset, 4);
+}
+
+void X86_64Assembler::RET()
+{
+    emit8(0xC3);
+}
+
+
+#if 0
+#pragma mark -
+#pragma mark Misc...
+#endif
+
+void X86_64Assembler::NOP(int size)
+{
+    uint8_t code[16];
+    while (size > 0) {
+        const int n = size < int(sizeof(code)) ? size : int(sizeof(code));
+        nop(code, n);
+        for (int i = 0; i < n; i++)
+            emit8(code[i]);
+        size -= n;
+    }
+}
+
+}; // namespace android
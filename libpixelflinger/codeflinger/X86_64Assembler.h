@@ -0,0 +1,414 @@
+/* libs/pixelflinger/codeflinger/X86_64Assembler.h
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_X86_64ASSEMBLER_H
+#define ANDROID_X86_64ASSEMBLER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tinyutils/KeyedVector.h"
+#include "tinyutils/Vector.h"
+#include "tinyutils/smartpointer.h"
+
+#include "ARMAssemblerInterface.h"
+#include "CodeCache.h"
+
+namespace android {
+
+class X86_64Assembler;  // forward reference
+
+// this class mimics ARMAssembler interface
+//  each ARM instruction is translated to 1 or more x86-64 instructions,
+//  which are emitted by the X86_64Assembler class below
+class ArmToX86_64Assembler : public ARMAssemblerInterface
+{
+public:
+                ArmToX86_64Assembler(const sp<Assembly>& assembly);
+    virtual     ~ArmToX86_64Assembler();
+
+    uint32_t*   base() const;
+    uint32_t*   pc() const;
+    void        disassemble(const char* name);
+
+    virtual void    reset();
+
+    virtual int     generate(const char* name);
+    virtual int     getCodegenArch();
+
+    virtual void    prolog();
+    virtual void    epilog(uint32_t touched);
+    virtual void    comment(const char* string);
+
+
+    // -----------------------------------------------------------------------
+    // shifters and addressing modes
+    // -----------------------------------------------------------------------
+
+    // shifters...
+    virtual bool        isValidImmediate(uint32_t immed);
+    virtual int         buildImmediate(uint32_t i, uint32_t& rot, uint32_t& imm);
+
+    virtual uint32_t    imm(uint32_t immediate);
+    virtual uint32_t    reg_imm(int Rm, int type, uint32_t shift);
+    virtual uint32_t    reg_rrx(int Rm);
+    virtual uint32_t    reg_reg(int Rm, int type, int Rs);
+
+    // addressing modes...
+    // LDR(B)/STR(B)/PLD
+    // (immediate and Rm can be negative, which indicates U=0)
+    virtual uint32_t    immed12_pre(int32_t immed12, int W=0);
+    virtual uint32_t    immed12_post(int32_t immed12);
+    virtual uint32_t    reg_scale_pre(int Rm, int type=0, uint32_t shift=0, int W=0);
+    virtual uint32_t    reg_scale_post(int Rm, int type=0, uint32_t shift=0);
+
+    // LDRH/LDRSB/LDRSH/STRH
+    // (immediate and Rm can be negative, which indicates U=0)
+    virtual uint32_t    immed8_pre(int32_t immed8, int W=0);
+    virtual uint32_t    immed8_post(int32_t immed8);
+    virtual uint32_t    reg_pre(int Rm, int W=0);
+    virtual uint32_t    reg_post(int Rm);
+
+
+    virtual void    dataProcessing(int opcode, int cc, int s,
+                                int Rd, int Rn,
+                                uint32_t Op2);
+    virtual void MLA(int cc, int s,
+                int Rd, int Rm, int Rs, int Rn);
+    virtual void MUL(int cc, int s,
+                int Rd, int Rm, int Rs);
+    virtual void UMULL(int cc, int s,
+                int RdLo, int RdHi, int Rm, int Rs);
+    virtual void UMUAL(int cc, int s,
+                int RdLo, int RdHi, int Rm, int Rs);
+    virtual void SMULL(int cc, int s,
+                int RdLo, int RdHi, int Rm, int Rs);
+    virtual void SMUAL(int cc, int s,
+                int RdLo, int RdHi, int Rm, int Rs);
+
+    virtual void B(int cc, uint32_t* pc);
+    virtual void BL(int cc, uint32_t* pc);
+    virtual void BX(int cc, int Rn);
+    virtual void label(const char* theLabel);
+    virtual void B(int cc, const char* label);
+    virtual void BL(int cc, const char* label);
+
+    virtual uint32_t* pcForLabel(const char* label);
+
+    virtual void LDR (int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void LDRB(int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void STR (int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void STRB(int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void LDRH (int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void LDRSB(int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void LDRSH(int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+    virtual void STRH (int cc, int Rd,
+                int Rn, uint32_t offset = 0);
+
+    virtual void LDM(int cc, int dir,
+                int Rn, int W, uint32_t reg_list);
+    virtual void STM(int cc, int dir,
+                int Rn, int W, uint32_t reg_list);
+
+    virtual void SWP(int cc, int Rn, int Rd, int Rm);
+    virtual void SWPB(int cc, int Rn, int Rd, int Rm);
+    virtual void SWI(int cc, uint32_t comment);
+
+    virtual void PLD(int Rn, uint32_t offset);
+    virtual void CLZ(int cc, int Rd, int Rm);
+    virtual void QADD(int cc, int Rd, int Rm, int Rn);
+    virtual void QDADD(int cc, int Rd, int Rm, int Rn);
+    virtual void QSUB(int cc, int Rd, int Rm, int Rn);
+    virtual void QDSUB(int cc, int Rd, int Rm, int Rn);
+    virtual void SMUL(int cc, int xy,
+                int Rd, int Rm, int Rs);
+    virtual void SMULW(int cc, int y,
+                int Rd, int Rm, int Rs);
+    virtual void SMLA(int cc, int xy,
+                int Rd, int Rm, int Rs, int Rn);
+    virtual void SMLAL(int cc, int xy,
+                int RdHi, int RdLo, int Rs, int Rm);
+    virtual void SMLAW(int cc, int y,
+                int Rd, int Rm, int Rs, int Rn);
+
+    // byte/half word extract...
+    virtual void UXTB16(int cc, int Rd, int Rm, int rotate);
+
+    // bit manipulation...
+    virtual void UBFX(int cc, int Rd, int Rn, int lsb, int width);
+
+    // address loading/storing/manipulation (64-bit pointers)
+    virtual void ADDR_LDR(int cc, int Rd,
+                int Rn, uint32_t offset = __immed12_pre(0));
+    virtual void ADDR_STR(int cc, int Rd,
+                int Rn, uint32_t offset = __immed12_pre(0));
+    virtual void ADDR_ADD(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+    virtual void ADDR_SUB(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+
+private:
+    ArmToX86_64Assembler(const ArmToX86_64Assembler& rhs);
+    ArmToX86_64Assembler& operator = (const ArmToX86_64Assembler& rhs);
+
+    // conditional execution and ARM condition flags
+    void begin(int cc);
+    void end(int cc, int kind = FLAGS_UNCHANGED);
+    void useFlags();
+    int  x86cc(int cc);
+
+    // operand decoding, the result is either a x86 register or an
+    // immediate (when SRC_IMM is returned)
+    int  dataProcAdrModes(uint32_t Op2, int& source);
+    int  addrOffset(uint32_t Op2, int& scale);
+    void loadHalf(int Rd, int Rm, int top, bool wide = false);
+    void smul(int xy, int Rd, int Rm, int Rs);
+    void memoryOp(int cc, bool load, int size,
+                int Rd, int Rn, uint32_t offset);
+
+    sp<Assembly>        mAssembly;
+    X86_64Assembler*    mX86;
+
+    enum {
+        SRC_REG = 0,
+        SRC_IMM,
+        SRC_ERROR = -1
+    };
+
+    enum addr_modes {
+        // start above the range of legal arm reg #'s (0-15)
+        AMODE_REG = 0x20,
+        AMODE_IMM, AMODE_REG_IMM,               // for data processing
+        AMODE_IMM_12_PRE, AMODE_IMM_12_POST,    // for load/store
+        AMODE_REG_SCALE_PRE, AMODE_IMM_8_PRE,
+        AMODE_IMM_8_POST, AMODE_REG_PRE,
+        AMODE_UNSUPPORTED
+    };
+
+    struct addr_mode_t {    // address modes for current ARM instruction
+        int         reg;
+        int         stype;
+        uint32_t    value;
+        bool        writeback;  // writeback the adr reg after modification
+    } amode;
+
+    // The ARM condition flags live in EFLAGS, which most x86 instructions
+    // clobber. Flags are only saved (in xmm0) once an instruction that
+    // needs them follows one that destroyed them; the save is then
+    // inserted where they were last valid.
+    enum flags_state_t {
+        FLAGS_NONE,         // no flags set since the last label
+        FLAGS_LIVE,         // EFLAGS hold the ARM flags
+        FLAGS_CLOBBERED,    // EFLAGS destroyed, valid at mFlagsValidPC
+        FLAGS_SAVED         // ARM flags saved in xmm0
+    };
+
+    enum flags_kind_t {
+        FLAGS_UNCHANGED = 0,
+        FLAGS_CLOBBER,      // EFLAGS destroyed, ARM flags unchanged
+        FLAGS_SUB,          // set by cmp/sub (x86 CF is ARM's inverted C)
+        FLAGS_ADD,          // set by add (x86 CF is ARM's C)
+        FLAGS_LOGIC         // set by test/and/or/xor (only N and Z are valid)
+    };
+
+    flags_state_t   mFlagsState;
+    flags_kind_t    mFlagsKind;
+    uint8_t*        mFlagsValidPC;
+    bool            mFlagsInXmm;    // xmm0 holds the current ARM flags
+    uint8_t*        mInstrPC;       // first x86 instruction of current op
+    uint8_t*        mSkipPC;        // jcc over a conditional op
+    uint8_t*        mPrologPC;
+};
+
+
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+// ----------------------------------------------------------------------------
+
+// This is the basic x86-64 assembler, which just creates the opcodes in
+// memory. All the more complicated work is done in ArmToX86_64Assembler.
+
+class X86_64Assembler
+{
+public:
+                X86_64Assembler(const sp<Assembly>& assembly);
+    virtual     ~X86_64Assembler();
+
+    uint8_t*    base() const;
+    uint8_t*    pc() const;
+    void        reset();
+
+    void        disassemble(const char* name);
+
+    int         generate(const char* name);
+    void        comment(const char* string);
+    void        label(const char* string);
+
+    // valid only after generate() has been called
+    uint8_t*    pcForLabel(const char* label);
+
+    // moves the code following 'at' to make room for 'size' bytes,
+    // which are copied there
+    void        insert(uint8_t* at, const uint8_t* code, size_t size);
+
+    // overwrites 'room' bytes at 'at' with 'code', padded with NOPs
+    void        patch(uint8_t* at, const uint8_t* code, size_t size,
+                        size_t room);
+
+    // whether EFLAGS were modified since the last clearFlagsTouched()
+    void        clearFlagsTouched();
+    bool        flagsTouched() const;
+
+    enum {
+        RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+        R8, R9, R10, R11, R12, R13, R14, R15
+    };
+
+    // x86 condition codes
+    enum {
+        CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+        CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G
+    };
+
+    // group 1 arithmetic, in ModRM.reg order
+    enum {
+        ALU_ADD, ALU_OR, ALU_ADC, ALU_SBB, ALU_AND, ALU_SUB, ALU_XOR, ALU_CMP
+    };
+
+    // group 2 shifts, in ModRM.reg order
+    enum {
+        SH_ROL, SH_ROR, SH_RCL, SH_RCR, SH_SHL, SH_SHR, SH_SAL, SH_SAR
+    };
+
+    // memory access widths, for LOAD/STORE
+    enum {
+        MEM_U8, MEM_S8, MEM_U16, MEM_S16, MEM_32, MEM_64
+    };
+
+
+#if 0
+#pragma mark -
+#pragma mark Arithmetic and logic...
+#endif
+
+    // 32-bit operations zero the upper half of the destination,
+    // 'wide' selects the 64-bit form
+    void ALU(int op, int Rd, int Rs, bool wide = false);
+    void ALUI(int op, int Rd, int32_t imm, bool wide = false);
+    void TEST(int Rd, int Rs, bool wide = false);
+    void TESTI(int Rd, uint32_t imm);
+    void SHIFT(int op, int Rd, int count, bool wide = false);
+    void NOT(int Rd);
+    void NEG(int Rd);
+    void IMUL(int Rd, int Rs, bool wide = false);
+    void BSR(int Rd, int Rs);
+    void LEA(int Rd, int base, int index, int scale, int32_t disp,
+            bool wide = false);
+
+
+#if 0
+#pragma mark -
+#pragma mark Register moves...
+#endif
+
+    void MOV(int Rd, int Rs, bool wide = false);
+    void MOVI(int Rd, uint32_t imm);
+    void MOVSXD(int Rd, int Rs);                        // 32 to 64 bits
+    void MOVSXW(int Rd, int Rs, bool wide = false);     // 16 to 32/64 bits
+    void MOVQ_TO_XMM(int xmm, int Rs);
+    void MOVQ_FROM_XMM(int Rd, int xmm);
+
+
+#if 0
+#pragma mark -
+#pragma mark Load/store...
+#endif
+
+    // base + index*(1<<scale) + disp, index < 0 for none
+    void LOAD(int size, int Rd, int base, int index, int scale, int32_t disp);
+    void STORE(int size, int Rs, int base, int index, int scale, int32_t disp);
+    void PREFETCH(int base, int32_t disp);
+    void PUSH(int Rs);
+    void POP(int Rd);
+    void PUSHF();
+    void POPF();
+
+
+#if 0
+#pragma mark -
+#pragma mark Branch...
+#endif
+
+    void JMP(const char* label);
+    void JCC(int cc, const char* label);
+
+    // short forward jump over a conditional op, see patchJCC()
+    uint8_t* JCC_SKIP(int cc);
+    void patchJCC(uint8_t* jcc);
+    void RET();
+
+
+#if 0
+#pragma mark -
+#pragma mark Misc...
+#endif
+
+    void NOP(int size);
+
+private:
+    void emit8(uint8_t b);
+    void emit32(uint32_t w);
+    void rex(bool w, int reg, int index, int base, bool force = false);
+    void modrm_reg(int reg, int rm);
+    void modrm_mem(int reg, int base, int index, int scale, int32_t disp);
+    void jump(int cc, const char* label);
+
+    sp<Assembly>    mAssembly;
+    uint8_t*        mBase;
+    uint8_t*        mPC;
+    uint8_t*        mEnd;
+    bool            mOverflow;
+    bool            mFlagsTouched;
+    int64_t         mDuration;
+#if defined(WITH_LIB_HARDWARE)
+    bool            mQemuTracing;
+#endif
+
+    struct branch_target_t {
+        inline branch_target_t() : label(0), pc(0) { }
+        inline branch_target_t(const char* l, uint8_t* p)
+            : label(l), pc(p) { }
+        const char* label;
+        uint8_t*    pc;         // rel32 displacement to fix
+    };
+
+    Vector<branch_target_t>                 mBranchTargets;
+    KeyedVector< const char*, uint8_t* >    mLabels;
+    KeyedVector< uint8_t*, const char* >    mLabelsInverseMapping;
+    KeyedVector< uint8_t*, const char* >    mComments;
+};
+
+}; // namespace android
+
+#endif //ANDROID_X86_64ASSEMBLER_H
@@ -347,17 +347,22 @@ void GGLAssembler::init_textures(
             (tmu.twrap == GGL_NEEDS_WRAP_11)) 
         {
             // 1:1 texture
+            // x and y are still needed by the other tmus and the
+            // iterated colors, work on copies
+            Scratch scratches(registerFile());
+            int tx = scratches.obtain();
+            int ty = scratches.obtain();
             pointer_t& txPtr = coords[i].ptr;
             txPtr.setTo(obtainReg(), tmu.bits);
             CONTEXT_LOAD(txPtr.reg, state.texture[i].iterators.ydsdy);
-            ADD(AL, 0, Rx, Rx, reg_imm(txPtr.reg, ASR, 16));    // x += (s>>16)
+            ADD(AL, 0, tx, Rx, reg_imm(txPtr.reg, ASR, 16));    // x + (s>>16)
             CONTEXT_LOAD(txPtr.reg, state.texture[i].iterators.ydtdy);
-            ADD(AL, 0, Ry, Ry, reg_imm(txPtr.reg, ASR, 16));    // y += (t>>16)
+            ADD(AL, 0, ty, Ry, reg_imm(txPtr.reg, ASR, 16));    // y + (t>>16)
             // merge base & offset
             CONTEXT_LOAD(txPtr.reg, generated_vars.texture[i].stride);
-            SMLABB(AL, Rx, Ry, txPtr.reg, Rx);               // x+y*stride
-            CONTEXT_LOAD(txPtr.reg, generated_vars.texture[i].data);
-            base_offset(txPtr, txPtr, Rx);
+            SMLABB(AL, tx, ty, txPtr.reg, tx);               // x+y*stride
+            CONTEXT_ADDR_LOAD(txPtr.reg, generated_vars.texture[i].data);
+            base_offset(txPtr, txPtr, tx);
         } else {
             Scratch scratches(registerFile());
             reg_t& s = coords[i].s;
@@ -548,21 +553,30 @@ void GGLAssembler::build_textures(  fragment_parts_t& parts,
                     // if ((u>>4) >= width)
                     //      u = width<<4
                     //      width = 0
+                    //      U = 0
                     // else
                     //      width = 1<<shift
                     // u = u>>4; // get integer part
                     // if (u<0)
                     //      u = 0
                     //      width = 0
+                    //      U = 0
                     // generated_vars.rt = width
+                    //
+                    // both texels are the same once clamped, U is cleared
+                    // so that the filter doesn't split the weight of that
+                    // texel in two truncated products (like the generic
+                    // pipeline, which clamps the coordinate first)
                     
                     CMP(AL, width, reg_imm(u, ASR, FRAC_BITS));
                     MOV(LE, 0, u, reg_imm(width, LSL, FRAC_BITS));
                     MOV(LE, 0, width, imm(0));
+                    MOV(LE, 0, U, imm(0));
                     MOV(GT, 0, width, imm(1 << shift));
                     MOV(AL, 1, u, reg_imm(u, ASR, FRAC_BITS));
                     MOV(MI, 0, u, imm(0));
                     MOV(MI, 0, width, imm(0));
+                    MOV(MI, 0, U, imm(0));
                 }
                 CONTEXT_STORE(width, generated_vars.rt);
 
@@ -583,6 +597,7 @@ void GGLAssembler::build_textures(  fragment_parts_t& parts,
                     CMP(AL, height, reg_imm(v, ASR, FRAC_BITS));
                     MOV(LE, 0, v, reg_imm(height, LSL, FRAC_BITS));
                     MOV(LE, 0, height, imm(0));
+                    MOV(LE, 0, V, imm(0));
                     if (shift) {
                         MOV(GT, 0, height, reg_imm(stride, LSL, shift));
                     } else {
@@ -591,6 +606,7 @@ void GGLAssembler::build_textures(  fragment_parts_t& parts,
                     MOV(AL, 1, v, reg_imm(v, ASR, FRAC_BITS));
                     MOV(MI, 0, v, imm(0));
                     MOV(MI, 0, height, imm(0));
+                    MOV(MI, 0, V, imm(0));
                 }
                 CONTEXT_STORE(height, generated_vars.lb);
             }
@@ -629,7 +645,7 @@ void GGLAssembler::build_textures(  fragment_parts_t& parts,
                 return;
 
             CONTEXT_LOAD(stride,    generated_vars.texture[i].stride);
-            CONTEXT_LOAD(txPtr.reg, generated_vars.texture[i].data);
+            CONTEXT_ADDR_LOAD(txPtr.reg, generated_vars.texture[i].data);
             SMLABB(AL, u, v, stride, u);    // u+v*stride 
             base_offset(txPtr, txPtr, u);
 
@@ -668,7 +684,7 @@ void GGLAssembler::build_iterate_texture_coordinates(
             (tmu.twrap == GGL_NEEDS_WRAP_11))
         { // 1:1 textures
             const pointer_t& txPtr = parts.coords[i].ptr;
-            ADD(AL, 0, txPtr.reg, txPtr.reg, imm(txPtr.size>>3));
+            ADDR_ADD(AL, 0, txPtr.reg, txPtr.reg, imm(txPtr.size>>3));
         } else {
             Scratch scratches(registerFile());
             int s = parts.coords[i].s.reg;
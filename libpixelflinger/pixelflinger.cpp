@@ -25,6 +25,7 @@
 #include <pixelflinger/pixelflinger.h>
 #include <private/pixelflinger/ggl_context.h>
 
+#include "blit.h"
 #include "buffer.h"
 #include "clear.h"
 #include "picker.h"
@@ -42,8 +43,8 @@ namespace android {
 
 // ----------------------------------------------------------------------------
 
-// 8x8 Bayer dither matrix
-static const uint8_t gDitherMatrix[GGL_DITHER_SIZE] = {
+// 8x8 Bayer dither matrix, also used by the blitter
+const uint8_t gDitherMatrix[GGL_DITHER_SIZE] = {
      0, 32,  8, 40,  2, 34, 10, 42,
     48, 16, 56, 24, 50, 18, 58, 26,
     12, 44,  4, 36, 14, 46,  6, 38,
@@ -69,6 +70,7 @@ static void ggl_enable_point_aa_nice(context_t* c, int enable);
 static void ggl_enable_texture2d(context_t* c, int enable);
 static void ggl_enable_w_lerp(context_t* c, int enable);
 static void ggl_enable_fog(context_t* c, int enable);
+static void ggl_enable_tiled(context_t* c, int enable);
 
 static inline int min(int a, int b) CONST;
 static inline int min(int a, int b) {
@@ -171,6 +173,7 @@ static void enable_disable(context_t* c, GGLenum name, int en)
     case GGL_W_LERP:            ggl_enable_w_lerp(c, en);        break;
     case GGL_FOG:               ggl_enable_fog(c, en);           break;
     case GGL_POINT_SMOOTH_NICE: ggl_enable_point_aa_nice(c, en); break;
+    case GGL_TILED_RENDERING:   ggl_enable_tiled(c, en);         break;
     }
 }
 
@@ -708,6 +711,17 @@ void ggl_enable_w_lerp(context_t* c, int enable)
     }
 }
 
+void ggl_enable_tiled(context_t* c, int enable)
+{
+    const int e = (c->state.enables & GGL_ENABLE_TILED)?1:0;
+    if (e != enable) {
+        if (enable) c->state.enables |= GGL_ENABLE_TILED;
+        else        c->state.enables &= ~GGL_ENABLE_TILED;
+        // the pixel pipeline doesn't change, only the rasterizer
+        ggl_state_changed(c, 0);
+    }
+}
+
 void ggl_enable_texture2d(context_t* c, int enable)
 {
     if (c->activeTMU->enable != enable) {
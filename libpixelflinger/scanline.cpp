@@ -19,13 +19,18 @@
 #define LOG_TAG "pixelflinger"
 
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <cutils/memory.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
+#include "blit.h"
 #include "buffer.h"
 #include "scanline.h"
 
@@ -34,6 +39,8 @@
 #include "codeflinger/ARMAssembler.h"
 #if defined(__mips__)
 #include "codeflinger/MIPSAssembler.h"
+#elif defined(__x86_64__)
+#include "codeflinger/X86_64Assembler.h"
 #endif
 //#include "codeflinger/ARMAssemblerOptimizer.h"
 
@@ -52,12 +59,20 @@
 #   define ANDROID_CODEGEN      ANDROID_CODEGEN_GENERATED
 #endif
 
-#if defined(__arm__) || defined(__mips__)
+#if (defined(__arm__) || defined(__mips__) || defined(__x86_64__)) && \
+        !defined(PIXELFLINGER_NO_CODEGEN)
 #   define ANDROID_ARM_CODEGEN  1
 #else
 #   define ANDROID_ARM_CODEGEN  0
 #endif
 
+/* Without a code generator (or with it disabled, for systems that don't
+ * allow writable and executable mappings), the common states are rendered
+ * by kernels generated from templates at compile time instead of the
+ * generic pipeline.
+ */
+#define ANDROID_PRECOMPILED_KERNELS  (!ANDROID_ARM_CODEGEN)
+
 #define DEBUG__CODEGEN_ONLY     0
 
 /* Set to 1 to dump to the log the states that need a new
@@ -66,7 +81,7 @@
  */
 #define DEBUG_NEEDS  0
 
-#ifdef __mips__
+#if defined(__mips__) || defined(__x86_64__)
 #define ASSEMBLY_SCRATCH_SIZE   4096
 #else
 #define ASSEMBLY_SCRATCH_SIZE   2048
@@ -99,14 +114,13 @@ static void scanline_t32cb16blend_clamp_mod(context_t* c);
 static void scanline_x32cb16blend_clamp_mod(context_t* c);
 static void scanline_t32cb16blend_clamp_mod_dither(context_t* c);
 static void scanline_x32cb16blend_clamp_mod_dither(context_t* c);
-static void scanline_t32cb16(context_t* c);
-static void scanline_t32cb16_dither(context_t* c);
 static void scanline_t32cb16_clamp(context_t* c);
 static void scanline_t32cb16_clamp_dither(context_t* c);
 static void scanline_col32cb16blend(context_t* c);
 static void scanline_t16cb16_clamp(context_t* c);
 static void scanline_t16cb16blend_clamp_mod(context_t* c);
 static void scanline_memcpy(context_t* c);
+static void scanline_blit(context_t* c);
 static void scanline_memset8(context_t* c);
 static void scanline_memset16(context_t* c);
 static void scanline_memset32(context_t* c);
@@ -116,6 +130,12 @@ static void scanline_clear(context_t* c);
 
 static void rect_generic(context_t* c, size_t yc);
 static void rect_memcpy(context_t* c, size_t yc);
+static void rect_blit(context_t* c, size_t yc);
+
+#if ANDROID_PRECOMPILED_KERNELS
+typedef void (*scanline_kernel_t)(context_t*);
+static scanline_kernel_t pick_kernel(const context_t* c);
+#endif
 
 #if defined( __arm__)
 extern "C" void scanline_t32cb16blend_arm(uint16_t*, uint32_t*, size_t);
@@ -178,17 +198,10 @@ static shortcut_t shortcuts[] = {
     { { { 0x03515104, 0x00000077, { 0x00000A01, 0x00000000 } },
         { 0xFFFFFFFF, 0xFFFFFFFF, { 0xFFFFFFFF, 0x0000003F } } },
         "565 fb, 8888 tx, blend SRC_OVER", scanline_t32cb16blend, init_y_noop },
-    { { { 0x03010104, 0x00000077, { 0x00000A01, 0x00000000 } },
-        { 0xFFFFFFFF, 0xFFFFFFFF, { 0xFFFFFFFF, 0x0000003F } } },
-        "565 fb, 8888 tx, SRC", scanline_t32cb16, init_y_noop  },
     /* same as first entry, but with dithering */
     { { { 0x03515104, 0x00000177, { 0x00000A01, 0x00000000 } },
         { 0xFFFFFFFF, 0xFFFFFFFF, { 0xFFFFFFFF, 0x0000003F } } },
         "565 fb, 8888 tx, blend SRC_OVER dither", scanline_t32cb16blend_dither, init_y_noop },
-    /* same as second entry, but with dithering */
-    { { { 0x03010104, 0x00000177, { 0x00000A01, 0x00000000 } },
-        { 0xFFFFFFFF, 0xFFFFFFFF, { 0xFFFFFFFF, 0x0000003F } } },
-        "565 fb, 8888 tx, SRC dither", scanline_t32cb16_dither, init_y_noop  },
     /* this is used during the boot animation - CHEAT: ignore dithering */
     { { { 0x03545404, 0x00000077, { 0x00000A01, 0x00000000 } },
         { 0xFFFFFFFF, 0xFFFFFEFF, { 0xFFFFFFFF, 0x0000003F } } },
@@ -274,7 +287,7 @@ static  const needs_filter_t fill16noblend = {
 
 #if ANDROID_ARM_CODEGEN
 
-#if defined(__mips__)
+#if defined(__mips__) || defined(__x86_64__)
 static CodeCache gCodeCache(32 * 1024);
 #else
 static CodeCache gCodeCache(12 * 1024);
@@ -287,12 +300,54 @@ public:
         : Assembly(size), mKey(needs) { }
     const AssemblyKey<needs_t>& key() const { return mKey; }
 };
+
+#if defined(__arm__)
+#define CODEGEN_ARCH    "arm"
+#elif defined(__mips__)
+#define CODEGEN_ARCH    "mips"
+#else
+#define CODEGEN_ARCH    "x86_64"
+#endif
+
+static pthread_once_t gCodeCacheOnce = PTHREAD_ONCE_INIT;
+
+/* debug.pf.cache_kb overrides the size of the code cache, up to 256KB.
+ *
+ * debug.pf.cache_dir enables the persistent code cache: each user gets a
+ * file in that directory, so that its processes don't generate the same
+ * pipelines again. It's only valid for the build that generated it.
+ */
+static void init_code_cache()
+{
+    char value[PROPERTY_VALUE_MAX];
+    if (property_get("debug.pf.cache_kb", value, 0) > 0) {
+        const int size = atoi(value);
+        if (size > 0)
+            gCodeCache.setCacheSize(size * 1024);
+    }
+    if (property_get("debug.pf.cache_dir", value, 0) > 0) {
+        char path[PATH_MAX];
+        char fingerprint[PROPERTY_VALUE_MAX];
+        char tag[PROPERTY_VALUE_MAX + 64];
+        snprintf(path, sizeof(path), "%s/codeflinger-%d.cache",
+                value, int(getuid()));
+        property_get("ro.build.fingerprint", fingerprint, "");
+        snprintf(tag, sizeof(tag), "%s %s %d", fingerprint, CODEGEN_ARCH,
+                int(sizeof(context_t)));
+        int err = gCodeCache.setPersistentStore(path, tag);
+        ALOGW_IF(err, "can't use %s as code cache store (%s)",
+                path, strerror(-err));
+    }
+}
 #endif
 
 // ----------------------------------------------------------------------------
 
 void ggl_init_scanline(context_t* c)
 {
+#if ANDROID_ARM_CODEGEN
+    pthread_once(&gCodeCacheOnce, init_code_cache);
+#endif
     c->init_y = init_y;
     c->step_y = step_y__generic;
     c->scanline = scanline;
@@ -346,6 +401,23 @@ static void pick_scanline(context_t* c)
                 return;
             }
         }
+    } else if (c->state.needs.match(noblend1to1)) {
+        // a format conversion (and dithering), as long as the texture has
+        // all the components of the color-buffer
+        const GGLFormat* tf =
+            &(c->formats[GGL_READ_NEEDS(T_FORMAT, c->state.needs.t[0])]);
+        const GGLFormat* cf = &(c->formats[cb_format]);
+        if ((tf->components == GGL_RGB) ||
+            (tf->components == GGL_RGBA) ||
+            (tf->components == GGL_LUMINANCE) ||
+            (tf->components == GGL_LUMINANCE_ALPHA))
+        {
+            if (tf->c[GGLFormat::ALPHA].h || !cf->c[GGLFormat::ALPHA].h) {
+                c->scanline = scanline_blit;
+                c->init_y = init_y_noop;
+                return;
+            }
+        }
     }
 
     if (c->state.needs.match(fill16noblend)) {
@@ -366,6 +438,15 @@ static void pick_scanline(context_t* c)
         }
     }
 
+#if ANDROID_PRECOMPILED_KERNELS
+    scanline_kernel_t kernel = pick_kernel(c);
+    if (kernel) {
+        c->scanline = kernel;
+        c->init_y = init_y;
+        return;
+    }
+#endif
+
 #if DEBUG_NEEDS
     ALOGI("Needs: n=0x%08x p=0x%08x t0=0x%08x t1=0x%08x",
          c->state.needs.n, c->state.needs.p,
@@ -381,27 +462,42 @@ static void pick_scanline(context_t* c)
     // we're going to have to generate some code...
     // here, generate code for our pixel pipeline
     const AssemblyKey<needs_t> key(c->state.needs);
-    sp<Assembly> assembly = gCodeCache.lookup(key);
+    sp<Assembly> assembly = gCodeCache.acquire(key);
     if (assembly == 0) {
         // create a new assembly region
         sp<ScanlineAssembly> a = new ScanlineAssembly(c->state.needs, 
                 ASSEMBLY_SCRATCH_SIZE);
-        // initialize our assembler
+        int err = 0;
+        // another process may have generated it already
+        if (!gCodeCache.restore(a->key(), a)) {
+            // initialize our assembler
 #if defined(__arm__)
-        GGLAssembler assembler( new ARMAssembler(a) );
-        //GGLAssembler assembler(
-        //        new ARMAssemblerOptimizer(new ARMAssembler(a)) );
+            GGLAssembler assembler( new ARMAssembler(a) );
+            //GGLAssembler assembler(
+            //        new ARMAssemblerOptimizer(new ARMAssembler(a)) );
 #endif
 #if defined(__mips__)
-        GGLAssembler assembler( new ArmToMipsAssembler(a) );
+            GGLAssembler assembler( new ArmToMipsAssembler(a) );
 #endif
-        // generate the scanline code for the given needs
-        int err = assembler.scanline(c->state.needs, c);
+#if defined(__x86_64__)
+            GGLAssembler assembler( new ArmToX86_64Assembler(a) );
+#endif
+            // generate the scanline code for the given needs
+            err = assembler.scanline(c->state.needs, c);
+        }
         if (ggl_likely(!err)) {
             // finally, cache this assembly
             err = gCodeCache.cache(a->key(), a);
+        } else {
+            gCodeCache.cancel(key);
         }
         if (ggl_unlikely(err)) {
+#if defined(__x86_64__)
+            // the generic pipeline is always available here
+            ALOGE("error generating or caching assembly. Reverting to generic.");
+            c->scanline = scanline;
+            return;
+#endif
             ALOGE("error generating or caching assembly. Reverting to NOP.");
             c->scanline = scanline_noop;
             c->init_y = init_y_noop;
@@ -441,6 +537,13 @@ void ggl_pick_scanline(context_t* c)
     }
 }
 
+void ggl_pick_generic_scanline(context_t* c)
+{
+    c->init_y = init_y;
+    c->step_y = step_y__generic;
+    c->scanline = scanline;
+}
+
 // ----------------------------------------------------------------------------
 
 static void blending(context_t* c, pixel_t* fragment, pixel_t* fb);
@@ -448,7 +551,8 @@ static void blend_factor(context_t* c, pixel_t* r, uint32_t factor,
         const pixel_t* src, const pixel_t* dst);
 static void rescale(uint32_t& u, uint8_t& su, uint32_t& v, uint8_t& sv);
 
-#if ANDROID_ARM_CODEGEN && (ANDROID_CODEGEN == ANDROID_CODEGEN_GENERATED)
+#if ANDROID_ARM_CODEGEN && (ANDROID_CODEGEN == ANDROID_CODEGEN_GENERATED) && \
+        !defined(__x86_64__)
 
 // no need to compile the generic-pipeline, it can't be reached
 void scanline(context_t*)
@@ -1445,18 +1549,6 @@ static void scanline_t32cb16_clamp(context_t* c)
     }
 }
 
-static void scanline_t32cb16_dither(context_t* c)
-{
-    horz_iterator32 si(c);
-    dst_iterator16  di(c);
-    ditherer        dither(c);
-
-    while (di.count--) {
-        uint32_t s = si.get_pixel32();
-        *di.dst++ = dither.abgr8888ToRgb565(s);
-    }
-}
-
 static void scanline_t32cb16_clamp_dither(context_t* c)
 {
     dst_iterator16  di(c);
@@ -1602,6 +1694,472 @@ void scanline_t16cb16_clamp(context_t* c)
 }
 
 
+// ----------------------------------------------------------------------------
+#if ANDROID_PRECOMPILED_KERNELS
+#if 0
+#pragma mark -
+#pragma mark Precompiled kernels
+#endif
+
+/* The kernels below are instantiated from templates for every combination
+ * of the states they handle:
+ *
+ *   - color buffer and texture formats: RGBA_8888, RGBX_8888 and RGB_565
+ *   - texture coordinates: 1:1, clamped nearest or clamped linear
+ *   - texture environment: REPLACE or MODULATE (with the flat color)
+ *   - blending: SRC, SRC_OVER (premultiplied) or SRCA_OVER
+ *   - dithering (RGB_565 color buffers only)
+ *
+ * Pixels are handled as ABGR8888 host values. The blending is done on two
+ * channels at once (red/blue and alpha/green pairs held in 16-bit lanes of
+ * a 32-bit word) so the inner loops stay free of per-channel branches.
+ */
+
+enum {
+    KERNEL_FMT_8888,
+    KERNEL_FMT_X888,
+    KERNEL_FMT_565,
+    KERNEL_FMT_COUNT
+};
+
+enum {
+    KERNEL_FETCH_11,
+    KERNEL_FETCH_CLAMP,
+    KERNEL_FETCH_LINEAR,
+    KERNEL_FETCH_COUNT
+};
+
+enum {
+    KERNEL_ENV_REPLACE,
+    KERNEL_ENV_MODULATE,
+    KERNEL_ENV_COUNT
+};
+
+enum {
+    KERNEL_BLEND_SRC,
+    KERNEL_BLEND_SRC_OVER,
+    KERNEL_BLEND_SRCA_OVER,
+    KERNEL_BLEND_COUNT
+};
+
+const uint32_t KERNEL_LANES = 0x00FF00FF;
+
+template <int FMT> struct kernel_format;
+
+template <> struct kernel_format<KERNEL_FMT_8888> {
+    enum { shift = 2, has_alpha = 1 };
+    static inline uint32_t load(const uint8_t* p) {
+        return GGL_RGBA_TO_HOST(*reinterpret_cast<const uint32_t*>(p));
+    }
+    static inline void store(uint8_t* p, uint32_t s) {
+        *reinterpret_cast<uint32_t*>(p) = GGL_HOST_TO_RGBA(s);
+    }
+};
+
+template <> struct kernel_format<KERNEL_FMT_X888> {
+    enum { shift = 2, has_alpha = 0 };
+    static inline uint32_t load(const uint8_t* p) {
+        return GGL_RGBA_TO_HOST(*reinterpret_cast<const uint32_t*>(p)) |
+                0xFF000000;
+    }
+    static inline void store(uint8_t* p, uint32_t s) {
+        *reinterpret_cast<uint32_t*>(p) = GGL_HOST_TO_RGBA(s | 0xFF000000);
+    }
+};
+
+template <> struct kernel_format<KERNEL_FMT_565> {
+    enum { shift = 1, has_alpha = 0 };
+    static inline uint32_t load(const uint8_t* p) {
+        const uint32_t d = *reinterpret_cast<const uint16_t*>(p);
+        uint32_t r = (d >> 11) & 0x1F;
+        uint32_t g = (d >>  5) & 0x3F;
+        uint32_t b = (d      ) & 0x1F;
+        r = (r << 3) | (r >> 2);
+        g = (g << 2) | (g >> 4);
+        b = (b << 3) | (b >> 2);
+        return 0xFF000000 | (b << 16) | (g << 8) | r;
+    }
+    static inline void store(uint8_t* p, uint32_t s) {
+        *reinterpret_cast<uint16_t*>(p) = convertAbgr8888ToRgb565(s);
+    }
+    static inline void store(uint8_t* p, uint32_t s, ditherer& di) {
+        uint32_t r = (s      ) & 0xFF;
+        uint32_t g = (s >>  8) & 0xFF;
+        uint32_t b = (s >> 16) & 0xFF;
+        *reinterpret_cast<uint16_t*>(p) = di.rgb888ToRgb565(r, g, b);
+    }
+};
+
+/* Texture fetchers, one per texture coordinates mode. get() returns the
+ * next texel and steps to the following pixel.
+ */
+template <int FMT, int FETCH> struct kernel_fetch;
+
+template <int FMT> struct kernel_fetch<FMT, KERNEL_FETCH_11> {
+    kernel_fetch(const context_t* c) {
+        const texture_t& tx = c->state.texture[0];
+        const int32_t u = (tx.shade.is0>>16) + c->iterators.xl;
+        const int32_t v = (tx.shade.it0>>16) + c->iterators.y;
+        m_src = tx.surface.data +
+                ((u + tx.surface.stride*v) << kernel_format<FMT>::shift);
+    }
+    uint32_t get() {
+        const uint32_t s = kernel_format<FMT>::load(m_src);
+        m_src += 1 << kernel_format<FMT>::shift;
+        return s;
+    }
+private:
+    const uint8_t* m_src;
+};
+
+template <int FMT> struct kernel_fetch<FMT, KERNEL_FETCH_CLAMP> {
+    kernel_fetch(const context_t* c) {
+        const int xs = c->iterators.xl;
+        const texture_t& tx = c->state.texture[0];
+        const texture_iterators_t& ti = tx.iterators;
+        m_s = (xs * ti.dsdx) + ti.ydsdy;
+        m_t = (xs * ti.dtdx) + ti.ydtdy;
+        m_ds = ti.dsdx;
+        m_dt = ti.dtdx;
+        m_width_m1 = tx.surface.width - 1;
+        m_height_m1 = tx.surface.height - 1;
+        m_data = tx.surface.data;
+        m_stride = tx.surface.stride;
+    }
+    uint32_t get() {
+        int u = m_s >> 16;
+        int v = m_t >> 16;
+        m_s += m_ds;
+        m_t += m_dt;
+        if (u < 0)              u = 0;
+        if (u > m_width_m1)     u = m_width_m1;
+        if (v < 0)              v = 0;
+        if (v > m_height_m1)    v = m_height_m1;
+        return kernel_format<FMT>::load(m_data +
+                ((u + m_stride*v) << kernel_format<FMT>::shift));
+    }
+private:
+    GGLfixed        m_s, m_t;
+    GGLfixed        m_ds, m_dt;
+    int             m_width_m1, m_height_m1;
+    const uint8_t*  m_data;
+    int             m_stride;
+};
+
+/* Bilinear filtering with CLAMP_TO_EDGE, with the same 4-bit weights as
+ * the generic pipeline.
+ */
+template <int FMT> struct kernel_fetch<FMT, KERNEL_FETCH_LINEAR> {
+    kernel_fetch(const context_t* c) {
+        const int xs = c->iterators.xl;
+        const texture_t& tx = c->state.texture[0];
+        const texture_iterators_t& ti = tx.iterators;
+        m_s = (xs * ti.dsdx) + ti.ydsdy;
+        m_t = (xs * ti.dtdx) + ti.ydtdy;
+        m_ds = ti.dsdx;
+        m_dt = ti.dtdx;
+        m_width = tx.surface.width;
+        m_height = tx.surface.height;
+        m_data = tx.surface.data;
+        m_stride = tx.surface.stride;
+    }
+    uint32_t get() {
+        GGLfixed u = m_s;
+        GGLfixed v = m_t;
+        m_s += m_ds;
+        m_t += m_dt;
+        const GGLfixed umax = (m_width << 16) - FIXED_HALF;
+        const GGLfixed vmax = (m_height << 16) - FIXED_HALF;
+        if (u < FIXED_HALF)     u = FIXED_HALF;
+        if (u > umax)           u = umax;
+        if (v < FIXED_HALF)     v = FIXED_HALF;
+        if (v > vmax)           v = vmax;
+        u -= FIXED_HALF;
+        v -= FIXED_HALF;
+        const int u0 = u >> 16;
+        const int v0 = v >> 16;
+        const int u1 = (u0+1 < m_width)  ? u0+1 : u0;
+        const int v1 = (v0+1 < m_height) ? v0+1 : v0;
+        uint32_t fu = (u >> 12) & 0xF;
+        uint32_t fv = (v >> 12) & 0xF;
+        fu += fu>>3;
+        fv += fv>>3;
+        const uint32_t m0 = (0x10 - fu) * (0x10 - fv);
+        const uint32_t m1 = (0x10 - fu) * fv;
+        const uint32_t m2 = fu * (0x10 - fv);
+        const uint32_t m3 = 0x100 - (m0 + m1 + m2);
+        const uint32_t t0 = texel(u0, v0);
+        const uint32_t t1 = texel(u0, v1);
+        const uint32_t t2 = texel(u1, v0);
+        const uint32_t t3 = texel(u1, v1);
+        // the weights add up to 0x100, so each lane stays within 16 bits
+        const uint32_t rb = (t0 & KERNEL_LANES)*m0 + (t1 & KERNEL_LANES)*m1 +
+                            (t2 & KERNEL_LANES)*m2 + (t3 & KERNEL_LANES)*m3;
+        const uint32_t ag = ((t0>>8) & KERNEL_LANES)*m0 +
+                            ((t1>>8) & KERNEL_LANES)*m1 +
+                            ((t2>>8) & KERNEL_LANES)*m2 +
+                            ((t3>>8) & KERNEL_LANES)*m3;
+        return ((rb >> 8) & KERNEL_LANES) | (ag & ~KERNEL_LANES);
+    }
+private:
+    uint32_t texel(int u, int v) const {
+        return kernel_format<FMT>::load(m_data +
+                ((u + m_stride*v) << kernel_format<FMT>::shift));
+    }
+    GGLfixed        m_s, m_t;
+    GGLfixed        m_ds, m_dt;
+    int             m_width, m_height;
+    const uint8_t*  m_data;
+    int             m_stride;
+};
+
+/* Texture environment. Textures without alpha take the alpha of the
+ * (flat) fragment color, like in the generic pipeline.
+ */
+template <int FMT, int ENV> struct kernel_env {
+    kernel_env(const context_t* c) {
+        const int r = c->iterators.ydrdy >> (GGL_COLOR_BITS-8);
+        const int g = c->iterators.ydgdy >> (GGL_COLOR_BITS-8);
+        const int b = c->iterators.ydbdy >> (GGL_COLOR_BITS-8);
+        const int a = c->iterators.ydady >> (GGL_COLOR_BITS-8);
+        m_r = r + (r >> 7);
+        m_g = g + (g >> 7);
+        m_b = b + (b >> 7);
+        m_a = a + (a >> 7);
+        m_alpha = uint32_t(a) << 24;
+    }
+    uint32_t apply(uint32_t s) const {
+        if (ENV == KERNEL_ENV_MODULATE) {
+            const uint32_t sR = (((s      ) & 0xFF) * m_r) >> 8;
+            const uint32_t sG = (((s >>  8) & 0xFF) * m_g) >> 8;
+            const uint32_t sB = (((s >> 16) & 0xFF) * m_b) >> 8;
+            uint32_t sA = m_alpha;
+            if (kernel_format<FMT>::has_alpha)
+                sA = (((s >> 24) * m_a) >> 8) << 24;
+            return sA | (sB << 16) | (sG << 8) | sR;
+        }
+        if (!kernel_format<FMT>::has_alpha)
+            s = (s & 0x00FFFFFF) | m_alpha;
+        return s;
+    }
+private:
+    uint32_t m_r, m_g, m_b, m_a;
+    uint32_t m_alpha;
+};
+
+/* dst = src + dst*(1-srcA), saturated */
+static inline uint32_t kernel_src_over(uint32_t s, uint32_t d)
+{
+    const uint32_t sA = s >> 24;
+    const uint32_t f = 0x100 - (sA + (sA >> 7));
+    uint32_t rb = (((d & KERNEL_LANES) * f) >> 8) & KERNEL_LANES;
+    uint32_t ag = ((((d >> 8) & KERNEL_LANES) * f) >> 8) & KERNEL_LANES;
+    rb += s & KERNEL_LANES;
+    ag += (s >> 8) & KERNEL_LANES;
+    // lanes that went past 0xFF are clamped to it
+    rb |= ((rb >> 8) & 0x00010001) * 0xFF;
+    ag |= ((ag >> 8) & 0x00010001) * 0xFF;
+    return (rb & KERNEL_LANES) | ((ag & KERNEL_LANES) << 8);
+}
+
+/* dst = src*srcA + dst*(1-srcA) */
+static inline uint32_t kernel_srca_over(uint32_t s, uint32_t d)
+{
+    const uint32_t sA = s >> 24;
+    const uint32_t f = sA + (sA >> 7);
+    const uint32_t g = 0x100 - f;
+    const uint32_t rb = (s & KERNEL_LANES)*f + (d & KERNEL_LANES)*g;
+    const uint32_t ag = ((s >> 8) & KERNEL_LANES)*f +
+                        ((d >> 8) & KERNEL_LANES)*g;
+    return ((rb >> 8) & KERNEL_LANES) | (ag & ~KERNEL_LANES);
+}
+
+template <int DST, int SRC, int FETCH, int ENV, int BLEND, int DITHER>
+static void scanline_kernel(context_t* c)
+{
+    const int xs = c->iterators.xl;
+    const surface_t* cb = &(c->state.buffers.color);
+    uint8_t* dst = cb->data +
+            ((xs + cb->stride*c->iterators.y) << kernel_format<DST>::shift);
+    int count = c->iterators.xr - xs;
+
+    kernel_fetch<SRC, FETCH>    fetch(c);
+    kernel_env<SRC, ENV>        env(c);
+    ditherer                    dither(c);
+
+    for ( ; count-- ; dst += 1 << kernel_format<DST>::shift) {
+        uint32_t s = env.apply(fetch.get());
+        if (BLEND != KERNEL_BLEND_SRC) {
+            const uint32_t sA = s >> 24;
+            if ((BLEND == KERNEL_BLEND_SRC_OVER && s == 0) ||
+                (BLEND == KERNEL_BLEND_SRCA_OVER && sA == 0)) {
+                // the destination is left as it is
+                if (DITHER)
+                    dither.step();
+                continue;
+            }
+            if (sA != 0xFF) {
+                const uint32_t d = kernel_format<DST>::load(dst);
+                s = (BLEND == KERNEL_BLEND_SRC_OVER) ?
+                        kernel_src_over(s, d) : kernel_srca_over(s, d);
+            }
+        }
+        if (DITHER) {
+            kernel_format<KERNEL_FMT_565>::store(dst, s, dither);
+        } else {
+            kernel_format<DST>::store(dst, s);
+        }
+    }
+}
+
+// dithering is only done when writing to a 16-bit color buffer
+#define KERNEL(D, S, F, E, B, DI) \
+    scanline_kernel<D, S, F, E, B, (DI) && ((D) == KERNEL_FMT_565)>
+
+#define KERNELS_DITHER(D, S, F, E, B) \
+    KERNEL(D, S, F, E, B, 0), KERNEL(D, S, F, E, B, 1)
+
+#define KERNELS_BLEND(D, S, F, E) \
+    KERNELS_DITHER(D, S, F, E, KERNEL_BLEND_SRC), \
+    KERNELS_DITHER(D, S, F, E, KERNEL_BLEND_SRC_OVER), \
+    KERNELS_DITHER(D, S, F, E, KERNEL_BLEND_SRCA_OVER)
+
+#define KERNELS_ENV(D, S, F) \
+    KERNELS_BLEND(D, S, F, KERNEL_ENV_REPLACE), \
+    KERNELS_BLEND(D, S, F, KERNEL_ENV_MODULATE)
+
+#define KERNELS_FETCH(D, S) \
+    KERNELS_ENV(D, S, KERNEL_FETCH_11), \
+    KERNELS_ENV(D, S, KERNEL_FETCH_CLAMP), \
+    KERNELS_ENV(D, S, KERNEL_FETCH_LINEAR)
+
+#define KERNELS_SRC(D) \
+    KERNELS_FETCH(D, KERNEL_FMT_8888), \
+    KERNELS_FETCH(D, KERNEL_FMT_X888), \
+    KERNELS_FETCH(D, KERNEL_FMT_565)
+
+// indexed by [dst format][texture format][fetch][env][blend][dither]
+static const scanline_kernel_t kernels[] = {
+    KERNELS_SRC(KERNEL_FMT_8888),
+    KERNELS_SRC(KERNEL_FMT_X888),
+    KERNELS_SRC(KERNEL_FMT_565)
+};
+
+#undef KERNELS_SRC
+#undef KERNELS_FETCH
+#undef KERNELS_ENV
+#undef KERNELS_BLEND
+#undef KERNELS_DITHER
+#undef KERNEL
+
+typedef char kernels_table_is_complete[
+        (sizeof(kernels)/sizeof(kernels[0]) == KERNEL_FMT_COUNT *
+        KERNEL_FMT_COUNT * KERNEL_FETCH_COUNT * KERNEL_ENV_COUNT *
+        KERNEL_BLEND_COUNT * 2) ? 1 : -1];
+
+static int kernel_format_index(uint32_t format)
+{
+    switch (format) {
+    case GGL_PIXEL_FORMAT_RGBA_8888:    return KERNEL_FMT_8888;
+    case GGL_PIXEL_FORMAT_RGBX_8888:    return KERNEL_FMT_X888;
+    case GGL_PIXEL_FORMAT_RGB_565:      return KERNEL_FMT_565;
+    }
+    return -1;
+}
+
+/* Returns the precompiled kernel for the current state, or 0 if there
+ * isn't one. The needs are decoded into the kernel's table index, then the
+ * needs for that kernel are rebuilt and must match the state exactly, so
+ * that anything the kernels don't handle (alpha/depth test, fog, logic-op,
+ * color mask, a second TMU...) is left to the next stage of the picker.
+ */
+scanline_kernel_t pick_kernel(const context_t* c)
+{
+    const needs_t& needs = c->state.needs;
+    if (!c->state.texture[0].enable)
+        return 0;
+
+    const uint32_t cb_format = GGL_READ_NEEDS(CB_FORMAT, needs.n);
+    const uint32_t tx_format = GGL_READ_NEEDS(T_FORMAT, needs.t[0]);
+    const int dst = kernel_format_index(cb_format);
+    const int src = kernel_format_index(tx_format);
+    if (dst < 0 || src < 0)
+        return 0;
+
+    const uint32_t bsrc = GGL_READ_NEEDS(BLEND_SRC, needs.n);
+    const uint32_t bdst = GGL_READ_NEEDS(BLEND_DST, needs.n);
+    const uint32_t one = ggl_blendfactor_to_needs(GGL_ONE);
+    const uint32_t zero = ggl_blendfactor_to_needs(GGL_ZERO);
+    const uint32_t srca = ggl_blendfactor_to_needs(GGL_SRC_ALPHA);
+    const uint32_t one_minus_srca =
+            ggl_blendfactor_to_needs(GGL_ONE_MINUS_SRC_ALPHA);
+    int blend;
+    if (bsrc == one && bdst == zero)
+        blend = KERNEL_BLEND_SRC;
+    else if (bsrc == one && bdst == one_minus_srca)
+        blend = KERNEL_BLEND_SRC_OVER;
+    else if (bsrc == srca && bdst == one_minus_srca)
+        blend = KERNEL_BLEND_SRCA_OVER;
+    else
+        return 0;
+
+    // 1:1 texels are sampled in their centers, filtering doesn't change them
+    const uint32_t s_wrap = GGL_READ_NEEDS(T_S_WRAP, needs.t[0]);
+    const uint32_t t_wrap = GGL_READ_NEEDS(T_T_WRAP, needs.t[0]);
+    const uint32_t linear = GGL_READ_NEEDS(T_LINEAR, needs.t[0]);
+    int fetch;
+    if (s_wrap == GGL_NEEDS_WRAP_11 && t_wrap == GGL_NEEDS_WRAP_11)
+        fetch = KERNEL_FETCH_11;
+    else if (s_wrap == GGL_NEEDS_WRAP_CLAMP_TO_EDGE &&
+             t_wrap == GGL_NEEDS_WRAP_CLAMP_TO_EDGE)
+        fetch = linear ? KERNEL_FETCH_LINEAR : KERNEL_FETCH_CLAMP;
+    else
+        return 0;
+
+    const uint32_t tx_env = GGL_READ_NEEDS(T_ENV, needs.t[0]);
+    int env;
+    if (tx_env == ggl_env_to_needs(GGL_REPLACE))
+        env = KERNEL_ENV_REPLACE;
+    else if (tx_env == ggl_env_to_needs(GGL_MODULATE))
+        env = KERNEL_ENV_MODULATE;
+    else
+        return 0;
+
+    // smooth shading is fine as long as the color isn't used at all
+    uint32_t shade = GGL_READ_NEEDS(SHADE, needs.n);
+    if (env != KERNEL_ENV_REPLACE || tx_format != GGL_PIXEL_FORMAT_RGBA_8888)
+        shade = 0;
+
+    const uint32_t dither = GGL_READ_NEEDS(P_DITHER, needs.p);
+
+    needs_t k;
+    k.n = GGL_BUILD_NEEDS(cb_format, CB_FORMAT) |
+          GGL_BUILD_NEEDS(shade, SHADE) |
+          GGL_BUILD_NEEDS(bsrc, BLEND_SRC) |
+          GGL_BUILD_NEEDS(bdst, BLEND_DST) |
+          GGL_BUILD_NEEDS(bsrc, BLEND_SRCA) |
+          GGL_BUILD_NEEDS(bdst, BLEND_DSTA) |
+          GGL_BUILD_NEEDS(GGL_COPY, LOGIC_OP);
+    k.p = GGL_BUILD_NEEDS(GGL_ALWAYS, P_ALPHA_TEST) |
+          GGL_BUILD_NEEDS(GGL_ALWAYS, P_DEPTH_TEST) |
+          GGL_BUILD_NEEDS(dither, P_DITHER);
+    k.t[0] = GGL_BUILD_NEEDS(tx_format, T_FORMAT) |
+          GGL_BUILD_NEEDS(s_wrap, T_S_WRAP) |
+          GGL_BUILD_NEEDS(t_wrap, T_T_WRAP) |
+          GGL_BUILD_NEEDS(tx_env, T_ENV) |
+          GGL_BUILD_NEEDS(linear, T_LINEAR);
+    k.t[1] = 0;
+    if (k != needs)
+        return 0;
+
+    const int index =
+            ((((dst * KERNEL_FMT_COUNT + src) * KERNEL_FETCH_COUNT + fetch)
+            * KERNEL_ENV_COUNT + env) * KERNEL_BLEND_COUNT + blend) * 2 + dither;
+    return kernels[index];
+}
+
+#endif // ANDROID_PRECOMPILED_KERNELS
+
 
 template <typename T, typename U>
 static inline __attribute__((const))
@@ -1717,7 +2275,7 @@ void init_y(context_t* c, int32_t ys)
             gen.width   = t.surface.width;
             gen.height  = t.surface.height;
             gen.stride  = t.surface.stride;
-            gen.data    = int32_t(t.surface.data);
+            gen.data    = uintptr_t(t.surface.data);
             gen.dsdx = ti.dsdx;
             gen.dtdx = ti.dtdx;
         }
@@ -1774,6 +2332,8 @@ void init_y_noop(context_t* c, int32_t y0)
     c->rect = rect_generic;
     if (c->scanline == scanline_memcpy) {
         c->rect = rect_memcpy;
+    } else if (c->scanline == scanline_blit) {
+        c->rect = rect_blit;
     }
 }
 
@@ -2106,55 +2666,6 @@ void scanline_col32cb16blend(context_t* c)
 
 }
 
-void scanline_t32cb16(context_t* c)
-{
-    int32_t x = c->iterators.xl;
-    size_t ct = c->iterators.xr - x;    
-    int32_t y = c->iterators.y;
-    surface_t* cb = &(c->state.buffers.color);
-    union {
-        uint16_t* dst;
-        uint32_t* dst32;
-    };
-    dst = reinterpret_cast<uint16_t*>(cb->data) + (x+(cb->stride*y));
-
-    surface_t* tex = &(c->state.texture[0].surface);
-    const int32_t u = (c->state.texture[0].shade.is0>>16) + x;
-    const int32_t v = (c->state.texture[0].shade.it0>>16) + y;
-    uint32_t *src = reinterpret_cast<uint32_t*>(tex->data)+(u+(tex->stride*v));
-    int sR, sG, sB;
-    uint32_t s, d;
-
-    if (ct==1 || uint32_t(dst)&2) {
-last_one:
-        s = GGL_RGBA_TO_HOST( *src++ );
-        *dst++ = convertAbgr8888ToRgb565(s);
-        ct--;
-    }
-
-    while (ct >= 2) {
-#if BYTE_ORDER == BIG_ENDIAN
-        s = GGL_RGBA_TO_HOST( *src++ );
-        d = convertAbgr8888ToRgb565_hi16(s);
-
-        s = GGL_RGBA_TO_HOST( *src++ );
-        d |= convertAbgr8888ToRgb565(s);
-#else
-        s = GGL_RGBA_TO_HOST( *src++ );
-        d = convertAbgr8888ToRgb565(s);
-
-        s = GGL_RGBA_TO_HOST( *src++ );
-        d |= convertAbgr8888ToRgb565(s) << 16;
-#endif
-        *dst32++ = d;
-        ct -= 2;
-    }
-    
-    if (ct > 0) {
-        goto last_one;
-    }
-}
-
 void scanline_t32cb16blend(context_t* c)
 {
 #if ((ANDROID_CODEGEN >= ANDROID_CODEGEN_ASM) && (defined(__arm__) || defined(__mips)))
@@ -2242,6 +2753,26 @@ void scanline_memcpy(context_t* c)
     memcpy(dst, src, size);
 }
 
+void scanline_blit(context_t* c)
+{
+    int32_t x = c->iterators.xl;
+    size_t ct = c->iterators.xr - x;
+    int32_t y = c->iterators.y;
+    surface_t* cb = &(c->state.buffers.color);
+    surface_t* tex = &(c->state.texture[0].surface);
+    const blit_t* b = ggl_pick_blit(cb->format, tex->format,
+            GGL_READ_NEEDS(P_DITHER, c->state.needs.p) ? GGL_BLIT_DITHER : 0);
+    uint8_t* dst = reinterpret_cast<uint8_t*>(cb->data) +
+                            (x + (cb->stride * y)) * c->formats[cb->format].size;
+
+    const int32_t u = (c->state.texture[0].shade.is0>>16) + x;
+    const int32_t v = (c->state.texture[0].shade.it0>>16) + y;
+    uint8_t *src = reinterpret_cast<uint8_t*>(tex->data) +
+                            (u + (tex->stride * v)) * c->formats[tex->format].size;
+
+    b->row(b, dst, src, ct, x, y);
+}
+
 void scanline_memset8(context_t* c)
 {
     int32_t x = c->iterators.xl;
@@ -2342,6 +2873,33 @@ void rect_memcpy(context_t* c, size_t yc)
         } while (--yc);
     }
 }
+
+void rect_blit(context_t* c, size_t yc)
+{
+    int32_t x = c->iterators.xl;
+    size_t ct = c->iterators.xr - x;
+    int32_t y = c->iterators.y;
+    surface_t* cb = &(c->state.buffers.color);
+    surface_t* tex = &(c->state.texture[0].surface);
+    const blit_t* b = ggl_pick_blit(cb->format, tex->format,
+            GGL_READ_NEEDS(P_DITHER, c->state.needs.p) ? GGL_BLIT_DITHER : 0);
+    const size_t dsize = c->formats[cb->format].size;
+    const size_t ssize = c->formats[tex->format].size;
+    uint8_t* dst = reinterpret_cast<uint8_t*>(cb->data) +
+                            (x + (cb->stride * y)) * dsize;
+
+    const int32_t u = (c->state.texture[0].shade.is0>>16) + x;
+    const int32_t v = (c->state.texture[0].shade.it0>>16) + y;
+    uint8_t *src = reinterpret_cast<uint8_t*>(tex->data) +
+                            (u + (tex->stride * v)) * ssize;
+
+    const size_t dbpr = cb->stride  * dsize;
+    const size_t sbpr = tex->stride * ssize;
+    do {
+        b->row(b, dst, src, ct, x, y++);
+        dst += dbpr;
+        src += sbpr;
+    } while (--yc);
+}
 // ----------------------------------------------------------------------------
 }; // namespace android
-
@@ -27,6 +27,11 @@ void ggl_init_scanline(context_t* c);
 void ggl_uninit_scanline(context_t* c);
 void ggl_pick_scanline(context_t* c);
 
+// selects the generic pixel pipeline, bypassing the shortcuts and the
+// code generator (it renders nothing where code generation can't fail,
+// as it isn't compiled in)
+void ggl_pick_generic_scanline(context_t* c);
+
 }; // namespace android
 
 #endif
@@ -0,0 +1,219 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "private/pixelflinger/ggl_context.h"
+
+using namespace android;
+
+// Converts random surfaces between all the pairs of color formats with
+// gglBlitSurface(), the pixels must be the same as those of the per pixel
+// reference below (which is what the vectorized paths must implement).
+
+enum {
+    // odd sizes so the vector loops have leftovers
+    BLIT_W  = 45,
+    BLIT_H  = 9,
+    BLIT_SW = 53,
+    BLIT_SH = 13
+};
+
+static const uint8_t dither_matrix[GGL_DITHER_SIZE] = {
+     0, 32,  8, 40,  2, 34, 10, 42,
+    48, 16, 56, 24, 50, 18, 58, 26,
+    12, 44,  4, 36, 14, 46,  6, 38,
+    60, 28, 52, 20, 62, 30, 54, 22,
+     3, 35, 11, 43,  1, 33,  9, 41,
+    51, 19, 59, 27, 49, 17, 57, 25,
+    15, 47,  7, 39, 13, 45,  5, 37,
+    63, 31, 55, 23, 61, 29, 53, 21
+};
+
+static uint32_t blit_random(uint32_t& seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static bool is_color_format(const GGLFormat& f)
+{
+    return f.components == GGL_ALPHA || f.components == GGL_RGB ||
+           f.components == GGL_RGBA || f.components == GGL_LUMINANCE ||
+           f.components == GGL_LUMINANCE_ALPHA;
+}
+
+static uint32_t load(const GGLFormat& f, const uint8_t* p)
+{
+    uint32_t v = 0;
+    for (int i = 0 ; i < f.size ; i++)
+        v |= uint32_t(p[i]) << (8*i);
+    return v;
+}
+
+static void store(const GGLFormat& f, uint8_t* p, uint32_t v)
+{
+    for (int i = 0 ; i < f.size ; i++)
+        p[i] = v >> (8*i);
+}
+
+// components in a, r, g, b order, on 8 bits
+static void unpack(const GGLFormat& f, uint32_t v, uint32_t c[4])
+{
+    for (int i = 0 ; i < 4 ; i++) {
+        const int bits = f.bits(i);
+        if (!bits) {
+            c[i] = (i == GGLFormat::ALPHA) ? 0xff : 0;
+            continue;
+        }
+        uint32_t e = ((v >> f.c[i].l) & ((1 << bits) - 1)) << (8 - bits);
+        for (int s = bits ; s < 8 ; s += bits)
+            e |= e >> bits;
+        c[i] = e & 0xff;
+    }
+}
+
+// dithers the color components with fewer bits than sbits[]
+static uint32_t pack(const GGLFormat& f, const uint32_t c[4],
+        const int sbits[4], int threshold)
+{
+    uint32_t v = 0;
+    for (int i = 0 ; i < 4 ; i++) {
+        const int bits = f.bits(i);
+        if (!bits)
+            continue;
+        if (f.components >= GGL_LUMINANCE && i > GGLFormat::RED)
+            continue;
+        uint32_t u = c[i];
+        if (threshold >= 0 && i != GGLFormat::ALPHA && sbits[i] > bits) {
+            u += (threshold << (8 - bits)) >> GGL_DITHER_BITS;
+            if (u > 0xff) u = 0xff;
+        }
+        v |= (u >> (8 - bits)) << f.c[i].l;
+    }
+    return v;
+}
+
+static int blit_test(int dstFormat, int srcFormat, uint32_t flags)
+{
+    const GGLFormat& df = gglGetPixelFormatTable()[dstFormat];
+    const GGLFormat& sf = gglGetPixelFormatTable()[srcFormat];
+    const size_t dstSize = BLIT_W * BLIT_H * df.size;
+    const size_t srcSize = BLIT_SW * BLIT_SH * sf.size;
+    uint8_t* dstData = new uint8_t[dstSize];
+    uint8_t* refData = new uint8_t[dstSize];
+    uint8_t* srcData = new uint8_t[srcSize];
+
+    uint32_t seed = dstFormat * 256 + srcFormat * 16 + flags;
+    for (size_t i = 0 ; i < dstSize ; i++)
+        refData[i] = dstData[i] = blit_random(seed);
+    for (size_t i = 0 ; i < srcSize ; i++)
+        srcData[i] = blit_random(seed);
+
+    GGLSurface dst = { sizeof(GGLSurface), BLIT_W, BLIT_H, BLIT_W, dstData,
+            uint8_t(dstFormat) };
+    GGLSurface src = { sizeof(GGLSurface), BLIT_SW, BLIT_SH, BLIT_SW, srcData,
+            uint8_t(srcFormat) };
+
+    // partly out of dst
+    const GGLint crop[4] = { 3, 2, 47, 10 };
+    const GGLint x = -1;
+    const GGLint y = 1;
+
+    int err = gglBlitSurface(&dst, x, y, &src, crop, flags);
+    if (err) {
+        printf("%x to %x (%x): error %d\n", srcFormat, dstFormat, flags, err);
+        return -1;
+    }
+
+    for (int j = 0 ; j < crop[3] ; j++) {
+        for (int i = 0 ; i < crop[2] ; i++) {
+            const int dx = x + i;
+            const int dy = y + j;
+            if (dx < 0 || dy < 0 || dx >= BLIT_W || dy >= BLIT_H)
+                continue;
+            uint8_t* d = refData + (dx + dy * BLIT_W) * df.size;
+            const uint8_t* s = srcData +
+                    ((crop[0] + i) + (crop[1] + j) * BLIT_SW) * sf.size;
+            uint32_t c[4];
+            int sbits[4];
+            unpack(sf, load(sf, s), c);
+            for (int k = 0 ; k < 4 ; k++)
+                sbits[k] = sf.bits(k);
+            if (flags & GGL_BLIT_BLEND) {
+                uint32_t b[4];
+                unpack(df, load(df, d), b);
+                const uint32_t f = 0x100 - (c[0] + (c[0] >> 7));
+                for (int k = 0 ; k < 4 ; k++) {
+                    c[k] += (b[k] * f) >> 8;
+                    if (c[k] > 0xff) c[k] = 0xff;
+                    sbits[k] = 8;
+                }
+            }
+            int threshold = -1;
+            if (flags & GGL_BLIT_DITHER) {
+                threshold = dither_matrix[(dx & GGL_DITHER_MASK) +
+                        ((dy & GGL_DITHER_MASK) << GGL_DITHER_ORDER_SHIFT)];
+            }
+            store(df, d, pack(df, c, sbits, threshold));
+        }
+    }
+
+    // the padding bits of RGBX_8888 are undefined
+    const uint32_t mask = (dstFormat == GGL_PIXEL_FORMAT_RGBX_8888) ?
+            0x00ffffff : 0xffffffff;
+    for (int i = 0 ; i < BLIT_W * BLIT_H && !err ; i++) {
+        const uint32_t pixel = load(df, dstData + i * df.size) & mask;
+        const uint32_t expected = load(df, refData + i * df.size) & mask;
+        if (pixel != expected) {
+            printf("%x to %x (%x): pixel %d,%d is %08x, expected %08x\n",
+                    srcFormat, dstFormat, flags,
+                    i % BLIT_W, i / BLIT_W, pixel, expected);
+            err = -1;
+        }
+    }
+
+    delete [] dstData;
+    delete [] refData;
+    delete [] srcData;
+    return err;
+}
+
+int main(int argc, char** argv)
+{
+    size_t count;
+    const GGLFormat* formats = gglGetPixelFormatTable(&count);
+    int tested = 0;
+    int failed = 0;
+    for (size_t d = 0 ; d < count ; d++) {
+        if (!is_color_format(formats[d]))
+            continue;
+        for (size_t s = 0 ; s < count ; s++) {
+            if (!is_color_format(formats[s]))
+                continue;
+            for (uint32_t flags = 0 ; flags < 4 ; flags++) {
+                if (blit_test(d, s, flags))
+                    failed++;
+                tested++;
+            }
+        }
+    }
+
+    // not a color format, and a crop out of the source
+    uint16_t pixels[4];
+    GGLSurface z = { sizeof(GGLSurface), 2, 2, 2, (GGLubyte*)pixels,
+            GGL_PIXEL_FORMAT_Z_16 };
+    GGLSurface cb = { sizeof(GGLSurface), 2, 2, 2, (GGLubyte*)pixels,
+            GGL_PIXEL_FORMAT_RGB_565 };
+    const GGLint crop[4] = { 1, 0, 2, 2 };
+    const GGLint full[4] = { 0, 0, 2, 2 };
+    if (gglBlitSurface(&cb, 0, 0, &z, full, 0) != -EINVAL ||
+        gglBlitSurface(&cb, 0, 0, &cb, crop, 0) != -EINVAL) {
+        printf("invalid blits not rejected\n");
+        failed++;
+    }
+
+    printf("%d conversions, %d failed\n", tested, failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "codeflinger/CodeCache.h"
+
+using namespace android;
+
+// The LRU eviction, the threads waiting for an assembly that another one is
+// generating, and the persistent store of the code cache.
+
+class TestAssembly : public Assembly {
+    AssemblyKey<uint32_t> mKey;
+public:
+    // the code is the key, repeated
+    TestAssembly(uint32_t key, size_t size)
+        : Assembly(size), mKey(key) { memset(base(), key, size); }
+    const AssemblyKey<uint32_t>& key() const { return mKey; }
+};
+
+static bool cached(const CodeCache& cache, uint32_t key)
+{
+    return cache.lookup(AssemblyKey<uint32_t>(key)) != 0;
+}
+
+static bool check(bool ok, const char* what)
+{
+    if (!ok)
+        printf("    %s\n", what);
+    return ok;
+}
+
+static int lru_test()
+{
+    bool ok = true;
+    CodeCache cache(10 * 64);
+    for (uint32_t i = 0 ; i < 100 ; i++) {
+        sp<TestAssembly> a = new TestAssembly(i, 64);
+        cache.cache(a->key(), a);
+        // keeps 0 from being the least recently used
+        cache.lookup(AssemblyKey<uint32_t>(0));
+    }
+    int count = 0;
+    for (uint32_t i = 0 ; i < 100 ; i++)
+        count += cached(cache, i);
+    ok &= check(count == 10, "the cache doesn't hold 10 assemblies");
+    ok &= check(cached(cache, 0), "a used assembly was evicted");
+    ok &= check(cached(cache, 99) && !cached(cache, 90),
+            "the oldest assemblies weren't evicted first");
+
+    cache.setCacheSize(3 * 64);
+    count = 0;
+    for (uint32_t i = 0 ; i < 100 ; i++)
+        count += cached(cache, i);
+    ok &= check(count == 3, "shrinking the cache didn't evict");
+
+    // more than the executable store, which must not run out
+    cache.setCacheSize(64 * 1024 * 1024);
+    for (uint32_t i = 0 ; i < 512 ; i++) {
+        sp<TestAssembly> a = new TestAssembly(i, 4096);
+        cache.cache(a->key(), a);
+    }
+
+    printf("%-40s %s\n", "LRU eviction", ok ? "ok" : "FAILED");
+    return ok ? 0 : -1;
+}
+
+enum {
+    PENDING_THREADS = 8,
+    PENDING_KEYS    = 50,
+    PENDING_LOOKUPS = 1000
+};
+
+struct pending_test_t {
+    CodeCache*  cache;
+    int32_t     generated;
+    int32_t     bad;
+};
+
+static void* pending_worker(void* arg)
+{
+    pending_test_t* t = static_cast<pending_test_t*>(arg);
+    for (int i = 0 ; i < PENDING_LOOKUPS ; i++) {
+        const uint32_t key = i % PENDING_KEYS;
+        // must outlive cache(), the waiting threads compare against it
+        const AssemblyKey<uint32_t> pendingKey(key);
+        sp<Assembly> a = t->cache->acquire(pendingKey);
+        if (a == 0) {
+            // long enough for the other threads to ask for it too
+            __sync_fetch_and_add(&t->generated, 1);
+            usleep(1000);
+            sp<TestAssembly> g = new TestAssembly(key, 64);
+            t->cache->cache(g->key(), g);
+        } else if (*(uint8_t*)a->base() != key) {
+            __sync_fetch_and_add(&t->bad, 1);
+        }
+    }
+    return 0;
+}
+
+static int pending_test()
+{
+    bool ok = true;
+    CodeCache cache(PENDING_KEYS * 64);
+    pending_test_t t = { &cache, 0, 0 };
+    pthread_t threads[PENDING_THREADS];
+    for (int i = 0 ; i < PENDING_THREADS ; i++)
+        pthread_create(&threads[i], 0, pending_worker, &t);
+    for (int i = 0 ; i < PENDING_THREADS ; i++)
+        pthread_join(threads[i], 0);
+    ok &= check(t.generated == PENDING_KEYS, "an assembly was generated twice");
+    ok &= check(t.bad == 0, "an assembly has the wrong code");
+
+    // a cancelled key can be acquired again
+    AssemblyKey<uint32_t> key(PENDING_KEYS);
+    ok &= check(cache.acquire(key) == 0, "acquired an unknown key");
+    cache.cancel(key);
+    ok &= check(cache.acquire(key) == 0, "acquired a cancelled key");
+    cache.cancel(key);
+
+    printf("%-40s %s\n", "pending assemblies", ok ? "ok" : "FAILED");
+    return ok ? 0 : -1;
+}
+
+static bool restored(const CodeCache& cache, uint32_t key, size_t size)
+{
+    sp<TestAssembly> a = new TestAssembly(~0, 8);
+    if (!const_cast<CodeCache&>(cache).restore(AssemblyKey<uint32_t>(key), a))
+        return false;
+    const uint8_t* p = (const uint8_t*)a->base();
+    for (size_t i = 0 ; i < size ; i++) {
+        if (p[i] != uint8_t(key))
+            return false;
+    }
+    return a->size() == ssize_t(size);
+}
+
+static int store_test()
+{
+    bool ok = true;
+    const char* dir = getenv("TMPDIR");
+    char path[256];
+    snprintf(path, sizeof(path), "%s/codecache-test-%d",
+            dir ? dir : "/data/local/tmp", int(getpid()));
+    unlink(path);
+
+    {
+        CodeCache cache(1024 * 1024);
+        ok &= check(cache.setPersistentStore(path, "tag") == 0,
+                "can't create the store");
+        for (uint32_t i = 0 ; i < 5 ; i++) {
+            sp<TestAssembly> a = new TestAssembly(i, 100 + i);
+            cache.cache(a->key(), a);
+        }
+    }
+    {
+        CodeCache cache(1024 * 1024);
+        ok &= check(cache.setPersistentStore(path, "tag") == 0,
+                "can't open the store");
+        ok &= check(restored(cache, 3, 103), "an assembly wasn't restored");
+        ok &= check(!restored(cache, 9, 0), "restored an unknown assembly");
+    }
+
+    // cut in the middle of the second record: the first one is still good
+    truncate(path, 12 + (12 + 4 + 100) + (12 + 4 + 50));
+    {
+        CodeCache cache(1024 * 1024);
+        cache.setPersistentStore(path, "tag");
+        ok &= check(restored(cache, 0, 100) && !restored(cache, 1, 101),
+                "a truncated store wasn't handled");
+    }
+    {
+        CodeCache cache(1024 * 1024);
+        cache.setPersistentStore(path, "other tag");
+        ok &= check(!restored(cache, 0, 100),
+                "restored the code of another build");
+    }
+
+    chmod(path, 0666);
+    {
+        CodeCache cache(1024 * 1024);
+        ok &= check(cache.setPersistentStore(path, "tag") == -EPERM,
+                "used a store that others can write");
+    }
+    unlink(path);
+
+    printf("%-40s %s\n", "persistent store", ok ? "ok" : "FAILED");
+    return ok ? 0 : -1;
+}
+
+int main(int argc, char** argv)
+{
+    int err = 0;
+    if (lru_test())
+        err = 1;
+    if (pending_test())
+        err = 1;
+    if (store_test())
+        err = 1;
+    return err;
+}
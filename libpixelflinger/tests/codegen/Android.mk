@@ -11,6 +11,10 @@ LOCAL_SHARED_LIBRARIES := \
 LOCAL_C_INCLUDES := \
 	system/core/libpixelflinger
 
+ifeq ($(PIXELFLINGER_DISABLE_CODEGEN),true)
+LOCAL_CFLAGS += -DPIXELFLINGER_NO_CODEGEN
+endif
+
 LOCAL_MODULE:= test-opengl-codegen
 
 LOCAL_MODULE_TAGS := tests
@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "private/pixelflinger/ggl_context.h"
 
@@ -10,14 +12,15 @@
 #include "codeflinger/GGLAssembler.h"
 #include "codeflinger/ARMAssembler.h"
 #include "codeflinger/MIPSAssembler.h"
+#include "codeflinger/X86_64Assembler.h"
 
-#if defined(__arm__) || defined(__mips__)
+#if defined(__arm__) || defined(__mips__) || defined(__x86_64__)
 #   define ANDROID_ARM_CODEGEN  1
 #else
 #   define ANDROID_ARM_CODEGEN  0
 #endif
 
-#if defined (__mips__)
+#if defined(__mips__) || defined(__x86_64__)
 #define ASSEMBLY_SCRATCH_SIZE   4096
 #else
 #define ASSEMBLY_SCRATCH_SIZE   2048
@@ -53,21 +56,350 @@ static void ggl_test_codegen(uint32_t n, uint32_t p, uint32_t t0, uint32_t t1)
     GGLAssembler assembler( new ArmToMipsAssembler(a) );
 #endif
 
+#if defined(__x86_64__)
+    GGLAssembler assembler( new ArmToX86_64Assembler(a) );
+#endif
+
     int err = assembler.scanline(needs, (context_t*)c);
     if (err != 0) {
         printf("error %08x (%s)\n", err, strerror(-err));
     }
     gglUninit(c);
 #else
-    printf("This test runs only on ARM or MIPS\n");
+    printf("This test runs only on ARM, MIPS or x86-64\n");
 #endif
 }
 
+// ----------------------------------------------------------------------------
+
+#if defined(__x86_64__) || defined(PIXELFLINGER_NO_CODEGEN)
+#define HAVE_GENERIC_PIPELINE 1
+#endif
+
+#if HAVE_GENERIC_PIPELINE
+
+// The generic pipeline is also compiled in on x86-64 and in builds without
+// the code generator, the generated code (or the precompiled kernels) must
+// render the same pixels. Both don't round the same way (dithering,
+// blending, fog, filtering), so each component is allowed to be off by
+// DIFF_TOLERANCE. The states where they don't agree at all aren't tested:
+// the ADD and BLEND texture environments and DECAL with an alpha texture.
+// The states in diff_known_failures are drawn and compared, but with
+// generated code a mismatch is reported as a known failure.
+
+struct diff_test_t {
+    const char* name;
+    GGLenum     cbFormat;
+    GGLenum     txFormat;       // 0 for no texture
+    GGLenum     env;
+    GGLenum     filter;
+    GGLenum     wrap;
+    bool        oneToOne;
+    GGLenum     blend;          // source factor, 0 for no blending
+    bool        dither;
+    bool        smooth;
+    GGLenum     depthFunc;      // 0 for no depth test
+    GGLenum     alphaFunc;      // 0 for no alpha test
+    bool        fog;
+};
+
+static const diff_test_t diff_tests[] = {
+    { "smooth 565 dither",
+        GGL_PIXEL_FORMAT_RGB_565, 0, 0, 0, 0,
+        false, 0, true, true, 0, 0, false },
+    { "smooth 8888 blend",
+        GGL_PIXEL_FORMAT_RGBA_8888, 0, 0, 0, 0,
+        false, GGL_SRC_ALPHA, false, true, 0, 0, false },
+    { "flat 565 blend fog",
+        GGL_PIXEL_FORMAT_RGB_565, 0, 0, 0, 0,
+        false, GGL_SRC_ALPHA, false, false, 0, 0, true },
+    { "8888 on 565 modulate 1:1 blend dither",
+        GGL_PIXEL_FORMAT_RGB_565, GGL_PIXEL_FORMAT_RGBA_8888,
+        GGL_MODULATE, GGL_NEAREST, GGL_REPEAT,
+        true, GGL_SRC_ALPHA, true, true, 0, 0, false },
+    { "8888 on 8888 modulate nearest repeat",
+        GGL_PIXEL_FORMAT_RGBA_8888, GGL_PIXEL_FORMAT_RGBA_8888,
+        GGL_MODULATE, GGL_NEAREST, GGL_REPEAT,
+        false, 0, false, true, 0, 0, false },
+    { "4444 on 8888 replace nearest",
+        GGL_PIXEL_FORMAT_RGBA_8888, GGL_PIXEL_FORMAT_RGBA_4444,
+        GGL_REPLACE, GGL_NEAREST, GGL_REPEAT,
+        false, 0, false, false, 0, 0, false },
+    { "LA88 on 565 modulate clamp blend",
+        GGL_PIXEL_FORMAT_RGB_565, GGL_PIXEL_FORMAT_LA_88,
+        GGL_MODULATE, GGL_NEAREST, GGL_CLAMP,
+        false, GGL_SRC_ALPHA, false, true, 0, 0, false },
+    { "A8 on 565 modulate linear blend",
+        GGL_PIXEL_FORMAT_RGB_565, GGL_PIXEL_FORMAT_A_8,
+        GGL_MODULATE, GGL_LINEAR, GGL_REPEAT,
+        false, GGL_SRC_ALPHA, false, false, 0, 0, false },
+    { "565 on 8888 decal clamp",
+        GGL_PIXEL_FORMAT_RGBA_8888, GGL_PIXEL_FORMAT_RGB_565,
+        GGL_DECAL, GGL_NEAREST, GGL_CLAMP,
+        false, 0, false, true, 0, 0, false },
+    { "565 depth test",
+        GGL_PIXEL_FORMAT_RGB_565, GGL_PIXEL_FORMAT_RGBA_8888,
+        GGL_MODULATE, GGL_NEAREST, GGL_REPEAT,
+        true, 0, false, true, GGL_LESS, 0, false },
+    { "8888 depth and alpha test fog",
+        GGL_PIXEL_FORMAT_RGBA_8888, 0, 0, 0, 0,
+        false, 0, false, true, GGL_GEQUAL, GGL_GREATER, true },
+    // the alpha source must not alias the texel when the blend factor is
+    // replaced by GGL_ONE_MINUS_SRC_ALPHA in place
+    { "8888 on 8888 replace repeat premultiplied blend",
+        GGL_PIXEL_FORMAT_RGBA_8888, GGL_PIXEL_FORMAT_RGBA_8888,
+        GGL_REPLACE, GGL_NEAREST, GGL_REPEAT,
+        false, GGL_ONE, false, false, 0, 0, false },
+    // these are rendered by precompiled kernels without code generator
+    { "8888 on 8888 replace clamp premultiplied blend",
+        GGL_PIXEL_FORMAT_RGBA_8888, GGL_PIXEL_FORMAT_RGBA_8888,
+        GGL_REPLACE, GGL_NEAREST, GGL_CLAMP,
+        false, GGL_ONE, false, false, 0, 0, false },
+    { "8888 on x888 replace linear smooth",
+        GGL_PIXEL_FORMAT_RGBX_8888, GGL_PIXEL_FORMAT_RGBA_8888,
+        GGL_REPLACE, GGL_LINEAR, GGL_CLAMP,
+        false, 0, false, true, 0, 0, false },
+    { "x888 on 565 modulate linear blend dither",
+        GGL_PIXEL_FORMAT_RGB_565, GGL_PIXEL_FORMAT_RGBX_8888,
+        GGL_MODULATE, GGL_LINEAR, GGL_CLAMP,
+        false, GGL_SRC_ALPHA, true, false, 0, 0, false },
+    { "565 on 8888 modulate 1:1",
+        GGL_PIXEL_FORMAT_RGBA_8888, GGL_PIXEL_FORMAT_RGB_565,
+        GGL_MODULATE, GGL_NEAREST, GGL_CLAMP,
+        true, 0, false, false, 0, 0, false },
+    { "565 on 565 replace linear blend",
+        GGL_PIXEL_FORMAT_RGB_565, GGL_PIXEL_FORMAT_RGB_565,
+        GGL_REPLACE, GGL_LINEAR, GGL_CLAMP,
+        false, GGL_SRC_ALPHA, false, false, 0, 0, false },
+    { "8888 on 565 modulate 1:1 premultiplied blend",
+        GGL_PIXEL_FORMAT_RGB_565, GGL_PIXEL_FORMAT_RGBA_8888,
+        GGL_MODULATE, GGL_NEAREST, GGL_CLAMP,
+        true, GGL_ONE, false, false, 0, 0, false },
+    // these are converted by the blitter
+    { "8888 on 565 replace 1:1 dither",
+        GGL_PIXEL_FORMAT_RGB_565, GGL_PIXEL_FORMAT_RGBA_8888,
+        GGL_REPLACE, GGL_NEAREST, GGL_CLAMP,
+        true, 0, true, false, 0, 0, false },
+    { "565 on x888 replace 1:1",
+        GGL_PIXEL_FORMAT_RGBX_8888, GGL_PIXEL_FORMAT_RGB_565,
+        GGL_REPLACE, GGL_NEAREST, GGL_CLAMP,
+        true, 0, false, false, 0, 0, false },
+    { "8888 on 4444 replace 1:1 dither",
+        GGL_PIXEL_FORMAT_RGBA_4444, GGL_PIXEL_FORMAT_RGBA_8888,
+        GGL_REPLACE, GGL_NEAREST, GGL_CLAMP,
+        true, 0, true, false, 0, 0, false },
+};
+
+// The generic pipeline filters with 4-bit weights, the generated code with
+// 5 (filter16) or 8 (filter32) bits, which is more than DIFF_TOLERANCE apart
+// between the neighboring texels of the random texture.
+static const char* const diff_known_failures[] = {
+    "8888 on x888 replace linear smooth",
+    "565 on 565 replace linear blend",
+};
+
+enum {
+    // odd sizes to exercise the pixel loops and the texture wrapping
+    DIFF_W  = 61,
+    DIFF_H  = 7,
+    DIFF_TW = 16,
+    DIFF_TH = 16,
+    DIFF_TOLERANCE = 2
+};
+
+static void diff_fill(uint8_t* p, size_t size, uint32_t seed)
+{
+    while (size--) {
+        seed = seed * 1103515245 + 12345;
+        *p++ = seed >> 16;
+    }
+}
+
+static void diff_setup(GGLContext* gl, const diff_test_t& t,
+        GGLSurface* cb, GGLSurface* tx, GGLSurface* zb)
+{
+    gl->colorBuffer(gl, cb);
+    if (t.txFormat) {
+        gl->activeTexture(gl, 0);
+        gl->bindTexture(gl, tx);
+        gl->enable(gl, GGL_TEXTURE_2D);
+        gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, t.env);
+        gl->texParameteri(gl, GGL_TEXTURE_2D, GGL_TEXTURE_MIN_FILTER, t.filter);
+        gl->texParameteri(gl, GGL_TEXTURE_2D, GGL_TEXTURE_MAG_FILTER, t.filter);
+        gl->texParameteri(gl, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_S, t.wrap);
+        gl->texParameteri(gl, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_T, t.wrap);
+        if (t.oneToOne) {
+            gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+            gl->texGeni(gl, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+            gl->texCoord2i(gl, 3, 5);
+        } else {
+            // s, ds/dx, ds/dy, t, dt/dx, dt/dy, sscale, tscale
+            const int32_t grad[8] = {
+                0x8000, 0x14000, 0x1000, 0x2000, 0x0800, 0x16000, 0, 0
+            };
+            gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+            gl->texGeni(gl, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+            gl->texCoordGradScale8xv(gl, 0, grad);
+        }
+    }
+    if (t.smooth) {
+        // 8.16 colors, which must stay in range over the whole rectangle
+        const GGLcolor grad[12] = {
+            0x100000, 0x30000, 0x10000,     // r
+            0xF00000,-0x28000, 0x20000,     // g
+            0x400000, 0x18000,-0x30000,     // b
+            0x800000, 0x10000, 0x08000      // a
+        };
+        gl->shadeModel(gl, GGL_SMOOTH);
+        gl->colorGrad12xv(gl, grad);
+    } else {
+        const GGLclampx color[4] = { 0x4000, 0xC000, 0x8000, 0xA000 };
+        gl->shadeModel(gl, GGL_FLAT);
+        gl->color4xv(gl, color);
+    }
+    if (t.blend) {
+        gl->enable(gl, GGL_BLEND);
+        gl->blendFunc(gl, t.blend, GGL_ONE_MINUS_SRC_ALPHA);
+    }
+    gl->enableDisable(gl, GGL_DITHER, t.dither);
+    if (t.depthFunc) {
+        const GGLfixed32 grad[3] = { 0x40000000, 0x01000000, 0x00400000 };
+        gl->depthBuffer(gl, zb);
+        gl->enable(gl, GGL_DEPTH_TEST);
+        gl->depthFunc(gl, t.depthFunc);
+        gl->depthMask(gl, 1);
+        gl->zGrad3xv(gl, grad);
+    }
+    if (t.alphaFunc) {
+        gl->enable(gl, GGL_ALPHA_TEST);
+        gl->alphaFuncx(gl, t.alphaFunc, 0x6000);
+    }
+    if (t.fog) {
+        const GGLfixed grad[3] = { 0x4000, 0x0100, 0x0800 };
+        const GGLclampx color[3] = { 0x10000, 0x8000, 0 };
+        gl->enable(gl, GGL_FOG);
+        gl->fogGrad3xv(gl, grad);
+        gl->fogColor3xv(gl, color);
+    }
+}
+
+static int ggl_test_diff(const diff_test_t& t)
+{
+    GGLContext* gl;
+    gglInit(&gl);
+    context_t* c = (context_t*)gl;
+
+    const size_t cbSize = DIFF_W * DIFF_H * c->formats[t.cbFormat].size;
+    const size_t zbSize = DIFF_W * DIFF_H * 2;
+    uint8_t* cbInit = new uint8_t[cbSize];
+    uint8_t* zbInit = new uint8_t[zbSize];
+    uint8_t* cbData = new uint8_t[cbSize];
+    uint8_t* zbData = new uint8_t[zbSize];
+    uint8_t* cbGenerated = new uint8_t[cbSize];
+    uint8_t* zbGenerated = new uint8_t[zbSize];
+    uint8_t* txData = new uint8_t[DIFF_TW * DIFF_TH * 4];
+    diff_fill(cbInit, cbSize, 1);
+    diff_fill(zbInit, zbSize, 2);
+    diff_fill(txData, DIFF_TW * DIFF_TH * 4, 3);
+
+    GGLSurface cb = { sizeof(GGLSurface), DIFF_W, DIFF_H, DIFF_W, cbData,
+            uint8_t(t.cbFormat) };
+    GGLSurface zb = { sizeof(GGLSurface), DIFF_W, DIFF_H, DIFF_W, zbData,
+            GGL_PIXEL_FORMAT_Z_16 };
+    GGLSurface tx = { sizeof(GGLSurface), DIFF_TW, DIFF_TH, DIFF_TW, txData,
+            uint8_t(t.txFormat) };
+    diff_setup(gl, t, &cb, &tx, &zb);
+
+    // first with whatever was picked...
+    memcpy(cbData, cbInit, cbSize);
+    memcpy(zbData, zbInit, zbSize);
+    gl->recti(gl, 0, 0, DIFF_W, DIFF_H);
+    memcpy(cbGenerated, cbData, cbSize);
+    memcpy(zbGenerated, zbData, zbSize);
+    const bool generated = (c->scanline_as != 0);
+    bool known = false;
+    for (size_t i = 0 ; generated && i < sizeof(diff_known_failures) /
+            sizeof(diff_known_failures[0]) ; i++) {
+        if (!strcmp(t.name, diff_known_failures[i]))
+            known = true;
+    }
+
+    // ...then with the generic pipeline, the state is validated already
+    memcpy(cbData, cbInit, cbSize);
+    memcpy(zbData, zbInit, zbSize);
+    ggl_pick_generic_scanline(c);
+    gl->recti(gl, 0, 0, DIFF_W, DIFF_H);
+
+    int err = 0;
+    const GGLFormat& f = c->formats[t.cbFormat];
+    for (int i = 0 ; i < DIFF_W * DIFF_H && !err ; i++) {
+        uint32_t pixel = 0;
+        uint32_t expected = 0;
+        memcpy(&pixel, cbGenerated + i * f.size, f.size);
+        memcpy(&expected, cbData + i * f.size, f.size);
+        for (int j = 0 ; j < 4 ; j++) {
+            if (!f.bits(j))
+                continue;
+            const int d = int((pixel & f.mask(j)) >> f.c[j].l) -
+                          int((expected & f.mask(j)) >> f.c[j].l);
+            if (abs(d) > DIFF_TOLERANCE) {
+                printf("%s: pixel %d,%d is %08x, expected %08x\n", t.name,
+                        i % DIFF_W, i / DIFF_W, pixel, expected);
+                err = -1;
+                break;
+            }
+        }
+    }
+    if (memcmp(zbGenerated, zbData, zbSize)) {
+        printf("%s: depth buffers differ\n", t.name);
+        err = -1;
+    }
+    printf("%-40s %s%s\n", t.name,
+            err ? (known ? "known failure" : "FAILED") : "ok",
+            generated ? "" : " (not code generated)");
+    if (known)
+        err = 0;
+
+    gglUninit(gl);
+    delete [] cbInit;
+    delete [] zbInit;
+    delete [] cbData;
+    delete [] zbData;
+    delete [] cbGenerated;
+    delete [] zbGenerated;
+    delete [] txData;
+    return err;
+}
+
+static int ggl_test_diff()
+{
+    int err = 0;
+    const int count = sizeof(diff_tests) / sizeof(diff_tests[0]);
+    for (int i = 0 ; i < count ; i++) {
+        if (ggl_test_diff(diff_tests[i]))
+            err = 1;
+    }
+    return err;
+}
+
+#endif // HAVE_GENERIC_PIPELINE
+
 int main(int argc, char** argv)
 {
     if (argc != 2) {
         printf("usage: %s 00000117:03454504_00001501_00000000\n", argv[0]);
+        printf("       %s -d (compare with the generic pipeline)\n",
+                argv[0]);
+        return 0;
+    }
+    if (!strcmp(argv[1], "-d")) {
+#if HAVE_GENERIC_PIPELINE
+        return ggl_test_diff();
+#else
+        printf("This test needs the generic pipeline (x86-64, or built "
+                "without code generator)\n");
         return 0;
+#endif
     }
     uint32_t n;
     uint32_t p;
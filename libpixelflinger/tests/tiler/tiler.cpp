@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "private/pixelflinger/ggl_context.h"
+#include "tiler.h"
+
+using namespace android;
+
+// Draws the same primitives with and without GGL_TILED_RENDERING, the
+// color and depth buffers must be identical. The pool is forced to
+// TILER_THREADS threads, so that the tiles are shared even on a single CPU.
+
+struct tiler_test_t {
+    const char* name;
+    GGLenum     cbFormat;
+    bool        texture;
+    bool        blend;
+    bool        dither;
+    bool        depth;
+};
+
+static const tiler_test_t tiler_tests[] = {
+    { "565 smooth dither",          GGL_PIXEL_FORMAT_RGB_565,
+        false, false, true, false },
+    { "8888 texture blend",         GGL_PIXEL_FORMAT_RGBA_8888,
+        true, true, false, false },
+    { "565 texture depth dither",   GGL_PIXEL_FORMAT_RGB_565,
+        true, false, true, true },
+    { "8888 blend depth",           GGL_PIXEL_FORMAT_RGBA_8888,
+        false, true, false, true },
+};
+
+enum {
+    // odd sizes so the last tile isn't full
+    TILER_W  = 301,
+    TILER_H  = 227,
+    TILER_TW = 32,
+    TILER_TH = 32,
+    TILER_PRIMITIVES = 40,
+    TILER_THREADS = 4
+};
+
+static uint32_t tiler_random(uint32_t& seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static void tiler_fill(uint8_t* p, size_t size, uint32_t seed)
+{
+    while (size--) {
+        *p++ = tiler_random(seed);
+    }
+}
+
+static void tiler_draw(GGLContext* gl, bool tiled)
+{
+    gl->enableDisable(gl, GGL_TILED_RENDERING, tiled);
+
+    uint32_t seed = 4;
+    for (int i = 0 ; i < TILER_PRIMITIVES ; i++) {
+        // 8.16 colors, kept in range over the whole surface
+        const GGLcolor grad[12] = {
+            0x100000, 0x100, 0x200,
+            0x400000, 0x200, 0x100,
+            0x800000,-0x100, 0x300,
+            0x300000, 0x400, 0x200
+        };
+        gl->colorGrad12xv(gl, grad);
+
+        // z in 0.32, but we don't want it to wrap
+        const GGLfixed32 zgrad[3] = {
+            GGLfixed32(tiler_random(seed) << 4), 0x10000, 0x20000
+        };
+        gl->zGrad3xv(gl, zgrad);
+
+        if (i & 1) {
+            const int32_t x = tiler_random(seed) % TILER_W;
+            const int32_t y = tiler_random(seed) % TILER_H;
+            const int32_t w = tiler_random(seed) % TILER_W;
+            const int32_t h = tiler_random(seed) % TILER_H;
+            gl->recti(gl, x - w/2, y - h/2, x + w/2, y + h/2);
+        } else {
+            // 28.4 coordinates, which can be out of the surface
+            GGLcoord v[3][2];
+            for (int j = 0 ; j < 3 ; j++) {
+                v[j][0] = (tiler_random(seed) % (TILER_W*24)) - TILER_W*4;
+                v[j][1] = (tiler_random(seed) % (TILER_H*24)) - TILER_H*4;
+            }
+            gl->trianglex(gl, v[0], v[1], v[2]);
+        }
+    }
+}
+
+static int tiler_test(const tiler_test_t& t)
+{
+    GGLContext* gl;
+    gglInit(&gl);
+    context_t* c = (context_t*)gl;
+
+    const size_t cbSize = TILER_W * TILER_H * c->formats[t.cbFormat].size;
+    const size_t zbSize = TILER_W * TILER_H * 2;
+    uint8_t* cbData = new uint8_t[cbSize];
+    uint8_t* zbData = new uint8_t[zbSize];
+    uint8_t* cbRef = new uint8_t[cbSize];
+    uint8_t* zbRef = new uint8_t[zbSize];
+    uint8_t* txData = new uint8_t[TILER_TW * TILER_TH * 4];
+    tiler_fill(txData, TILER_TW * TILER_TH * 4, 3);
+
+    GGLSurface cb = { sizeof(GGLSurface), TILER_W, TILER_H, TILER_W, cbData,
+            uint8_t(t.cbFormat) };
+    GGLSurface zb = { sizeof(GGLSurface), TILER_W, TILER_H, TILER_W, zbData,
+            GGL_PIXEL_FORMAT_Z_16 };
+    GGLSurface tx = { sizeof(GGLSurface), TILER_TW, TILER_TH, TILER_TW,
+            txData, GGL_PIXEL_FORMAT_RGBA_8888 };
+
+    gl->colorBuffer(gl, &cb);
+    gl->shadeModel(gl, GGL_SMOOTH);
+    if (t.texture) {
+        const int32_t grad[8] = {
+            0x8000, 0x14000, 0x1000, 0x2000, 0x0800, 0x16000, 0, 0
+        };
+        gl->activeTexture(gl, 0);
+        gl->bindTexture(gl, &tx);
+        gl->enable(gl, GGL_TEXTURE_2D);
+        gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_MODULATE);
+        gl->texParameteri(gl, GGL_TEXTURE_2D, GGL_TEXTURE_MIN_FILTER, GGL_LINEAR);
+        gl->texParameteri(gl, GGL_TEXTURE_2D, GGL_TEXTURE_MAG_FILTER, GGL_LINEAR);
+        gl->texParameteri(gl, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_S, GGL_REPEAT);
+        gl->texParameteri(gl, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_T, GGL_REPEAT);
+        gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+        gl->texGeni(gl, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+        gl->texCoordGradScale8xv(gl, 0, grad);
+    }
+    if (t.blend) {
+        gl->enable(gl, GGL_BLEND);
+        gl->blendFunc(gl, GGL_SRC_ALPHA, GGL_ONE_MINUS_SRC_ALPHA);
+    }
+    gl->enableDisable(gl, GGL_DITHER, t.dither);
+    if (t.depth) {
+        gl->depthBuffer(gl, &zb);
+        gl->enable(gl, GGL_DEPTH_TEST);
+        gl->depthFunc(gl, GGL_LESS);
+        gl->depthMask(gl, 1);
+    }
+
+    tiler_fill(cbData, cbSize, 1);
+    tiler_fill(zbData, zbSize, 2);
+    tiler_draw(gl, false);
+    memcpy(cbRef, cbData, cbSize);
+    memcpy(zbRef, zbData, zbSize);
+
+    tiler_fill(cbData, cbSize, 1);
+    tiler_fill(zbData, zbSize, 2);
+    const uint32_t draws = ggl_tiler_draw_count();
+    tiler_draw(gl, true);
+
+    int err = 0;
+    if (ggl_tiler_draw_count() == draws) {
+        printf("%s: nothing was tiled\n", t.name);
+        err = -1;
+    }
+    if (memcmp(cbRef, cbData, cbSize)) {
+        printf("%s: color buffers differ\n", t.name);
+        err = -1;
+    }
+    if (memcmp(zbRef, zbData, zbSize)) {
+        printf("%s: depth buffers differ\n", t.name);
+        err = -1;
+    }
+    printf("%-40s %s\n", t.name, err ? "FAILED" : "ok");
+
+    gglUninit(gl);
+    delete [] cbData;
+    delete [] zbData;
+    delete [] cbRef;
+    delete [] zbRef;
+    delete [] txData;
+    return err;
+}
+
+int main(int argc, char** argv)
+{
+    int err = 0;
+    const int threads = ggl_tiler_set_threads(TILER_THREADS);
+    if (threads < 2) {
+        printf("can't create the tiler threads (%d)\n", threads);
+        return 1;
+    }
+    const int count = sizeof(tiler_tests) / sizeof(tiler_tests[0]);
+    for (int i = 0 ; i < count ; i++) {
+        if (tiler_test(tiler_tests[i]))
+            err = 1;
+    }
+    return err;
+}
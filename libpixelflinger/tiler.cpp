@@ -0,0 +1,215 @@
+/* libs/pixelflinger/tiler.cpp
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#define LOG_TAG "pixelflinger"
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "tiler.h"
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Each primitive is drawn by all the threads of the pool at once. The tiles
+ * are bands of rows, owned by the threads in turn (tile k by thread k % n),
+ * and each thread draws the primitive once for each of its tiles, with the
+ * scissor of its copy of the context set to that tile. So a thread is the
+ * only one writing to its tiles, and the primitives are drawn in order in
+ * each of them. The pixels are the same as those drawn by a single thread:
+ * the rasterizer clips against the scissor without changing the edges or
+ * the iterators of the rows that are left.
+ *
+ * Dispatching a primitive costs a few context switches, so only the large
+ * ones are tiled.
+ */
+
+enum {
+    TILE_ROWS_SHIFT = 4,            // 16 rows per tile
+    TILE_MIN_AREA   = 128*128,      // bounding box area worth tiling
+    TILE_MAX_THREADS= 8
+};
+
+struct tile_job_t {
+    tile_draw_t         draw;
+    const void*         prim;
+    const context_t*    c;
+    int32_t             top;
+    int32_t             bottom;
+};
+
+static pthread_once_t gTilerOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t gTilerBusy = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t gTilerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gTilerStart = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gTilerDone = PTHREAD_COND_INITIALIZER;
+
+// context copies of the threads, the caller uses the first one
+static context_t* gTilerContexts[TILE_MAX_THREADS];
+static int gTilerCount;             // threads, including the caller
+static int gTilerRequested;         // set by ggl_tiler_set_threads()
+static uint32_t gTilerDraws;        // primitives drawn, under gTilerBusy
+static uint32_t gTilerGeneration;   // incremented for each job
+static int gTilerPending;           // threads still drawing the job
+static tile_job_t gTilerJob;
+
+static void draw_tiles(int index, const tile_job_t& job)
+{
+    context_t* const c = gTilerContexts[index];
+    memcpy(c, job.c, sizeof(context_t));
+
+    const int n = gTilerCount;
+    const int32_t first = job.top >> TILE_ROWS_SHIFT;
+    const int32_t last = (job.bottom - 1) >> TILE_ROWS_SHIFT;
+    for (int32_t k = first + (index - first % n + n) % n ; k <= last ; k += n) {
+        const int32_t t = k << TILE_ROWS_SHIFT;
+        const int32_t b = t + (1 << TILE_ROWS_SHIFT);
+        c->state.scissor.top    = t < job.top ? job.top : t;
+        c->state.scissor.bottom = b > job.bottom ? job.bottom : b;
+        job.draw(c, job.prim);
+    }
+}
+
+static void* tiler_thread(void* arg)
+{
+    const int index = int(intptr_t(arg));
+    uint32_t generation = 0;
+    pthread_mutex_lock(&gTilerLock);
+    while (true) {
+        while (gTilerGeneration == generation)
+            pthread_cond_wait(&gTilerStart, &gTilerLock);
+        generation = gTilerGeneration;
+        const tile_job_t job(gTilerJob);
+        pthread_mutex_unlock(&gTilerLock);
+
+        draw_tiles(index, job);
+
+        pthread_mutex_lock(&gTilerLock);
+        if (--gTilerPending == 0)
+            pthread_cond_signal(&gTilerDone);
+    }
+    return 0;
+}
+
+/* debug.pf.tiler_threads sets the number of threads drawing the tiles,
+ * there is one per CPU by default.
+ */
+static void init_tiler()
+{
+    char value[PROPERTY_VALUE_MAX];
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (gTilerRequested > 0)
+        count = gTilerRequested;
+    else if (property_get("debug.pf.tiler_threads", value, 0) > 0)
+        count = atoi(value);
+    if (count > TILE_MAX_THREADS)
+        count = TILE_MAX_THREADS;
+
+    int i;
+    for (i=0 ; i<count ; i++) {
+        gTilerContexts[i] = (context_t*)memalign(32, sizeof(context_t));
+        if (!gTilerContexts[i])
+            break;
+        if (i == 0)
+            continue;
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int err = pthread_create(&thread, &attr, tiler_thread, (void*)intptr_t(i));
+        pthread_attr_destroy(&attr);
+        if (err) {
+            ALOGW("can't create tiler thread (%s)", strerror(err));
+            free(gTilerContexts[i]);
+            gTilerContexts[i] = 0;
+            break;
+        }
+    }
+    gTilerCount = i;
+}
+
+bool ggl_tiled_draw(context_t* c, tile_draw_t draw, const void* prim,
+        int32_t l, int32_t t, int32_t r, int32_t b)
+{
+    pthread_once(&gTilerOnce, init_tiler);
+    if (gTilerCount < 2)
+        return false;
+
+    if (l < int32_t(c->state.scissor.left))     l = c->state.scissor.left;
+    if (t < int32_t(c->state.scissor.top))      t = c->state.scissor.top;
+    if (r > int32_t(c->state.scissor.right))    r = c->state.scissor.right;
+    if (b > int32_t(c->state.scissor.bottom))   b = c->state.scissor.bottom;
+    if (l >= r || (b - t) <= (1 << TILE_ROWS_SHIFT))
+        return false;
+    if ((r - l) * (b - t) < TILE_MIN_AREA)
+        return false;
+
+    // another context is using the pool, don't wait for it
+    if (pthread_mutex_trylock(&gTilerBusy))
+        return false;
+
+    tile_job_t job;
+    job.draw = draw;
+    job.prim = prim;
+    job.c = c;
+    job.top = t;
+    job.bottom = b;
+
+    pthread_mutex_lock(&gTilerLock);
+    gTilerJob = job;
+    gTilerPending = gTilerCount - 1;
+    gTilerGeneration++;
+    pthread_cond_broadcast(&gTilerStart);
+    pthread_mutex_unlock(&gTilerLock);
+
+    draw_tiles(0, job);
+
+    pthread_mutex_lock(&gTilerLock);
+    while (gTilerPending)
+        pthread_cond_wait(&gTilerDone, &gTilerLock);
+    pthread_mutex_unlock(&gTilerLock);
+
+    gTilerDraws++;
+    pthread_mutex_unlock(&gTilerBusy);
+    return true;
+}
+
+int ggl_tiler_set_threads(int count)
+{
+    gTilerRequested = count;
+    pthread_once(&gTilerOnce, init_tiler);
+    return gTilerCount;
+}
+
+uint32_t ggl_tiler_draw_count()
+{
+    pthread_mutex_lock(&gTilerBusy);
+    const uint32_t count = gTilerDraws;
+    pthread_mutex_unlock(&gTilerBusy);
+    return count;
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
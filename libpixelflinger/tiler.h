@@ -0,0 +1,47 @@
+/* libs/pixelflinger/tiler.h
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+#ifndef ANDROID_TILER_H
+#define ANDROID_TILER_H
+
+#include <private/pixelflinger/ggl_context.h>
+
+namespace android {
+
+// draws 'prim' in context 'c', which is clipped by its scissor
+typedef void (*tile_draw_t)(context_t* c, const void* prim);
+
+// With GGL_TILED_RENDERING, the screen is cut in bands of rows (the tiles)
+// and each thread of the pool only draws the tiles it owns, with its own
+// copy of the context. (l, t, r, b) is the bounding box of the primitive.
+// Returns false if the primitive is too small to be worth it, or if the
+// pool is busy: the caller must draw it instead.
+bool ggl_tiled_draw(context_t* c, tile_draw_t draw, const void* prim,
+        int32_t l, int32_t t, int32_t r, int32_t b);
+
+// For the tests. Sets the number of threads of the pool (including the
+// caller) instead of debug.pf.tiler_threads, if the pool isn't created yet.
+// Returns the number of threads the pool has.
+int ggl_tiler_set_threads(int count);
+
+// For the tests. Number of primitives drawn by the pool so far.
+uint32_t ggl_tiler_draw_count();
+
+}; // namespace android
+
+#endif
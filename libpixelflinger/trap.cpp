@@ -21,6 +21,7 @@
 
 #include "trap.h"
 #include "picker.h"
+#include "tiler.h"
 
 #include <cutils/log.h>
 #include <cutils/memory.h>
@@ -45,6 +46,7 @@ static void aa_linex(void *con, const GGLcoord* v0, const GGLcoord* v1, GGLcoord
 
 static void recti_validate(void* c, GGLint l, GGLint t, GGLint r, GGLint b); 
 static void recti(void* c, GGLint l, GGLint t, GGLint r, GGLint b); 
+static void recti_tiled(void* c, GGLint l, GGLint t, GGLint r, GGLint b);
 
 static void trianglex_validate(void*,
         const GGLcoord*, const GGLcoord*, const GGLcoord*);
@@ -52,6 +54,8 @@ static void trianglex_small(void*,
         const GGLcoord*, const GGLcoord*, const GGLcoord*);
 static void trianglex_big(void*,
         const GGLcoord*, const GGLcoord*, const GGLcoord*);
+static void trianglex_tiled(void*,
+        const GGLcoord*, const GGLcoord*, const GGLcoord*);
 static void aa_trianglex(void*,
         const GGLcoord*, const GGLcoord*, const GGLcoord*);
 static void trianglex_debug(void* con,
@@ -412,7 +416,11 @@ void recti_validate(void *con, GGLint l, GGLint t, GGLint r, GGLint b)
 {
     GGL_CONTEXT(c, con);
     ggl_pick(c);
-    c->procs.recti = recti;
+    if (c->state.enables & GGL_ENABLE_TILED) {
+        c->procs.recti = recti_tiled;
+    } else {
+        c->procs.recti = recti;
+    }
     c->procs.recti(con, l, t, r, b);
 }
 
@@ -440,6 +448,20 @@ void recti(void* con, GGLint l, GGLint t, GGLint r, GGLint b)
     }
 }
 
+static void recti_tile(context_t* c, const void* prim)
+{
+    const GGLint* rect = static_cast<const GGLint*>(prim);
+    recti(c, rect[0], rect[1], rect[2], rect[3]);
+}
+
+void recti_tiled(void* con, GGLint l, GGLint t, GGLint r, GGLint b)
+{
+    GGL_CONTEXT(c, con);
+    const GGLint rect[4] = { l, t, r, b };
+    if (!ggl_tiled_draw(c, recti_tile, rect, l, t, r, b))
+        recti(con, l, t, r, b);
+}
+
 // ----------------------------------------------------------------------------
 #if 0
 #pragma mark -
@@ -496,6 +518,8 @@ void trianglex_validate(void *con,
     ggl_pick(c);
     if (c->state.needs.p & GGL_NEED_MASK(P_AA)) {
         c->procs.trianglex = DEBUG_TRANGLES ? trianglex_debug : aa_trianglex;
+    } else if (c->state.enables & GGL_ENABLE_TILED) {
+        c->procs.trianglex = DEBUG_TRANGLES ? trianglex_debug : trianglex_tiled;
     } else {
         c->procs.trianglex = DEBUG_TRANGLES ? trianglex_debug : trianglex_big;
     }
@@ -707,7 +731,9 @@ void edge_setup(
         edge->x_incr = gglDivQ16(dx, dy);
     }
     if (ggl_likely(y1 < ymin)) {
-        int32_t xadjust = (edge->x_incr * (ymin-y1)) >> TRI_FRACTION_BITS;
+        // in 64 bits, the edge may start far above the scissor (or the tile)
+        int32_t xadjust = (int64_t(edge->x_incr) * (ymin-y1))
+                >> TRI_FRACTION_BITS;
         edge->x += xadjust;
     }
   
@@ -808,6 +834,25 @@ void trianglex_big(void* con,
     }
 }
 
+static void trianglex_tile(context_t* c, const void* prim)
+{
+    const GGLcoord* v = static_cast<const GGLcoord*>(prim);
+    trianglex_big(c, v, v+2, v+4);
+}
+
+void trianglex_tiled(void* con,
+        const GGLcoord* v0, const GGLcoord* v1, const GGLcoord* v2)
+{
+    GGL_CONTEXT(c, con);
+    const GGLcoord v[6] = { v0[0], v0[1], v1[0], v1[1], v2[0], v2[1] };
+    const int32_t l = TRI_FLOOR(min(v0[0], v1[0], v2[0])) >> TRI_FRACTION_BITS;
+    const int32_t t = TRI_FLOOR(min(v0[1], v1[1], v2[1])) >> TRI_FRACTION_BITS;
+    const int32_t r = TRI_CEIL( max(v0[0], v1[0], v2[0])) >> TRI_FRACTION_BITS;
+    const int32_t b = TRI_CEIL( max(v0[1], v1[1], v2[1])) >> TRI_FRACTION_BITS;
+    if (!ggl_tiled_draw(c, trianglex_tile, v, l, t, r, b))
+        trianglex_big(con, v0, v1, v2);
+}
+
 void aa_trianglex(void* con,
         const GGLcoord* a, const GGLcoord* b, const GGLcoord* c)
 {
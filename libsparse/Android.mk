@@ -48,6 +48,9 @@ LOCAL_MODULE_STEM := simg2img
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
     libz
+ifeq ($(HOST_OS),linux)
+  LOCAL_LDLIBS += -lpthread
+endif
 include $(BUILD_HOST_EXECUTABLE)
 
 
@@ -69,6 +72,9 @@ LOCAL_MODULE_STEM := img2simg
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
     libz
+ifeq ($(HOST_OS),linux)
+  LOCAL_LDLIBS += -lpthread
+endif
 include $(BUILD_HOST_EXECUTABLE)
 
 
@@ -87,6 +93,22 @@ LOCAL_MODULE := simg2simg
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
     libz
+ifeq ($(HOST_OS),linux)
+  LOCAL_LDLIBS += -lpthread
+endif
+include $(BUILD_HOST_EXECUTABLE)
+
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := backed_block_bench.c
+LOCAL_MODULE := backed_block_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_STATIC_LIBRARIES := \
+    libsparse_host \
+    libz
+ifeq ($(HOST_OS),linux)
+  LOCAL_LDLIBS += -lpthread
+endif
 include $(BUILD_HOST_EXECUTABLE)
 
 
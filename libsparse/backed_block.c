@@ -16,6 +16,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,17 +45,129 @@ struct backed_block {
 		} fill;
 	};
 	struct backed_block *next;
+	/* Skip list links above level 0, which is next */
+	unsigned int height;
+	struct backed_block **skip;
 };
 
+/*
+ * The blocks are kept in a skip list sorted by block number, so that
+ * lookups, inserts and splits are O(log n) however the blocks are queued.
+ * Level 0 is a plain linked list through bb->next, which is all iteration
+ * needs.
+ */
+#define BB_MAX_HEIGHT 16
+
 struct backed_block_list {
-	struct backed_block *data_blocks;
-	struct backed_block *last_used;
+	struct backed_block *head[BB_MAX_HEIGHT];
+	unsigned int height;
+	uint32_t seed;
 	unsigned int block_size;
 };
 
+static struct backed_block **bb_link(struct backed_block_list *bbl,
+		struct backed_block *bb, unsigned int level)
+{
+	if (!bb) {
+		return &bbl->head[level];
+	}
+	return level ? &bb->skip[level - 1] : &bb->next;
+}
+
+/* Picks a height with P(h) = 4^-(h-1), from a xorshift PRNG */
+static unsigned int bb_random_height(struct backed_block_list *bbl)
+{
+	unsigned int height = 1;
+	uint32_t r;
+
+	r = bbl->seed;
+	r ^= r << 13;
+	r ^= r >> 17;
+	r ^= r << 5;
+	bbl->seed = r;
+
+	while (height < BB_MAX_HEIGHT && (r & 3) == 0) {
+		height++;
+		r >>= 2;
+	}
+
+	return height;
+}
+
+/*
+ * Fills prev with the last block starting before block on each level, or
+ * NULL for the list head.
+ */
+static void bb_find_prev(struct backed_block_list *bbl, unsigned int block,
+		struct backed_block **prev)
+{
+	struct backed_block *bb = NULL;
+	struct backed_block *next;
+	int level;
+
+	for (level = BB_MAX_HEIGHT - 1; level >= 0; level--) {
+		if ((unsigned int)level < bbl->height) {
+			while ((next = *bb_link(bbl, bb, level)) && next->block < block) {
+				bb = next;
+			}
+		}
+		prev[level] = bb;
+	}
+}
+
+static int bb_set_height(struct backed_block *bb, unsigned int height)
+{
+	bb->height = height;
+	bb->skip = NULL;
+	if (height > 1) {
+		bb->skip = calloc(height - 1, sizeof(struct backed_block *));
+		if (!bb->skip) {
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+static void bb_link_after(struct backed_block_list *bbl,
+		struct backed_block **prev, struct backed_block *bb)
+{
+	unsigned int level;
+
+	if (bb->height > bbl->height) {
+		bbl->height = bb->height;
+	}
+
+	for (level = 0; level < bb->height; level++) {
+		*bb_link(bbl, bb, level) = *bb_link(bbl, prev[level], level);
+		*bb_link(bbl, prev[level], level) = bb;
+	}
+}
+
+static void bb_unlink(struct backed_block_list *bbl, struct backed_block *bb)
+{
+	struct backed_block *prev[BB_MAX_HEIGHT];
+	unsigned int level;
+
+	struct backed_block **link;
+
+	bb_find_prev(bbl, bb->block, prev);
+	for (level = 0; level < bb->height; level++) {
+		/* step over any other blocks queued at the same block number */
+		for (link = bb_link(bbl, prev[level], level); *link != bb;
+				link = bb_link(bbl, *link, level)) {
+			assert(*link && (*link)->block == bb->block);
+		}
+		*link = *bb_link(bbl, bb, level);
+	}
+
+	while (bbl->height > 0 && !bbl->head[bbl->height - 1]) {
+		bbl->height--;
+	}
+}
+
 struct backed_block *backed_block_iter_new(struct backed_block_list *bbl)
 {
-	return bbl->data_blocks;
+	return bbl->head[0];
 }
 
 struct backed_block *backed_block_iter_next(struct backed_block *bb)
@@ -117,25 +230,29 @@ void backed_block_destroy(struct backed_block *bb)
 		free(bb->file.filename);
 	}
 
+	free(bb->skip);
 	free(bb);
 }
 
 struct backed_block_list *backed_block_list_new(unsigned int block_size)
 {
 	struct backed_block_list *b = calloc(sizeof(struct backed_block_list), 1);
+	if (!b) {
+		return NULL;
+	}
 	b->block_size = block_size;
+	b->seed = 0x2545f491;
 	return b;
 }
 
 void backed_block_list_destroy(struct backed_block_list *bbl)
 {
-	if (bbl->data_blocks) {
-		struct backed_block *bb = bbl->data_blocks;
-		while (bb) {
-			struct backed_block *next = bb->next;
-			backed_block_destroy(bb);
-			bb = next;
-		}
+	struct backed_block *bb = bbl->head[0];
+
+	while (bb) {
+		struct backed_block *next = bb->next;
+		backed_block_destroy(bb);
+		bb = next;
 	}
 
 	free(bbl);
@@ -145,45 +262,24 @@ void backed_block_list_move(struct backed_block_list *from,
 		struct backed_block_list *to, struct backed_block *start,
 		struct backed_block *end)
 {
+	struct backed_block *prev[BB_MAX_HEIGHT];
 	struct backed_block *bb;
+	struct backed_block *next;
 
 	if (start == NULL) {
-		start = from->data_blocks;
+		start = from->head[0];
 	}
 
-	if (!end) {
-		for (end = start; end && end->next; end = end->next)
-			;
-	}
-
-	if (start == NULL || end == NULL) {
+	if (start == NULL) {
 		return;
 	}
 
-	from->last_used = NULL;
-	to->last_used = NULL;
-	if (from->data_blocks == start) {
-		from->data_blocks = end->next;
-	} else {
-		for (bb = from->data_blocks; bb; bb = bb->next) {
-			if (bb->next == start) {
-				bb->next = end->next;
-				break;
-			}
-		}
-	}
-
-	if (!to->data_blocks) {
-		to->data_blocks = start;
-		end->next = NULL;
-	} else {
-		for (bb = to->data_blocks; bb; bb = bb->next) {
-			if (!bb->next || bb->next->block > start->block) {
-				end->next = bb->next;
-				bb->next = start;
-				break;
-			}
-		}
+	/* Blocks keep their height, so each one is relinked in O(log n) */
+	for (bb = start; bb; bb = next) {
+		next = (bb == end) ? NULL : bb->next;
+		bb_unlink(from, bb);
+		bb_find_prev(to, bb->block, prev);
+		bb_link_after(to, prev, bb);
 	}
 }
 
@@ -211,6 +307,11 @@ static int merge_bb(struct backed_block_list *bbl,
 		return -EINVAL;
 	}
 
+	/* Merged length would not fit */
+	if (a->len > UINT_MAX - b->len) {
+		return -EINVAL;
+	}
+
 	switch (a->type) {
 	case BACKED_BLOCK_DATA:
 		/* Don't support merging data for now */
@@ -236,8 +337,8 @@ static int merge_bb(struct backed_block_list *bbl,
 
 	/* Blocks are compatible and adjacent, with a before b.  Merge b into a,
 	 * and free b */
+	bb_unlink(bbl, b);
 	a->len += b->len;
-	a->next = b->next;
 
 	backed_block_destroy(b);
 
@@ -246,40 +347,20 @@ static int merge_bb(struct backed_block_list *bbl,
 
 static int queue_bb(struct backed_block_list *bbl, struct backed_block *new_bb)
 {
-	struct backed_block *bb;
+	struct backed_block *prev[BB_MAX_HEIGHT];
+	int ret;
 
-	if (bbl->data_blocks == NULL) {
-		bbl->data_blocks = new_bb;
-		return 0;
+	ret = bb_set_height(new_bb, bb_random_height(bbl));
+	if (ret < 0) {
+		backed_block_destroy(new_bb);
+		return ret;
 	}
 
-	if (bbl->data_blocks->block > new_bb->block) {
-		new_bb->next = bbl->data_blocks;
-		bbl->data_blocks = new_bb;
-		return 0;
-	}
-
-	/* Optimization: blocks are mostly queued in sequence, so save the
-	   pointer to the last bb that was added, and start searching from
-	   there if the next block number is higher */
-	if (bbl->last_used && new_bb->block > bbl->last_used->block)
-		bb = bbl->last_used;
-	else
-		bb = bbl->data_blocks;
-	bbl->last_used = new_bb;
-
-	for (; bb->next && bb->next->block < new_bb->block; bb = bb->next)
-		;
-
-	if (bb->next == NULL) {
-		bb->next = new_bb;
-	} else {
-		new_bb->next = bb->next;
-		bb->next = new_bb;
-	}
+	bb_find_prev(bbl, new_bb->block, prev);
+	bb_link_after(bbl, prev, new_bb);
 
 	merge_bb(bbl, new_bb, new_bb->next);
-	merge_bb(bbl, bb, new_bb);
+	merge_bb(bbl, prev[0], new_bb);
 
 	return 0;
 }
@@ -361,6 +442,7 @@ int backed_block_add_fd(struct backed_block_list *bbl, int fd, int64_t offset,
 int backed_block_split(struct backed_block_list *bbl, struct backed_block *bb,
 		unsigned int max_len)
 {
+	struct backed_block *prev[BB_MAX_HEIGHT];
 	struct backed_block *new_bb;
 
 	max_len = ALIGN_DOWN(max_len, bbl->block_size);
@@ -370,18 +452,23 @@ int backed_block_split(struct backed_block_list *bbl, struct backed_block *bb,
 	}
 
 	new_bb = malloc(sizeof(struct backed_block));
-	if (bb == NULL) {
+	if (new_bb == NULL) {
 		return -ENOMEM;
 	}
 
 	*new_bb = *bb;
+	if (bb_set_height(new_bb, bb_random_height(bbl)) < 0) {
+		free(new_bb);
+		return -ENOMEM;
+	}
 
 	new_bb->len = bb->len - max_len;
 	new_bb->block = bb->block + max_len / bbl->block_size;
-	new_bb->next = bb->next;
-	bb->next = new_bb;
 	bb->len = max_len;
 
+	bb_find_prev(bbl, new_bb->block, prev);
+	bb_link_after(bbl, prev, new_bb);
+
 	switch (bb->type) {
 	case BACKED_BLOCK_DATA:
 		new_bb->data.data = (char *)bb->data.data + max_len;
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE 1
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <sparse/sparse.h>
+
+#include "backed_block.h"
+
+/*
+ * Times the backed_block_list operations on images with a large number of
+ * chunks, as produced by fragmented filesystems: ordered and out of order
+ * inserts, merging on insert, lookups (relinking every block into another
+ * list), splitting, and resparsing the whole image.
+ */
+
+#define BLOCK_SIZE 4096
+
+static uint32_t rand_state;
+
+void usage()
+{
+  fprintf(stderr, "Usage: backed_block_bench [-n <chunks>] [-s <seed>] [-m <max_size>]\n");
+  fprintf(stderr, "  -n <chunks>    number of chunks (default: 1000000)\n");
+  fprintf(stderr, "  -s <seed>      seed for the insert order (default: 1)\n");
+  fprintf(stderr, "  -m <max_size>  size of the resparsed files (default: 2MB)\n");
+}
+
+static uint32_t bench_rand(void)
+{
+	/* xorshift32, rand() only has 15 bits on some hosts */
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+static unsigned int *shuffled(unsigned int count)
+{
+	unsigned int *order;
+	unsigned int i;
+
+	order = malloc(count * sizeof(*order));
+	if (!order) {
+		fprintf(stderr, "Failed to allocate %u entries\n", count);
+		exit(-1);
+	}
+
+	for (i = 0; i < count; i++) {
+		order[i] = i;
+	}
+	for (i = count - 1; i > 0; i--) {
+		unsigned int j = bench_rand() % (i + 1);
+		unsigned int tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	return order;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void report(const char *name, unsigned int count, double start)
+{
+	double t = now() - start;
+
+	printf("%-20s %8u ops %9.3f s %9.1f ns/op\n", name, count, t,
+			count ? t * 1000000000.0 / count : 0.0);
+}
+
+/* Checks that the list is sorted and has the expected number of chunks */
+static void check_list(const char *name, struct backed_block_list *bbl,
+		unsigned int expected)
+{
+	struct backed_block *bb;
+	unsigned int count = 0;
+	unsigned int last = 0;
+
+	for (bb = backed_block_iter_new(bbl); bb; bb = backed_block_iter_next(bb)) {
+		if (count && backed_block_block(bb) <= last) {
+			fprintf(stderr, "%s: block %u after block %u\n", name,
+					backed_block_block(bb), last);
+			exit(-1);
+		}
+		last = backed_block_block(bb);
+		count++;
+	}
+
+	if (count != expected) {
+		fprintf(stderr, "%s: %u chunks, expected %u\n", name, count, expected);
+		exit(-1);
+	}
+}
+
+static void add_fill(struct backed_block_list *bbl, unsigned int val,
+		unsigned int len, unsigned int block)
+{
+	if (backed_block_add_fill(bbl, val, len, block) < 0) {
+		fprintf(stderr, "Failed to add block %u\n", block);
+		exit(-1);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct backed_block_list *bbl;
+	struct backed_block_list *to;
+	struct backed_block **blocks;
+	struct backed_block *bb;
+	struct sparse_file *s;
+	struct sparse_file *out_s;
+	unsigned int *order;
+	unsigned int count = 1000000;
+	unsigned int max_size = 2 * 1024 * 1024;
+	unsigned int seed = 1;
+	unsigned int files;
+	unsigned int i;
+	double start;
+	int opt;
+	int ret;
+
+	while ((opt = getopt(argc, argv, "n:s:m:")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			max_size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			exit(-1);
+		}
+	}
+
+	if (optind != argc || count == 0 || count > UINT32_MAX / 4 ||
+			max_size < 4 * BLOCK_SIZE) {
+		usage();
+		exit(-1);
+	}
+
+	rand_state = seed ? seed : 1;
+	order = shuffled(count);
+
+	/* Separate chunks (a hole between each one), blocks 2i */
+	bbl = backed_block_list_new(BLOCK_SIZE);
+	start = now();
+	for (i = 0; i < count; i++) {
+		add_fill(bbl, i, BLOCK_SIZE, i * 2);
+	}
+	report("insert in order", count, start);
+	check_list("insert in order", bbl, count);
+	backed_block_list_destroy(bbl);
+
+	bbl = backed_block_list_new(BLOCK_SIZE);
+	start = now();
+	for (i = 0; i < count; i++) {
+		add_fill(bbl, order[i], BLOCK_SIZE, order[i] * 2);
+	}
+	report("insert random", count, start);
+	check_list("insert random", bbl, count);
+
+	/* Every lookup finds the position of a block in both lists */
+	to = backed_block_list_new(BLOCK_SIZE);
+	blocks = malloc(count * sizeof(*blocks));
+	if (!blocks) {
+		fprintf(stderr, "Failed to allocate %u entries\n", count);
+		exit(-1);
+	}
+	for (i = 0, bb = backed_block_iter_new(bbl); bb;
+			bb = backed_block_iter_next(bb)) {
+		blocks[i++] = bb;
+	}
+	start = now();
+	for (i = 0; i < count; i++) {
+		bb = blocks[order[i]];
+		backed_block_list_move(bbl, to, bb, bb);
+	}
+	report("lookup and move", count, start);
+	check_list("lookup and move", to, count);
+	check_list("lookup and move", bbl, 0);
+	backed_block_list_destroy(bbl);
+	backed_block_list_destroy(to);
+
+	/* Adjacent chunks of the same value merge into a single one */
+	bbl = backed_block_list_new(BLOCK_SIZE);
+	start = now();
+	for (i = 0; i < count; i++) {
+		add_fill(bbl, 0, BLOCK_SIZE, order[i]);
+	}
+	report("insert and merge", count, start);
+	check_list("insert and merge", bbl, 1);
+	backed_block_list_destroy(bbl);
+
+	/* Two block chunks split in two, in random order */
+	bbl = backed_block_list_new(BLOCK_SIZE);
+	for (i = 0; i < count; i++) {
+		add_fill(bbl, i, 2 * BLOCK_SIZE, i * 4);
+	}
+	for (i = 0, bb = backed_block_iter_new(bbl); bb;
+			bb = backed_block_iter_next(bb)) {
+		blocks[i++] = bb;
+	}
+	start = now();
+	for (i = 0; i < count; i++) {
+		if (backed_block_split(bbl, blocks[order[i]], BLOCK_SIZE) < 0) {
+			fprintf(stderr, "Failed to split block %u\n", order[i] * 4);
+			exit(-1);
+		}
+	}
+	report("split", count, start);
+	check_list("split", bbl, count * 2);
+	backed_block_list_destroy(bbl);
+	free(blocks);
+
+	/* The whole path for a fragmented image: import out of order, resparse */
+	s = sparse_file_new(BLOCK_SIZE, (int64_t)count * 2 * BLOCK_SIZE);
+	if (!s) {
+		fprintf(stderr, "Failed to create sparse file\n");
+		exit(-1);
+	}
+	start = now();
+	for (i = 0; i < count; i++) {
+		if (sparse_file_add_fill(s, order[i], BLOCK_SIZE, order[i] * 2) < 0) {
+			fprintf(stderr, "Failed to add block %u\n", order[i] * 2);
+			exit(-1);
+		}
+	}
+	report("sparse_file_add_fill", count, start);
+
+	start = now();
+	files = 0;
+	while ((ret = sparse_file_resparse_next(s, max_size, &out_s)) > 0) {
+		sparse_file_destroy(out_s);
+		files++;
+	}
+	if (ret < 0) {
+		fprintf(stderr, "Failed to resparse\n");
+		exit(-1);
+	}
+	report("resparse", count, start);
+	printf("%u chunks resparsed into %u files of up to %u bytes\n", count,
+			files, max_size);
+	sparse_file_destroy(s);
+
+	free(order);
+
+	return 0;
+}
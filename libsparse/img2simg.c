@@ -40,7 +40,9 @@
 
 void usage()
 {
-    fprintf(stderr, "Usage: img2simg <raw_image_file> <sparse_image_file> [<block_size>]\n");
+    fprintf(stderr, "Usage: img2simg [-z] [-j <threads>] <raw_image_file> <sparse_image_file> [<block_size>]\n");
+    fprintf(stderr, "  -z            store blocks of zeros as don't care chunks instead of fills\n");
+    fprintf(stderr, "  -j <threads>  number of threads to scan with (default: one per cpu)\n");
 }
 
 int main(int argc, char *argv[])
@@ -51,7 +53,26 @@ int main(int argc, char *argv[])
 	int ret;
 	struct sparse_file *s;
 	unsigned int block_size = 4096;
+	unsigned int threads = 0;
+	enum sparse_read_mode mode = SPARSE_READ_MODE_NORMAL;
 	off64_t len;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "zj:")) != -1) {
+		switch (opt) {
+		case 'z':
+			mode = SPARSE_READ_MODE_HOLE;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		default:
+			usage();
+			exit(-1);
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
 
 	if (argc < 3 || argc > 4) {
 		usage();
@@ -97,7 +118,8 @@ int main(int argc, char *argv[])
 	}
 
 	sparse_file_verbose(s);
-	ret = sparse_file_read(s, in, false, false);
+	sparse_file_set_threads(s, threads);
+	ret = sparse_file_read(s, in, mode, false);
 	if (ret) {
 		fprintf(stderr, "Failed to read file\n");
 		exit(-1);
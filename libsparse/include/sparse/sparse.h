@@ -192,23 +192,42 @@ int64_t sparse_file_len(struct sparse_file *s, bool sparse, bool crc);
 int sparse_file_callback(struct sparse_file *s, bool sparse, bool crc,
 		int (*write)(void *priv, const void *data, int len), void *priv);
 
+/**
+ * enum sparse_read_mode - how sparse_file_read interprets its input
+ *
+ * SPARSE_READ_MODE_NORMAL - a raw image; block aligned chunks of all zeros
+ *     or another 32 bit value become fill chunks
+ * SPARSE_READ_MODE_SPARSE - a file in the Android sparse file format
+ * SPARSE_READ_MODE_HOLE - like NORMAL, but blocks of all zeros are left out
+ *     of the sparse file entirely and are written as don't care chunks
+ *
+ * The first two values match the old bool sparse argument of
+ * sparse_file_read.
+ */
+enum sparse_read_mode {
+	SPARSE_READ_MODE_NORMAL = false,
+	SPARSE_READ_MODE_SPARSE = true,
+	SPARSE_READ_MODE_HOLE,
+};
+
 /**
  * sparse_file_read - read a file into a sparse file cookie
  *
  * @s - sparse file cookie
  * @fd - file descriptor to read from
- * @sparse - read a file in the Android sparse file format
+ * @mode - how to interpret the file, see enum sparse_read_mode
  * @crc - verify the crc of a file in the Android sparse file format
  *
- * Reads a file into a sparse file cookie.  If sparse is true, the file is
- * assumed to be in the Android sparse file format.  If sparse is false, the
+ * Reads a file into a sparse file cookie.  If mode is SPARSE_READ_MODE_SPARSE,
+ * the file is assumed to be in the Android sparse file format.  Otherwise the
  * file will be sparsed by looking for block aligned chunks of all zeros or
- * another 32 bit value.  If crc is true, the crc of the sparse file will be
- * verified.
+ * another 32 bit value, using up to sparse_file_set_threads() threads.  If crc
+ * is true, the crc of the sparse file will be verified.
  *
  * Returns 0 on success, negative errno on error.
  */
-int sparse_file_read(struct sparse_file *s, int fd, bool sparse, bool crc);
+int sparse_file_read(struct sparse_file *s, int fd, enum sparse_read_mode mode,
+		bool crc);
 
 /**
  * sparse_file_import - import an existing sparse file
@@ -241,6 +260,29 @@ struct sparse_file *sparse_file_import(int fd, bool verbose, bool crc);
  */
 struct sparse_file *sparse_file_import_auto(int fd, bool crc);
 
+/**
+ * sparse_stream_decode - expand a sparse file read from a stream
+ *
+ * @read - function to call to read exactly len bytes of input
+ * @write - function to call for each run of expanded data
+ * @priv - value that will be passed as the first argument to read and write
+ * @crc - verify the crc of the sparse file
+ * @block_size - if not NULL, set to the block size from the sparse header
+ *
+ * Decodes a file in the Android sparse file format from a source that can
+ * only be read front to back, such as a usb transfer, without building a
+ * sparse file cookie.  Input is consumed in pieces of at most 1MB.  The
+ * callback 'write' will be called with the byte offset in the expanded image,
+ * data and length for each raw or fill chunk, in increasing offset order;
+ * don't care chunks are not written.  Both callbacks should return negative
+ * errno on error, 0 on success.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_stream_decode(int (*read)(void *priv, void *data, int len),
+		int (*write)(void *priv, int64_t off, const void *data, int len),
+		void *priv, bool crc, unsigned int *block_size);
+
 /** sparse_file_resparse - rechunk an existing sparse file into smaller files
  *
  * @in_s - sparse file cookie of the existing sparse file
@@ -255,6 +297,33 @@ struct sparse_file *sparse_file_import_auto(int fd, bool crc);
 int sparse_file_resparse(struct sparse_file *in_s, unsigned int max_len,
 		struct sparse_file **out_s, int out_s_count);
 
+/** sparse_file_resparse_next - split the next smaller file off a sparse file
+ *
+ * @in_s - sparse file cookie of the existing sparse file
+ * @max_len - maximum file size
+ * @out_s - set to the new sparse file cookie, or NULL if in_s is empty
+ *
+ * Moves chunks from the start of an existing sparse file into a new sparse
+ * file that is less than max_len, like one step of sparse_file_resparse, so
+ * that the pieces can be produced as they are consumed.  Unlike
+ * sparse_file_resparse, the chunks are not restored to in_s.
+ *
+ * Returns 1 if a file was split off, 0 if in_s was empty, or negative errno.
+ */
+int sparse_file_resparse_next(struct sparse_file *in_s, unsigned int max_len,
+		struct sparse_file **out_s);
+
+/**
+ * sparse_file_set_threads - set the number of threads used for a sparse file
+ *
+ * @s - sparse file cookie
+ * @threads - maximum number of worker threads, 0 to use one per online cpu
+ *
+ * Sets how many threads may be used when reading, checksumming or compressing
+ * the sparse file.  Defaults to 0.
+ */
+void sparse_file_set_threads(struct sparse_file *s, unsigned int threads);
+
 /**
  * sparse_file_verbose - set a sparse file cookie to print verbose errors
  *
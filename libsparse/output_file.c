@@ -33,7 +33,9 @@
 #include "sparse_crc32.h"
 
 #ifndef USE_MINGW
+#include <pthread.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #define O_BINARY 0
 #else
 #define ftruncate64 ftruncate
@@ -46,6 +48,11 @@
 #define off64_t off_t
 #endif
 
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
 #ifdef __BIONIC__
 extern void*  __mmap2(void *, size_t, int, int, int, off_t);
 static inline void *mmap64(void *addr, size_t length, int prot, int flags,
@@ -71,7 +78,9 @@ struct output_file_ops {
 	int (*skip)(struct output_file *, int64_t);
 	int (*pad)(struct output_file *, int64_t);
 	int (*write)(struct output_file *, void *, int);
-	void (*close)(struct output_file *);
+	/* optional, copies len bytes at offset in fd to the output */
+	int (*copy)(struct output_file *, int fd, int64_t offset, unsigned int len);
+	int (*close)(struct output_file *);
 };
 
 struct sparse_file_ops {
@@ -79,6 +88,8 @@ struct sparse_file_ops {
 			void *data);
 	int (*write_fill_chunk)(struct output_file *out, unsigned int len,
 			uint32_t fill_val);
+	int (*write_fd_chunk)(struct output_file *out, unsigned int len,
+			int fd, int64_t offset);
 	int (*write_skip_chunk)(struct output_file *out, int64_t len);
 	int (*write_end_chunk)(struct output_file *out);
 };
@@ -90,6 +101,7 @@ struct output_file {
 	struct output_file_ops *ops;
 	struct sparse_file_ops *sparse_ops;
 	int use_crc;
+	unsigned int threads;
 	unsigned int block_size;
 	int64_t len;
 	char *zero_buf;
@@ -97,17 +109,79 @@ struct output_file {
 	char *buf;
 };
 
+/*
+ * gzip output is compressed in independent GZ_BLOCK_SIZE blocks, each primed
+ * with the last 32k of the block before it, so the blocks can be deflated in
+ * parallel and still be concatenated into a single gzip member.
+ */
+#define GZ_BLOCK_SIZE (128 * 1024)
+#define GZ_DICT_SIZE (32 * 1024)
+#define GZ_MAX_THREADS 32
+#define GZ_MAX_JOBS (2 * GZ_MAX_THREADS)
+
+enum gz_job_state {
+	GZ_JOB_FREE,
+	GZ_JOB_QUEUED,
+	GZ_JOB_DONE,
+};
+
+struct gz_job {
+	enum gz_job_state state;
+	bool last;
+	int ret;
+	unsigned char in[GZ_BLOCK_SIZE];
+	unsigned int in_len;
+	unsigned char dict[GZ_DICT_SIZE];
+	unsigned int dict_len;
+	unsigned char *out;
+	unsigned int out_len;
+	uint32_t crc;
+};
+
 struct output_file_gz {
 	struct output_file out;
-	gzFile gz_fd;
+	int fd;
+	int64_t pos;
+	uint32_t crc;
+	uint32_t isize;
+	int err;
+
+	/* jobs are used in order, as a ring of njobs, sized on the first flush */
+	struct gz_job *jobs[GZ_MAX_JOBS];
+	unsigned int njobs;
+	unsigned int submitted;
+	unsigned int taken;
+	unsigned int written;
+
+	z_stream strm;
+	bool strm_init;
+
+	unsigned int nworkers;
+#ifndef USE_MINGW
+	pthread_t workers[GZ_MAX_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t queued_cond;
+	pthread_cond_t done_cond;
+	bool quit;
+#endif
 };
 
 #define to_output_file_gz(_o) \
 	container_of((_o), struct output_file_gz, out)
 
+/*
+ * Small writes like chunk headers are collected in wbuf and go out in the
+ * same writev() as the next large write, or before the next copy.
+ */
+#define FILE_WBUF_SIZE (64 * 1024)
+
 struct output_file_normal {
 	struct output_file out;
 	int fd;
+	bool no_copy_file_range;
+	bool no_sendfile;
+	unsigned int wbuf_len;
+	char wbuf[FILE_WBUF_SIZE];
 };
 
 #define to_output_file_normal(_o) \
@@ -130,11 +204,84 @@ static int file_open(struct output_file *out, int fd)
 	return 0;
 }
 
+/* Writes out wbuf followed by len bytes of data */
+static int file_writev(struct output_file_normal *outn, void *data, int len)
+{
+	ssize_t ret;
+#ifndef USE_MINGW
+	struct iovec iov[2];
+	struct iovec *cur = iov;
+	int cnt = 0;
+
+	if (outn->wbuf_len) {
+		iov[cnt].iov_base = outn->wbuf;
+		iov[cnt++].iov_len = outn->wbuf_len;
+	}
+	if (len) {
+		iov[cnt].iov_base = data;
+		iov[cnt++].iov_len = len;
+	}
+	outn->wbuf_len = 0;
+
+	while (cnt) {
+		ret = writev(outn->fd, cur, cnt);
+		if (ret < 0) {
+			error_errno("write");
+			return -1;
+		} else if (ret == 0) {
+			error("incomplete write");
+			return -1;
+		}
+		while (cnt && (size_t)ret >= cur->iov_len) {
+			ret -= cur->iov_len;
+			cur++;
+			cnt--;
+		}
+		if (cnt) {
+			cur->iov_base = (char *)cur->iov_base + ret;
+			cur->iov_len -= ret;
+		}
+	}
+#else
+	int wbuf_len = outn->wbuf_len;
+
+	outn->wbuf_len = 0;
+	if (wbuf_len) {
+		ret = write(outn->fd, outn->wbuf, wbuf_len);
+		if (ret < wbuf_len) {
+			error_errno("write");
+			return -1;
+		}
+	}
+	if (len) {
+		ret = write(outn->fd, data, len);
+		if (ret < len) {
+			error_errno("write");
+			return -1;
+		}
+	}
+#endif
+
+	return 0;
+}
+
+static int file_flush(struct output_file_normal *outn)
+{
+	if (!outn->wbuf_len) {
+		return 0;
+	}
+	return file_writev(outn, NULL, 0);
+}
+
 static int file_skip(struct output_file *out, int64_t cnt)
 {
 	off64_t ret;
 	struct output_file_normal *outn = to_output_file_normal(out);
 
+	if (file_flush(outn) < 0) {
+		return -1;
+	}
+
 	ret = lseek64(outn->fd, cnt, SEEK_CUR);
 	if (ret < 0) {
 		error_errno("lseek64");
@@ -148,6 +295,10 @@ static int file_pad(struct output_file *out, int64_t len)
 	int ret;
 	struct output_file_normal *outn = to_output_file_normal(out);
 
+	if (file_flush(outn) < 0) {
+		return -1;
+	}
+
 	ret = ftruncate64(outn->fd, len);
 	if (ret < 0) {
 		return -errno;
@@ -158,26 +309,97 @@ static int file_pad(struct output_file *out, int64_t len)
 
 static int file_write(struct output_file *out, void *data, int len)
 {
-	int ret;
 	struct output_file_normal *outn = to_output_file_normal(out);
 
-	ret = write(outn->fd, data, len);
-	if (ret < 0) {
-		error_errno("write");
-		return -1;
-	} else if (ret < len) {
-		error("incomplete write");
+	if (outn->wbuf_len + len <= FILE_WBUF_SIZE) {
+		memcpy(outn->wbuf + outn->wbuf_len, data, len);
+		outn->wbuf_len += len;
+		return 0;
+	}
+
+	return file_writev(outn, data, len);
+}
+
+/*
+ * Copies in the kernel where possible, trying copy_file_range (which can
+ * share extents on filesystems that support it), then sendfile, then falls
+ * back to bouncing through wbuf.
+ */
+static int file_copy(struct output_file *out, int fd, int64_t offset,
+		unsigned int len)
+{
+	struct output_file_normal *outn = to_output_file_normal(out);
+	ssize_t ret;
+
+	if (file_flush(outn) < 0) {
 		return -1;
 	}
 
+#if defined(__linux__) && defined(__NR_copy_file_range)
+	while (len && !outn->no_copy_file_range) {
+		loff_t off_in = offset;
+
+		ret = syscall(__NR_copy_file_range, fd, &off_in, outn->fd, NULL,
+				(size_t)len, 0);
+		if (ret <= 0) {
+			outn->no_copy_file_range = true;
+			break;
+		}
+		offset += ret;
+		len -= ret;
+	}
+#endif
+
+#ifdef __linux__
+	while (len && !outn->no_sendfile) {
+		off_t off_in = offset;
+
+		if (off_in != offset) {
+			/* offset doesn't fit in this off_t */
+			break;
+		}
+		ret = sendfile(outn->fd, fd, &off_in, len);
+		if (ret <= 0) {
+			outn->no_sendfile = true;
+			break;
+		}
+		offset += ret;
+		len -= ret;
+	}
+#endif
+
+	while (len) {
+		unsigned int chunk = min(len, (unsigned int)FILE_WBUF_SIZE);
+
+		if (lseek64(fd, offset, SEEK_SET) < 0) {
+			error_errno("lseek64");
+			return -1;
+		}
+		ret = read_all(fd, outn->wbuf, chunk);
+		if (ret < 0) {
+			error("failed to read %u bytes at %lld", chunk, (long long)offset);
+			return -1;
+		}
+		outn->wbuf_len = chunk;
+		if (file_flush(outn) < 0) {
+			return -1;
+		}
+		offset += chunk;
+		len -= chunk;
+	}
+
 	return 0;
 }
 
-static void file_close(struct output_file *out)
+static int file_close(struct output_file *out)
 {
 	struct output_file_normal *outn = to_output_file_normal(out);
+	int ret;
 
+	ret = file_flush(outn);
 	free(outn);
+
+	return ret;
 }
 
 static struct output_file_ops file_ops = {
@@ -185,83 +407,382 @@ static struct output_file_ops file_ops = {
 	.skip = file_skip,
 	.pad = file_pad,
 	.write = file_write,
+	.copy = file_copy,
 	.close = file_close,
 };
 
-static int gz_file_open(struct output_file *out, int fd)
+static int gz_stream_init(z_stream *strm)
 {
-	struct output_file_gz *outgz = to_output_file_gz(out);
+	memset(strm, 0, sizeof(*strm));
+	if (deflateInit2(strm, 9, Z_DEFLATED, -MAX_WBITS, 8,
+			Z_DEFAULT_STRATEGY) != Z_OK) {
+		error("deflateInit2 failed");
+		return -ENOMEM;
+	}
+	return 0;
+}
 
-	outgz->gz_fd = gzdopen(fd, "wb9");
-	if (!outgz->gz_fd) {
-		error_errno("gzopen");
-		return -errno;
+/*
+ * Deflates one block as raw deflate data.  All but the last block end with a
+ * sync flush, so they end on a byte boundary without a final block marker.
+ */
+static void gz_job_compress(struct gz_job *job, z_stream *strm)
+{
+	int ret;
+
+	job->crc = sparse_crc32(0, job->in, job->in_len);
+
+	deflateReset(strm);
+	if (job->dict_len) {
+		deflateSetDictionary(strm, job->dict, job->dict_len);
 	}
 
-	return 0;
+	strm->next_in = job->in;
+	strm->avail_in = job->in_len;
+	strm->next_out = job->out;
+	strm->avail_out = compressBound(GZ_BLOCK_SIZE) + 16;
+	ret = deflate(strm, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (strm->avail_in != 0 || ret != (job->last ? Z_STREAM_END : Z_OK)) {
+		job->ret = -1;
+		return;
+	}
+	job->out_len = strm->next_out - job->out;
+	job->ret = 0;
+}
+
+#ifndef USE_MINGW
+static void *gz_worker(void *priv)
+{
+	struct output_file_gz *outgz = priv;
+	struct gz_job *job;
+	z_stream strm;
+	int ret;
+
+	ret = gz_stream_init(&strm);
+
+	pthread_mutex_lock(&outgz->lock);
+	for (;;) {
+		while (!outgz->quit && outgz->taken == outgz->submitted) {
+			pthread_cond_wait(&outgz->queued_cond, &outgz->lock);
+		}
+		if (outgz->taken == outgz->submitted) {
+			break;
+		}
+		job = outgz->jobs[outgz->taken++ % outgz->njobs];
+		pthread_mutex_unlock(&outgz->lock);
+
+		if (ret == 0) {
+			gz_job_compress(job, &strm);
+		} else {
+			job->ret = ret;
+		}
+
+		pthread_mutex_lock(&outgz->lock);
+		job->state = GZ_JOB_DONE;
+		pthread_cond_broadcast(&outgz->done_cond);
+	}
+	pthread_mutex_unlock(&outgz->lock);
+
+	if (ret == 0) {
+		deflateEnd(&strm);
+	}
+
+	return NULL;
 }
+#endif
 
+static struct gz_job *gz_job_get(struct output_file_gz *outgz,
+		unsigned int n)
+{
+	unsigned int slot = outgz->njobs ? n % outgz->njobs : n;
+	struct gz_job *job = outgz->jobs[slot];
 
-static int gz_file_skip(struct output_file *out, int64_t cnt)
+	if (!job) {
+		job = calloc(1, sizeof(struct gz_job));
+		if (!job) {
+			return NULL;
+		}
+		job->out = malloc(compressBound(GZ_BLOCK_SIZE) + 16);
+		if (!job->out) {
+			free(job);
+			return NULL;
+		}
+		outgz->jobs[slot] = job;
+	}
+
+	return job;
+}
+
+/* Sizes the job ring and starts the workers, once the thread count is known */
+static int gz_start(struct output_file_gz *outgz)
 {
-	off64_t ret;
-	struct output_file_gz *outgz = to_output_file_gz(out);
+	unsigned int threads = min(outgz->out.threads, GZ_MAX_THREADS);
+	unsigned int i;
+	int ret;
 
-	ret = gzseek(outgz->gz_fd, cnt, SEEK_CUR);
+	ret = gz_stream_init(&outgz->strm);
 	if (ret < 0) {
-		error_errno("gzseek");
-		return -1;
+		return ret;
 	}
+	outgz->strm_init = true;
+
+	outgz->njobs = 2;
+#ifndef USE_MINGW
+	if (threads > 1) {
+		outgz->njobs = 2 * threads;
+		pthread_mutex_init(&outgz->lock, NULL);
+		pthread_cond_init(&outgz->queued_cond, NULL);
+		pthread_cond_init(&outgz->done_cond, NULL);
+		for (i = 0; i < threads; i++) {
+			if (pthread_create(&outgz->workers[i], NULL, gz_worker, outgz)) {
+				break;
+			}
+			outgz->nworkers++;
+		}
+	}
+#endif
+
 	return 0;
 }
 
-static int gz_file_pad(struct output_file *out, int64_t len)
+static int gz_write_oldest(struct output_file_gz *outgz)
 {
-	off64_t ret;
-	struct output_file_gz *outgz = to_output_file_gz(out);
+	struct gz_job *job = outgz->jobs[outgz->written % outgz->njobs];
+	unsigned char *ptr;
+	unsigned int len;
+	int ret;
 
-	ret = gztell(outgz->gz_fd);
-	if (ret < 0) {
+#ifndef USE_MINGW
+	if (outgz->nworkers) {
+		pthread_mutex_lock(&outgz->lock);
+		while (job->state != GZ_JOB_DONE) {
+			pthread_cond_wait(&outgz->done_cond, &outgz->lock);
+		}
+		pthread_mutex_unlock(&outgz->lock);
+	}
+#endif
+
+	job->state = GZ_JOB_FREE;
+	outgz->written++;
+
+	if (job->ret < 0) {
+		error("deflate failed");
 		return -1;
 	}
 
-	if (ret >= len) {
-		return 0;
+	for (ptr = job->out, len = job->out_len; len; ptr += ret, len -= ret) {
+		ret = write(outgz->fd, ptr, len);
+		if (ret < 0) {
+			error_errno("write");
+			return -1;
+		}
 	}
 
-	ret = gzseek(outgz->gz_fd, len - 1, SEEK_SET);
-	if (ret < 0) {
-		return -1;
+	outgz->crc = sparse_crc32_combine(outgz->crc, job->crc, job->in_len);
+	outgz->isize += job->in_len;
+
+	return 0;
+}
+
+/* Hands the block being filled to a worker, and starts filling the next */
+static int gz_flush(struct output_file_gz *outgz, bool last)
+{
+	struct gz_job *job;
+	struct gz_job *prev;
+	int ret;
+
+	if (!outgz->njobs) {
+		ret = gz_start(outgz);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	job = gz_job_get(outgz, outgz->submitted);
+	job->last = last;
+	job->dict_len = 0;
+	if (outgz->submitted > 0) {
+		prev = outgz->jobs[(outgz->submitted - 1) % outgz->njobs];
+		job->dict_len = min(prev->in_len, GZ_DICT_SIZE);
+		memcpy(job->dict, prev->in + prev->in_len - job->dict_len,
+				job->dict_len);
+	}
+
+#ifndef USE_MINGW
+	if (outgz->nworkers) {
+		pthread_mutex_lock(&outgz->lock);
+		job->state = GZ_JOB_QUEUED;
+		outgz->submitted++;
+		pthread_cond_signal(&outgz->queued_cond);
+		pthread_mutex_unlock(&outgz->lock);
+	} else
+#endif
+	{
+		gz_job_compress(job, &outgz->strm);
+		job->state = GZ_JOB_DONE;
+		outgz->submitted++;
+	}
+
+	while (outgz->submitted - outgz->written >= outgz->njobs ||
+			(last && outgz->written != outgz->submitted)) {
+		ret = gz_write_oldest(outgz);
+		if (ret < 0) {
+			return ret;
+		}
 	}
 
-	gzwrite(outgz->gz_fd, "", 1);
+	if (!last) {
+		job = gz_job_get(outgz, outgz->submitted);
+		if (!job) {
+			error_errno("malloc gz job");
+			return -ENOMEM;
+		}
+		job->in_len = 0;
+	}
 
 	return 0;
 }
 
-static int gz_file_write(struct output_file *out, void *data, int len)
+static int gz_file_open(struct output_file *out, int fd)
 {
+	struct output_file_gz *outgz = to_output_file_gz(out);
+	unsigned char header[10] = {
+		0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0,
+		2, /* maximum compression */
+		3, /* unix */
+	};
 	int ret;
+
+	outgz->fd = fd;
+	if (!gz_job_get(outgz, 0)) {
+		error_errno("malloc gz job");
+		return -ENOMEM;
+	}
+
+	ret = write(fd, header, sizeof(header));
+	if (ret < (int)sizeof(header)) {
+		error_errno("write");
+		return -errno;
+	}
+
+	return 0;
+}
+
+static int gz_file_write(struct output_file *out, void *data, int len)
+{
 	struct output_file_gz *outgz = to_output_file_gz(out);
+	struct gz_job *job;
+	unsigned int chunk;
+	char *ptr = data;
 
-	ret = gzwrite(outgz->gz_fd, data, len);
-	if (ret < 0) {
-		error_errno("gzwrite");
-		return -1;
-	} else if (ret < len) {
-		error("incomplete gzwrite");
+	if (outgz->err) {
 		return -1;
 	}
 
+	while (len > 0) {
+		job = outgz->jobs[outgz->njobs ? outgz->submitted % outgz->njobs : 0];
+		chunk = min((unsigned int)len, GZ_BLOCK_SIZE - job->in_len);
+		memcpy(job->in + job->in_len, ptr, chunk);
+		job->in_len += chunk;
+		ptr += chunk;
+		len -= chunk;
+		outgz->pos += chunk;
+
+		if (job->in_len == GZ_BLOCK_SIZE && gz_flush(outgz, false) < 0) {
+			outgz->err = -1;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int gz_file_write_zeros(struct output_file *out, int64_t cnt)
+{
+	int ret;
+	int chunk;
+
+	while (cnt > 0) {
+		chunk = min(cnt, (int64_t)out->block_size);
+		ret = gz_file_write(out, out->zero_buf, chunk);
+		if (ret < 0) {
+			return ret;
+		}
+		cnt -= chunk;
+	}
+
 	return 0;
 }
 
-static void gz_file_close(struct output_file *out)
+static int gz_file_skip(struct output_file *out, int64_t cnt)
+{
+	/* a gzip stream can't have holes, skipped data is compressed zeros */
+	return gz_file_write_zeros(out, cnt);
+}
+
+static int gz_file_pad(struct output_file *out, int64_t len)
+{
+	struct output_file_gz *outgz = to_output_file_gz(out);
+
+	if (outgz->pos >= len) {
+		return 0;
+	}
+
+	return gz_file_write_zeros(out, len - outgz->pos);
+}
+
+static int gz_file_close(struct output_file *out)
 {
 	struct output_file_gz *outgz = to_output_file_gz(out);
+	unsigned char trailer[8];
+	unsigned int i;
+	int ret = -1;
+
+	if (!outgz->err && gz_flush(outgz, true) == 0) {
+		for (i = 0; i < 4; i++) {
+			trailer[i] = outgz->crc >> (8 * i);
+			trailer[i + 4] = outgz->isize >> (8 * i);
+		}
+		if (write(outgz->fd, trailer, sizeof(trailer)) != sizeof(trailer)) {
+			error_errno("write");
+		} else {
+			ret = 0;
+		}
+	}
 
-	gzclose(outgz->gz_fd);
+#ifndef USE_MINGW
+	if (outgz->nworkers) {
+		/* workers drain any queued jobs before they see quit */
+		pthread_mutex_lock(&outgz->lock);
+		outgz->quit = true;
+		pthread_cond_broadcast(&outgz->queued_cond);
+		pthread_mutex_unlock(&outgz->lock);
+		for (i = 0; i < outgz->nworkers; i++) {
+			pthread_join(outgz->workers[i], NULL);
+		}
+		pthread_mutex_destroy(&outgz->lock);
+		pthread_cond_destroy(&outgz->queued_cond);
+		pthread_cond_destroy(&outgz->done_cond);
+	}
+#endif
+
+	if (outgz->strm_init) {
+		deflateEnd(&outgz->strm);
+	}
+	for (i = 0; i < GZ_MAX_JOBS; i++) {
+		if (outgz->jobs[i]) {
+			free(outgz->jobs[i]->out);
+			free(outgz->jobs[i]);
+		}
+	}
+
+	if (close(outgz->fd) < 0) {
+		error_errno("close");
+		ret = -1;
+	}
 	free(outgz);
+
+	return ret;
 }
 
 static struct output_file_ops gz_file_ops = {
@@ -308,11 +829,13 @@ static int callback_file_write(struct output_file *out, void *data, int len)
 	return outc->write(outc->priv, data, len);
 }
 
-static void callback_file_close(struct output_file *out)
+static int callback_file_close(struct output_file *out)
 {
 	struct output_file_callback *outc = to_output_file_callback(out);
 
 	free(outc);
+
+	return 0;
 }
 
 static struct output_file_ops callback_file_ops = {
@@ -365,6 +888,10 @@ static int write_sparse_skip_chunk(struct output_file *out, int64_t skip_len)
 	if (ret < 0)
 		return -1;
 
+	/* The reader checksums skipped blocks as zeros */
+	if (out->use_crc)
+		out->crc32 = sparse_crc32_zeros(out->crc32, skip_len);
+
 	out->cur_out_ptr += skip_len;
 	out->chunk_cnt++;
 
@@ -375,7 +902,7 @@ static int write_sparse_fill_chunk(struct output_file *out, unsigned int len,
 		uint32_t fill_val)
 {
 	chunk_header_t chunk_header;
-	int rnd_up_len, zero_len, count;
+	int rnd_up_len, zero_len;
 	int ret;
 	unsigned int i;
 
@@ -395,11 +922,8 @@ static int write_sparse_fill_chunk(struct output_file *out, unsigned int len,
 	if (ret < 0)
 		return -1;
 
-	if (out->use_crc) {
-		count = out->block_size / sizeof(uint32_t);
-		while (count--)
-			out->crc32 = sparse_crc32(out->crc32, &fill_val, sizeof(uint32_t));
-	}
+	if (out->use_crc)
+		out->crc32 = sparse_crc32_fill(out->crc32, fill_val, rnd_up_len);
 
 	out->cur_out_ptr += rnd_up_len;
 	out->chunk_cnt++;
@@ -407,8 +931,9 @@ static int write_sparse_fill_chunk(struct output_file *out, unsigned int len,
 	return 0;
 }
 
-static int write_sparse_data_chunk(struct output_file *out, unsigned int len,
-		void *data)
+/* Emits a raw chunk from either data or, if data is NULL, fd at offset */
+static int write_sparse_raw_chunk(struct output_file *out, unsigned int len,
+		void *data, int fd, int64_t offset)
 {
 	chunk_header_t chunk_header;
 	int rnd_up_len, zero_len;
@@ -427,7 +952,10 @@ static int write_sparse_data_chunk(struct output_file *out, unsigned int len,
 
 	if (ret < 0)
 		return -1;
-	ret = out->ops->write(out, data, len);
+	if (data)
+		ret = out->ops->write(out, data, len);
+	else
+		ret = out->ops->copy(out, fd, offset, len);
 	if (ret < 0)
 		return -1;
 	if (zero_len) {
@@ -437,9 +965,10 @@ static int write_sparse_data_chunk(struct output_file *out, unsigned int len,
 	}
 
 	if (out->use_crc) {
-		out->crc32 = sparse_crc32(out->crc32, data, len);
+		out->crc32 = sparse_crc32_parallel(out->crc32, data, len,
+				out->threads);
 		if (zero_len)
-			out->crc32 = sparse_crc32(out->crc32, out->zero_buf, zero_len);
+			out->crc32 = sparse_crc32_zeros(out->crc32, zero_len);
 	}
 
 	out->cur_out_ptr += rnd_up_len;
@@ -474,8 +1003,21 @@ int write_sparse_end_chunk(struct output_file *out)
 	return 0;
 }
 
+static int write_sparse_data_chunk(struct output_file *out, unsigned int len,
+		void *data)
+{
+	return write_sparse_raw_chunk(out, len, data, -1, 0);
+}
+
+static int write_sparse_fd_chunk(struct output_file *out, unsigned int len,
+		int fd, int64_t offset)
+{
+	return write_sparse_raw_chunk(out, len, NULL, fd, offset);
+}
+
 static struct sparse_file_ops sparse_file_ops = {
 		.write_data_chunk = write_sparse_data_chunk,
+		.write_fd_chunk = write_sparse_fd_chunk,
 		.write_fill_chunk = write_sparse_fill_chunk,
 		.write_skip_chunk = write_sparse_skip_chunk,
 		.write_end_chunk = write_sparse_end_chunk,
@@ -499,6 +1041,24 @@ static int write_normal_data_chunk(struct output_file *out, unsigned int len,
 	return ret;
 }
 
+static int write_normal_fd_chunk(struct output_file *out, unsigned int len,
+		int fd, int64_t offset)
+{
+	int ret;
+	unsigned int rnd_up_len = ALIGN(len, out->block_size);
+
+	ret = out->ops->copy(out, fd, offset, len);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (rnd_up_len > len) {
+		ret = out->ops->skip(out, rnd_up_len - len);
+	}
+
+	return ret;
+}
+
 static int write_normal_fill_chunk(struct output_file *out, unsigned int len,
 		uint32_t fill_val)
 {
@@ -536,17 +1096,28 @@ int write_normal_end_chunk(struct output_file *out)
 
 static struct sparse_file_ops normal_file_ops = {
 		.write_data_chunk = write_normal_data_chunk,
+		.write_fd_chunk = write_normal_fd_chunk,
 		.write_fill_chunk = write_normal_fill_chunk,
 		.write_skip_chunk = write_normal_skip_chunk,
 		.write_end_chunk = write_normal_end_chunk,
 };
 
-void output_file_close(struct output_file *out)
+void output_file_set_threads(struct output_file *out, unsigned int threads)
+{
+	out->threads = threads;
+}
+
+int output_file_close(struct output_file *out)
 {
 	int ret;
 
-	out->sparse_ops->write_end_chunk(out);
-	out->ops->close(out);
+	/* the end chunk and anything still buffered are written here */
+	ret = out->sparse_ops->write_end_chunk(out);
+	if (out->ops->close(out) < 0) {
+		ret = -1;
+	}
+
+	return ret;
 }
 
 static int output_file_init(struct output_file *out, int block_size,
@@ -560,6 +1131,7 @@ static int output_file_init(struct output_file *out, int block_size,
 	out->chunk_cnt = 0;
 	out->crc32 = 0;
 	out->use_crc = crc;
+	out->threads = 1;
 
 	out->zero_buf = calloc(block_size, 1);
 	if (!out->zero_buf) {
@@ -712,6 +1284,11 @@ int write_fd_chunk(struct output_file *out, unsigned int len,
 	int buffer_size;
 	char *ptr;
 
+	/* Without a crc to compute the data never needs to be in user space */
+	if (out->ops->copy && !out->use_crc) {
+		return out->sparse_ops->write_fd_chunk(out, len, fd, offset);
+	}
+
 	aligned_offset = offset & ~(4096 - 1);
 	aligned_diff = offset - aligned_offset;
 	buffer_size = len + aligned_diff;
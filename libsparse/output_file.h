@@ -34,7 +34,8 @@ int write_file_chunk(struct output_file *out, unsigned int len,
 int write_fd_chunk(struct output_file *out, unsigned int len,
 		int fd, int64_t offset);
 int write_skip_chunk(struct output_file *out, int64_t len);
-void output_file_close(struct output_file *out);
+void output_file_set_threads(struct output_file *out, unsigned int threads);
+int output_file_close(struct output_file *out);
 
 int read_all(int fd, void *buf, size_t len);
 
@@ -36,7 +36,9 @@
 
 void usage()
 {
-  fprintf(stderr, "Usage: simg2simg <sparse image file> <sparse_image_file> <max_size>\n");
+  fprintf(stderr, "Usage: simg2simg [-z] [-j <threads>] <sparse image file> <sparse_image_file> <max_size>\n");
+  fprintf(stderr, "  -z            gzip compress the output files\n");
+  fprintf(stderr, "  -j <threads>  number of threads to compress with (default: one per cpu)\n");
 }
 
 int main(int argc, char *argv[])
@@ -50,6 +52,25 @@ int main(int argc, char *argv[])
 	struct sparse_file **out_s;
 	int files;
 	char filename[4096];
+	bool gz = false;
+	unsigned int threads = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "zj:")) != -1) {
+		switch (opt) {
+		case 'z':
+			gz = true;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		default:
+			usage();
+			exit(-1);
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
 
 	if (argc != 4) {
 		usage();
@@ -101,7 +122,8 @@ int main(int argc, char *argv[])
 			exit(-1);
 		}
 
-		ret = sparse_file_write(out_s[i], out, false, true, false);
+		sparse_file_set_threads(out_s[i], threads);
+		ret = sparse_file_write(out_s[i], out, gz, true, false);
 		if (ret) {
 			fprintf(stderr, "Failed to write sparse file\n");
 			exit(-1);
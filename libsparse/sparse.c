@@ -16,6 +16,7 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <sparse/sparse.h>
 
@@ -100,26 +101,30 @@ unsigned int sparse_count_chunks(struct sparse_file *s)
 	return chunks;
 }
 
-static void sparse_file_write_block(struct output_file *out,
+static int sparse_file_write_block(struct output_file *out,
 		struct backed_block *bb)
 {
+	int ret = -EINVAL;
+
 	switch (backed_block_type(bb)) {
 	case BACKED_BLOCK_DATA:
-		write_data_chunk(out, backed_block_len(bb), backed_block_data(bb));
+		ret = write_data_chunk(out, backed_block_len(bb), backed_block_data(bb));
 		break;
 	case BACKED_BLOCK_FILE:
-		write_file_chunk(out, backed_block_len(bb),
+		ret = write_file_chunk(out, backed_block_len(bb),
 				backed_block_filename(bb), backed_block_file_offset(bb));
 		break;
 	case BACKED_BLOCK_FD:
-		write_fd_chunk(out, backed_block_len(bb),
+		ret = write_fd_chunk(out, backed_block_len(bb),
 				backed_block_fd(bb), backed_block_file_offset(bb));
 		break;
 	case BACKED_BLOCK_FILL:
-		write_fill_chunk(out, backed_block_len(bb),
+		ret = write_fill_chunk(out, backed_block_len(bb),
 				backed_block_fill_val(bb));
 		break;
 	}
+
+	return ret;
 }
 
 static int write_all_blocks(struct sparse_file *s, struct output_file *out)
@@ -127,14 +132,19 @@ static int write_all_blocks(struct sparse_file *s, struct output_file *out)
 	struct backed_block *bb;
 	unsigned int last_block = 0;
 	int64_t pad;
+	int ret = 0;
 
 	for (bb = backed_block_iter_new(s->backed_block_list); bb;
 			bb = backed_block_iter_next(bb)) {
 		if (backed_block_block(bb) > last_block) {
 			unsigned int blocks = backed_block_block(bb) - last_block;
-			write_skip_chunk(out, (int64_t)blocks * s->block_size);
+			ret = write_skip_chunk(out, (int64_t)blocks * s->block_size);
+			if (ret < 0)
+				return ret;
 		}
-		sparse_file_write_block(out, bb);
+		ret = sparse_file_write_block(out, bb);
+		if (ret < 0)
+			return ret;
 		last_block = backed_block_block(bb) +
 				DIV_ROUND_UP(backed_block_len(bb), s->block_size);
 	}
@@ -142,10 +152,10 @@ static int write_all_blocks(struct sparse_file *s, struct output_file *out)
 	pad = s->len - (int64_t)last_block * s->block_size;
 	assert(pad >= 0);
 	if (pad > 0) {
-		write_skip_chunk(out, pad);
+		ret = write_skip_chunk(out, pad);
 	}
 
-	return 0;
+	return ret < 0 ? ret : 0;
 }
 
 int sparse_file_write(struct sparse_file *s, int fd, bool gz, bool sparse,
@@ -161,9 +171,11 @@ int sparse_file_write(struct sparse_file *s, int fd, bool gz, bool sparse,
 	if (!out)
 		return -ENOMEM;
 
+	output_file_set_threads(out, sparse_file_get_threads(s));
 	ret = write_all_blocks(s, out);
 
-	output_file_close(out);
+	if (output_file_close(out) < 0 && !ret)
+		ret = -EIO;
 
 	return ret;
 }
@@ -182,9 +194,11 @@ int sparse_file_callback(struct sparse_file *s, bool sparse, bool crc,
 	if (!out)
 		return -ENOMEM;
 
+	output_file_set_threads(out, sparse_file_get_threads(s));
 	ret = write_all_blocks(s, out);
 
-	output_file_close(out);
+	if (output_file_close(out) < 0 && !ret)
+		ret = -EIO;
 
 	return ret;
 }
@@ -211,7 +225,8 @@ int64_t sparse_file_len(struct sparse_file *s, bool sparse, bool crc)
 
 	ret = write_all_blocks(s, out);
 
-	output_file_close(out);
+	if (output_file_close(out) < 0)
+		ret = -1;
 
 	if (ret < 0) {
 		return -1;
@@ -311,7 +326,51 @@ int sparse_file_resparse(struct sparse_file *in_s, unsigned int max_len,
 	return c;
 }
 
+int sparse_file_resparse_next(struct sparse_file *in_s, unsigned int max_len,
+		struct sparse_file **out_s)
+{
+	struct sparse_file *s;
+
+	*out_s = NULL;
+	if (!backed_block_iter_new(in_s->backed_block_list)) {
+		return 0;
+	}
+
+	s = sparse_file_new(in_s->block_size, in_s->len);
+	if (!s) {
+		return -ENOMEM;
+	}
+	s->threads = in_s->threads;
+
+	move_chunks_up_to_len(in_s, s, max_len);
+
+	*out_s = s;
+	return 1;
+}
+
 void sparse_file_verbose(struct sparse_file *s)
 {
 	s->verbose = true;
 }
+
+void sparse_file_set_threads(struct sparse_file *s, unsigned int threads)
+{
+	s->threads = threads;
+}
+
+unsigned int sparse_file_get_threads(struct sparse_file *s)
+{
+	long cpus;
+
+	if (s->threads) {
+		return s->threads;
+	}
+
+#ifdef _SC_NPROCESSORS_ONLN
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0) {
+		return cpus;
+	}
+#endif
+	return 1;
+}
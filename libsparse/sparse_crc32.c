@@ -43,7 +43,44 @@
  */
 
 /* Code taken from FreeBSD 8 */
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef USE_MINGW
+#include <pthread.h>
+#endif
+
+/*
+ * The accelerated paths are compiled with target attributes, so that they
+ * don't need -m flags, but the intrinsics headers of older compilers refuse
+ * to be included unless the instructions are enabled for the whole file.
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+#define CRC32_GCC_VERSION (__GNUC__ * 100 + __GNUC_MINOR__)
+#else
+#define CRC32_GCC_VERSION 0
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#if (defined(__PCLMUL__) && defined(__SSE4_1__)) || CRC32_GCC_VERSION >= 409
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#define CRC32_HAVE_PCLMUL
+#endif
+#elif defined(__aarch64__) && defined(__linux__)
+#if defined(__ARM_FEATURE_CRC32) || CRC32_GCC_VERSION >= 600
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC32_HAVE_ARMV8
+#endif
+#endif
+
+#include "sparse_crc32.h"
 
 static uint32_t crc32_tab[] = {
         0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
@@ -92,20 +129,363 @@ static uint32_t crc32_tab[] = {
 };
 
 /*
- * A function that calculates the CRC-32 based on the table above is
- * given below for documentation purposes. An equivalent implementation
- * of this function that's actually used in the kernel can be found
- * in sys/libkern.h, where it can be inlined.
+ * Everything below operates on the raw shift register value, i.e. without
+ * the ~0 pre and post conditioning applied by the public functions.
+ */
+
+#define CRC32_POLY 0xedb88320
+
+/* Tables for slicing-by-8, crc32_slice8_tab[0] is crc32_tab */
+static uint32_t crc32_slice8_tab[8][256];
+
+/* x2n_table[n] is x^(2^n) modulo the crc polynomial */
+static uint32_t x2n_table[32];
+
+static uint32_t (*crc32_update)(uint32_t crc, const uint8_t *p, size_t size);
+
+static uint32_t crc32_bytes(uint32_t crc, const uint8_t *p, size_t size)
+{
+	while (size--)
+		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *p, size_t size)
+{
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	const uint32_t (*t)[256] = (const uint32_t (*)[256])crc32_slice8_tab;
+
+	while (size && ((uintptr_t)p & 7)) {
+		crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+		size--;
+	}
+
+	while (size >= 8) {
+		uint32_t lo, hi;
+
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo ^= crc;
+		crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^
+				t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+				t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+				t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+		p += 8;
+		size -= 8;
+	}
+#endif
+
+	return crc32_bytes(crc, p, size);
+}
+
+#ifdef CRC32_HAVE_PCLMUL
+/*
+ * Carry-less multiplication folding, from "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction" (Intel, 2009).  Handles the
+ * largest multiple of 16 bytes, at least 64, and leaves the rest to
+ * crc32_slice8.
  */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *p, size_t size)
+{
+	static const uint64_t __attribute__((aligned(16))) k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+	static const uint64_t __attribute__((aligned(16))) k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+	static const uint64_t __attribute__((aligned(16))) k5k0[] = { 0x0163cd6124, 0x0000000000 };
+	static const uint64_t __attribute__((aligned(16))) poly[] = { 0x01db710641, 0x01f7011641 };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+	size_t len;
+
+	if (size < 64)
+		return crc32_slice8(crc, p, size);
+
+	len = size & ~(size_t)15;
+	size -= len;
+
+	x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	p += 64;
+	len -= 64;
+
+	/* fold 4 x 128 bits at a time */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+				_mm_loadu_si128((const __m128i *)(p + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+				_mm_loadu_si128((const __m128i *)(p + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+				_mm_loadu_si128((const __m128i *)(p + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+				_mm_loadu_si128((const __m128i *)(p + 0x30)));
+		p += 64;
+		len -= 64;
+	}
+
+	/* fold down to 128 bits */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)p);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		p += 16;
+		len -= 16;
+	}
 
-uint32_t sparse_crc32(uint32_t crc_in, const void *buf, int size)
+	/* fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	crc = _mm_extract_epi32(x1, 1);
+
+	return crc32_slice8(crc, p, size);
+}
+#endif
+
+#ifdef CRC32_HAVE_ARMV8
+__attribute__((target("+crc")))
+static uint32_t crc32_armv8(uint32_t crc, const uint8_t *p, size_t size)
 {
-        const uint8_t *p = buf;
-        uint32_t crc;
+	while (size && ((uintptr_t)p & 7)) {
+		crc = __crc32b(crc, *p++);
+		size--;
+	}
 
-        crc = crc_in ^ ~0U;
-        while (size--)
-                crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
-        return crc ^ ~0U;
+	while (size >= 8) {
+		uint64_t v;
+
+		memcpy(&v, p, 8);
+		crc = __crc32d(crc, v);
+		p += 8;
+		size -= 8;
+	}
+
+	while (size--)
+		crc = __crc32b(crc, *p++);
+
+	return crc;
 }
+#endif
+
+/* returns a * b modulo the crc polynomial */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = (uint32_t)1 << 31;
+	uint32_t p = 0;
 
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ CRC32_POLY : b >> 1;
+	}
+
+	return p;
+}
+
+/* returns x^(n * 2^k) modulo the crc polynomial */
+static uint32_t x2nmodp(uint64_t n, unsigned int k)
+{
+	uint32_t p = (uint32_t)1 << 31; /* x^0 == 1 */
+
+	while (n) {
+		if (n & 1)
+			p = multmodp(x2n_table[k & 31], p);
+		n >>= 1;
+		k++;
+	}
+
+	return p;
+}
+
+static void crc32_init(void)
+{
+	unsigned int i, k;
+	uint32_t p;
+
+	for (i = 0; i < 256; i++) {
+		crc32_slice8_tab[0][i] = crc32_tab[i];
+	}
+	for (k = 1; k < 8; k++) {
+		for (i = 0; i < 256; i++) {
+			uint32_t c = crc32_slice8_tab[k - 1][i];
+			crc32_slice8_tab[k][i] = (c >> 8) ^ crc32_tab[c & 0xFF];
+		}
+	}
+
+	p = (uint32_t)1 << 30; /* x^1 */
+	x2n_table[0] = p;
+	for (i = 1; i < 32; i++)
+		x2n_table[i] = p = multmodp(p, p);
+
+	crc32_update = crc32_slice8;
+
+#ifdef CRC32_HAVE_PCLMUL
+	{
+		unsigned int eax, ebx, ecx, edx;
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+				(ecx & bit_PCLMUL) && (ecx & bit_SSE4_1)) {
+			crc32_update = crc32_pclmul;
+		}
+	}
+#endif
+#ifdef CRC32_HAVE_ARMV8
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+		crc32_update = crc32_armv8;
+	}
+#endif
+}
+
+#ifndef USE_MINGW
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+#define crc32_ensure_init() pthread_once(&crc32_once, crc32_init)
+#else
+static int crc32_inited;
+#define crc32_ensure_init() \
+	do { if (!crc32_inited) { crc32_init(); crc32_inited = 1; } } while (0)
+#endif
+
+uint32_t sparse_crc32(uint32_t crc_in, const void *buf, size_t size)
+{
+	crc32_ensure_init();
+	return crc32_update(crc_in ^ ~0U, buf, size) ^ ~0U;
+}
+
+uint32_t sparse_crc32_combine(uint32_t crc1, uint32_t crc2, int64_t len2)
+{
+	crc32_ensure_init();
+	return multmodp(x2nmodp(len2, 3), crc1) ^ crc2;
+}
+
+uint32_t sparse_crc32_zeros(uint32_t crc_in, int64_t len)
+{
+	crc32_ensure_init();
+	/* zero bytes only shift the register, i.e. multiply it by x^(8 * len) */
+	return multmodp(x2nmodp(len, 3), crc_in ^ ~0U) ^ ~0U;
+}
+
+uint32_t sparse_crc32_fill(uint32_t crc_in, uint32_t fill_val, int64_t len)
+{
+	uint32_t pattern_crc;
+	int64_t pattern_len = sizeof(fill_val);
+	int64_t n = len / sizeof(fill_val);
+
+	/* square-and-multiply over the crc of the repeated pattern */
+	pattern_crc = sparse_crc32(0, &fill_val, sizeof(fill_val));
+	while (n) {
+		if (n & 1)
+			crc_in = sparse_crc32_combine(crc_in, pattern_crc, pattern_len);
+		n >>= 1;
+		if (n) {
+			pattern_crc = sparse_crc32_combine(pattern_crc, pattern_crc,
+					pattern_len);
+			pattern_len *= 2;
+		}
+	}
+
+	return sparse_crc32(crc_in, &fill_val, len % sizeof(fill_val));
+}
+
+/* Don't bother splitting buffers into pieces smaller than this */
+#define CRC32_MIN_PIECE (1024 * 1024)
+#define CRC32_MAX_THREADS 32
+
+struct crc32_piece {
+	const uint8_t *buf;
+	size_t size;
+	uint32_t crc;
+};
+
+static void *crc32_piece_thread(void *priv)
+{
+	struct crc32_piece *piece = priv;
+
+	piece->crc = sparse_crc32(0, piece->buf, piece->size);
+	return NULL;
+}
+
+uint32_t sparse_crc32_parallel(uint32_t crc_in, const void *buf, size_t size,
+		unsigned int threads)
+{
+#ifndef USE_MINGW
+	struct crc32_piece pieces[CRC32_MAX_THREADS];
+	pthread_t tids[CRC32_MAX_THREADS];
+	bool started[CRC32_MAX_THREADS];
+	size_t piece_size;
+	unsigned int i;
+
+	if (threads > CRC32_MAX_THREADS)
+		threads = CRC32_MAX_THREADS;
+	if (threads > size / CRC32_MIN_PIECE)
+		threads = size / CRC32_MIN_PIECE;
+	if (threads <= 1)
+		return sparse_crc32(crc_in, buf, size);
+
+	piece_size = (size + threads - 1) / threads;
+	for (i = 0; i < threads; i++) {
+		size_t off = (size_t)i * piece_size;
+		pieces[i].buf = (const uint8_t *)buf + off;
+		pieces[i].size = off < size ? size - off : 0;
+		if (pieces[i].size > piece_size)
+			pieces[i].size = piece_size;
+		/* the first piece is done on this thread */
+		started[i] = i > 0 &&
+				pthread_create(&tids[i], NULL, crc32_piece_thread, &pieces[i]) == 0;
+	}
+
+	for (i = 0; i < threads; i++) {
+		if (started[i])
+			pthread_join(tids[i], NULL);
+		else
+			crc32_piece_thread(&pieces[i]);
+		crc_in = sparse_crc32_combine(crc_in, pieces[i].crc, pieces[i].size);
+	}
+
+	return crc_in;
+#else
+	return sparse_crc32(crc_in, buf, size);
+#endif
+}
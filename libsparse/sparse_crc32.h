@@ -14,7 +14,27 @@
  * limitations under the License.
  */
 
+#ifndef _LIBSPARSE_SPARSE_CRC32_H_
+#define _LIBSPARSE_SPARSE_CRC32_H_
+
+#include <stddef.h>
 #include <stdint.h>
 
+/* crc of size bytes of buf, continuing from crc (0 to start) */
 uint32_t sparse_crc32(uint32_t crc, const void *buf, size_t size);
 
+/* crc of the concatenation of two buffers, given each one's crc and the
+ * length of the second one */
+uint32_t sparse_crc32_combine(uint32_t crc1, uint32_t crc2, int64_t len2);
+
+/* crc continued over len zero bytes, or over len bytes of a repeated 32 bit
+ * fill value, in time logarithmic in len */
+uint32_t sparse_crc32_zeros(uint32_t crc, int64_t len);
+uint32_t sparse_crc32_fill(uint32_t crc, uint32_t fill_val, int64_t len);
+
+/* sparse_crc32 split over up to threads threads */
+uint32_t sparse_crc32_parallel(uint32_t crc, const void *buf, size_t size,
+		unsigned int threads);
+
+#endif
+
@@ -23,10 +23,12 @@ struct sparse_file {
 	unsigned int block_size;
 	int64_t len;
 	bool verbose;
+	unsigned int threads;
 
 	struct backed_block_list *backed_block_list;
 	struct output_file *out;
 };
 
+unsigned int sparse_file_get_threads(struct sparse_file *s);
 
 #endif /* _LIBSPARSE_SPARSE_FILE_H_ */
@@ -19,6 +19,7 @@
 #define _LARGEFILE64_SOURCE 1
 
 #include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -27,9 +28,21 @@
 #include <string.h>
 #include <unistd.h>
 
+#ifndef USE_MINGW
+#include <pthread.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #include <sparse/sparse.h>
 
+#include "output_file.h"
 #include "sparse_crc32.h"
+#include "sparse_defs.h"
 #include "sparse_file.h"
 #include "sparse_format.h"
 
@@ -45,6 +58,9 @@
 #define COPY_BUF_SIZE (1024U*1024U)
 static char *copybuf;
 
+/* Bytes of a normal file read and scanned per pipeline stage */
+#define READ_CHUNK_SIZE (16U*1024U*1024U)
+
 #define min(a, b) \
 	({ typeof(a) _a = (a); typeof(b) _b = (b); (_a < _b) ? _a : _b; })
 
@@ -137,11 +153,8 @@ static int process_fill_chunk(struct sparse_file *s, unsigned int chunk_size,
 		int fd, unsigned int blocks, unsigned int block, uint32_t *crc32)
 {
 	int ret;
-	int chunk;
 	int64_t len = (int64_t)blocks * s->block_size;
 	uint32_t fill_val;
-	uint32_t *fillbuf;
-	unsigned int i;
 
 	if (chunk_size != sizeof(fill_val)) {
 		return -EINVAL;
@@ -158,17 +171,7 @@ static int process_fill_chunk(struct sparse_file *s, unsigned int chunk_size,
 	}
 
 	if (crc32) {
-		/* Fill copy_buf with the fill value */
-		fillbuf = (uint32_t *)copybuf;
-		for (i = 0; i < (COPY_BUF_SIZE / sizeof(fill_val)); i++) {
-			fillbuf[i] = fill_val;
-		}
-
-		while (len) {
-			chunk = min(len, COPY_BUF_SIZE);
-			*crc32 = sparse_crc32(*crc32, copybuf, chunk);
-			len -= chunk;
-		}
+		*crc32 = sparse_crc32_fill(*crc32, fill_val, len);
 	}
 
 	return 0;
@@ -177,25 +180,14 @@ static int process_fill_chunk(struct sparse_file *s, unsigned int chunk_size,
 static int process_skip_chunk(struct sparse_file *s, unsigned int chunk_size,
 		int fd, unsigned int blocks, unsigned int block, uint32_t *crc32)
 {
-	int ret;
-	int chunk;
 	int64_t len = (int64_t)blocks * s->block_size;
-	uint32_t fill_val;
-	uint32_t *fillbuf;
-	unsigned int i;
 
 	if (chunk_size != 0) {
 		return -EINVAL;
 	}
 
 	if (crc32) {
-		memset(copybuf, 0, COPY_BUF_SIZE);
-
-		while (len) {
-			chunk = min(len, COPY_BUF_SIZE);
-			*crc32 = sparse_crc32(*crc32, copybuf, chunk);
-			len -= chunk;
-		}
+		*crc32 = sparse_crc32_zeros(*crc32, len);
 	}
 
 	return 0;
@@ -274,6 +266,31 @@ static int process_chunk(struct sparse_file *s, int fd, off64_t offset,
 	return 0;
 }
 
+static int check_sparse_header(const sparse_header_t *sparse_header)
+{
+	if (sparse_header->magic != SPARSE_HEADER_MAGIC) {
+		return -EINVAL;
+	}
+
+	if (sparse_header->major_version != SPARSE_HEADER_MAJOR_VER) {
+		return -EINVAL;
+	}
+
+	if (sparse_header->file_hdr_sz < SPARSE_HEADER_LEN) {
+		return -EINVAL;
+	}
+
+	if (sparse_header->chunk_hdr_sz < CHUNK_HEADER_LEN) {
+		return -EINVAL;
+	}
+
+	if (sparse_header->blk_sz == 0 || sparse_header->blk_sz % 4 != 0) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 static int sparse_file_read_sparse(struct sparse_file *s, int fd, bool crc)
 {
 	int ret;
@@ -302,20 +319,9 @@ static int sparse_file_read_sparse(struct sparse_file *s, int fd, bool crc)
 		return ret;
 	}
 
-	if (sparse_header.magic != SPARSE_HEADER_MAGIC) {
-		return -EINVAL;
-	}
-
-	if (sparse_header.major_version != SPARSE_HEADER_MAJOR_VER) {
-		return -EINVAL;
-	}
-
-	if (sparse_header.file_hdr_sz < SPARSE_HEADER_LEN) {
-		return -EINVAL;
-	}
-
-	if (sparse_header.chunk_hdr_sz < sizeof(chunk_header)) {
-		return -EINVAL;
+	ret = check_sparse_header(&sparse_header);
+	if (ret < 0) {
+		return ret;
 	}
 
 	if (sparse_header.file_hdr_sz > SPARSE_HEADER_LEN) {
@@ -356,67 +362,322 @@ static int sparse_file_read_sparse(struct sparse_file *s, int fd, bool crc)
 	return 0;
 }
 
-static int sparse_file_read_normal(struct sparse_file *s, int fd)
+/* Returns true if every 32 bit word of buf equals buf[0] */
+static bool block_is_fill(const uint32_t *buf, unsigned int words)
 {
+	unsigned int i = 0;
+
+#if defined(__SSE2__)
+	const __m128i val = _mm_set1_epi32(buf[0]);
+	const __m128i zero = _mm_setzero_si128();
+
+	/* 64 bytes per iteration, bailing out on the first mismatch */
+	for (; i + 16 <= words; i += 16) {
+		const __m128i *p = (const __m128i *)(buf + i);
+		__m128i diff = _mm_or_si128(
+				_mm_or_si128(_mm_xor_si128(_mm_loadu_si128(p), val),
+						_mm_xor_si128(_mm_loadu_si128(p + 1), val)),
+				_mm_or_si128(_mm_xor_si128(_mm_loadu_si128(p + 2), val),
+						_mm_xor_si128(_mm_loadu_si128(p + 3), val)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero)) != 0xffff) {
+			return false;
+		}
+	}
+#elif defined(__ARM_NEON__) || defined(__aarch64__)
+	const uint32x4_t val = vdupq_n_u32(buf[0]);
+
+	for (; i + 16 <= words; i += 16) {
+		uint32x4_t diff = vorrq_u32(
+				vorrq_u32(veorq_u32(vld1q_u32(buf + i), val),
+						veorq_u32(vld1q_u32(buf + i + 4), val)),
+				vorrq_u32(veorq_u32(vld1q_u32(buf + i + 8), val),
+						veorq_u32(vld1q_u32(buf + i + 12), val)));
+		uint32x2_t r = vorr_u32(vget_low_u32(diff), vget_high_u32(diff));
+		if (vget_lane_u32(r, 0) | vget_lane_u32(r, 1)) {
+			return false;
+		}
+	}
+#endif
+
+	for (; i < words; i++) {
+		if (buf[0] != buf[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+struct scan_job {
+	const char *buf;
+	unsigned int block_size;
+	unsigned int first;
+	unsigned int count;
+	bool *is_fill;
+};
+
+static void *scan_blocks(void *priv)
+{
+	struct scan_job *job = priv;
+	unsigned int i;
+
+	for (i = job->first; i < job->first + job->count; i++) {
+		job->is_fill[i] = block_is_fill(
+				(const uint32_t *)(job->buf + (size_t)i * job->block_size),
+				job->block_size / sizeof(uint32_t));
+	}
+
+	return NULL;
+}
+
+#define MAX_SCAN_THREADS 32
+
+/*
+ * Classifies the full blocks of one chunk, spread across the worker threads.
+ * scan_start returns without waiting when it could hand the work to threads,
+ * so that the next chunk can be read in the meantime; scan_finish waits for
+ * them.
+ */
+struct scan_state {
+	struct scan_job jobs[MAX_SCAN_THREADS];
+#ifndef USE_MINGW
+	pthread_t threads[MAX_SCAN_THREADS];
+#endif
+	unsigned int nthreads;
+};
+
+static void scan_start(struct scan_state *st, unsigned int threads,
+		const char *buf, unsigned int block_size, unsigned int blocks,
+		bool *is_fill)
+{
+	unsigned int per_thread;
+	unsigned int i;
+
+	if (threads > MAX_SCAN_THREADS) {
+		threads = MAX_SCAN_THREADS;
+	}
+	if (threads > blocks) {
+		threads = blocks;
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+	per_thread = DIV_ROUND_UP(blocks, threads);
+
+	st->nthreads = 0;
+	for (i = 0; i < threads; i++) {
+		struct scan_job *job = &st->jobs[i];
+		job->buf = buf;
+		job->block_size = block_size;
+		job->first = min(i * per_thread, blocks);
+		job->count = min(per_thread, blocks - job->first);
+		job->is_fill = is_fill;
+#ifndef USE_MINGW
+		if (threads > 1 &&
+				pthread_create(&st->threads[i], NULL, scan_blocks, job) == 0) {
+			st->nthreads++;
+			continue;
+		}
+#endif
+		scan_blocks(job);
+	}
+}
+
+static void scan_finish(struct scan_state *st)
+{
+#ifndef USE_MINGW
+	unsigned int i;
+
+	for (i = 0; i < st->nthreads; i++) {
+		pthread_join(st->threads[i], NULL);
+	}
+#endif
+	st->nthreads = 0;
+}
+
+enum run_type {
+	RUN_NONE,
+	RUN_DATA,
+	RUN_FILL,
+	RUN_SKIP,
+};
+
+/* A run of consecutive blocks that will become a single backed block */
+struct run {
+	enum run_type type;
+	uint32_t fill_val;
+	unsigned int block;
+	int64_t offset;
+	unsigned int len;
+};
+
+static int flush_run(struct sparse_file *s, int fd, struct run *run)
+{
+	int ret = 0;
+
+	switch (run->type) {
+	case RUN_DATA:
+		ret = sparse_file_add_fd(s, fd, run->offset, run->len, run->block);
+		break;
+	case RUN_FILL:
+		ret = sparse_file_add_fill(s, run->fill_val, run->len, run->block);
+		break;
+	case RUN_NONE:
+	case RUN_SKIP:
+		break;
+	}
+
+	run->type = RUN_NONE;
+	return ret;
+}
+
+/* Appends len bytes at block/offset to the current run, or starts a new one */
+static int add_to_run(struct sparse_file *s, int fd, struct run *run,
+		enum run_type type, uint32_t fill_val, unsigned int block,
+		int64_t offset, unsigned int len)
+{
+	unsigned int max_len = (UINT_MAX / s->block_size) * s->block_size;
 	int ret;
-	uint32_t *buf = malloc(s->block_size);
+
+	if (run->type == type && (type != RUN_FILL || run->fill_val == fill_val)
+			&& run->len <= max_len - len) {
+		run->len += len;
+		return 0;
+	}
+
+	ret = flush_run(s, fd, run);
+	if (ret < 0) {
+		return ret;
+	}
+
+	run->type = type;
+	run->fill_val = fill_val;
+	run->block = block;
+	run->offset = offset;
+	run->len = len;
+	return 0;
+}
+
+static int sparse_file_read_normal(struct sparse_file *s, int fd,
+		enum sparse_read_mode mode)
+{
+	int ret = 0;
+	unsigned int chunk_size;
+	unsigned int chunk_blocks;
+	char *bufs[2] = { NULL, NULL };
+	bool *is_fill = NULL;
+	struct scan_state st;
+	struct run run = { RUN_NONE, 0, 0, 0, 0 };
 	unsigned int block = 0;
 	int64_t remain = s->len;
 	int64_t offset = 0;
 	unsigned int to_read;
-	char *ptr;
+	unsigned int next_read;
+	unsigned int full_blocks;
 	unsigned int i;
-	bool sparse_block;
+	int cur = 0;
 
-	if (!buf) {
-		return -ENOMEM;
+	chunk_size = READ_CHUNK_SIZE - READ_CHUNK_SIZE % s->block_size;
+	if (chunk_size == 0) {
+		chunk_size = s->block_size;
+	}
+	chunk_blocks = chunk_size / s->block_size;
+
+	bufs[0] = malloc(chunk_size);
+	bufs[1] = malloc(chunk_size);
+	is_fill = malloc(chunk_blocks * sizeof(bool));
+	if (!bufs[0] || !bufs[1] || !is_fill) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	to_read = min(remain, chunk_size);
+	ret = read_all(fd, bufs[cur], to_read);
+	if (ret < 0) {
+		error("failed to read sparse file");
+		goto out;
 	}
 
 	while (remain > 0) {
-		to_read = min(remain, s->block_size);
-		ret = read_all(fd, buf, to_read);
+		/* a trailing partial block is always stored as data */
+		full_blocks = to_read / s->block_size;
+
+		scan_start(&st, sparse_file_get_threads(s), bufs[cur], s->block_size,
+				full_blocks, is_fill);
+
+		/* read the next chunk while the current one is being scanned */
+		next_read = min(remain - to_read, chunk_size);
+		if (next_read > 0) {
+			ret = read_all(fd, bufs[!cur], next_read);
+		}
+
+		scan_finish(&st);
+
 		if (ret < 0) {
 			error("failed to read sparse file");
-			return ret;
+			goto out;
 		}
 
-		if (to_read == s->block_size) {
-			sparse_block = true;
-			for (i = 1; i < s->block_size / sizeof(uint32_t); i++) {
-				if (buf[0] != buf[i]) {
-					sparse_block = false;
-					break;
-				}
+		for (i = 0; i < full_blocks; i++) {
+			uint32_t fill_val = *(uint32_t *)(bufs[cur] + (size_t)i * s->block_size);
+			enum run_type type;
+
+			if (!is_fill[i]) {
+				type = RUN_DATA;
+			} else if (fill_val == 0 && mode == SPARSE_READ_MODE_HOLE) {
+				type = RUN_SKIP;
+			} else {
+				type = RUN_FILL;
 			}
-		} else {
-			sparse_block = false;
+
+			ret = add_to_run(s, fd, &run, type, fill_val, block, offset,
+					s->block_size);
+			if (ret < 0) {
+				goto out;
+			}
+			block++;
+			offset += s->block_size;
 		}
 
-		if (sparse_block) {
-			/* TODO: add flag to use skip instead of fill for buf[0] == 0 */
-			sparse_file_add_fill(s, buf[0], to_read, block);
-		} else {
-			sparse_file_add_fd(s, fd, offset, to_read, block);
+		if (to_read % s->block_size) {
+			ret = add_to_run(s, fd, &run, RUN_DATA, 0, block, offset,
+					to_read % s->block_size);
+			if (ret < 0) {
+				goto out;
+			}
+			block++;
+			offset += to_read % s->block_size;
 		}
 
 		remain -= to_read;
-		offset += to_read;
-		block++;
+		to_read = next_read;
+		cur = !cur;
 	}
 
-	return 0;
+	ret = flush_run(s, fd, &run);
+
+out:
+	free(bufs[0]);
+	free(bufs[1]);
+	free(is_fill);
+	return ret < 0 ? ret : 0;
 }
 
-int sparse_file_read(struct sparse_file *s, int fd, bool sparse, bool crc)
+int sparse_file_read(struct sparse_file *s, int fd, enum sparse_read_mode mode,
+		bool crc)
 {
-	if (crc && !sparse) {
+	if (crc && mode != SPARSE_READ_MODE_SPARSE) {
 		return -EINVAL;
 	}
 
-	if (sparse) {
+	switch (mode) {
+	case SPARSE_READ_MODE_SPARSE:
 		return sparse_file_read_sparse(s, fd, crc);
-	} else {
-		return sparse_file_read_normal(s, fd);
+	case SPARSE_READ_MODE_NORMAL:
+	case SPARSE_READ_MODE_HOLE:
+		return sparse_file_read_normal(s, fd, mode);
+	default:
+		return -EINVAL;
 	}
 }
 
@@ -467,7 +728,7 @@ struct sparse_file *sparse_file_import(int fd, bool verbose, bool crc)
 
 	s->verbose = verbose;
 
-	ret = sparse_file_read(s, fd, true, crc);
+	ret = sparse_file_read(s, fd, SPARSE_READ_MODE_SPARSE, crc);
 	if (ret < 0) {
 		sparse_file_destroy(s);
 		return NULL;
@@ -499,7 +760,7 @@ struct sparse_file *sparse_file_import_auto(int fd, bool crc)
 		return NULL;
 	}
 
-	ret = sparse_file_read_normal(s, fd);
+	ret = sparse_file_read_normal(s, fd, SPARSE_READ_MODE_NORMAL);
 	if (ret < 0) {
 		sparse_file_destroy(s);
 		return NULL;
@@ -507,3 +768,206 @@ struct sparse_file *sparse_file_import_auto(int fd, bool crc)
 
 	return s;
 }
+
+/* Reads and drops len bytes of header padding from a stream */
+static int stream_skip(int (*read)(void *priv, void *data, int len),
+		void *priv, char *buf, unsigned int len)
+{
+	int ret;
+
+	while (len) {
+		unsigned int chunk = min(len, COPY_BUF_SIZE);
+		ret = read(priv, buf, chunk);
+		if (ret < 0) {
+			return ret;
+		}
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+static int stream_raw_chunk(int (*read)(void *priv, void *data, int len),
+		int (*write)(void *priv, int64_t off, const void *data, int len),
+		void *priv, char *buf, int64_t off, int64_t len, uint32_t *crc32)
+{
+	int ret;
+
+	while (len) {
+		unsigned int chunk = min(len, (int64_t)COPY_BUF_SIZE);
+		ret = read(priv, buf, chunk);
+		if (ret < 0) {
+			return ret;
+		}
+		if (crc32) {
+			*crc32 = sparse_crc32(*crc32, buf, chunk);
+		}
+		ret = write(priv, off, buf, chunk);
+		if (ret < 0) {
+			return ret;
+		}
+		off += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+static int stream_fill_chunk(
+		int (*write)(void *priv, int64_t off, const void *data, int len),
+		void *priv, char *buf, int64_t off, int64_t len, uint32_t fill_val,
+		uint32_t *crc32)
+{
+	uint32_t *fill_buf = (uint32_t *)buf;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < min(len, (int64_t)COPY_BUF_SIZE) / sizeof(uint32_t); i++) {
+		fill_buf[i] = fill_val;
+	}
+
+	if (crc32) {
+		*crc32 = sparse_crc32_fill(*crc32, fill_val, len);
+	}
+
+	while (len) {
+		unsigned int chunk = min(len, (int64_t)COPY_BUF_SIZE);
+		ret = write(priv, off, fill_buf, chunk);
+		if (ret < 0) {
+			return ret;
+		}
+		off += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+int sparse_stream_decode(int (*read)(void *priv, void *data, int len),
+		int (*write)(void *priv, int64_t off, const void *data, int len),
+		void *priv, bool crc, unsigned int *block_size)
+{
+	int ret;
+	unsigned int i;
+	sparse_header_t sparse_header;
+	chunk_header_t chunk_header;
+	uint32_t crc32 = 0;
+	uint32_t *crc_ptr = NULL;
+	uint32_t val;
+	unsigned int cur_block = 0;
+	unsigned int chunk_data_size;
+	int64_t off;
+	int64_t len;
+	char *buf;
+
+	if (crc) {
+		crc_ptr = &crc32;
+	}
+
+	ret = read(priv, &sparse_header, sizeof(sparse_header));
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = check_sparse_header(&sparse_header);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (block_size) {
+		*block_size = sparse_header.blk_sz;
+	}
+
+	buf = malloc(COPY_BUF_SIZE);
+	if (!buf) {
+		return -ENOMEM;
+	}
+
+	ret = stream_skip(read, priv, buf,
+			sparse_header.file_hdr_sz - SPARSE_HEADER_LEN);
+	if (ret < 0) {
+		goto out;
+	}
+
+	for (i = 0; i < sparse_header.total_chunks; i++) {
+		ret = read(priv, &chunk_header, sizeof(chunk_header));
+		if (ret < 0) {
+			goto out;
+		}
+
+		ret = stream_skip(read, priv, buf,
+				sparse_header.chunk_hdr_sz - CHUNK_HEADER_LEN);
+		if (ret < 0) {
+			goto out;
+		}
+
+		ret = -EINVAL;
+		if (chunk_header.total_sz < sparse_header.chunk_hdr_sz) {
+			goto out;
+		}
+
+		chunk_data_size = chunk_header.total_sz - sparse_header.chunk_hdr_sz;
+		off = (int64_t)cur_block * sparse_header.blk_sz;
+		len = (int64_t)chunk_header.chunk_sz * sparse_header.blk_sz;
+
+		switch (chunk_header.chunk_type) {
+		case CHUNK_TYPE_RAW:
+			if (chunk_data_size != len) {
+				goto out;
+			}
+			ret = stream_raw_chunk(read, write, priv, buf, off, len,
+					crc_ptr);
+			break;
+		case CHUNK_TYPE_FILL:
+			if (chunk_data_size != sizeof(val)) {
+				goto out;
+			}
+			ret = read(priv, &val, sizeof(val));
+			if (ret < 0) {
+				goto out;
+			}
+			ret = stream_fill_chunk(write, priv, buf, off, len, val,
+					crc_ptr);
+			break;
+		case CHUNK_TYPE_DONT_CARE:
+			if (chunk_data_size != 0) {
+				goto out;
+			}
+			if (crc_ptr) {
+				crc32 = sparse_crc32_zeros(crc32, len);
+			}
+			ret = 0;
+			break;
+		case CHUNK_TYPE_CRC32:
+			if (chunk_data_size != sizeof(val)) {
+				goto out;
+			}
+			ret = read(priv, &val, sizeof(val));
+			if (ret < 0) {
+				goto out;
+			}
+			if (crc_ptr && val != crc32) {
+				ret = -EINVAL;
+				goto out;
+			}
+			continue;
+		default:
+			goto out;
+		}
+
+		if (ret < 0) {
+			goto out;
+		}
+
+		cur_block += chunk_header.chunk_sz;
+	}
+
+	ret = 0;
+	if (sparse_header.total_blks != cur_block) {
+		ret = -EINVAL;
+	}
+
+out:
+	free(buf);
+	return ret;
+}
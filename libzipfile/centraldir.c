@@ -72,7 +72,6 @@ read_central_directory_entry(Zipfile* file, Zipentry* entry,
     unsigned short  compressionMethod;
     unsigned short  lastModFileTime;
     unsigned short  lastModFileDate;
-    unsigned long   crc32;
     unsigned short  extraFieldLength;
     unsigned short  fileCommentLength;
     unsigned short  diskNumberStart;
@@ -103,7 +102,7 @@ read_central_directory_entry(Zipfile* file, Zipentry* entry,
     entry->compressionMethod = read_le_short(&p[0x0a]);
     lastModFileTime = read_le_short(&p[0x0c]);
     lastModFileDate = read_le_short(&p[0x0e]);
-    crc32 = read_le_int(&p[0x10]);
+    entry->crc32 = read_le_int(&p[0x10]);
     entry->compressedSize = read_le_int(&p[0x14]);
     entry->uncompressedSize = read_le_int(&p[0x18]);
     entry->fileNameLength = read_le_short(&p[0x1c]);
@@ -140,15 +139,29 @@ read_central_directory_entry(Zipfile* file, Zipentry* entry,
     }
     p += fileCommentLength;
 
+    if (p - *buf > *len) {
+        fprintf(stderr, "cde entry runs past the central directory\n");
+        return -1;
+    }
+    *len -= p - *buf;
     *buf = p;
 
     // the size of the extraField in the central dir is how much data there is,
     // but the one in the local file header also contains some padding.
+    if (localHeaderRelOffset + LFH_SIZE > (unsigned long)file->bufsize) {
+        fprintf(stderr, "local file header out of range\n");
+        return -1;
+    }
     p = file->buf + localHeaderRelOffset;
     extraFieldLength = read_le_short(&p[0x1c]);
 
     dataOffset = localHeaderRelOffset + LFH_SIZE
         + entry->fileNameLength + extraFieldLength;
+    if ((unsigned long long)dataOffset + entry->compressedSize
+            > (unsigned long long)file->bufsize) {
+        fprintf(stderr, "entry data out of range\n");
+        return -1;
+    }
     entry->data = file->buf + dataOffset;
 #if 0
     printf("file->buf=%p entry->data=%p dataOffset=%x localHeaderRelOffset=%d "
@@ -159,6 +172,51 @@ read_central_directory_entry(Zipfile* file, Zipentry* entry,
     return 0;
 }
 
+/*
+ * The same string hash the framework's ZipFileRO uses.
+ */
+unsigned int
+hash_zipentry_name(const unsigned char* name, size_t len)
+{
+    unsigned int hash = 0;
+
+    while (len--) {
+        hash = hash * 31 + *name++;
+    }
+    return hash;
+}
+
+static int
+build_hash_table(Zipfile* file)
+{
+    Zipentry* entry;
+    unsigned int size = 16;
+
+    // keep the load factor under 1/2
+    while (size < 2u * file->totalEntryCount) {
+        size <<= 1;
+    }
+
+    file->hashTable = calloc(size, sizeof(Zipentry*));
+    if (file->hashTable == NULL) {
+        return -1;
+    }
+    file->hashSize = size;
+
+    for (entry = file->entries; entry; entry = entry->next) {
+        Zipentry** slot;
+
+        entry->hash = hash_zipentry_name(entry->fileName, entry->fileNameLength);
+        slot = &file->hashTable[entry->hash & (size - 1)];
+        while (*slot) {
+            slot = &(*slot)->hashNext;
+        }
+        *slot = entry;
+    }
+
+    return 0;
+}
+
 /*
  * Find the central directory and read the contents.
  *
@@ -228,11 +286,19 @@ read_central_dir(Zipfile *file)
         goto bail;
     }
 
+    if (file->centralDirOffest > (unsigned int)(eocd - buf)) {
+        fprintf(stderr, "central directory offset out of range\n");
+        goto bail;
+    }
+
     // Loop through and read the central dir entries.
     p = buf + file->centralDirOffest;
-    len = (buf+bufsize)-p;
+    len = eocd - p;
     for (i=0; i < file->totalEntryCount; i++) {
         Zipentry* entry = malloc(sizeof(Zipentry));
+        if (entry == NULL) {
+            goto bail;
+        }
         memset(entry, 0, sizeof(Zipentry));
 
         err = read_central_directory_entry(file, entry, &p, &len);
@@ -247,6 +313,13 @@ read_central_dir(Zipfile *file)
         file->entries = entry;
     }
 
+    // Index the entries so lookups don't walk the list.  Entries were
+    // prepended, so on duplicate names the last one in the archive wins,
+    // as it did with the linear search.
+    if (build_hash_table(file) != 0) {
+        goto bail;
+    }
+
     return 0;
 bail:
     return -1;
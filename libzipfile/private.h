@@ -13,9 +13,14 @@ typedef struct Zipentry {
     unsigned short compressionMethod;
     unsigned int uncompressedSize;
     unsigned int compressedSize;
+    unsigned int crc32;
     const unsigned char* data;
     
     struct Zipentry* next;
+
+    // chain in the Zipfile's hash table
+    unsigned int hash;
+    struct Zipentry* hashNext;
 } Zipentry;
 
 typedef struct Zipfile
@@ -34,10 +39,19 @@ typedef struct Zipfile
     const unsigned char*  comment;            //mComment;
 
     Zipentry* entries;
+
+    // entries by name, hashSize is a power of two
+    Zipentry** hashTable;
+    unsigned int hashSize;
+
+    // set when buf was mapped or read in by init_zipfile_fd
+    int ownsBuf;
 } Zipfile;
 
 int read_central_dir(Zipfile* file);
 
+unsigned int hash_zipentry_name(const unsigned char* name, size_t len);
+
 unsigned int read_le_int(const unsigned char* buf);
 unsigned int read_le_short(const unsigned char* buf);
 
@@ -3,9 +3,17 @@
 #include "private.h"
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef USE_MINGW
+#include <sys/mman.h>
+#endif
 #include <zlib.h>
 #define DEF_MEM_LEVEL 8                // normally in zutil.h?
 
+// largest piece decompress_zipentry_stream hands to its callback
+#define STREAM_CHUNK (64 * 1024)
+
 zipfile_t
 init_zipfile(const void* data, size_t size)
 {
@@ -22,10 +30,61 @@ init_zipfile(const void* data, size_t size)
 
     return file;
 fail:
-    free(file);
+    release_zipfile(file);
     return NULL;
 }
 
+zipfile_t
+init_zipfile_fd(int fd)
+{
+    Zipfile* file;
+    void* data;
+    off_t size;
+
+    size = lseek(fd, 0, SEEK_END);
+    if (size <= 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        return NULL;
+    }
+
+#ifdef USE_MINGW
+    // no mmap, read the whole archive in
+    {
+        off_t n = 0;
+
+        data = malloc(size);
+        if (data == NULL) {
+            return NULL;
+        }
+        while (n < size) {
+            ssize_t r = read(fd, (char*)data + n, size - n);
+            if (r <= 0) {
+                free(data);
+                return NULL;
+            }
+            n += r;
+        }
+    }
+#else
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+#endif
+
+    file = init_zipfile(data, size);
+    if (file == NULL) {
+#ifdef USE_MINGW
+        free(data);
+#else
+        munmap(data, size);
+#endif
+        return NULL;
+    }
+    file->ownsBuf = 1;
+
+    return file;
+}
+
 void
 release_zipfile(zipfile_t f)
 {
@@ -36,6 +95,14 @@ release_zipfile(zipfile_t f)
         free(entry);
         entry = next;
     }
+    free(file->hashTable);
+    if (file->ownsBuf) {
+#ifdef USE_MINGW
+        free((void*)file->buf);
+#else
+        munmap((void*)file->buf, file->bufsize);
+#endif
+    }
     free(file);
 }
 
@@ -43,12 +110,17 @@ zipentry_t
 lookup_zipentry(zipfile_t f, const char* entryName)
 {
     Zipfile* file = (Zipfile*)f;
-    Zipentry* entry = file->entries;
-    while (entry) {
-        if (0 == memcmp(entryName, entry->fileName, entry->fileNameLength)) {
+    Zipentry* entry;
+    size_t len = strlen(entryName);
+    unsigned int hash;
+
+    hash = hash_zipentry_name((const unsigned char*)entryName, len);
+    for (entry = file->hashTable[hash & (file->hashSize - 1)]; entry;
+            entry = entry->hashNext) {
+        if (entry->hash == hash && entry->fileNameLength == len
+                && 0 == memcmp(entryName, entry->fileName, len)) {
             return entry;
         }
-        entry = entry->next;
     }
     return NULL;
 }
@@ -128,6 +200,100 @@ decompress_zipentry(zipentry_t e, void* buf, int bufsize)
     }
 }
 
+int
+decompress_zipentry_stream(zipentry_t e,
+        int (*callback)(void* cookie, const void* data, size_t len),
+        void* cookie)
+{
+    Zipentry* entry = (Zipentry*)e;
+    unsigned char* out;
+    unsigned long crc = crc32(0L, Z_NULL, 0);
+    unsigned long total = 0;
+    z_stream zstream;
+    int zerr;
+    int err = 0;
+
+    if (entry->compressionMethod == STORED) {
+        const unsigned char* p = entry->data;
+        unsigned int left = entry->uncompressedSize;
+
+        if (entry->compressedSize != entry->uncompressedSize) {
+            return -1;
+        }
+        // no copy, hand out the archive's own buffer
+        while (left > 0 && err == 0) {
+            unsigned int n = left < STREAM_CHUNK ? left : STREAM_CHUNK;
+            crc = crc32(crc, p, n);
+            err = callback(cookie, p, n);
+            p += n;
+            left -= n;
+        }
+        if (err == 0 && crc != entry->crc32) {
+            fprintf(stderr, "crc mismatch\n");
+            err = -1;
+        }
+        return err;
+    }
+
+    if (entry->compressionMethod != DEFLATED) {
+        return -1;
+    }
+
+    out = malloc(STREAM_CHUNK);
+    if (out == NULL) {
+        return -1;
+    }
+
+    memset(&zstream, 0, sizeof(zstream));
+    zstream.next_in = (void*)entry->data;
+    zstream.avail_in = entry->compressedSize;
+
+    zerr = inflateInit2(&zstream, -MAX_WBITS);
+    if (zerr != Z_OK) {
+        free(out);
+        return -1;
+    }
+
+    do {
+        unsigned int n;
+
+        zstream.next_out = out;
+        zstream.avail_out = STREAM_CHUNK;
+        zerr = inflate(&zstream, Z_NO_FLUSH);
+        if (zerr != Z_OK && zerr != Z_STREAM_END) {
+            fprintf(stderr, "zerr=%d total_out=%lu\n", zerr, zstream.total_out);
+            err = -1;
+            break;
+        }
+        if (zerr == Z_OK && zstream.avail_in == 0 && zstream.avail_out != 0) {
+            fprintf(stderr, "truncated deflate stream\n");
+            err = -1;
+            break;
+        }
+
+        n = STREAM_CHUNK - zstream.avail_out;
+        if (n > 0) {
+            total += n;
+            if (total > entry->uncompressedSize) {
+                fprintf(stderr, "entry is larger than its stated size\n");
+                err = -1;
+                break;
+            }
+            crc = crc32(crc, out, n);
+            err = callback(cookie, out, n);
+        }
+    } while (err == 0 && zerr != Z_STREAM_END);
+
+    if (err == 0 && (total != entry->uncompressedSize || crc != entry->crc32)) {
+        fprintf(stderr, "size or crc mismatch\n");
+        err = -1;
+    }
+
+    inflateEnd(&zstream);
+    free(out);
+    return err;
+}
+
 void
 dump_zipfile(FILE* to, zipfile_t file)
 {
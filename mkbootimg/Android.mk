@@ -5,6 +5,10 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := mkbootimg.c
 LOCAL_STATIC_LIBRARIES := libmincrypt
 
+ifeq ($(HOST_OS),linux)
+  LOCAL_LDLIBS += -lpthread
+endif
+
 LOCAL_MODULE := mkbootimg
 
 include $(BUILD_HOST_EXECUTABLE)
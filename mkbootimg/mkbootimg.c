@@ -21,33 +21,63 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "mincrypt/sha.h"
+#include "mincrypt/sha256.h"
 #include "bootimg.h"
 
+/* hashed per update call so the hash thread trails the writer closely */
+#define HASH_CHUNK (1024 * 1024)
+
+/* Maps the file, or reads it in if it can't be mapped (a pipe, say). The
+ * image is never freed; mkbootimg exits once it has been written.
+ */
 static void *load_file(const char *fn, unsigned *_sz)
 {
     char *data;
     int sz;
     int fd;
+    int n;
+    int cap;
 
     data = 0;
     fd = open(fn, O_RDONLY);
     if(fd < 0) return 0;
 
     sz = lseek(fd, 0, SEEK_END);
-    if(sz < 0) goto oops;
-
-    if(lseek(fd, 0, SEEK_SET) != 0) goto oops;
-
-    data = (char*) malloc(sz);
-    if(data == 0) goto oops;
+    if(sz > 0 && lseek(fd, 0, SEEK_SET) == 0) {
+        data = mmap(0, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED) {
+            madvise(data, sz, MADV_SEQUENTIAL);
+            close(fd);
+            if(_sz) *_sz = sz;
+            return data;
+        }
+        data = 0;
+    }
 
-    if(read(fd, data, sz) != sz) goto oops;
+    sz = 0;
+    cap = 0;
+    for(;;) {
+        if(sz == cap) {
+            char *tmp;
+            cap = cap ? cap * 2 : 65536;
+            tmp = (char*) realloc(data, cap);
+            if(tmp == 0) goto oops;
+            data = tmp;
+        }
+        n = read(fd, data + sz, cap - sz);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0) goto oops;
+        if(n == 0) break;
+        sz += n;
+    }
     close(fd);
 
     if(_sz) *_sz = sz;
-    return data;
+    return data ? data : malloc(1);
 
 oops:
     close(fd);
@@ -55,6 +85,58 @@ oops:
     return 0;
 }
 
+static int write_all(int fd, const void *data, unsigned len)
+{
+    const char *p = data;
+    int n;
+
+    while(len > 0) {
+        n = write(fd, p, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+struct hash_item {
+    const void *data;
+    const unsigned *size;
+};
+
+struct hash_job {
+    HASH_CTX ctx;
+    const uint8_t *digest;
+    struct hash_item items[4];
+    int count;
+};
+
+/* Hashes the images while the main thread writes them out, both reading
+ * the same mapped pages.
+ */
+static void *hash_thread(void *arg)
+{
+    struct hash_job *job = arg;
+    int i;
+
+    for(i = 0; i < job->count; i++) {
+        const char *p = job->items[i].data;
+        unsigned left = *job->items[i].size;
+
+        while(left > 0) {
+            unsigned n = left < HASH_CHUNK ? left : HASH_CHUNK;
+            HASH_update(&job->ctx, p, n);
+            p += n;
+            left -= n;
+        }
+        HASH_update(&job->ctx, job->items[i].size, sizeof(*job->items[i].size));
+    }
+    job->digest = HASH_final(&job->ctx);
+
+    return 0;
+}
+
 int usage(void)
 {
     fprintf(stderr,"usage: mkbootimg\n"
@@ -66,6 +148,7 @@ int usage(void)
             "       [ --base <address> ]\n"
             "       [ --pagesize <pagesize> ]\n"
             "       [ --dt <filename> ]\n"
+            "       [ --hash <sha1|sha256> ]\n"
             "       -o|--output <filename>\n"
             );
     return 1;
@@ -110,8 +193,12 @@ int main(int argc, char **argv)
     void *dt_data = 0;
     unsigned pagesize = 2048;
     int fd;
-    SHA_CTX ctx;
-    uint8_t* sha;
+    int use_sha256 = 0;
+    struct hash_job job;
+    pthread_t thread;
+    int hashing = 0;
+    const uint8_t* sha;
+    unsigned sha_size;
     unsigned base           = 0x10000000;
     unsigned kernel_offset  = 0x00008000;
     unsigned ramdisk_offset = 0x01000000;
@@ -162,6 +249,13 @@ int main(int argc, char **argv)
             }
         } else if(!strcmp(arg, "--dt")) {
             dt_fn = val;
+        } else if(!strcmp(arg, "--hash")) {
+            if(!strcmp(val, "sha256")) {
+                use_sha256 = 1;
+            } else if(strcmp(val, "sha1")) {
+                fprintf(stderr,"error: unsupported hash %s\n", val);
+                return usage();
+            }
         } else {
             return usage();
         }
@@ -237,22 +331,26 @@ int main(int argc, char **argv)
     }
 
     /* put a hash of the contents in the header so boot images can be
-     * differentiated based on their first 2k.
+     * differentiated based on their first 2k.  The hash is computed on
+     * another thread while the images are written, and the header is
+     * filled in once both are done.
      */
-    SHA_init(&ctx);
-    SHA_update(&ctx, kernel_data, hdr.kernel_size);
-    SHA_update(&ctx, &hdr.kernel_size, sizeof(hdr.kernel_size));
-    SHA_update(&ctx, ramdisk_data, hdr.ramdisk_size);
-    SHA_update(&ctx, &hdr.ramdisk_size, sizeof(hdr.ramdisk_size));
-    SHA_update(&ctx, second_data, hdr.second_size);
-    SHA_update(&ctx, &hdr.second_size, sizeof(hdr.second_size));
+    memset(&job, 0, sizeof(job));
+    if(use_sha256) {
+        SHA256_init(&job.ctx);
+    } else {
+        SHA_init(&job.ctx);
+    }
+    job.items[job.count].data = kernel_data;
+    job.items[job.count++].size = &hdr.kernel_size;
+    job.items[job.count].data = ramdisk_data;
+    job.items[job.count++].size = &hdr.ramdisk_size;
+    job.items[job.count].data = second_data;
+    job.items[job.count++].size = &hdr.second_size;
     if(dt_data) {
-        SHA_update(&ctx, dt_data, hdr.dt_size);
-        SHA_update(&ctx, &hdr.dt_size, sizeof(hdr.dt_size));
+        job.items[job.count].data = dt_data;
+        job.items[job.count++].size = &hdr.dt_size;
     }
-    sha = SHA_final(&ctx);
-    memcpy(hdr.id, sha,
-           SHA_DIGEST_SIZE > sizeof(hdr.id) ? sizeof(hdr.id) : SHA_DIGEST_SIZE);
 
     fd = open(bootimg, O_CREAT | O_TRUNC | O_WRONLY, 0644);
     if(fd < 0) {
@@ -260,29 +358,51 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    if(write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) goto fail;
+    if(pthread_create(&thread, 0, hash_thread, &job) == 0) {
+        hashing = 1;
+    } else {
+        hash_thread(&job);
+    }
+
+    /* the header page is rewritten with the id at the end */
+    if(write_all(fd, &hdr, sizeof(hdr))) goto fail;
     if(write_padding(fd, pagesize, sizeof(hdr))) goto fail;
 
-    if(write(fd, kernel_data, hdr.kernel_size) != hdr.kernel_size) goto fail;
+    if(write_all(fd, kernel_data, hdr.kernel_size)) goto fail;
     if(write_padding(fd, pagesize, hdr.kernel_size)) goto fail;
 
-    if(write(fd, ramdisk_data, hdr.ramdisk_size) != hdr.ramdisk_size) goto fail;
+    if(write_all(fd, ramdisk_data, hdr.ramdisk_size)) goto fail;
     if(write_padding(fd, pagesize, hdr.ramdisk_size)) goto fail;
 
     if(second_data) {
-        if(write(fd, second_data, hdr.second_size) != hdr.second_size) goto fail;
-        if(write_padding(fd, pagesize, hdr.ramdisk_size)) goto fail;
+        if(write_all(fd, second_data, hdr.second_size)) goto fail;
+        if(write_padding(fd, pagesize, hdr.second_size)) goto fail;
     }
 
     if(dt_data) {
-        if(write(fd, dt_data, hdr.dt_size) != hdr.dt_size) goto fail;
+        if(write_all(fd, dt_data, hdr.dt_size)) goto fail;
         if(write_padding(fd, pagesize, hdr.dt_size)) goto fail;
     }
+
+    if(hashing) {
+        pthread_join(thread, 0);
+        hashing = 0;
+    }
+    sha = job.digest;
+    sha_size = HASH_size(&job.ctx);
+    memcpy(hdr.id, sha, sha_size > sizeof(hdr.id) ? sizeof(hdr.id) : sha_size);
+
+    if(pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) goto fail;
+    if(close(fd)) {
+        fd = -1;
+        goto fail;
+    }
     return 0;
 
 fail:
+    if(hashing) pthread_join(thread, 0);
     unlink(bootimg);
-    close(fd);
+    if(fd >= 0) close(fd);
     fprintf(stderr,"error: failed writing '%s': %s\n", bootimg,
             strerror(errno));
     return 1;